@@ -143,6 +143,9 @@ extern "C" {
 #define HAP_CHAR_UUID_VALVE_TYPE                                "D5"
 #define HAP_CHAR_UUID_IS_CONFIGURED                             "D6"
 #define HAP_CHAR_UUID_PRODUCT_DATA                              "220"
+#define HAP_CHAR_UUID_CHARACTERISTIC_VALUE_TRANSITION_CONTROL   "143"
+#define HAP_CHAR_UUID_SUPPORTED_CHARACTERISTIC_VALUE_TRANSITION_CONFIGURATION "144"
+#define HAP_CHAR_UUID_CHARACTERISTIC_VALUE_ACTIVE_TRANSITION_COUNT "24B"
 
 /** Create Brightness Characteristic
  *
@@ -1415,6 +1418,42 @@ hap_char_t *hap_char_air_particulate_density_create(float air_particulate_densit
  */
 hap_char_t *hap_char_air_particulate_size_create(uint8_t air_particulate_size);
 
+/** Characteristic Value Transition Control Characteristic
+ *
+ * This API creates the Characteristic Value Transition Control characteristic object with other metadata
+ * (format, constraints, permissions, etc.) set as per the HAP Specs
+ *
+ * @param[in] transition_control  Initial value of Characteristic Value Transition Control characteristic
+ *
+ * @return Pointer to the characteristic object on success
+ * @return NULL on failure
+ */
+hap_char_t *hap_char_characteristic_value_transition_control_create(hap_tlv8_val_t *transition_control);
+
+/** Supported Characteristic Value Transition Configuration Characteristic
+ *
+ * This API creates the Supported Characteristic Value Transition Configuration characteristic object
+ * with other metadata (format, constraints, permissions, etc.) set as per the HAP Specs
+ *
+ * @param[in] supported_config  Value of Supported Characteristic Value Transition Configuration characteristic
+ *
+ * @return Pointer to the characteristic object on success
+ * @return NULL on failure
+ */
+hap_char_t *hap_char_supported_characteristic_value_transition_configuration_create(hap_tlv8_val_t *supported_config);
+
+/** Characteristic Value Active Transition Count Characteristic
+ *
+ * This API creates the Characteristic Value Active Transition Count characteristic object with other metadata
+ * (format, constraints, permissions, etc.) set as per the HAP Specs
+ *
+ * @param[in] active_transition_count  Initial value of Characteristic Value Active Transition Count characteristic
+ *
+ * @return Pointer to the characteristic object on success
+ * @return NULL on failure
+ */
+hap_char_t *hap_char_characteristic_value_active_transition_count_create(uint8_t active_transition_count);
+
 #ifdef __cplusplus
 }
 #endif
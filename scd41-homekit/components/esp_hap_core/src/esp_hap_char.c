@@ -32,8 +32,19 @@
 #include <esp_hap_char.h>
 #include <esp_hap_ip_services.h>
 #include <esp_hap_database.h>
+#include <esp_hap_persist.h>
 
-static QueueHandle_t hap_event_queue;
+/* Characteristics with a pending event notification are kept in an intrusive
+ * FIFO list threaded through __hap_char_t. A characteristic is present in the
+ * list at most once, so any number of updates before the notification goes
+ * out collapse into a single entry, and the value read at send time is the
+ * latest one.
+ */
+static hap_char_t *hap_dirty_head;
+static hap_char_t *hap_dirty_tail;
+static bool hap_notif_trigger_pending;
+static bool hap_event_queue_active;
+static portMUX_TYPE hap_event_lock = portMUX_INITIALIZER_UNLOCKED;
 
 /**
  * @brief get characteristics's value
@@ -69,49 +80,130 @@ static double esp_mfi_fmod(double a, double b)
 
 int hap_event_queue_init()
 {
-    hap_event_queue = xQueueCreate( hap_priv.cfg.max_event_notif_chars,
-                    sizeof(hap_char_t *) );
-    if (hap_event_queue) {
-        return HAP_SUCCESS;
-    } else {
-        return HAP_FAIL;
-    }
+    portENTER_CRITICAL_SAFE(&hap_event_lock);
+    hap_dirty_head = hap_dirty_tail = NULL;
+    hap_notif_trigger_pending = false;
+    hap_event_queue_active = true;
+    portEXIT_CRITICAL_SAFE(&hap_event_lock);
+    return HAP_SUCCESS;
 }
 
 int hap_event_queue_deinit()
 {
-    if (hap_event_queue) {
-        vQueueDelete(hap_event_queue);
-        hap_event_queue = NULL;
+    portENTER_CRITICAL_SAFE(&hap_event_lock);
+    hap_event_queue_active = false;
+    while (hap_dirty_head) {
+        __hap_char_t *_hc = (__hap_char_t *)hap_dirty_head;
+        hap_dirty_head = _hc->next_dirty;
+        _hc->next_dirty = NULL;
+        _hc->dirty = false;
     }
+    hap_dirty_tail = NULL;
+    hap_notif_trigger_pending = false;
+    portEXIT_CRITICAL_SAFE(&hap_event_lock);
     return HAP_SUCCESS;
 }
 
 hap_char_t * hap_get_pending_notif_char()
 {
     hap_char_t *hc;
-    if (xQueueReceive(hap_event_queue, &hc, 0) != pdTRUE) {
-        return NULL;
+    portENTER_CRITICAL_SAFE(&hap_event_lock);
+    hc = hap_dirty_head;
+    if (hc) {
+        __hap_char_t *_hc = (__hap_char_t *)hc;
+        hap_dirty_head = _hc->next_dirty;
+        _hc->next_dirty = NULL;
+        _hc->dirty = false;
+    }
+    if (!hap_dirty_head) {
+        /* Nothing left. The next update should trigger a notification again */
+        hap_dirty_tail = NULL;
+        hap_notif_trigger_pending = false;
     }
+    portEXIT_CRITICAL_SAFE(&hap_event_lock);
     return hc;
 }
 
+bool hap_is_notif_pending()
+{
+    return hap_dirty_head ? true : false;
+}
+
+/* For when a triggered notification run could not be scheduled or could not
+ * take its batch. The characteristics stay pending, and the next update
+ * triggers a run again.
+ */
+void hap_notif_trigger_reset()
+{
+    portENTER_CRITICAL_SAFE(&hap_event_lock);
+    hap_notif_trigger_pending = false;
+    portEXIT_CRITICAL_SAFE(&hap_event_lock);
+}
+
+/* Remove a characteristic from the pending list. Required before the
+ * characteristic memory is freed.
+ */
+static void hap_dequeue_event(hap_char_t *hc)
+{
+    portENTER_CRITICAL_SAFE(&hap_event_lock);
+    __hap_char_t *_hc = (__hap_char_t *)hc;
+    if (_hc->dirty) {
+        hap_char_t *prev = NULL;
+        hap_char_t *cur = hap_dirty_head;
+        while (cur && cur != hc) {
+            prev = cur;
+            cur = ((__hap_char_t *)cur)->next_dirty;
+        }
+        if (cur) {
+            if (prev) {
+                ((__hap_char_t *)prev)->next_dirty = _hc->next_dirty;
+            } else {
+                hap_dirty_head = _hc->next_dirty;
+            }
+            if (hap_dirty_tail == hc) {
+                hap_dirty_tail = prev;
+            }
+        }
+        _hc->next_dirty = NULL;
+        _hc->dirty = false;
+    }
+    portEXIT_CRITICAL_SAFE(&hap_event_lock);
+}
+
 static int hap_queue_event(hap_char_t *hc)
 {
-    int ret;
-    if (!hap_event_queue) {
+    bool trigger = false;
+    __hap_char_t *_hc = (__hap_char_t *)hc;
+    portENTER_CRITICAL_SAFE(&hap_event_lock);
+    if (!hap_event_queue_active) {
+        portEXIT_CRITICAL_SAFE(&hap_event_lock);
         return HAP_FAIL;
     }
-    if (xPortInIsrContext() == pdTRUE) {
-        ret = xQueueSendFromISR(hap_event_queue, &hc, NULL);
-    } else {
-        ret = xQueueSend(hap_event_queue, &hc, 0);
+    if (!_hc->dirty) {
+        _hc->dirty = true;
+        _hc->next_dirty = NULL;
+        if (hap_dirty_tail) {
+            ((__hap_char_t *)hap_dirty_tail)->next_dirty = hc;
+        } else {
+            hap_dirty_head = hc;
+        }
+        hap_dirty_tail = hc;
     }
-    if (ret == pdTRUE) {
-        hap_send_event(HAP_INTERNAL_EVENT_TRIGGER_NOTIF);
-        return HAP_SUCCESS;
+    /* A single trigger is enough for any number of pending characteristics,
+     * since the notification handler drains the whole list.
+     */
+    if (!hap_notif_trigger_pending) {
+        hap_notif_trigger_pending = true;
+        trigger = true;
+    }
+    portEXIT_CRITICAL_SAFE(&hap_event_lock);
+    if (trigger && hap_send_event(HAP_INTERNAL_EVENT_TRIGGER_NOTIF) != HAP_SUCCESS) {
+        /* Let the next update try again */
+        portENTER_CRITICAL_SAFE(&hap_event_lock);
+        hap_notif_trigger_pending = false;
+        portEXIT_CRITICAL_SAFE(&hap_event_lock);
     }
-    return HAP_FAIL;
+    return HAP_SUCCESS;
 }
 
 
@@ -256,6 +348,9 @@ int hap_char_update_val(hap_char_t *hc, hap_val_t *val)
 		default:
 			break;
 	}
+	if (value_changed && (_hc->permission & HAP_CHAR_PERM_PERSIST)) {
+		hap_persist_mark_changed();
+	}
 	if (value_changed || (_hc->permission & HAP_CHAR_PERM_SPECIAL_READ)) {
 		ESP_MFI_DEBUG_INTR(ESP_MFI_DEBUG_INFO, "Value Changed");
         hap_queue_event(hc);
@@ -453,6 +548,7 @@ void hap_char_delete(hap_char_t *hc)
 {
     ESP_MFI_ASSERT(hc);
     __hap_char_t *_hc = (__hap_char_t *)hc;
+    hap_dequeue_event(hc);
     if (_hc->format == HAP_CHAR_FORMAT_STRING) {
         if (_hc->val.s) {
             hap_platform_memory_free(_hc->val.s);
@@ -482,6 +578,7 @@ void hap_char_int_set_constraints(hap_char_t *hc, int min, int max, int step)
     } else {
         tmp->constraint_flags |= (HAP_CHAR_MIN_FLAG | HAP_CHAR_MAX_FLAG);
     }
+    hap_acc_db_mark_changed();
 }
 void hap_char_float_set_constraints(hap_char_t *hc, float min, float max, float step)
 {
@@ -495,6 +592,7 @@ void hap_char_float_set_constraints(hap_char_t *hc, float min, float max, float
     } else {
         tmp->constraint_flags |= (HAP_CHAR_MIN_FLAG | HAP_CHAR_MAX_FLAG);
     }
+    hap_acc_db_mark_changed();
 }
 
 void hap_char_string_set_maxlen(hap_char_t *hc, int maxlen)
@@ -507,6 +605,7 @@ void hap_char_string_set_maxlen(hap_char_t *hc, int maxlen)
     }
     tmp->max.i = maxlen;
     tmp->constraint_flags |= HAP_CHAR_MAXLEN_FLAG;
+    hap_acc_db_mark_changed();
 }
 
 void hap_char_add_description(hap_char_t *hc, const char *description)
@@ -514,13 +613,28 @@ void hap_char_add_description(hap_char_t *hc, const char *description)
     ESP_MFI_ASSERT(hc);
     __hap_char_t *tmp = (__hap_char_t *)hc;
     tmp->description = (char *)description;
+    hap_acc_db_mark_changed();
 }
 void hap_char_add_unit(hap_char_t *hc, const char *unit)
 {
     ESP_MFI_ASSERT(hc);
     __hap_char_t *tmp = (__hap_char_t *)hc;
     tmp->unit = (char *)unit;
+    hap_acc_db_mark_changed();
 }
+void hap_char_set_persistent(hap_char_t *hc, bool persistent)
+{
+    if (!hc) {
+        return;
+    }
+    __hap_char_t *_hc = (__hap_char_t *)hc;
+    if (persistent) {
+        _hc->permission |= HAP_CHAR_PERM_PERSIST;
+    } else {
+        _hc->permission &= ~HAP_CHAR_PERM_PERSIST;
+    }
+}
+
 hap_char_t *hap_char_get_next(hap_char_t *hc)
 {
     return ((__hap_char_t *)hc)->next_char;
@@ -549,6 +663,12 @@ bool hap_char_is_ctrl_subscribed(hap_char_t *hc, int index)
 	return (_hc->ev_ctrls & (1 << index)) ? true : false;
 }
 
+bool hap_char_has_subscribers(hap_char_t *hc)
+{
+	__hap_char_t *_hc = (__hap_char_t *)hc;
+	return _hc->ev_ctrls ? true : false;
+}
+
 void hap_char_set_owner_ctrl(hap_char_t *hc, int index)
 {
 	__hap_char_t *_hc = (__hap_char_t *)hc;
@@ -566,6 +686,7 @@ void hap_char_set_iid(hap_char_t *hc, int32_t iid)
 {
     if (hc) {
         ((__hap_char_t *)hc)->iid = iid;
+        hap_acc_index_invalidate();
     }
 }
 
@@ -596,6 +717,7 @@ void hap_char_add_valid_vals(hap_char_t *hc, const uint8_t *valid_vals, size_t v
         memcpy(_hc->valid_vals, valid_vals, valid_val_cnt);
         _hc->valid_vals_cnt = valid_val_cnt;
     }
+    hap_acc_db_mark_changed();
 }
 
 void hap_char_add_valid_vals_range(hap_char_t *hc, uint8_t start_val, uint8_t end_val)
@@ -608,4 +730,5 @@ void hap_char_add_valid_vals_range(hap_char_t *hc, uint8_t start_val, uint8_t en
         _hc->valid_vals_range[0] = start_val;
         _hc->valid_vals_range[1] = end_val;
     }
+    hap_acc_db_mark_changed();
 }
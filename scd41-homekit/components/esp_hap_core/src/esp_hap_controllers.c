@@ -31,6 +31,7 @@
 #include <esp_hap_controllers.h>
 #include <esp_hap_keystore.h>
 #include <esp_hap_pair_setup.h>
+#include <esp_hap_ephemeral.h>
 
 #define HAP_KEYSTORE_NAMESPACE_CTRL "hap_ctrl"
 
@@ -132,6 +133,9 @@ void hap_controller_remove(hap_ctrl_data_t *ctrl_data)
     hap_keystore_delete(HAP_KEYSTORE_NAMESPACE_CTRL, index_str);
     memset(ctrl_data, 0, sizeof(hap_ctrl_data_t));
     hap_report_event(HAP_EVENT_CTRL_UNPAIRED, id, sizeof(id));
+    if (!is_accessory_paired()) {
+        hap_ephemeral_wake();
+    }
 }
 
 hap_ctrl_data_t *hap_get_controller(char *ctrl_id)
@@ -38,6 +38,7 @@
 #include <esp_hap_pair_setup.h>
 
 #include <esp_mfi_base64.h>
+#include <mu_srp.h>
 
 #define HAP_KEY_ACC_ID                  "acc_id"
 #define HAP_KEY_LTSKA                   "ltska"
@@ -50,6 +51,7 @@
 #define HAP_KEY_SETUP_ID                "setup_id"
 #define HAP_KEY_SETUP_SALT              "setup_salt"
 #define HAP_KEY_SETUP_VERIFIER          "setup_verifier"
+#define HAP_KEY_SETUP_CODE_HASH         "setup_code_hash"
 
 #define HAP_LOOP_STACK              (4 * 1024)
 #define HAP_MAIN_THREAD_PRIORITY    7
@@ -168,11 +170,98 @@ static int hap_get_setup_id()
     return HAP_SUCCESS;
 }
 
+/* SHA512 of the salt and the setup code, to tell whether a stored salt and
+ * verifier are for the current setup code. It gives nothing away, as the
+ * setup code is in the firmware anyway.
+ */
+static int hap_get_setup_code_hash(const uint8_t *salt, size_t salt_len, uint8_t *digest)
+{
+    esp_mfi_sha_ctx_t ctx = esp_mfi_sha512_new();
+    if (!ctx) {
+        return HAP_FAIL;
+    }
+    esp_mfi_sha512_init(ctx);
+    esp_mfi_sha512_update(ctx, salt, salt_len);
+    esp_mfi_sha512_update(ctx, (const uint8_t *)hap_priv.setup_code, strlen(hap_priv.setup_code));
+    esp_mfi_sha512_final(ctx, digest);
+    esp_mfi_sha512_free(ctx);
+    return HAP_SUCCESS;
+}
+
+/* The SRP salt and verifier of a setup code set by the accessory code are
+ * derived once and kept in the keystore, so that pair setup does not have
+ * to work out the verifier, a 3072-bit exponentiation, every time.
+ */
+int hap_get_setup_code_info()
+{
+    if (!hap_priv.setup_code) {
+        return HAP_FAIL;
+    }
+    if (hap_priv.setup_code_info) {
+        return HAP_SUCCESS;
+    }
+    hap_setup_info_t *info = hap_platform_memory_calloc(1, sizeof(hap_setup_info_t));
+    if (!info) {
+        return HAP_FAIL;
+    }
+
+    uint8_t digest[MFI_SHA512_SIZE], stored_digest[MFI_SHA512_SIZE];
+    size_t salt_len = sizeof(info->salt);
+    size_t verifier_len = sizeof(info->verifier);
+    size_t digest_len = sizeof(stored_digest);
+    if ((hap_keystore_get(HAP_KEYSTORE_NAMESPACE_HAPMAIN, HAP_KEY_SETUP_SALT,
+                    info->salt, &salt_len) == HAP_SUCCESS) &&
+            (hap_keystore_get(HAP_KEYSTORE_NAMESPACE_HAPMAIN, HAP_KEY_SETUP_VERIFIER,
+                    info->verifier, &verifier_len) == HAP_SUCCESS) &&
+            (hap_keystore_get(HAP_KEYSTORE_NAMESPACE_HAPMAIN, HAP_KEY_SETUP_CODE_HASH,
+                    stored_digest, &digest_len) == HAP_SUCCESS) &&
+            (salt_len == sizeof(info->salt)) && (verifier_len == sizeof(info->verifier)) &&
+            (digest_len == sizeof(stored_digest)) &&
+            (hap_get_setup_code_hash(info->salt, salt_len, digest) == HAP_SUCCESS) &&
+            (memcmp(digest, stored_digest, sizeof(digest)) == 0)) {
+        hap_priv.setup_code_info = info;
+        return HAP_SUCCESS;
+    }
+
+    ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Deriving the SRP salt and verifier for the setup code");
+    char *bytes_salt, *bytes_verifier;
+    int len_verifier;
+    if (mu_srp_gen_salt_verifier("Pair-Setup", hap_priv.setup_code, strlen(hap_priv.setup_code),
+                sizeof(info->salt), &bytes_salt, &bytes_verifier, &len_verifier) < 0) {
+        hap_platform_memory_free(info);
+        return HAP_FAIL;
+    }
+    if ((size_t)len_verifier > sizeof(info->verifier)) {
+        free(bytes_salt);
+        free(bytes_verifier);
+        hap_platform_memory_free(info);
+        return HAP_FAIL;
+    }
+    memcpy(info->salt, bytes_salt, sizeof(info->salt));
+    memset(info->verifier, 0, sizeof(info->verifier));
+    memcpy(info->verifier + sizeof(info->verifier) - len_verifier, bytes_verifier, len_verifier);
+    free(bytes_salt);
+    free(bytes_verifier);
+    hap_priv.setup_code_info = info;
+
+    /* If they cannot be stored, they are derived again on the next boot */
+    if (hap_get_setup_code_hash(info->salt, sizeof(info->salt), digest) != HAP_SUCCESS ||
+            hap_keystore_set(HAP_KEYSTORE_NAMESPACE_HAPMAIN, HAP_KEY_SETUP_SALT,
+                info->salt, sizeof(info->salt)) != HAP_SUCCESS ||
+            hap_keystore_set(HAP_KEYSTORE_NAMESPACE_HAPMAIN, HAP_KEY_SETUP_VERIFIER,
+                info->verifier, sizeof(info->verifier)) != HAP_SUCCESS ||
+            hap_keystore_set(HAP_KEYSTORE_NAMESPACE_HAPMAIN, HAP_KEY_SETUP_CODE_HASH,
+                digest, sizeof(digest)) != HAP_SUCCESS) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_WARN, "Failed to store the SRP salt and verifier");
+    }
+    return HAP_SUCCESS;
+}
+
 static int hap_get_setup_info()
 {
-    /* If the setup code has been set directly, no need to check for setup info */
+    /* If the setup code has been set directly, the salt and verifier come from it */
     if (hap_priv.setup_code) {
-        return HAP_SUCCESS;
+        return hap_get_setup_code_info();
     }
     /* If the setup info has been set externally, directly from the accessory code,
      * no need to check in the NVS
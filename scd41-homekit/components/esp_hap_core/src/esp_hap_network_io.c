@@ -23,6 +23,7 @@
  */
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/socket.h>
 
 #include <sodium/crypto_aead_chacha20poly1305.h>
@@ -30,29 +31,41 @@
 
 #include <esp_mfi_debug.h>
 #include <hap.h>
+#include <hap_platform_memory.h>
 #include <esp_hap_database.h>
 #include <esp_hap_pair_common.h>
 #include <esp_hap_pair_verify.h>
+#include <esp_hap_network_io.h>
 
-#define HAP_MAX_NW_FRAME_SIZE	1024 /* As per HAP Specifications */
 #define AUTH_TAG_LEN            16
-typedef struct {
-	uint8_t pkt_size[2];
-	uint8_t data[HAP_MAX_NW_FRAME_SIZE];
-	/* The Poly auth tag buffer will get used only if the data length is
-	 * greater than HAP_MAX_NW_FRAME_SIZE - 16.
-	 * Else, the auth tag would be included in the data buffer itself
-	 */
-	uint8_t poly_auth_tag[AUTH_TAG_LEN];
-} hap_encrypt_frame_t;
+#define HAP_FRAME_AAD_LEN       2
+#define HAP_FRAME_OVERHEAD      (HAP_FRAME_AAD_LEN + AUTH_TAG_LEN)
+/* Maximum number of encrypted frames that are batched into a single send().
+ * Responses longer than this go out in several send() calls, HAP_MAX_FRAMES_PER_SEND
+ * frames at a time. The cap is there to bound RAM: the ciphertext has to be
+ * written somewhere, as the caller's buffer is const, and the send buffer of a
+ * session grows to hold a whole batch. With the default of 4 that is about 4 KB
+ * per session, where sending a 64 KB /accessories in one call would need 64 KB.
+ */
+#ifdef CONFIG_HAP_MAX_FRAMES_PER_SEND
+#define HAP_MAX_FRAMES_PER_SEND CONFIG_HAP_MAX_FRAMES_PER_SEND
+#else
+#define HAP_MAX_FRAMES_PER_SEND 4
+#endif
 
-typedef struct {
+typedef struct hap_decrypt_frame {
 	uint16_t pkt_size;
 	uint16_t bytes_read;
 	uint8_t data[HAP_MAX_NW_FRAME_SIZE + AUTH_TAG_LEN];
+	/* Owner of this frame. NULL if the frame is free in the pool */
 	hap_secure_session_t *session;
 } hap_decrypt_frame_t;
 
+/* One decrypt frame per possible session, so that interleaved requests
+ * from different controllers can be decrypted independently.
+ */
+static hap_decrypt_frame_t hap_decrypt_frame_pool[HAP_MAX_SESSIONS];
+
 typedef int (*hap_decrypt_read_fn_t) (uint8_t *buf, int buf_size, void *context);
 static int min(int val1, int val2)
 {
@@ -70,29 +83,34 @@ static int hap_httpd_raw_recv(uint8_t *buf, int buf_size, void *context)
  * <2: AAD for Little Endian length of encrypted data (n) in bytes>
  * <n: Encrypted data according to AEAD algorithm, upto 1024 bytes>
  * <16: authTag according to AEAD algorithm>
+ *
+ * The frame is written directly to "frame", which should have space for
+ * buflen + HAP_FRAME_OVERHEAD bytes. The plaintext is read from "buf" and
+ * is not modified.
  */
-int hap_encrypt_data(hap_encrypt_frame_t *frame, hap_secure_session_t *session,
-		uint8_t *buf, int buflen)
+static int hap_encrypt_data(uint8_t *frame, hap_secure_session_t *session,
+		const uint8_t *buf, int buflen)
 {
 	if (!session)
 		return HAP_FAIL;
-	put_u16_le(frame->pkt_size, buflen);
+	put_u16_le(frame, buflen);
 	/* Encrypt the received data as per Chacha20-Poly1305 AEAD algorithm.
 	 * The authTag will be appended at the end of data. Hence, pointer given as
-	 * frame->data + nlen
+	 * frame + HAP_FRAME_AAD_LEN + buflen
 	 */
-    unsigned long long mlen = 16;
+    unsigned long long mlen = AUTH_TAG_LEN;
     uint8_t newnonce[12];
     memset(newnonce, 0, sizeof newnonce);
     memcpy(newnonce+4, session->encrypt_nonce, 8);
-    crypto_aead_chacha20poly1305_ietf_encrypt_detached(frame->data, frame->data + buflen, &mlen,
-                buf, buflen, frame->pkt_size, 2, NULL, newnonce, session->encrypt_key);
+    crypto_aead_chacha20poly1305_ietf_encrypt_detached(frame + HAP_FRAME_AAD_LEN,
+                frame + HAP_FRAME_AAD_LEN + buflen, &mlen,
+                buf, buflen, frame, HAP_FRAME_AAD_LEN, NULL, newnonce, session->encrypt_key);
 
 	/* Increment nonce after every frame */
 	uint64_t int_nonce = get_u64_le(session->encrypt_nonce);
 	int_nonce++;
 	put_u64_le(session->encrypt_nonce, int_nonce);
-	return 2 + buflen + 16; /* Total length of the encrypted data */
+	return buflen + HAP_FRAME_OVERHEAD; /* Total length of the encrypted data */
 }
 
 static int hap_session_error(hap_secure_session_t *session)
@@ -105,6 +123,56 @@ static int hap_session_error(hap_secure_session_t *session)
 	return HAP_FAIL;
 }
 
+static hap_decrypt_frame_t *hap_decrypt_frame_get(hap_secure_session_t *session)
+{
+	if (session->decrypt_frame)
+		return session->decrypt_frame;
+	int i;
+	for (i = 0; i < HAP_MAX_SESSIONS; i++) {
+		if (!hap_decrypt_frame_pool[i].session) {
+			memset(&hap_decrypt_frame_pool[i], 0, sizeof(hap_decrypt_frame_t));
+			hap_decrypt_frame_pool[i].session = session;
+			session->decrypt_frame = &hap_decrypt_frame_pool[i];
+			return session->decrypt_frame;
+		}
+	}
+	ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "No free decrypt frame for the session");
+	return NULL;
+}
+
+/* Get the send buffer of the session, large enough to hold "len" bytes.
+ * The buffer is reused across sends and only grows, upto the size required
+ * for HAP_MAX_FRAMES_PER_SEND full frames.
+ */
+static uint8_t *hap_send_buf_get(hap_secure_session_t *session, int len)
+{
+	if (session->send_buf_size < len) {
+		hap_platform_memory_free(session->send_buf);
+		session->send_buf = hap_platform_memory_malloc(len);
+		if (!session->send_buf) {
+			session->send_buf_size = 0;
+			return NULL;
+		}
+		session->send_buf_size = len;
+	}
+	return session->send_buf;
+}
+
+void hap_session_io_release(hap_secure_session_t *session)
+{
+	if (!session)
+		return;
+	if (session->decrypt_frame) {
+		session->decrypt_frame->session = NULL;
+		session->decrypt_frame = NULL;
+	}
+	if (session->send_buf) {
+		hap_platform_memory_free(session->send_buf);
+		session->send_buf = NULL;
+		session->send_buf_size = 0;
+	}
+}
+
 int hap_decrypt_data(hap_decrypt_frame_t *frame, hap_secure_session_t *session,
 	void *buf, int buf_size, hap_decrypt_read_fn_t read_fn, void *context)
 {
@@ -154,22 +222,59 @@ int hap_decrypt_data(hap_decrypt_frame_t *frame, hap_secure_session_t *session,
 	return bytes;
 }
 
-int hap_httpd_send(httpd_handle_t hd, int sockfd, const char *buf, unsigned buf_len, int flags)
+static int hap_send_all(int sockfd, const uint8_t *buf, int len, int flags)
 {
-	hap_secure_session_t *session = httpd_sess_get_ctx(hap_priv.server, sockfd);
-	if (session && (session->state == STATE_VERIFIED)) {
-		uint8_t *buf_ptr = (uint8_t *)buf;
-		int tmp_buf_len = buf_len;
-		while (tmp_buf_len) {
-			hap_encrypt_frame_t encrypt_frame;
-			memset(&encrypt_frame, 0, sizeof(encrypt_frame));
-			int len = min(tmp_buf_len, HAP_MAX_NW_FRAME_SIZE);
-			int send_len = hap_encrypt_data(&encrypt_frame, session, buf_ptr, len);
-			if (send(sockfd, (uint8_t *)&encrypt_frame, send_len, flags) <= 0)
-				return HAP_FAIL;
+	while (len) {
+		int sent = send(sockfd, buf, len, flags);
+		if (sent <= 0)
+			return HAP_FAIL;
+		buf += sent;
+		len -= sent;
+	}
+	return HAP_SUCCESS;
+}
+
+/* Encrypts buf into frames and sends them. Returns the number of frames sent,
+ * or HAP_FAIL.
+ */
+static int hap_send_frames(hap_secure_session_t *session, int sockfd, const char *buf, unsigned buf_len, int flags)
+{
+	const uint8_t *buf_ptr = (const uint8_t *)buf;
+	int tmp_buf_len = buf_len;
+	int total_frames = 0;
+	while (tmp_buf_len) {
+		/* Encrypt as many frames as fit in the send buffer, back to back,
+		 * and push them out with a single send()
+		 */
+		int num_frames = (tmp_buf_len + HAP_MAX_NW_FRAME_SIZE - 1) / HAP_MAX_NW_FRAME_SIZE;
+		if (num_frames > HAP_MAX_FRAMES_PER_SEND)
+			num_frames = HAP_MAX_FRAMES_PER_SEND;
+		int batch_len = min(tmp_buf_len, num_frames * HAP_MAX_NW_FRAME_SIZE);
+		uint8_t *send_buf = hap_send_buf_get(session,
+				batch_len + num_frames * HAP_FRAME_OVERHEAD);
+		if (!send_buf)
+			return HAP_FAIL;
+		int send_len = 0;
+		while (batch_len) {
+			int len = min(batch_len, HAP_MAX_NW_FRAME_SIZE);
+			send_len += hap_encrypt_data(send_buf + send_len, session, buf_ptr, len);
+			batch_len -= len;
 			tmp_buf_len -= len;
 			buf_ptr += len;
 		}
+		if (hap_send_all(sockfd, send_buf, send_len, flags) != HAP_SUCCESS)
+			return HAP_FAIL;
+		total_frames += num_frames;
+	}
+	return total_frames;
+}
+
+int hap_httpd_send(httpd_handle_t hd, int sockfd, const char *buf, unsigned buf_len, int flags)
+{
+	hap_secure_session_t *session = httpd_sess_get_ctx(hap_priv.server, sockfd);
+	if (session && (session->state == STATE_VERIFIED)) {
+		if (hap_send_frames(session, sockfd, buf, buf_len, flags) < 0)
+			return HAP_FAIL;
 		/* Return the total length at the end since this API expects so
 		 */
 		return buf_len;
@@ -177,13 +282,43 @@ int hap_httpd_send(httpd_handle_t hd, int sockfd, const char *buf, unsigned buf_
 	return send(sockfd, buf, buf_len, flags);
 }
 
+/* Only updated from the httpd task, which sends all the notifications */
+static hap_notif_stats_t hap_notif_stats;
+
+int hap_httpd_send_notif(httpd_handle_t hd, int sockfd, const char *buf, unsigned buf_len)
+{
+	hap_secure_session_t *session = httpd_sess_get_ctx(hap_priv.server, sockfd);
+	if (!session || (session->state != STATE_VERIFIED))
+		return HAP_FAIL;
+	int num_frames = hap_send_frames(session, sockfd, buf, buf_len, 0);
+	if (num_frames < 0) {
+		hap_notif_stats.failed++;
+		return HAP_FAIL;
+	}
+	hap_notif_stats.notifications++;
+	hap_notif_stats.frames += num_frames;
+	return num_frames;
+}
+
+void hap_notif_stats_get(hap_notif_stats_t *stats)
+{
+	*stats = hap_notif_stats;
+}
+
+void hap_notif_stats_reset()
+{
+	memset(&hap_notif_stats, 0, sizeof(hap_notif_stats));
+}
+
 int hap_httpd_recv(httpd_handle_t hd, int sockfd, char *buf, unsigned buf_len, int flags)
 {
-	static hap_decrypt_frame_t decrypt_frame;
 	hap_secure_session_t *session = httpd_sess_get_ctx(hap_priv.server, sockfd);
 	if (session) {
 		if (session->state == STATE_VERIFIED) {
-			return hap_decrypt_data(&decrypt_frame, session, buf, buf_len,
+			hap_decrypt_frame_t *frame = hap_decrypt_frame_get(session);
+			if (!frame)
+				return hap_session_error(session);
+			return hap_decrypt_data(frame, session, buf, buf_len,
 					hap_httpd_raw_recv, &sockfd);
 		} else {
 			/* If the session state is invalid, we return an error.
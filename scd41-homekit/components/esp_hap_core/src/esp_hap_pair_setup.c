@@ -31,13 +31,16 @@
 #include <sodium/crypto_aead_chacha20poly1305.h>
 #include <hkdf-sha.h>
 #include <sodium/crypto_sign_ed25519.h>
+#include <sodium/utils.h>
 #include <hexdump.h>
 #include <hap_platform_memory.h>
 #include <hap_platform_os.h>
 #include <esp_hap_ip_services.h>
 #include <esp_hap_pair_common.h>
 #include <esp_hap_pair_setup.h>
+#include <esp_hap_ephemeral.h>
 #include <esp_hap_pair_verify.h>
+#include <esp_hap_pair_worker.h>
 #include <esp_hap_database.h>
 #include <esp_hap_main.h>
 #include <esp_hap_acc.h>
@@ -53,6 +56,10 @@
 #define PAIR_SETUP_ACC_SIGN_SALT	"Pair-Setup-Accessory-Sign-Salt"
 #define PAIR_SETUP_ACC_SIGN_INFO	"Pair-Setup-Accessory-Sign-Info"
 
+static esp_mfi_hmac_sha512_key_t ps_encrypt_salt_key;
+static esp_mfi_hmac_sha512_key_t ps_ctrl_sign_salt_key;
+static esp_mfi_hmac_sha512_key_t ps_acc_sign_salt_key;
+
 #define PS_CTX_INIT	1
 #define PS_CTX_DEINIT	2
 
@@ -117,8 +124,13 @@ static int hap_pair_setup_process_srp_start(pair_setup_ctx_t *ps_ctx, uint8_t *b
 		return HAP_FAIL;
 	}
 
-	ps_ctx->ctrl = hap_controller_get_empty_loc();
-	if (!ps_ctx->ctrl) {
+	/* The controller is only added at M6. This is just to fail early if it
+	 * would not fit.
+	 */
+	hap_pairing_lock();
+	hap_ctrl_data_t *ctrl = hap_controller_get_empty_loc();
+	hap_pairing_unlock();
+	if (!ctrl) {
 		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "No empty controller slot. Aborting");
 		hap_prepare_error_tlv(STATE_M2, kTLVError_Unknown, buf, bufsize, outlen);
 		return HAP_FAIL;
@@ -164,28 +176,32 @@ static int hap_pair_setup_process_srp_start(pair_setup_ctx_t *ps_ctx, uint8_t *b
     hap_priv.pairing_flags = ps_ctx->pairing_flags;
 
 	int len_B = 0;
-	char *bytes_B;
+	char *bytes_B = NULL;
 
 	/* Create SRP Salt and Verifier for the provided pairing PIN */
     mu_srp_init(&ps_ctx->srp_hd, MU_NG_3072);
 
-    /* If a setup code is explicitly set, use it */
+    /* If a setup code is explicitly set, use it, through the salt and verifier
+     * derived from it once. Else, use the salt and verifier for SRP.
+     * This should be the default production case
+     */
+    hap_setup_info_t *setup_info = hap_priv.setup_info;
     if (hap_priv.setup_code) {
-        ps_ctx->len_s = 16;
-        mu_srp_srv_pubkey(&ps_ctx->srp_hd, "Pair-Setup", (const char*)hap_priv.setup_code, strlen(hap_priv.setup_code),
-                ps_ctx->len_s, &bytes_B, &len_B, &ps_ctx->bytes_s);
-    } else {
-        /* Else, use the salt and verifier for SRP. This should be the default production case
-         */
-        if (mu_srp_set_salt_verifier(&ps_ctx->srp_hd, (char *)hap_priv.setup_info->salt, sizeof(hap_priv.setup_info->salt),
-                    (char *)hap_priv.setup_info->verifier, sizeof(hap_priv.setup_info->verifier)) < 0) {
-            ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "SRP-6a Salt-Verifier Init Failed");
-            hap_prepare_error_tlv(STATE_M2, kTLVError_Unknown, buf, bufsize, outlen);
-            return HAP_FAIL;
-        }
-        ps_ctx->bytes_s = (char *)hap_priv.setup_info->salt;
-        ps_ctx->len_s = sizeof(hap_priv.setup_info->salt);
-        mu_srp_srv_pubkey_from_salt_verifier(&ps_ctx->srp_hd, &bytes_B, &len_B);
+        setup_info = hap_get_setup_code_info() == HAP_SUCCESS ? hap_priv.setup_code_info : NULL;
+    }
+    if (!setup_info || mu_srp_set_salt_verifier(&ps_ctx->srp_hd, (char *)setup_info->salt, sizeof(setup_info->salt),
+                (char *)setup_info->verifier, sizeof(setup_info->verifier)) < 0) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "SRP-6a Salt-Verifier Init Failed");
+        hap_prepare_error_tlv(STATE_M2, kTLVError_Unknown, buf, bufsize, outlen);
+        return HAP_FAIL;
+    }
+    ps_ctx->bytes_s = ps_ctx->srp_hd.bytes_s;
+    ps_ctx->len_s = ps_ctx->srp_hd.len_s;
+    uint8_t srp_b[HAP_SRP_B_LEN], srp_gb[HAP_SRP_GB_LEN];
+    if (hap_ephemeral_get_srp(srp_b, srp_gb) == HAP_SUCCESS) {
+        mu_srp_srv_pubkey_from_ephemeral(&ps_ctx->srp_hd, (char *)srp_b, sizeof(srp_b),
+                (char *)srp_gb, sizeof(srp_gb), &bytes_B, &len_B);
+        sodium_memzero(srp_b, sizeof(srp_b));
     }
 	if (!ps_ctx->bytes_s || !bytes_B) {
 		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "SRP-6a Verifier Creation Failed");
@@ -260,10 +276,13 @@ static int hap_pair_setup_process_srp_verify(pair_setup_ctx_t *ps_ctx, uint8_t *
     }
     int acc_proof_length = SHA512HashSize;
 
-	hkdf(SHA512, (uint8_t *) PAIR_SETUP_ENCRYPT_SALT, strlen(PAIR_SETUP_ENCRYPT_SALT),
-			(uint8_t *)ps_ctx->shared_secret, ps_ctx->secret_len,
-			(uint8_t *) PAIR_SETUP_ENCRYPT_INFO, strlen(PAIR_SETUP_ENCRYPT_INFO),
-			ps_ctx->session_key, sizeof(ps_ctx->session_key));
+	if (hap_hkdf(&ps_encrypt_salt_key, PAIR_SETUP_ENCRYPT_SALT,
+				(uint8_t *)ps_ctx->shared_secret, ps_ctx->secret_len,
+				PAIR_SETUP_ENCRYPT_INFO, ps_ctx->session_key, sizeof(ps_ctx->session_key)) != 0) {
+		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Session key derivation failed");
+		hap_prepare_error_tlv(STATE_M4, kTLVError_Unknown, buf, bufsize, outlen);
+		return HAP_FAIL;
+	}
 
 	/* Construct the response M4 */
 	hap_tlv_data_t tlv_data;
@@ -326,27 +345,29 @@ static int hap_pair_setup_process_exchange(pair_setup_ctx_t *ps_ctx, uint8_t *bu
 	unsigned char ed_sign[64];
     unsigned long long ed_sign_len;
 	if (((ctrl_id_len = get_value_from_tlv(edata, edata_len, kTLVType_Identifier,
-					ps_ctx->ctrl->info.id, sizeof(ps_ctx->ctrl->info.id))) < 0) ||
+					ps_ctx->ctrl_info.id, sizeof(ps_ctx->ctrl_info.id))) < 0) ||
 			(get_value_from_tlv(edata, edata_len, kTLVType_PublicKey,
-					    ps_ctx->ctrl->info.ltpk, ED_KEY_LEN) != ED_KEY_LEN) ||
+					    ps_ctx->ctrl_info.ltpk, ED_KEY_LEN) != ED_KEY_LEN) ||
 			(get_value_from_tlv(edata, edata_len, kTLVType_Signature,
 					    ed_sign, sizeof(ed_sign)) != sizeof(ed_sign))) {
 		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Invalid subTLV received");
 		hap_prepare_error_tlv(STATE_M6, kTLVError_Authentication, buf, bufsize, outlen);
 		return HAP_FAIL;
 	}
-	ps_ctx->ctrl->info.id[ctrl_id_len] = 0; /* NULL termination */
-	hex_dbg_with_name("ctrl_id", (uint8_t *)ps_ctx->ctrl->info.id, ctrl_id_len);
-	hex_dbg_with_name("ltpkc", ps_ctx->ctrl->info.ltpk, ED_KEY_LEN);
+	ps_ctx->ctrl_info.id[ctrl_id_len] = 0; /* NULL termination */
+	hex_dbg_with_name("ctrl_id", (uint8_t *)ps_ctx->ctrl_info.id, ctrl_id_len);
+	hex_dbg_with_name("ltpkc", ps_ctx->ctrl_info.ltpk, ED_KEY_LEN);
 	hex_dbg_with_name("ctrl_sign", ed_sign, sizeof(ed_sign));
 
 	/* Derive iOSDeviceX from SRP shared secret using HKDF-SHA512 */
 	uint8_t ios_device_x[32];
-	hkdf(SHA512, (unsigned char *) PAIR_SETUP_CTRL_SIGN_SALT,
-			strlen(PAIR_SETUP_CTRL_SIGN_SALT), (uint8_t *)ps_ctx->shared_secret, ps_ctx->secret_len,
-			(unsigned char *) PAIR_SETUP_CTRL_SIGN_INFO,
-			strlen(PAIR_SETUP_CTRL_SIGN_INFO),
-			ios_device_x, sizeof(ios_device_x));
+	if (hap_hkdf(&ps_ctrl_sign_salt_key, PAIR_SETUP_CTRL_SIGN_SALT,
+				(uint8_t *)ps_ctx->shared_secret, ps_ctx->secret_len,
+				PAIR_SETUP_CTRL_SIGN_INFO, ios_device_x, sizeof(ios_device_x)) != 0) {
+		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "iOSDeviceX derivation failed");
+		hap_prepare_error_tlv(STATE_M6, kTLVError_Unknown, buf, bufsize, outlen);
+		return HAP_FAIL;
+	}
 	/* Construct iOSDeviceInfo by concatenating
 	 * iOSDeviceX
 	 * iOSDevicePairingID (ctrl_id)
@@ -357,12 +378,12 @@ static int hap_pair_setup_process_exchange(pair_setup_ctx_t *ps_ctx, uint8_t *bu
 	int ios_dev_info_len = 0;
 	memcpy(ios_dev_info, ios_device_x, sizeof(ios_device_x));
 	ios_dev_info_len += sizeof(ios_device_x);
-	memcpy(&ios_dev_info[ios_dev_info_len], ps_ctx->ctrl->info.id, ctrl_id_len);
+	memcpy(&ios_dev_info[ios_dev_info_len], ps_ctx->ctrl_info.id, ctrl_id_len);
 	ios_dev_info_len += ctrl_id_len;
-	memcpy(&ios_dev_info[ios_dev_info_len], ps_ctx->ctrl->info.ltpk, ED_KEY_LEN);
+	memcpy(&ios_dev_info[ios_dev_info_len], ps_ctx->ctrl_info.ltpk, ED_KEY_LEN);
 	ios_dev_info_len += ED_KEY_LEN;
 
-    ret = crypto_sign_ed25519_verify_detached(ed_sign, ios_dev_info, ios_dev_info_len, ps_ctx->ctrl->info.ltpk);
+    ret = crypto_sign_ed25519_verify_detached(ed_sign, ios_dev_info, ios_dev_info_len, ps_ctx->ctrl_info.ltpk);
 	/* Verify Signature of constructed iOSDeviceInfo using the iOSDeviceLTPK */
     if (ret != 0) {
 		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Invalid Signature");
@@ -374,11 +395,13 @@ static int hap_pair_setup_process_exchange(pair_setup_ctx_t *ps_ctx, uint8_t *bu
 
 	/* Derive AccessoryX from the SRP shared secret using HKDF-SHA512 */
 	uint8_t acc_x[32];
-	hkdf(SHA512, (unsigned char *) PAIR_SETUP_ACC_SIGN_SALT,
-			strlen(PAIR_SETUP_ACC_SIGN_SALT), (uint8_t *)ps_ctx->shared_secret, ps_ctx->secret_len,
-			(unsigned char *) PAIR_SETUP_ACC_SIGN_INFO,
-			strlen(PAIR_SETUP_ACC_SIGN_INFO),
-			acc_x, sizeof(acc_x));
+	if (hap_hkdf(&ps_acc_sign_salt_key, PAIR_SETUP_ACC_SIGN_SALT,
+				(uint8_t *)ps_ctx->shared_secret, ps_ctx->secret_len,
+				PAIR_SETUP_ACC_SIGN_INFO, acc_x, sizeof(acc_x)) != 0) {
+		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "AccessoryX derivation failed");
+		hap_prepare_error_tlv(STATE_M6, kTLVError_Unknown, buf, bufsize, outlen);
+		return HAP_FAIL;
+	}
 	/* Construct AccessoryInfo by concatenating
 	 * AccessoryX
 	 * AccessoryPairingID (acc_id)
@@ -437,12 +460,27 @@ static int hap_pair_setup_process_exchange(pair_setup_ctx_t *ps_ctx, uint8_t *bu
 		return HAP_FAIL;
 	}
 	*outlen = tlv_data.curlen;
+	ps_ctx->ctrl_info.perms = 1; /* Controller added using pair setup is always an admin */
+
+	/* Only the controller database is under the pairing lock, not the crypto
+	 * before, so that /pairings requests on the HTTP server are not held up.
+	 */
+	hap_pairing_lock();
+	hap_ctrl_data_t *ctrl = hap_controller_get_empty_loc();
+	if (ctrl) {
+		ctrl->info = ps_ctx->ctrl_info;
+		hap_controller_save(ctrl);
+	}
+	hap_pairing_unlock();
+	if (!ctrl) {
+		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "No empty controller slot. Aborting");
+		hap_prepare_error_tlv(STATE_M6, kTLVError_MaxPeers, buf, bufsize, outlen);
+		return HAP_FAIL;
+	}
 	ps_ctx->state = state;
-	ps_ctx->ctrl->info.perms = 1; /* Controller added using pair setup is always an admin */
-	ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Pair Setup Successful for %s", ps_ctx->ctrl->info.id);
+	ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Pair Setup Successful for %s", ps_ctx->ctrl_info.id);
     /* Reset the Pairing Attempts count */
 	hap_priv.pair_attempts = 0;
-    hap_controller_save(ps_ctx->ctrl);
     hap_send_event(HAP_INTERNAL_EVENT_ACC_PAIRED);
     /* Stop the pairing mode timer, since pairing is already done */
     hap_stop_pairing_mode_timer();
@@ -594,6 +632,11 @@ void hap_set_setup_code(const char *setup_code)
     if (hap_priv.setup_code)
         hap_platform_memory_free(hap_priv.setup_code);
     hap_priv.setup_code = strdup(setup_code);
+    /* Derived again for the new code */
+    if (hap_priv.setup_code_info) {
+        hap_platform_memory_free(hap_priv.setup_code_info);
+        hap_priv.setup_code_info = NULL;
+    }
 }
 
 int hap_set_setup_info(const hap_setup_info_t *setup_info)
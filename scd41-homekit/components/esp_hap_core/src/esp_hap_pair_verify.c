@@ -26,8 +26,8 @@
 #include <string.h>
 #include <sodium/crypto_scalarmult_curve25519.h>
 #include <sodium/crypto_sign_ed25519.h>
-#include <hkdf-sha.h>
 #include <sodium/crypto_aead_chacha20poly1305.h>
+#include <sodium/utils.h>
 #include <esp_http_server.h>
 #include <hap_platform_memory.h>
 
@@ -35,6 +35,9 @@
 #include <esp_hap_pair_common.h>
 #include <esp_hap_database.h>
 #include <esp_hap_char.h>
+#include <esp_hap_network_io.h>
+#include <esp_hap_ephemeral.h>
+#include <esp_hap_pair_worker.h>
 #include <hexdump.h>
 #include <esp_mfi_debug.h>
 #include <esp_mfi_rand.h>
@@ -47,6 +50,9 @@
 #define CONTROL_READ_INFO		"Control-Read-Encryption-Key"
 #define CONTROL_WRITE_INFO		"Control-Write-Encryption-Key"
 
+static esp_mfi_hmac_sha512_key_t pv_encrypt_salt_key;
+static esp_mfi_hmac_sha512_key_t control_salt_key;
+
 typedef struct {
 	/* It is important that "state" should be the first element of the structure.
 	 * It will be the first element, even in hap_secure_session_t.
@@ -120,7 +126,7 @@ void hap_close_all_sessions()
 	}
 }
 
-static void hap_add_secure_session(hap_secure_session_t *session)
+void hap_add_secure_session(hap_secure_session_t *session)
 {
 	int i;
 	for (i = 0; i < HAP_MAX_SESSIONS; i++) {
@@ -156,6 +162,7 @@ void hap_free_session(void *session)
 			break;
 		}
 	}
+	hap_session_io_release((hap_secure_session_t *)session);
 	hap_platform_memory_free(session);
 }
 
@@ -185,21 +192,17 @@ static int hap_pair_verify_process_start(pair_verify_ctx_t *pv_ctx, uint8_t *buf
 	ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Pair Verify M1 Received");
 	hex_dbg_with_name("ctrl curve pk", pv_ctx->ctrl_curve_pk, 32);
 
-	/* Generate a new Curve25519 Key Pair */
+	/* Take a new Curve25519 Key Pair */
 	uint8_t acc_curve_sk[CURVE_KEY_LEN];
-	esp_mfi_get_random(acc_curve_sk, CURVE_KEY_LEN);
-	/* This particular value of basepoint is required to generate the public key
-	 * from secret key
-	 */
-	uint8_t basepoint[32] = {9};
-    if (crypto_scalarmult_curve25519(pv_ctx->acc_curve_pk, acc_curve_sk, basepoint) == -1) {
-        ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Curve25519 Error");
+	if (hap_ephemeral_get_curve25519(acc_curve_sk, pv_ctx->acc_curve_pk) != HAP_SUCCESS) {
 		hap_prepare_error_tlv(STATE_M2, kTLVError_Unknown, buf, bufsize, outlen);
 		return HAP_FAIL;
-    }
+	}
 	hex_dbg_with_name("acc curve sk", acc_curve_sk, 32);
 	hex_dbg_with_name("acc curve pk", pv_ctx->acc_curve_pk, 32);
-    if (crypto_scalarmult_curve25519(pv_ctx->shared_secret, acc_curve_sk, pv_ctx->ctrl_curve_pk) == -1) {
+    int ret = crypto_scalarmult_curve25519(pv_ctx->shared_secret, acc_curve_sk, pv_ctx->ctrl_curve_pk);
+    sodium_memzero(acc_curve_sk, sizeof(acc_curve_sk));
+    if (ret == -1) {
         ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Curve25519 Error");
 		hap_prepare_error_tlv(STATE_M2, kTLVError_Unknown, buf, bufsize, outlen);
 		return HAP_FAIL;
@@ -248,12 +251,13 @@ static int hap_pair_verify_process_start(pair_verify_ctx_t *pv_ctx, uint8_t *buf
 	/* Derive Symmetric Session encryption key SessionKey from the curve
 	 * shared secret using HKDF-SHA-512
 	 */
-	hkdf(SHA512, (unsigned char *) PAIR_VERIFY_ENCRYPT_SALT,
-			strlen(PAIR_VERIFY_ENCRYPT_SALT),
-			pv_ctx->shared_secret, sizeof(pv_ctx->shared_secret),
-			(unsigned char *) PAIR_VERIFY_ENCRYPT_INFO,
-			strlen(PAIR_VERIFY_ENCRYPT_INFO),
-			pv_ctx->hkdf_key, sizeof(pv_ctx->hkdf_key));
+	if (hap_hkdf(&pv_encrypt_salt_key, PAIR_VERIFY_ENCRYPT_SALT,
+				pv_ctx->shared_secret, sizeof(pv_ctx->shared_secret),
+				PAIR_VERIFY_ENCRYPT_INFO, pv_ctx->hkdf_key, sizeof(pv_ctx->hkdf_key)) != 0) {
+		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Session key derivation failed");
+		hap_prepare_error_tlv(STATE_M2, kTLVError_Unknown, buf, bufsize, outlen);
+		return HAP_FAIL;
+	}
 	/* Encrypt the sub TLV to get encryptedData and an authTag using
 	 * Chacha20-Poly1305 AEAD Algorithm
 	 */
@@ -343,9 +347,17 @@ static int hap_pair_verify_process_finish(pair_verify_ctx_t *pv_ctx, uint8_t *bu
 	}
 
 	/* Check if the controller is present in the database i.e. check
-	 * if the controller was paired with the accessory
+	 * if the controller was paired with the accessory. Only the lookup is
+	 * under the pairing lock, and the signature is checked against a copy of
+	 * the key, so that /pairings requests are not held up by the crypto.
 	 */
+	uint8_t ctrl_ltpk[ED_KEY_LEN];
+	hap_pairing_lock();
 	hap_ctrl_data_t *ctrl = hap_get_controller(ctrl_id);
+	if (ctrl) {
+		memcpy(ctrl_ltpk, ctrl->info.ltpk, sizeof(ctrl_ltpk));
+	}
+	hap_pairing_unlock();
 	if (!ctrl) {
 		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "No ctrl details found");
 		hap_prepare_error_tlv(STATE_M4, kTLVError_Authentication, buf, bufsize, outlen);
@@ -368,7 +380,7 @@ static int hap_pair_verify_process_finish(pair_verify_ctx_t *pv_ctx, uint8_t *bu
 	ios_dev_info_len += CURVE_KEY_LEN;
 
 	/* Validate the signature with the received iOSDeviceSignature */
-    if (crypto_sign_ed25519_verify_detached(ed_sign, ios_dev_info, ios_dev_info_len, ctrl->info.ltpk) != 0) {
+    if (crypto_sign_ed25519_verify_detached(ed_sign, ios_dev_info, ios_dev_info_len, ctrl_ltpk) != 0) {
 		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Signature mismatch");
 		hap_prepare_error_tlv(STATE_M4, kTLVError_Authentication, buf, bufsize, outlen);
 		return HAP_FAIL;
@@ -399,17 +411,27 @@ static int hap_pair_verify_process_finish(pair_verify_ctx_t *pv_ctx, uint8_t *bu
 	 * Since, read and write are from the controller's point of view,
 	 * encryption key uses READ_INFO and decryption key uses WRITE_INFO
 	 *
+	 * Both come from the same salt and shared secret, so the extract step
+	 * is done once for the two.
+	 *
 	 * Also, set the nonce to zero
 	 */
-	hkdf(SHA512, (unsigned char *) CONTROL_SALT, strlen(CONTROL_SALT),
-			pv_ctx->shared_secret, sizeof(pv_ctx->shared_secret),
-			(unsigned char *) CONTROL_READ_INFO, strlen(CONTROL_READ_INFO),
+	esp_mfi_hmac_sha512_key_t control_salt = hap_hkdf_salt_key(&control_salt_key, CONTROL_SALT);
+	esp_mfi_hmac_sha512_key_t prk = NULL;
+	if (control_salt)
+		prk = esp_mfi_hkdf_sha512_extract(control_salt, pv_ctx->shared_secret,
+				sizeof(pv_ctx->shared_secret));
+	if (!prk) {
+		hap_prepare_error_tlv(STATE_M4, kTLVError_Unknown, buf, bufsize, outlen);
+		hap_platform_memory_free(session);
+		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Session key derivation failed");
+		return HAP_FAIL;
+	}
+	esp_mfi_hkdf_sha512_expand(prk, (uint8_t *) CONTROL_READ_INFO, strlen(CONTROL_READ_INFO),
 			session->encrypt_key, sizeof(session->encrypt_key));
-
-	hkdf(SHA512, (unsigned char *) CONTROL_SALT, strlen(CONTROL_SALT),
-			pv_ctx->shared_secret, sizeof(pv_ctx->shared_secret),
-			(unsigned char *) CONTROL_WRITE_INFO, strlen(CONTROL_WRITE_INFO),
+	esp_mfi_hkdf_sha512_expand(prk, (uint8_t *) CONTROL_WRITE_INFO, strlen(CONTROL_WRITE_INFO),
 			session->decrypt_key, sizeof(session->decrypt_key));
+	esp_mfi_hmac_sha512_key_free(prk);
 
 	session->state = STATE_VERIFIED;
 	pv_ctx->state = STATE_VERIFIED;
@@ -420,8 +442,9 @@ static int hap_pair_verify_process_finish(pair_verify_ctx_t *pv_ctx, uint8_t *bu
 
 	pv_ctx->session = session;
 
-	/* Add the session information to database */
-	hap_add_secure_session(session);
+	/* The caller adds the session to the database with hap_add_secure_session(),
+	 * from the HTTP server task, once the socket is set up for it.
+	 */
 	ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Pair Verify Successful for %s", ctrl_id);
 	return HAP_SUCCESS;
 }
@@ -0,0 +1,379 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2020 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include <stdlib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <lwip/sockets.h>
+#include <esp_http_server.h>
+#include <hap.h>
+
+#include <esp_mfi_debug.h>
+#include <hap_platform_memory.h>
+#include <hap_platform_httpd.h>
+#include <esp_hap_database.h>
+#include <esp_hap_pair_setup.h>
+#include <esp_hap_pair_verify.h>
+#include <esp_hap_network_io.h>
+#include <esp_hap_pair_worker.h>
+
+/* Pair setup takes hundreds of milliseconds of SRP, and pair verify tens of
+ * milliseconds of Curve25519 and Ed25519. They run on this task, below the
+ * priority of the HTTP server, so that the server keeps serving the other
+ * controllers meanwhile. The one task also keeps the handshakes one at a
+ * time, as they were on the server task.
+ */
+#ifdef CONFIG_HAP_HTTP_STACK_SIZE
+#define HAP_PAIR_WORKER_STACK       CONFIG_HAP_HTTP_STACK_SIZE
+#else
+#define HAP_PAIR_WORKER_STACK       (12 * 1024)
+#endif
+#define HAP_PAIR_WORKER_PRIORITY    (tskIDLE_PRIORITY + 4)
+#define HAP_PAIR_WORKER_QUEUE_LEN   8
+
+typedef struct {
+    hap_pair_work_fn_t fn;
+    void *arg;
+} hap_pair_work_t;
+
+static QueueHandle_t hap_pair_work_queue;
+static SemaphoreHandle_t hap_pairing_mutex;
+static TaskHandle_t hap_pair_worker_handle;
+
+static void hap_pair_worker_task(void *arg)
+{
+    hap_pair_work_t work;
+    while (1) {
+        if (xQueueReceive(hap_pair_work_queue, &work, portMAX_DELAY) == pdTRUE) {
+            work.fn(work.arg);
+        }
+    }
+}
+
+int hap_pair_worker_init()
+{
+    if (hap_pair_worker_handle) {
+        return HAP_SUCCESS;
+    }
+    if (!hap_pairing_mutex) {
+        hap_pairing_mutex = xSemaphoreCreateMutex();
+        if (!hap_pairing_mutex) {
+            return HAP_FAIL;
+        }
+    }
+    hap_pair_work_queue = xQueueCreate(HAP_PAIR_WORKER_QUEUE_LEN, sizeof(hap_pair_work_t));
+    if (!hap_pair_work_queue) {
+        return HAP_FAIL;
+    }
+    if (xTaskCreate(hap_pair_worker_task, "hap-pair", HAP_PAIR_WORKER_STACK, NULL,
+                HAP_PAIR_WORKER_PRIORITY, &hap_pair_worker_handle) != pdPASS) {
+        vQueueDelete(hap_pair_work_queue);
+        hap_pair_work_queue = NULL;
+        return HAP_FAIL;
+    }
+    return HAP_SUCCESS;
+}
+
+int hap_pair_worker_queue(hap_pair_work_fn_t fn, void *arg)
+{
+    hap_pair_work_t work = {
+        .fn = fn,
+        .arg = arg,
+    };
+    if (!hap_pair_work_queue || xQueueSend(hap_pair_work_queue, &work, 0) != pdTRUE) {
+        return HAP_FAIL;
+    }
+    return HAP_SUCCESS;
+}
+
+void hap_pairing_lock()
+{
+    if (hap_pairing_mutex) {
+        xSemaphoreTake(hap_pairing_mutex, portMAX_DELAY);
+    }
+}
+
+void hap_pairing_unlock()
+{
+    if (hap_pairing_mutex) {
+        xSemaphoreGive(hap_pairing_mutex);
+    }
+}
+
+/* Pair setup M5 is the largest of the handshake messages */
+#define HAP_PAIR_SETUP_BUF_SIZE     1200
+#define HAP_PAIR_VERIFY_BUF_SIZE    512
+
+/* A pair setup or pair verify request. Unless the session is pair verified
+ * already, it takes the session context over from when it is read until it
+ * is answered, so that nothing frees the context while it is worked on, and
+ * then hands the session back the context, or what replaced it.
+ */
+typedef struct {
+    httpd_req_t *req;
+    int fd;
+    bool verify;
+    void *ctx;
+    httpd_free_ctx_fn_t free_ctx;
+    /* Whether the session is encrypted from now on */
+    bool secure;
+    /* Context of a failed pair verify, freed on the server task */
+    void *stale_ctx;
+    httpd_free_ctx_fn_t stale_free_ctx;
+    esp_err_t send_ret;
+    int data_len;
+    uint8_t buf[HAP_PAIR_SETUP_BUF_SIZE];
+} hap_pair_req_t;
+
+static void hap_pair_verify_set_sockopts(int fd)
+{
+    struct timeval timeout;
+    timeout.tv_sec = hap_priv.cfg.recv_timeout;
+    timeout.tv_usec = 0;
+    if (setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout,
+                sizeof(timeout)) < 0) {
+         ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for SO_RCVTIMEO");
+    }
+
+    timeout.tv_sec = hap_priv.cfg.send_timeout;
+    timeout.tv_usec = 0;
+    if (setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout,
+                sizeof(timeout)) < 0) {
+         ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for SO_SNDTIMEO");
+    }
+#ifdef CONFIG_HAP_SESSION_KEEP_ALIVE_ENABLE
+    ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Enabling Keep-Alive on Pair Verify Session");
+    const int yes = 1; /* enable sending keepalive probes for socket */
+    if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes)) < 0 ) {
+         ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for SO_KEEPALIVE");
+    }
+
+    const int idle = 180; /* 180 sec idle before start sending probes */
+    if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) < 0) {
+         ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for TCP_KEEPIDLE");
+    }
+
+    const int interval = 30; /* 30 sec between probes */
+    if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) < 0) {
+         ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for TCP_KEEPINTVL");
+    }
+
+    const int maxpkt = 4; /* Drop connection after 4 probes without response */
+    if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &maxpkt, sizeof(maxpkt)) < 0) {
+         ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for TCP_KEEPCNT");
+    }
+#endif
+}
+
+/* Does the crypto of the request, sends the response, and works out what
+ * the session keeps. Nothing of the session itself is changed here, as this
+ * may run on the pair worker. Pair setup and pair verify take the pairing
+ * lock themselves, only around their reads and writes of the controllers.
+ */
+static void hap_pair_req_process(hap_pair_req_t *pr)
+{
+    void *ctx = pr->ctx;
+    int ret, outlen;
+
+    if (pr->verify) {
+        ret = hap_pair_verify_process(&ctx, pr->buf, pr->data_len, HAP_PAIR_VERIFY_BUF_SIZE, &outlen);
+    } else {
+        ret = hap_pair_setup_process(&ctx, pr->buf, pr->data_len, sizeof(pr->buf), &outlen);
+    }
+    httpd_resp_set_type(pr->req, "application/pairing+tlv8");
+    pr->send_ret = httpd_resp_send(pr->req, (char *)pr->buf, outlen);
+
+    if (ret != HAP_SUCCESS) {
+        if (!pr->verify) {
+            hap_pair_setup_ctx_clean(ctx);
+        } else if (pr->ctx) {
+            /* This may be a session that notifications are sent to */
+            pr->stale_ctx = pr->ctx;
+            pr->stale_free_ctx = pr->free_ctx;
+        }
+        ctx = NULL;
+    } else if (hap_pair_verify_get_state(ctx) == STATE_VERIFIED) {
+        /* A pair verified session. For Software Token Authentication, that
+         * is also the case from the step M4 of Pair Setup.
+         *
+         * Saving socket fd since it will later be required for
+         * event notifications.
+         */
+        ((hap_secure_session_t *)ctx)->conn_identifier = pr->fd;
+        if (pr->verify) {
+            hap_pair_verify_set_sockopts(pr->fd);
+        }
+        pr->free_ctx = hap_free_session;
+        pr->secure = true;
+    }
+    /* Context will be NULL, either if there was an error and a cleanup was required,
+     * or if the pair_setup_process cleared it after successful pairing.
+     */
+    pr->ctx = ctx;
+    if (!ctx) {
+        pr->free_ctx = NULL;
+    }
+}
+
+/* Only on the server task, which sends the notifications to the sessions */
+static void hap_pair_req_apply(hap_pair_req_t *pr)
+{
+    if (pr->stale_ctx) {
+        if (pr->stale_free_ctx) {
+            pr->stale_free_ctx(pr->stale_ctx);
+        } else {
+            free(pr->stale_ctx);
+        }
+    }
+    httpd_sess_set_ctx(hap_priv.server, pr->fd, pr->ctx, pr->free_ctx);
+    if (pr->secure) {
+        httpd_sess_set_send_override(hap_priv.server, pr->fd, hap_httpd_send);
+        httpd_sess_set_recv_override(hap_priv.server, pr->fd, hap_httpd_recv);
+        if (pr->verify) {
+            hap_secure_session_t *session = (hap_secure_session_t *)pr->ctx;
+            /* /pairings may have removed the controller while the worker
+             * verified it, and closed its sessions without this one.
+             */
+            if (!session->ctrl->valid) {
+                ESP_MFI_DEBUG(ESP_MFI_DEBUG_WARN, "Controller removed during Pair Verify");
+                httpd_sess_trigger_close(hap_priv.server, pr->fd);
+                return;
+            }
+            hap_add_secure_session(session);
+        }
+    }
+}
+
+#ifdef HAP_PAIR_WORKER
+/* Back on the server task. The server leaves the socket alone until the
+ * request is completed, so the next message of the controller only gets
+ * read after the session has its context.
+ */
+static void hap_pair_req_finish(void *arg)
+{
+    hap_pair_req_t *pr = (hap_pair_req_t *)arg;
+    hap_pair_req_apply(pr);
+    if (pr->send_ret != ESP_OK) {
+        httpd_sess_trigger_close(hap_priv.server, pr->fd);
+    }
+    httpd_req_async_handler_complete(pr->req);
+    hap_platform_memory_free(pr);
+}
+
+/* If the session cannot be handed back, it is dropped from here, without
+ * touching the server's session table, which only the server task may.
+ * Completing the request would touch it too, so the copy of the request is
+ * left. httpd_queue_work() only fails when the server cannot take any work,
+ * as when it is being stopped.
+ */
+static void hap_pair_req_drop(hap_pair_req_t *pr)
+{
+    if (pr->ctx) {
+        if (pr->free_ctx) {
+            pr->free_ctx(pr->ctx);
+        } else {
+            free(pr->ctx);
+        }
+    }
+    if (pr->stale_ctx) {
+        if (pr->stale_free_ctx) {
+            pr->stale_free_ctx(pr->stale_ctx);
+        } else {
+            free(pr->stale_ctx);
+        }
+    }
+    /* Shut down rather than closed, as the server still has the descriptor.
+     * The controller sees the connection go, and the server closes the socket
+     * once it finds it dead.
+     */
+    shutdown(pr->fd, SHUT_RDWR);
+    hap_platform_memory_free(pr);
+}
+
+static void hap_pair_req_work(void *arg)
+{
+    hap_pair_req_t *pr = (hap_pair_req_t *)arg;
+    hap_pair_req_process(pr);
+    if (httpd_queue_work(hap_priv.server, hap_pair_req_finish, pr) != ESP_OK) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_WARN, "Failed to hand the pairing session back");
+        hap_pair_req_drop(pr);
+    }
+}
+#endif /* HAP_PAIR_WORKER */
+
+int hap_pair_req_handle(httpd_req_t *req, bool verify)
+{
+    int fd = httpd_req_to_sockfd(req);
+    hap_pair_req_t *pr = hap_platform_memory_calloc(1, sizeof(hap_pair_req_t));
+    if (!pr) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Memory allocation failed");
+        return HAP_FAIL;
+    }
+    pr->req = req;
+    pr->fd = fd;
+    pr->verify = verify;
+    pr->ctx = hap_platform_httpd_get_sess_ctx(req);
+    pr->free_ctx = req->free_ctx;
+    if (!pr->ctx) {
+        int outlen;
+        if (verify) {
+            hap_pair_verify_context_init(&pr->ctx, pr->buf, HAP_PAIR_VERIFY_BUF_SIZE, &outlen);
+            pr->free_ctx = NULL;
+        } else if (hap_pair_setup_context_init(fd, &pr->ctx, pr->buf, sizeof(pr->buf), &outlen) == HAP_SUCCESS) {
+            pr->free_ctx = hap_pair_setup_ctx_clean;
+        } else {
+            httpd_resp_set_type(req, "application/pairing+tlv8");
+            httpd_resp_send(req, (char *)pr->buf, outlen);
+            hap_platform_memory_free(pr);
+            return HAP_SUCCESS;
+        }
+    }
+    pr->data_len = httpd_req_recv(req, (char *)pr->buf,
+            verify ? HAP_PAIR_VERIFY_BUF_SIZE : sizeof(pr->buf));
+
+#ifdef HAP_PAIR_WORKER
+    /* A pair verified session keeps its context, and so stays on the server
+     * task: its response, and the notifications sent to it meanwhile, are
+     * encrypted with the context.
+     */
+    if (hap_pair_verify_get_state(pr->ctx) != STATE_VERIFIED) {
+        hap_platform_httpd_set_sess_ctx(req, NULL, NULL, true);
+        if (httpd_req_async_handler_begin(req, &pr->req) == ESP_OK) {
+            if (hap_pair_worker_queue(hap_pair_req_work, pr) == HAP_SUCCESS) {
+                return ESP_OK;
+            }
+            httpd_req_async_handler_complete(pr->req);
+            pr->req = req;
+        }
+    }
+#endif
+    /* Right here on the server task otherwise */
+    hap_pair_req_process(pr);
+    hap_platform_httpd_set_sess_ctx(req, NULL, NULL, true);
+    hap_pair_req_apply(pr);
+    int ret = pr->send_ret;
+    hap_platform_memory_free(pr);
+    return ret;
+}
@@ -0,0 +1,284 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2020 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/timers.h>
+#include <esp_system.h>
+#include <hap_platform_memory.h>
+#include <hap_platform_os.h>
+
+#include <esp_mfi_debug.h>
+#include <esp_hap_main.h>
+#include <esp_hap_acc.h>
+#include <esp_hap_char.h>
+#include <esp_hap_keystore.h>
+#include <esp_hap_persist.h>
+
+/* Values of the characteristics created with HAP_CHAR_PERM_PERSIST are kept in a
+ * single blob of packed records, so that restoring them takes one read, and
+ * saving them one write and one commit, however many there are.
+ */
+#define HAP_KEYSTORE_NAMESPACE_CHARS    "hap_chars"
+#define HAP_KEY_CHAR_VALUES             "values"
+#define HAP_PERSIST_VERSION             1
+#ifdef CONFIG_HAP_CHAR_PERSIST_DELAY_MS
+#define HAP_PERSIST_DELAY_MS            CONFIG_HAP_CHAR_PERSIST_DELAY_MS
+#else
+#define HAP_PERSIST_DELAY_MS            2000
+#endif
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t count;
+} hap_persist_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t aid;
+    uint8_t format;
+    uint8_t reserved;
+    uint32_t iid;
+    uint32_t val;
+} hap_persist_rec_t;
+
+/* Blob read at hap_init(), until the values are restored at hap_start() */
+static uint8_t *hap_persist_loaded;
+static size_t hap_persist_loaded_len;
+/* Blob as last written, so that a flush which would not change it is skipped */
+static uint8_t *hap_persist_saved;
+static size_t hap_persist_saved_len;
+static TimerHandle_t hap_persist_timer;
+static volatile bool hap_persist_dirty;
+
+static bool hap_persist_format_supported(hap_char_format_t format)
+{
+    switch (format) {
+        case HAP_CHAR_FORMAT_BOOL:
+        case HAP_CHAR_FORMAT_UINT8:
+        case HAP_CHAR_FORMAT_UINT16:
+        case HAP_CHAR_FORMAT_UINT32:
+        case HAP_CHAR_FORMAT_INT:
+        case HAP_CHAR_FORMAT_FLOAT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool hap_persist_char_is_persistent(__hap_char_t *_hc)
+{
+    return (_hc->permission & HAP_CHAR_PERM_PERSIST) && hap_persist_format_supported(_hc->format);
+}
+
+static uint32_t hap_persist_val_to_u32(__hap_char_t *_hc)
+{
+    uint32_t val = 0;
+    if (_hc->format == HAP_CHAR_FORMAT_BOOL) {
+        val = _hc->val.b;
+    } else if (_hc->format == HAP_CHAR_FORMAT_FLOAT) {
+        memcpy(&val, &_hc->val.f, sizeof(val));
+    } else {
+        val = _hc->val.u;
+    }
+    return val;
+}
+
+static void hap_persist_val_from_u32(__hap_char_t *_hc, uint32_t val)
+{
+    if (_hc->format == HAP_CHAR_FORMAT_BOOL) {
+        _hc->val.b = val;
+    } else if (_hc->format == HAP_CHAR_FORMAT_FLOAT) {
+        memcpy(&_hc->val.f, &val, sizeof(val));
+    } else {
+        _hc->val.u = val;
+    }
+}
+
+static void hap_persist_timer_cb(TimerHandle_t timer)
+{
+    /* Flash writes take long, so leave them to the HAP loop rather than the timer task */
+    hap_send_event(HAP_INTERNAL_EVENT_PERSIST_FLUSH);
+}
+
+static void hap_persist_shutdown_handler(void)
+{
+    hap_persist_flush();
+}
+
+int hap_persist_init()
+{
+    if (hap_persist_timer) {
+        return HAP_SUCCESS;
+    }
+    hap_persist_timer = xTimerCreate("hap_persist_timer",
+            HAP_PERSIST_DELAY_MS / hap_platform_os_get_msec_per_tick(),
+            pdFALSE, NULL, hap_persist_timer_cb);
+    if (!hap_persist_timer) {
+        return HAP_FAIL;
+    }
+    /* Pending changes are written out on a restart, including the one after a reboot request */
+    esp_register_shutdown_handler(hap_persist_shutdown_handler);
+
+    size_t len = 0;
+    if (hap_keystore_get(HAP_KEYSTORE_NAMESPACE_CHARS, HAP_KEY_CHAR_VALUES, NULL, &len) != HAP_SUCCESS
+            || len < sizeof(hap_persist_hdr_t)) {
+        return HAP_SUCCESS;
+    }
+    hap_persist_loaded = hap_platform_memory_malloc(len);
+    if (!hap_persist_loaded) {
+        return HAP_FAIL;
+    }
+    if (hap_keystore_get(HAP_KEYSTORE_NAMESPACE_CHARS, HAP_KEY_CHAR_VALUES,
+                hap_persist_loaded, &len) != HAP_SUCCESS) {
+        hap_platform_memory_free(hap_persist_loaded);
+        hap_persist_loaded = NULL;
+        return HAP_SUCCESS;
+    }
+    hap_persist_loaded_len = len;
+    return HAP_SUCCESS;
+}
+
+/* Applies the values read at hap_init() to the characteristics, matched by aid, iid
+ * and format. Values whose characteristic no longer exists are dropped on the next save.
+ */
+void hap_persist_restore()
+{
+    if (!hap_persist_loaded) {
+        return;
+    }
+    hap_persist_hdr_t hdr;
+    memcpy(&hdr, hap_persist_loaded, sizeof(hdr));
+    if (hdr.version == HAP_PERSIST_VERSION &&
+            hap_persist_loaded_len >= sizeof(hdr) + hdr.count * sizeof(hap_persist_rec_t)) {
+        int restored = 0;
+        for (int i = 0; i < hdr.count; i++) {
+            hap_persist_rec_t rec;
+            memcpy(&rec, hap_persist_loaded + sizeof(hdr) + i * sizeof(rec), sizeof(rec));
+            __hap_char_t *_hc = (__hap_char_t *)hap_get_char_by_aid_iid(rec.aid, rec.iid);
+            if (_hc && hap_persist_char_is_persistent(_hc) && _hc->format == rec.format) {
+                /* Set directly, as this is the value the characteristic had before, not a change */
+                hap_persist_val_from_u32(_hc, rec.val);
+                restored++;
+            }
+        }
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Restored %d characteristic values", restored);
+    }
+    /* The blob is what is in flash, so keep it to compare against */
+    hap_platform_memory_free(hap_persist_saved);
+    hap_persist_saved = hap_persist_loaded;
+    hap_persist_saved_len = hap_persist_loaded_len;
+    hap_persist_loaded = NULL;
+    hap_persist_loaded_len = 0;
+}
+
+/* Called when the value of a persistent characteristic changes. Restarts the timer,
+ * so that a burst of changes, like those of a slider being dragged, is saved once,
+ * when it is over. hap_char_update_val() may be called from an ISR, and so this too.
+ */
+void hap_persist_mark_changed()
+{
+    hap_persist_dirty = true;
+    if (hap_persist_timer) {
+        if (xPortInIsrContext() == pdTRUE) {
+            xTimerResetFromISR(hap_persist_timer, NULL);
+        } else {
+            xTimerReset(hap_persist_timer, 0);
+        }
+    }
+}
+
+void hap_persist_flush()
+{
+    if (!hap_persist_dirty) {
+        return;
+    }
+    hap_persist_dirty = false;
+
+    int count = 0;
+    for (hap_acc_t *ha = hap_get_first_acc(); ha; ha = hap_acc_get_next(ha)) {
+        for (hap_serv_t *hs = hap_acc_get_first_serv(ha); hs; hs = hap_serv_get_next(hs)) {
+            for (hap_char_t *hc = hap_serv_get_first_char(hs); hc; hc = hap_char_get_next(hc)) {
+                if (hap_persist_char_is_persistent((__hap_char_t *)hc)) {
+                    count++;
+                }
+            }
+        }
+    }
+    size_t len = sizeof(hap_persist_hdr_t) + count * sizeof(hap_persist_rec_t);
+    uint8_t *blob = hap_platform_memory_calloc(1, len);
+    if (!blob) {
+        hap_persist_dirty = true;
+        return;
+    }
+    hap_persist_hdr_t hdr = {
+        .version = HAP_PERSIST_VERSION,
+        .count = count,
+    };
+    memcpy(blob, &hdr, sizeof(hdr));
+    uint8_t *p = blob + sizeof(hdr);
+    for (hap_acc_t *ha = hap_get_first_acc(); ha; ha = hap_acc_get_next(ha)) {
+        for (hap_serv_t *hs = hap_acc_get_first_serv(ha); hs; hs = hap_serv_get_next(hs)) {
+            for (hap_char_t *hc = hap_serv_get_first_char(hs); hc; hc = hap_char_get_next(hc)) {
+                __hap_char_t *_hc = (__hap_char_t *)hc;
+                if (!hap_persist_char_is_persistent(_hc)) {
+                    continue;
+                }
+                hap_persist_rec_t rec = {
+                    .aid = hap_acc_get_aid(ha),
+                    .format = _hc->format,
+                    .iid = _hc->iid,
+                    .val = hap_persist_val_to_u32(_hc),
+                };
+                memcpy(p, &rec, sizeof(rec));
+                p += sizeof(rec);
+            }
+        }
+    }
+
+    if (hap_persist_saved && hap_persist_saved_len == len && !memcmp(hap_persist_saved, blob, len)) {
+        hap_platform_memory_free(blob);
+        return;
+    }
+    if (hap_keystore_set(HAP_KEYSTORE_NAMESPACE_CHARS, HAP_KEY_CHAR_VALUES, blob, len) != HAP_SUCCESS) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Failed to save characteristic values");
+        hap_platform_memory_free(blob);
+        return;
+    }
+    ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Saved %d characteristic values", count);
+    hap_platform_memory_free(hap_persist_saved);
+    hap_persist_saved = blob;
+    hap_persist_saved_len = len;
+}
+
+/* Drops pending changes, after the keystore has been erased */
+void hap_persist_discard()
+{
+    hap_persist_dirty = false;
+    if (hap_persist_timer) {
+        xTimerStop(hap_persist_timer, 0);
+    }
+    hap_platform_memory_free(hap_persist_saved);
+    hap_persist_saved = NULL;
+    hap_persist_saved_len = 0;
+}
@@ -81,6 +81,12 @@ typedef struct  {
     uint8_t *valid_vals;
     size_t valid_vals_cnt;
     bool update_called;
+
+    /* Set if an event notification is pending for this characteristic.
+     * Such characteristics are linked through next_dirty.
+     */
+    bool dirty;
+    hap_char_t *next_dirty;
 } __hap_char_t;
 
 void hap_char_manage_notification(hap_char_t *hc, int index, bool ev);
@@ -92,6 +98,8 @@ int hap_char_check_val_constraints(__hap_char_t *_hc, hap_val_t *val);
 int hap_event_queue_init();
 int hap_event_queue_deinit();
 hap_char_t * hap_get_pending_notif_char();
+bool hap_is_notif_pending();
+void hap_notif_trigger_reset();
 #ifdef __cplusplus
 }
 #endif
@@ -64,6 +64,8 @@ typedef struct {
     hap_mdns_handle_t hap_mdns_handle;
     hap_setup_info_t *setup_info;
     char *setup_code;
+    /* Salt and verifier derived from the setup_code */
+    hap_setup_info_t *setup_code_info;
     char *ssid;
     char *password;
     hap_software_token_info_t *token_info;
@@ -89,6 +91,7 @@ int hap_database_init(void);
 char *hap_get_acc_id();
 int hap_get_next_aid();
 int hap_acc_setup_init();
+int hap_get_setup_code_info();
 void hap_erase_accessory_info();
 void hap_increment_and_save_config_num();
 void hap_increment_and_save_state_num();
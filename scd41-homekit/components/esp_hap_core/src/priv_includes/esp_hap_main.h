@@ -50,6 +50,7 @@ typedef enum {
     HAP_INTERNAL_EVENT_RESET_HOMEKIT_DATA,
     HAP_INTERNAL_EVENT_NETWORK_SWITCH,
     HAP_INTERNAL_EVENT_NETWORK_REVERT,
+    HAP_INTERNAL_EVENT_PERSIST_FLUSH,
 } hap_internal_event_t;
 
 typedef struct {
@@ -48,7 +48,8 @@ typedef struct {
     int secret_len;
     char *shared_secret;
     mu_srp_handle_t srp_hd;
-	hap_ctrl_data_t *ctrl;
+	/* The controller from M5, added to the database at M6 */
+	hap_ctrl_info_t ctrl_info;
 	uint8_t session_key[32];
     TimerHandle_t timer;
     hap_secure_session_t *session;
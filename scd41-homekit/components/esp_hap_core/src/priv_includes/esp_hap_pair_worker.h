@@ -0,0 +1,66 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2020 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _HAP_PAIR_WORKER_H_
+#define _HAP_PAIR_WORKER_H_
+
+#include <stdbool.h>
+#include <sdkconfig.h>
+#include <esp_idf_version.h>
+#include <esp_http_server.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The handshakes reach the worker through the asynchronous requests of the
+ * HTTP server, which came with ESP-IDF 5.1.
+ */
+#if defined(CONFIG_HAP_PAIR_WORKER_ENABLE) && ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+#define HAP_PAIR_WORKER 1
+#endif
+
+typedef void (*hap_pair_work_fn_t)(void *arg);
+
+int hap_pair_worker_init();
+/* Runs fn(arg) on the pair worker task. Fails if the task is not running or
+ * has too much queued already, in which case the caller does it itself.
+ */
+int hap_pair_worker_queue(hap_pair_work_fn_t fn, void *arg);
+/* Held around anything reading or changing the pairings, which the pair
+ * worker and the HTTP server task do at the same time otherwise.
+ */
+void hap_pairing_lock();
+void hap_pairing_unlock();
+/* Handles a /pair-setup or /pair-verify request. The crypto runs on the pair
+ * worker, unless the session is pair verified already or the worker cannot
+ * take it.
+ */
+int hap_pair_req_handle(httpd_req_t *req, bool verify);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HAP_PAIR_WORKER_H_ */
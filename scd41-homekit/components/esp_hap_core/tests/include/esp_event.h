@@ -0,0 +1,9 @@
+/* Host stand-in of the ESP-IDF header, for the tests */
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef const char *esp_event_base_t;
+
+#define ESP_EVENT_DECLARE_BASE(id) extern esp_event_base_t const id
+#define ESP_EVENT_DEFINE_BASE(id) esp_event_base_t const id = #id
@@ -0,0 +1,15 @@
+/* Host stand-in of the HAP debug header, for the tests. Only warnings and
+ * errors are printed, and asserts abort.
+ */
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#define ESP_MFI_DEBUG_INFO      1
+#define ESP_MFI_DEBUG_WARN      2
+#define ESP_MFI_DEBUG_ERR       3
+#define ESP_MFI_DEBUG(level, fmt, ...) \
+    do { if ((level) >= ESP_MFI_DEBUG_WARN) printf(fmt "\n", ##__VA_ARGS__); } while (0)
+#define ESP_MFI_DEBUG_INTR      ESP_MFI_DEBUG
+#define ESP_MFI_DEBUG_PLAIN(fmt, ...)
+#define ESP_MFI_ASSERT(cond) \
+    do { if (!(cond)) { printf("ASSERT %s:%d: %s\n", __FILE__, __LINE__, #cond); abort(); } } while (0)
@@ -0,0 +1,11 @@
+/* Host stand-in of the ESP-IDF header, for the tests */
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    WIFI_IF_STA,
+    WIFI_IF_AP,
+} wifi_interface_t;
+
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t *mac);
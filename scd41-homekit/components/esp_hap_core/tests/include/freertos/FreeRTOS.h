@@ -0,0 +1,41 @@
+/* Host stand-in of the FreeRTOS API the HAP core uses, over pthreads, for
+ * the tests. Tasks are threads, and their priorities are real-time ones
+ * where the host allows it.
+ */
+#pragma once
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void *arg);
+typedef struct host_task *TaskHandle_t;
+typedef struct host_queue *QueueHandle_t;
+typedef struct host_mutex *SemaphoreHandle_t;
+
+#define pdFALSE             0
+#define pdTRUE              1
+#define pdPASS              pdTRUE
+#define pdFAIL              pdFALSE
+#define portMAX_DELAY       ((TickType_t)0xffffffff)
+#define tskIDLE_PRIORITY    0
+
+/* Critical sections are one global lock */
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { 0 }
+#define portENTER_CRITICAL_SAFE(mux)    host_enter_critical(mux)
+#define portEXIT_CRITICAL_SAFE(mux)     host_exit_critical(mux)
+#define portENTER_CRITICAL(mux)         host_enter_critical(mux)
+#define portEXIT_CRITICAL(mux)          host_exit_critical(mux)
+
+void host_enter_critical(portMUX_TYPE *mux);
+void host_exit_critical(portMUX_TYPE *mux);
+
+/* A test sets host_in_isr on a thread for it to act as an interrupt handler.
+ * Calls that may block then abort, as configASSERT() would on the target.
+ */
+extern __thread int host_in_isr;
+BaseType_t xPortInIsrContext(void);
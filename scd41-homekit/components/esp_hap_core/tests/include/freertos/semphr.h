@@ -0,0 +1,7 @@
+/* See FreeRTOS.h */
+#pragma once
+#include "FreeRTOS.h"
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t m);
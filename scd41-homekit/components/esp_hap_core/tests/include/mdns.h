@@ -0,0 +1,6 @@
+/* Host stand-in of the ESP-IDF header, for the tests */
+#pragma once
+typedef struct {
+    const char *key;
+    const char *value;
+} mdns_txt_item_t;
@@ -0,0 +1,3 @@
+/* See crypto_aead_chacha20poly1305.h */
+#pragma once
+int sodium_init(void);
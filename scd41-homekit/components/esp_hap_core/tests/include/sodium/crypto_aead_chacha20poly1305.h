@@ -0,0 +1,12 @@
+/* The libsodium functions the HAP core uses, for the host's libsodium, which
+ * has no development package here.
+ */
+#pragma once
+int crypto_aead_chacha20poly1305_ietf_encrypt_detached(unsigned char *c, unsigned char *mac,
+        unsigned long long *maclen_p, const unsigned char *m, unsigned long long mlen,
+        const unsigned char *ad, unsigned long long adlen, const unsigned char *nsec,
+        const unsigned char *npub, const unsigned char *k);
+int crypto_aead_chacha20poly1305_ietf_decrypt_detached(unsigned char *m, unsigned char *nsec,
+        const unsigned char *c, unsigned long long clen, const unsigned char *mac,
+        const unsigned char *ad, unsigned long long adlen, const unsigned char *npub,
+        const unsigned char *k);
@@ -0,0 +1,4 @@
+/* See crypto_aead_chacha20poly1305.h */
+#pragma once
+int crypto_scalarmult_curve25519(unsigned char *q, const unsigned char *n, const unsigned char *p);
+int crypto_scalarmult_curve25519_base(unsigned char *q, const unsigned char *n);
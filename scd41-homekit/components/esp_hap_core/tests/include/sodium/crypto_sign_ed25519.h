@@ -0,0 +1,7 @@
+/* See crypto_aead_chacha20poly1305.h */
+#pragma once
+int crypto_sign_ed25519_seed_keypair(unsigned char *pk, unsigned char *sk, const unsigned char *seed);
+int crypto_sign_ed25519_detached(unsigned char *sig, unsigned long long *siglen_p,
+        const unsigned char *m, unsigned long long mlen, const unsigned char *sk);
+int crypto_sign_ed25519_verify_detached(const unsigned char *sig, const unsigned char *m,
+        unsigned long long mlen, const unsigned char *pk);
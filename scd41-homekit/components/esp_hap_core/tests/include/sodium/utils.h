@@ -0,0 +1,4 @@
+/* See crypto_aead_chacha20poly1305.h */
+#pragma once
+#include <stddef.h>
+void sodium_memzero(void * const pnt, const size_t len);
@@ -0,0 +1,244 @@
+/*
+ * Host test and benchmark of the (aid, iid) index of the characteristics.
+ *
+ * A bridge grows to 1, 50 and 150 accessories, each with a lightbulb
+ * service beside its Accessory Information. At each size, every
+ * characteristic is looked up through the index and through the list walk
+ * the lookups did before. Then bridged accessories come and go on another
+ * task while two more keep looking up; "make test" also runs that part with
+ * AddressSanitizer.
+ *
+ * Build and run with "make test" in this directory.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_hap_acc.h"
+#include "esp_hap_database.h"
+#include "esp_hap_main.h"
+#include "esp_wifi.h"
+
+#define MAX_CHARS       (150 * 16)
+#define BENCH_LOOKUPS   2000000
+#define CHURN_CYCLES    2000
+
+static atomic_int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* The rest of the core, as far as the database needs it */
+hap_priv_t hap_priv;
+static atomic_int next_aid = 2;
+
+int hap_get_next_aid(void) { return next_aid++; }
+int hap_update_config_number(void) { return HAP_SUCCESS; }
+int hap_send_event(hap_internal_event_t event) { return HAP_FAIL; }
+void hap_persist_mark_changed(void) {}
+int hap_keystore_get(const char *name_space, const char *key, uint8_t *val, size_t *val_size) { return HAP_FAIL; }
+int hap_keystore_set(const char *name_space, const char *key, const uint8_t *val, const size_t val_len) { return HAP_FAIL; }
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t *mac) { return ESP_FAIL; }
+hap_char_t *hap_char_accessory_flags_create(uint32_t flags) { return NULL; }
+hap_char_t *hap_char_product_data_create(hap_data_val_t *product_data) { return NULL; }
+
+typedef struct {
+    uint32_t aid, iid;
+    hap_char_t *hc;
+} char_id_t;
+
+static char_id_t ids[MAX_CHARS];
+static int num_ids;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static hap_acc_t *lightbulb_create(void)
+{
+    hap_acc_cfg_t cfg = {
+        .name = "Lamp",
+        .model = "Test",
+        .manufacturer = "Test",
+        .serial_num = "1",
+        .fw_rev = "1.0",
+    };
+    hap_acc_t *ha = hap_acc_create(&cfg);
+    hap_serv_t *hs = hap_serv_create("43");
+
+    hap_serv_add_char(hs, hap_char_bool_create("25", HAP_CHAR_PERM_PR | HAP_CHAR_PERM_PW | HAP_CHAR_PERM_EV, false));
+    hap_serv_add_char(hs, hap_char_int_create("8", HAP_CHAR_PERM_PR | HAP_CHAR_PERM_PW | HAP_CHAR_PERM_EV, 100));
+    hap_serv_add_char(hs, hap_char_float_create("13", HAP_CHAR_PERM_PR | HAP_CHAR_PERM_PW | HAP_CHAR_PERM_EV, 0));
+    hap_serv_add_char(hs, hap_char_float_create("2F", HAP_CHAR_PERM_PR | HAP_CHAR_PERM_PW | HAP_CHAR_PERM_EV, 0));
+    hap_acc_add_serv(ha, hs);
+    return ha;
+}
+
+/* All the characteristics, from the lists */
+static void collect_ids(void)
+{
+    hap_acc_t *ha;
+    hap_serv_t *hs;
+    hap_char_t *hc;
+
+    num_ids = 0;
+    for (ha = hap_get_first_acc(); ha; ha = hap_acc_get_next(ha)) {
+        for (hs = hap_acc_get_first_serv(ha); hs; hs = hap_serv_get_next(hs)) {
+            for (hc = hap_serv_get_first_char(hs); hc; hc = hap_char_get_next(hc)) {
+                ids[num_ids].aid = hap_acc_get_aid(ha);
+                ids[num_ids].iid = hap_char_get_iid(hc);
+                ids[num_ids].hc = hc;
+                num_ids++;
+            }
+        }
+    }
+}
+
+/* The lookup as it was before the index */
+static hap_char_t *list_lookup(uint32_t aid, uint32_t iid)
+{
+    hap_acc_t *ha;
+
+    for (ha = hap_get_first_acc(); ha; ha = hap_acc_get_next(ha)) {
+        if (hap_acc_get_aid(ha) == aid) {
+            return hap_acc_get_char_by_iid(ha, iid);
+        }
+    }
+    return NULL;
+}
+
+static void check_lookups(void)
+{
+    uint32_t last_aid = ids[num_ids - 1].aid;
+    int i;
+
+    for (i = 0; i < num_ids; i++) {
+        CHECK(hap_get_char_by_aid_iid(ids[i].aid, ids[i].iid) == ids[i].hc);
+        CHECK(list_lookup(ids[i].aid, ids[i].iid) == ids[i].hc);
+        CHECK(hap_acc_get_by_aid(ids[i].aid) == hap_serv_get_parent(hap_char_get_parent(ids[i].hc)));
+    }
+    CHECK(hap_get_char_by_aid_iid(1, 9999) == NULL);
+    CHECK(hap_get_char_by_aid_iid(last_aid + 1, 1) == NULL);
+    CHECK(hap_get_char_by_aid_iid(0, 0) == NULL);
+    CHECK(hap_acc_get_by_aid(last_aid + 1) == NULL);
+}
+
+static void bench(int accessories)
+{
+    volatile hap_char_t *sink;
+    double start, by_index, by_list;
+    int i;
+
+    collect_ids();
+    check_lookups();
+
+    start = now_ns();
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        char_id_t *id = &ids[i % num_ids];
+        sink = hap_get_char_by_aid_iid(id->aid, id->iid);
+    }
+    by_index = (now_ns() - start) / BENCH_LOOKUPS;
+
+    start = now_ns();
+    for (i = 0; i < BENCH_LOOKUPS / accessories; i++) {
+        char_id_t *id = &ids[i % num_ids];
+        sink = list_lookup(id->aid, id->iid);
+    }
+    by_list = (now_ns() - start) / (BENCH_LOOKUPS / accessories);
+    (void)sink;
+
+    printf("%3d accessories, %4d characteristics: %6.1f ns by index, %7.1f ns by list walk\n",
+           accessories, num_ids, by_index, by_list);
+}
+
+static atomic_int churn_done;
+
+/* Bridged accessories come and go, as on a bridge whose devices are paired
+ * and unpaired at run time.
+ */
+static void *churn_task(void *arg)
+{
+    int i;
+
+    for (i = 0; i < CHURN_CYCLES; i++) {
+        hap_acc_t *ha = lightbulb_create();
+        hap_add_bridged_accessory(ha, 0);
+        hap_remove_bridged_accessory(ha);
+        hap_acc_delete(ha);
+    }
+    churn_done = 1;
+    return NULL;
+}
+
+static void *lookup_task(void *arg)
+{
+    long lookups = 0;
+
+    while (!churn_done) {
+        char_id_t *id = &ids[lookups++ % num_ids];
+        CHECK(hap_get_char_by_aid_iid(id->aid, id->iid) == id->hc);
+        CHECK(hap_acc_get_by_aid(id->aid) != NULL);
+    }
+    return (void *)lookups;
+}
+
+/* Two tasks look up characteristics, each rebuilding the index when it
+ * finds it stale, under the other's lookups.
+ */
+static void test_churn(void)
+{
+    pthread_t churn, lookup[2];
+    long lookups = 0;
+    void *ret;
+    int i;
+
+    collect_ids();
+    for (i = 0; i < 2; i++) {
+        pthread_create(&lookup[i], NULL, lookup_task, NULL);
+    }
+    pthread_create(&churn, NULL, churn_task, NULL);
+    pthread_join(churn, NULL);
+    for (i = 0; i < 2; i++) {
+        pthread_join(lookup[i], &ret);
+        lookups += (long)ret;
+    }
+    printf("churn: %d accessories added and removed during %ld lookups\n", CHURN_CYCLES, lookups);
+}
+
+int main(int argc, char **argv)
+{
+    int accessories = 1;
+
+    CHECK(hap_acc_index_init() == HAP_SUCCESS);
+    hap_add_accessory(lightbulb_create());
+    if (argc < 2 || strcmp(argv[1], "churn")) {
+        bench(accessories);
+        for (; accessories < 50; accessories++) {
+            hap_add_bridged_accessory(lightbulb_create(), 0);
+        }
+        bench(accessories);
+        for (; accessories < 150; accessories++) {
+            hap_add_bridged_accessory(lightbulb_create(), 0);
+        }
+        bench(accessories);
+    }
+    test_churn();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
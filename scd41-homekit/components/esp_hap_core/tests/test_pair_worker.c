@@ -0,0 +1,1298 @@
+/*
+ * Host load test of pair setup, pair verify and /pairings through the HAP
+ * request handling: how long the HTTP server keeps other requests waiting
+ * while controllers pair, and that the pairing lock only covers the
+ * controller database.
+ *
+ * A server task stands in for the HTTP server, with its sessions, its
+ * asynchronous requests and its work queue, and runs hap_pair_req_handle()
+ * for /pair-setup and /pair-verify, and hap_pairings_process() under the
+ * pairing lock for /pairings, as the /pairings handler does. Over it:
+ *  - a controller pairs with SRP, pair verifies and removes its own pairing,
+ *    over and over, while another client sends a PUT every 2 ms,
+ *  - then, paired again, other controllers pair verify over and over while
+ *    the admin adds, lists and removes a pairing through /pairings.
+ * The controllers do their side of the crypto for real, with the mbedTLS
+ * bignums, libsodium and the RFC 6234 HKDF. It all runs once with the
+ * handshakes on the server task, as before, and once on the pair worker,
+ * which also gets a controller removed while it is verified, and the
+ * server refusing to take the session back. The whole process runs on one
+ * CPU, as on the ESP32-C6, so only the task priorities keep the requests
+ * going.
+ *
+ * Build and run with "make test" in this directory. Running it as root lets
+ * the tasks have their real-time priorities.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <mbedtls/bignum.h>
+#include <sodium/core.h>
+#include <sodium/crypto_aead_chacha20poly1305.h>
+#include <sodium/crypto_scalarmult_curve25519.h>
+#include <sodium/crypto_sign_ed25519.h>
+#include <esp_http_server.h>
+#include <esp_random.h>
+#include <hap.h>
+#include <hap_platform_httpd.h>
+#include <hkdf-sha.h>
+
+#include "esp_hap_controllers.h"
+#include "esp_hap_database.h"
+#include "esp_hap_ephemeral.h"
+#include "esp_hap_main.h"
+#include "esp_hap_pair_common.h"
+#include "esp_hap_pair_worker.h"
+#include "esp_hap_pairings.h"
+#include "mu_srp.h"
+
+#define SETUPS          10
+#define VERIFIERS       3
+#define VERIFY_ROUNDS   30
+#define PUT_PERIOD_US   2000
+#define PUT_WORK_US     100
+#define PAIRINGS_PERIOD_US  1000
+#define MAX_SAMPLES     100000
+#define MAX_FDS         1024
+#define BUF_SIZE        2048
+
+#define SERVER_PRIORITY     (tskIDLE_PRIORITY + 5)
+#define PUT_PRIORITY        (tskIDLE_PRIORITY + 10)
+/* Above the pair worker, as the server is */
+#define PAIRINGS_PRIORITY   (tskIDLE_PRIORITY + 6)
+/* The controllers' own crypto runs on other devices, so below everything */
+#define VERIFIER_PRIORITY   (tskIDLE_PRIORITY + 1)
+
+#define SETUP_CODE      "111-22-333"
+
+uint64_t test_random_state = 0x9E3779B97F4A7C15ULL;
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Waits up to five seconds */
+static bool wait_sem(sem_t *sem)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 5;
+    while (sem_timedwait(sem, &deadline) != 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The rest of the core, as far as the pairings need it */
+hap_priv_t hap_priv;
+static int server_handle;
+
+void hap_report_event(hap_event_t event, void *data, size_t data_size) {}
+int hap_send_event(hap_internal_event_t event) { return HAP_SUCCESS; }
+void hap_disable_all_char_notif(int index) {}
+int hap_mdns_announce(bool first) { return HAP_SUCCESS; }
+int hap_mdns_deannounce() { return HAP_SUCCESS; }
+uint16_t hap_platform_os_get_msec_per_tick() { return 1; }
+int hap_get_setup_code_info() { return HAP_FAIL; }
+int hap_keystore_get(const char *name_space, const char *key, uint8_t *val, size_t *val_size) { return HAP_FAIL; }
+int hap_keystore_set(const char *name_space, const char *key, const uint8_t *val, const size_t val_len) { return HAP_SUCCESS; }
+int hap_keystore_delete(const char *name_space, const char *key) { return HAP_SUCCESS; }
+int hap_keystore_delete_namespace(const char *name_space) { return HAP_SUCCESS; }
+
+/* Who holds the pairing lock, for the crypto to check that it is not them */
+static atomic_int lock_held;
+static pthread_t lock_owner;
+static atomic_int crypto_under_lock;
+
+void __real_hap_pairing_lock();
+void __real_hap_pairing_unlock();
+
+void __wrap_hap_pairing_lock()
+{
+    __real_hap_pairing_lock();
+    lock_owner = pthread_self();
+    lock_held = 1;
+}
+
+void __wrap_hap_pairing_unlock()
+{
+    lock_held = 0;
+    __real_hap_pairing_unlock();
+}
+
+static void check_unlocked(void)
+{
+    if (lock_held && pthread_equal(lock_owner, pthread_self())) {
+        crypto_under_lock++;
+    }
+}
+
+/* Generated there and then, as when the pools are empty */
+void hap_ephemeral_wake() {}
+
+int hap_ephemeral_get_curve25519(uint8_t sk[CURVE_KEY_LEN], uint8_t pk[CURVE_KEY_LEN])
+{
+    esp_fill_random(sk, CURVE_KEY_LEN);
+    check_unlocked();
+    return crypto_scalarmult_curve25519_base(pk, sk) == 0 ? HAP_SUCCESS : HAP_FAIL;
+}
+
+int hap_ephemeral_get_srp(uint8_t b[HAP_SRP_B_LEN], uint8_t gb[HAP_SRP_GB_LEN])
+{
+    char *bytes_b, *bytes_gb;
+    int len_b, len_gb;
+
+    check_unlocked();
+    if (mu_srp_gen_ephemeral(&bytes_b, &len_b, &bytes_gb, &len_gb) < 0) {
+        return HAP_FAIL;
+    }
+    memset(b, 0, HAP_SRP_B_LEN);
+    memset(gb, 0, HAP_SRP_GB_LEN);
+    memcpy(b + HAP_SRP_B_LEN - len_b, bytes_b, len_b);
+    memcpy(gb + HAP_SRP_GB_LEN - len_gb, bytes_gb, len_gb);
+    free(bytes_b);
+    free(bytes_gb);
+    return HAP_SUCCESS;
+}
+
+typedef struct {
+    char id[40];
+    uint8_t ltpk[ED_KEY_LEN];
+    uint8_t ltsk[64];
+} controller_t;
+
+typedef struct client {
+    int fd, peer;
+    /* The request, then the response */
+    uint8_t buf[BUF_SIZE];
+    int len;
+    double sent_us, resp_us;
+    sem_t resp;
+    /* Posted when the server closes the session */
+    sem_t gone;
+} client_t;
+
+/* A /pairings remove sent from the worker, while it verifies the controller */
+static const controller_t *remove_victim;
+static client_t *remove_client;
+static int remove_done;
+
+static bool pairings(client_t *c, uint8_t method, const controller_t *ctrl, uint8_t perms, double *latency);
+
+int __real_crypto_scalarmult_curve25519(unsigned char *q, const unsigned char *n, const unsigned char *p);
+int __real_crypto_sign_ed25519_detached(unsigned char *sig, unsigned long long *siglen_p,
+        const unsigned char *m, unsigned long long mlen, const unsigned char *sk);
+int __real_crypto_sign_ed25519_verify_detached(const unsigned char *sig, const unsigned char *m,
+        unsigned long long mlen, const unsigned char *pk);
+int __real_mu_srp_srv_pubkey_from_ephemeral(mu_srp_handle_t *hd, const char *bytes_b, int len_b,
+        const char *bytes_gb, int len_gb, char **bytes_B, int *len_B);
+int __real_mu_srp_get_session_key(mu_srp_handle_t *hd, char *bytes_A, int len_A, char **bytes_key, int *len_key);
+
+int __wrap_crypto_scalarmult_curve25519(unsigned char *q, const unsigned char *n, const unsigned char *p)
+{
+    check_unlocked();
+    return __real_crypto_scalarmult_curve25519(q, n, p);
+}
+
+int __wrap_crypto_sign_ed25519_detached(unsigned char *sig, unsigned long long *siglen_p,
+        const unsigned char *m, unsigned long long mlen, const unsigned char *sk)
+{
+    check_unlocked();
+    return __real_crypto_sign_ed25519_detached(sig, siglen_p, m, mlen, sk);
+}
+
+static __thread bool on_server;
+
+int __wrap_crypto_sign_ed25519_verify_detached(const unsigned char *sig, const unsigned char *m,
+        unsigned long long mlen, const unsigned char *pk)
+{
+    check_unlocked();
+    if (remove_victim && !on_server && !memcmp(pk, remove_victim->ltpk, ED_KEY_LEN)) {
+        const controller_t *victim = remove_victim;
+        remove_victim = NULL;
+        remove_done = pairings(remove_client, HAP_METHOD_REMOVE_PAIRING, victim, 0, NULL);
+    }
+    return __real_crypto_sign_ed25519_verify_detached(sig, m, mlen, pk);
+}
+
+int __wrap_mu_srp_srv_pubkey_from_ephemeral(mu_srp_handle_t *hd, const char *bytes_b, int len_b,
+        const char *bytes_gb, int len_gb, char **bytes_B, int *len_B)
+{
+    check_unlocked();
+    return __real_mu_srp_srv_pubkey_from_ephemeral(hd, bytes_b, len_b, bytes_gb, len_gb, bytes_B, len_B);
+}
+
+int __wrap_mu_srp_get_session_key(mu_srp_handle_t *hd, char *bytes_A, int len_A, char **bytes_key, int *len_key)
+{
+    check_unlocked();
+    return __real_mu_srp_get_session_key(hd, bytes_A, len_A, bytes_key, len_key);
+}
+
+/* The HTTP server */
+enum {
+    EVENT_OPEN,
+    EVENT_CLOSE,
+    EVENT_PUT,
+    EVENT_WORK,
+    EVENT_PAIR_SETUP,
+    EVENT_PAIR_VERIFY,
+    EVENT_PAIRINGS,
+};
+
+typedef struct {
+    int type;
+    double sent_us;
+    client_t *c;
+    httpd_work_fn_t fn;
+    void *arg;
+} event_t;
+
+typedef struct {
+    client_t *client;
+    void *ctx;
+    httpd_free_ctx_fn_t free_ctx;
+    bool secure;
+    /* An asynchronous request is out, so nothing more is read */
+    bool busy;
+    bool closing;
+    bool has_pending;
+    event_t pending;
+} sess_t;
+
+static QueueHandle_t server_queue;
+static sess_t sessions[MAX_FDS];
+static int max_fd;
+static httpd_req_t *cur_req;
+static atomic_int refuse_work;
+static atomic_int recording;
+static atomic_int puts_paused;
+static atomic_int server_realtime;
+static double put_samples[MAX_SAMPLES];
+static int num_put_samples;
+
+static void send_event(event_t *ev)
+{
+    while (xQueueSend(server_queue, ev, 0) != pdPASS) {
+        usleep(100);
+    }
+}
+
+static client_t *req_client(httpd_req_t *r)
+{
+    return (client_t *)r->aux;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+    return req_client(r)->fd;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    client_t *c = req_client(r);
+    int len = c->len < (int)buf_len ? c->len : (int)buf_len;
+    memcpy(buf, c->buf, len);
+    return len;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    return ESP_OK;
+}
+
+/* From the server or the pair worker */
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    client_t *c = req_client(r);
+    memcpy(c->buf, buf, buf_len);
+    c->len = buf_len;
+    c->resp_us = now_us();
+    sem_post(&c->resp);
+    return ESP_OK;
+}
+
+void *hap_platform_httpd_get_sess_ctx(httpd_req_t *req)
+{
+    return req->sess_ctx;
+}
+
+esp_err_t hap_platform_httpd_set_sess_ctx(httpd_req_t *req, void *ctx, httpd_free_ctx_fn_t free_ctx, bool ignore_ctx_changes)
+{
+    req->sess_ctx = ctx;
+    req->free_ctx = free_ctx;
+    req->ignore_sess_ctx_changes = ignore_ctx_changes;
+    return ESP_OK;
+}
+
+/* The session table is the server task's alone */
+void *httpd_sess_get_ctx(httpd_handle_t handle, int sockfd)
+{
+    CHECK(on_server);
+    return sessions[sockfd].ctx;
+}
+
+static void free_ctx(void *ctx, httpd_free_ctx_fn_t free_fn)
+{
+    if (ctx) {
+        if (free_fn) {
+            free_fn(ctx);
+        } else {
+            free(ctx);
+        }
+    }
+}
+
+/* From within a handler, the context goes to the request, which the server
+ * takes it from once the handler returns.
+ */
+void httpd_sess_set_ctx(httpd_handle_t handle, int sockfd, void *ctx, httpd_free_ctx_fn_t free_fn)
+{
+    void **sess_ctx = &sessions[sockfd].ctx;
+    httpd_free_ctx_fn_t *sess_free_ctx = &sessions[sockfd].free_ctx;
+
+    CHECK(on_server);
+    if (cur_req && httpd_req_to_sockfd(cur_req) == sockfd) {
+        sess_ctx = &cur_req->sess_ctx;
+        sess_free_ctx = &cur_req->free_ctx;
+    }
+    if (*sess_ctx != ctx) {
+        free_ctx(*sess_ctx, *sess_free_ctx);
+    }
+    *sess_ctx = ctx;
+    *sess_free_ctx = free_fn;
+}
+
+/* The stand-in keeps the sessions in the clear */
+esp_err_t httpd_sess_set_send_override(httpd_handle_t hd, int sockfd, httpd_send_func_t send_func)
+{
+    CHECK(on_server);
+    sessions[sockfd].secure = true;
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_set_recv_override(httpd_handle_t hd, int sockfd, httpd_recv_func_t recv_func)
+{
+    CHECK(on_server);
+    sessions[sockfd].secure = true;
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    CHECK(on_server);
+    sessions[sockfd].closing = true;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *r, httpd_req_t **out)
+{
+    httpd_req_t *copy = malloc(sizeof(*copy));
+
+    CHECK(on_server);
+    if (!copy) {
+        return ESP_ERR_NO_MEM;
+    }
+    *copy = *r;
+    sessions[httpd_req_to_sockfd(r)].busy = true;
+    *out = copy;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *r)
+{
+    CHECK(on_server);
+    sessions[httpd_req_to_sockfd(r)].busy = false;
+    free(r);
+    return ESP_OK;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg)
+{
+    event_t ev = {
+        .type = EVENT_WORK,
+        .fn = work,
+        .arg = arg,
+    };
+    if (refuse_work) {
+        return ESP_FAIL;
+    }
+    return xQueueSend(server_queue, &ev, 0) == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+static void sess_close(int fd)
+{
+    sess_t *s = &sessions[fd];
+    client_t *c = s->client;
+
+    if (!c) {
+        return;
+    }
+    free_ctx(s->ctx, s->free_ctx);
+    memset(s, 0, sizeof(*s));
+    sem_post(&c->gone);
+}
+
+/* As hap_http_pairings_handler() */
+static void pairings_handler(httpd_req_t *req)
+{
+    uint8_t buf[BUF_SIZE];
+    void *ctx = hap_platform_httpd_get_sess_ctx(req);
+    int data_len = httpd_req_recv(req, (char *)buf, sizeof(buf));
+    int outlen;
+
+    hap_pairing_lock();
+    hap_pairings_process(ctx, buf, data_len, sizeof(buf), &outlen);
+    hap_pairing_unlock();
+    httpd_resp_set_type(req, "application/pairing+tlv8");
+    httpd_resp_send(req, (char *)buf, outlen);
+}
+
+static void serve(sess_t *s, event_t *ev)
+{
+    httpd_req_t req = {
+        .handle = hap_priv.server,
+        .sess_ctx = s->ctx,
+        .free_ctx = s->free_ctx,
+        .content_len = ev->c->len,
+        .aux = ev->c,
+    };
+
+    cur_req = &req;
+    switch (ev->type) {
+    case EVENT_PAIR_SETUP:
+        hap_pair_req_handle(&req, false);
+        break;
+    case EVENT_PAIR_VERIFY:
+        hap_pair_req_handle(&req, true);
+        break;
+    case EVENT_PAIRINGS:
+        pairings_handler(&req);
+        break;
+    }
+    cur_req = NULL;
+    /* As httpd_req_cleanup() */
+    if (!req.ignore_sess_ctx_changes && req.sess_ctx != s->ctx) {
+        free_ctx(s->ctx, s->free_ctx);
+    }
+    s->ctx = req.sess_ctx;
+    s->free_ctx = req.free_ctx;
+}
+
+static void server_task(void *arg)
+{
+    struct sched_param param;
+    int policy;
+    event_t ev;
+
+    pthread_getschedparam(pthread_self(), &policy, &param);
+    server_realtime = policy == SCHED_FIFO;
+    on_server = true;
+    while (1) {
+        xQueueReceive(server_queue, &ev, portMAX_DELAY);
+        switch (ev.type) {
+        case EVENT_OPEN:
+            sessions[ev.c->fd].client = ev.c;
+            if (ev.c->fd > max_fd) {
+                max_fd = ev.c->fd;
+            }
+            sem_post(&ev.c->resp);
+            break;
+        case EVENT_CLOSE:
+            sess_close(ev.c->fd);
+            break;
+        case EVENT_PUT: {
+            double start = now_us();
+            while (now_us() - start < PUT_WORK_US)
+                ;
+            if (recording && num_put_samples < MAX_SAMPLES) {
+                put_samples[num_put_samples++] = now_us() - ev.sent_us;
+            }
+            break;
+        }
+        case EVENT_WORK:
+            ev.fn(ev.arg);
+            break;
+        default: {
+            sess_t *s = &sessions[ev.c->fd];
+            if (s->busy) {
+                s->pending = ev;
+                s->has_pending = true;
+            } else {
+                serve(s, &ev);
+            }
+            break;
+        }
+        }
+        /* The sessions closed meanwhile, and the ones free to read again */
+        for (int fd = 0; fd <= max_fd; fd++) {
+            sess_t *s = &sessions[fd];
+            if (!s->client || s->busy) {
+                continue;
+            }
+            if (s->closing) {
+                sess_close(fd);
+            } else if (s->has_pending) {
+                s->has_pending = false;
+                serve(s, &s->pending);
+            }
+        }
+    }
+}
+
+static void put_client_task(void *arg)
+{
+    struct timespec next;
+    event_t put = {
+        .type = EVENT_PUT,
+    };
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (1) {
+        next.tv_nsec += PUT_PERIOD_US * 1000;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        if (!puts_paused) {
+            put.sent_us = now_us();
+            xQueueSend(server_queue, &put, 0);
+        }
+    }
+}
+
+/* The controllers */
+static void client_open(client_t *c)
+{
+    int sv[2];
+    event_t ev = {
+        .type = EVENT_OPEN,
+        .c = c,
+    };
+
+    memset(c, 0, sizeof(*c));
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    CHECK(sv[0] < MAX_FDS);
+    c->fd = sv[0];
+    c->peer = sv[1];
+    sem_init(&c->resp, 0, 0);
+    sem_init(&c->gone, 0, 0);
+    send_event(&ev);
+    CHECK(wait_sem(&c->resp));
+}
+
+/* Either the controller goes, or it waits for the server to close it */
+static bool client_close(client_t *c, bool by_server)
+{
+    event_t ev = {
+        .type = EVENT_CLOSE,
+        .c = c,
+    };
+    bool closed;
+
+    if (!by_server) {
+        send_event(&ev);
+    }
+    closed = wait_sem(&c->gone);
+    close(c->fd);
+    close(c->peer);
+    sem_destroy(&c->resp);
+    sem_destroy(&c->gone);
+    return closed;
+}
+
+static int request(client_t *c, int type, int len)
+{
+    event_t ev = {
+        .type = type,
+        .c = c,
+    };
+
+    c->len = len;
+    c->sent_us = ev.sent_us = now_us();
+    send_event(&ev);
+    if (!wait_sem(&c->resp)) {
+        return -1;
+    }
+    return c->len;
+}
+
+static void tlv_start(hap_tlv_data_t *tlv, uint8_t *buf, int size)
+{
+    tlv->bufptr = buf;
+    tlv->bufsize = size;
+    tlv->curlen = 0;
+}
+
+static bool resp_ok(client_t *c, uint8_t expected)
+{
+    uint8_t state, error;
+    return get_value_from_tlv(c->buf, c->len, kTLVType_State, &state, sizeof(state)) == 1 &&
+           state == expected &&
+           get_value_from_tlv(c->buf, c->len, kTLVType_Error, &error, sizeof(error)) < 0;
+}
+
+static void derive(const char *salt, const uint8_t *ikm, int ikm_len, const char *info,
+                   uint8_t *okm, int okm_len)
+{
+    hkdf(SHA512, (const unsigned char *)salt, strlen(salt), ikm, ikm_len,
+         (const unsigned char *)info, strlen(info), okm, okm_len);
+}
+
+/* ChaCha20-Poly1305 in place, with the tag after the data */
+static void seal(const char *nonce, const uint8_t *key, uint8_t *buf, int len)
+{
+    uint8_t n[12] = { 0 };
+    unsigned long long maclen;
+    memcpy(n + 4, nonce, 8);
+    crypto_aead_chacha20poly1305_ietf_encrypt_detached(buf, buf + len, &maclen, buf, len,
+            NULL, 0, NULL, n, key);
+}
+
+static bool unseal(const char *nonce, const uint8_t *key, uint8_t *buf, int len)
+{
+    uint8_t n[12] = { 0 };
+    memcpy(n + 4, nonce, 8);
+    return len >= POLY_AUTHTAG_LEN &&
+           crypto_aead_chacha20poly1305_ietf_decrypt_detached(buf, NULL, buf, len - POLY_AUTHTAG_LEN,
+                   buf + len - POLY_AUTHTAG_LEN, NULL, 0, n, key) == 0;
+}
+
+static void sha512(const uint8_t *a, int len_a, const uint8_t *b, int len_b, uint8_t *digest)
+{
+    SHA512Context ctx;
+    SHA512Reset(&ctx);
+    SHA512Input(&ctx, a, len_a);
+    if (b) {
+        SHA512Input(&ctx, b, len_b);
+    }
+    SHA512Result(&ctx, digest);
+}
+
+/* H(PAD(a) | PAD(b)), each padded to the size of N */
+static void hash_padded(const uint8_t *a, int len_a, const uint8_t *b, int len_b, int len_n, mbedtls_mpi *out)
+{
+    static const uint8_t zeros[384];
+    uint8_t digest[SHA512HashSize];
+    SHA512Context ctx;
+
+    SHA512Reset(&ctx);
+    SHA512Input(&ctx, zeros, len_n - len_a);
+    SHA512Input(&ctx, a, len_a);
+    SHA512Input(&ctx, zeros, len_n - len_b);
+    SHA512Input(&ctx, b, len_b);
+    SHA512Result(&ctx, digest);
+    mbedtls_mpi_read_binary(out, digest, sizeof(digest));
+}
+
+/* The controller's side of SRP-6a with the 3072 bit group, as in the HAP
+ * specification: A, the proof M and the proof the accessory should send back.
+ */
+static void srp_client(const uint8_t *B, int len_B, const uint8_t *salt, int len_s,
+                       uint8_t A[384], uint8_t K[SHA512HashSize], uint8_t M[SHA512HashSize],
+                       uint8_t AMK[SHA512HashSize])
+{
+    mu_srp_handle_t ng;
+    mbedtls_mpi N, g, a, Am, Bm, k, u, x, v, base, e, S;
+    mbedtls_mpi *all[] = { &N, &g, &a, &Am, &Bm, &k, &u, &x, &v, &base, &e, &S };
+    uint8_t bytes_a[32], digest[SHA512HashSize], hash_g[SHA512HashSize], bytes_S[384];
+    SHA512Context ctx;
+    size_t i, len_S;
+
+    mu_srp_init(&ng, MU_NG_3072);
+    for (i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        mbedtls_mpi_init(all[i]);
+    }
+    mbedtls_mpi_read_binary(&N, (const uint8_t *)ng.bytes_n, ng.len_n);
+    mbedtls_mpi_read_binary(&g, (const uint8_t *)ng.bytes_g, ng.len_g);
+    esp_fill_random(bytes_a, sizeof(bytes_a));
+    mbedtls_mpi_read_binary(&a, bytes_a, sizeof(bytes_a));
+    mbedtls_mpi_exp_mod(&Am, &g, &a, &N, NULL);
+    mbedtls_mpi_write_binary(&Am, A, 384);
+    mbedtls_mpi_read_binary(&Bm, B, len_B);
+
+    /* k = H(N | PAD(g)), u = H(PAD(A) | PAD(B)), x = H(s | H(I | ":" | P)) */
+    hash_padded((const uint8_t *)ng.bytes_n, ng.len_n, (const uint8_t *)ng.bytes_g, ng.len_g, ng.len_n, &k);
+    hash_padded(A, 384, B, len_B, ng.len_n, &u);
+    sha512((const uint8_t *)"Pair-Setup:" SETUP_CODE, strlen("Pair-Setup:" SETUP_CODE), NULL, 0, digest);
+    sha512(salt, len_s, digest, sizeof(digest), digest);
+    mbedtls_mpi_read_binary(&x, digest, sizeof(digest));
+
+    /* S = (B - k g^x) ^ (a + u x) */
+    mbedtls_mpi_exp_mod(&v, &g, &x, &N, NULL);
+    mbedtls_mpi_mul_mpi(&base, &k, &v);
+    mbedtls_mpi_sub_mpi(&base, &Bm, &base);
+    mbedtls_mpi_mod_mpi(&base, &base, &N);
+    mbedtls_mpi_mul_mpi(&e, &u, &x);
+    mbedtls_mpi_add_mpi(&e, &e, &a);
+    mbedtls_mpi_exp_mod(&S, &base, &e, &N, NULL);
+    len_S = mbedtls_mpi_size(&S);
+    mbedtls_mpi_write_binary(&S, bytes_S, len_S);
+    sha512(bytes_S, len_S, NULL, 0, K);
+
+    /* M = H(H(N) xor H(g) | H(I) | s | A | B | K) */
+    sha512((const uint8_t *)ng.bytes_n, ng.len_n, NULL, 0, digest);
+    sha512((const uint8_t *)ng.bytes_g, ng.len_g, NULL, 0, hash_g);
+    for (i = 0; i < sizeof(digest); i++) {
+        digest[i] ^= hash_g[i];
+    }
+    SHA512Reset(&ctx);
+    SHA512Input(&ctx, digest, sizeof(digest));
+    sha512((const uint8_t *)"Pair-Setup", strlen("Pair-Setup"), NULL, 0, digest);
+    SHA512Input(&ctx, digest, sizeof(digest));
+    SHA512Input(&ctx, salt, len_s);
+    SHA512Input(&ctx, A, 384);
+    SHA512Input(&ctx, B, len_B);
+    SHA512Input(&ctx, K, SHA512HashSize);
+    SHA512Result(&ctx, M);
+
+    SHA512Reset(&ctx);
+    SHA512Input(&ctx, A, 384);
+    SHA512Input(&ctx, M, SHA512HashSize);
+    SHA512Input(&ctx, K, SHA512HashSize);
+    SHA512Result(&ctx, AMK);
+
+    for (i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        mbedtls_mpi_free(all[i]);
+    }
+    mu_srp_free(&ng);
+}
+
+/* Signs X | id | key, the info of each side in pair setup and pair verify */
+static void sign_info(const uint8_t *x, const char *id, const uint8_t *key,
+                      const uint8_t *sk, uint8_t sig[ED_SIGN_LEN])
+{
+    uint8_t info[32 + HAP_CTRL_ID_LEN + ED_KEY_LEN];
+    int len = 0;
+
+    memcpy(info, x, 32);
+    len += 32;
+    memcpy(info + len, id, strlen(id));
+    len += strlen(id);
+    memcpy(info + len, key, 32);
+    len += 32;
+    crypto_sign_ed25519_detached(sig, NULL, info, len, sk);
+}
+
+static bool verify_info(const uint8_t *x, const char *id, const uint8_t *key,
+                        const uint8_t *pk, const uint8_t sig[ED_SIGN_LEN])
+{
+    uint8_t info[32 + HAP_CTRL_ID_LEN + ED_KEY_LEN];
+    int len = 0;
+
+    memcpy(info, x, 32);
+    len += 32;
+    memcpy(info + len, id, strlen(id));
+    len += strlen(id);
+    memcpy(info + len, key, 32);
+    len += 32;
+    return crypto_sign_ed25519_verify_detached(sig, info, len, pk) == 0;
+}
+
+/* Seals the identifier, key and signature of one side, for M5 and M3 */
+static int seal_sub_tlv(const char *nonce, const uint8_t *key, const char *id,
+                        const uint8_t *ltpk, const uint8_t *sig, uint8_t *buf, int size)
+{
+    hap_tlv_data_t tlv;
+
+    tlv_start(&tlv, buf, size - POLY_AUTHTAG_LEN);
+    add_tlv(&tlv, kTLVType_Identifier, strlen(id), (void *)id);
+    if (ltpk) {
+        add_tlv(&tlv, kTLVType_PublicKey, ED_KEY_LEN, (void *)ltpk);
+    }
+    add_tlv(&tlv, kTLVType_Signature, ED_SIGN_LEN, (void *)sig);
+    seal(nonce, key, buf, tlv.curlen);
+    return tlv.curlen + POLY_AUTHTAG_LEN;
+}
+
+/* M1 to M6, which adds the controller as an admin */
+static bool pair_setup(client_t *c, const controller_t *ctrl)
+{
+    hap_tlv_data_t tlv;
+    uint8_t state, method = HAP_METHOD_RESERVED;
+    uint8_t B[384], salt[16], A[384], K[SHA512HashSize], M[SHA512HashSize], AMK[SHA512HashSize];
+    uint8_t proof[SHA512HashSize], key[32], x[32], sig[ED_SIGN_LEN], sub[256];
+    uint8_t acc_ltpk[ED_KEY_LEN];
+    char acc_id[HAP_ACC_ID_LEN] = { 0 };
+    int len_B, len;
+
+    tlv_start(&tlv, c->buf, sizeof(c->buf));
+    state = STATE_M1;
+    add_tlv(&tlv, kTLVType_State, 1, &state);
+    add_tlv(&tlv, kTLVType_Method, 1, &method);
+    if (request(c, EVENT_PAIR_SETUP, tlv.curlen) < 0 || !resp_ok(c, STATE_M2) ||
+            (len_B = get_value_from_tlv(c->buf, c->len, kTLVType_PublicKey, B, sizeof(B))) < 0 ||
+            get_value_from_tlv(c->buf, c->len, kTLVType_Salt, salt, sizeof(salt)) != sizeof(salt)) {
+        return false;
+    }
+
+    srp_client(B, len_B, salt, sizeof(salt), A, K, M, AMK);
+    tlv_start(&tlv, c->buf, sizeof(c->buf));
+    state = STATE_M3;
+    add_tlv(&tlv, kTLVType_State, 1, &state);
+    add_tlv(&tlv, kTLVType_PublicKey, sizeof(A), A);
+    add_tlv(&tlv, kTLVType_Proof, sizeof(M), M);
+    if (request(c, EVENT_PAIR_SETUP, tlv.curlen) < 0 || !resp_ok(c, STATE_M4) ||
+            get_value_from_tlv(c->buf, c->len, kTLVType_Proof, proof, sizeof(proof)) != sizeof(proof) ||
+            memcmp(proof, AMK, sizeof(proof))) {
+        return false;
+    }
+
+    derive("Pair-Setup-Encrypt-Salt", K, sizeof(K), "Pair-Setup-Encrypt-Info", key, sizeof(key));
+    derive("Pair-Setup-Controller-Sign-Salt", K, sizeof(K), "Pair-Setup-Controller-Sign-Info", x, sizeof(x));
+    sign_info(x, ctrl->id, ctrl->ltpk, ctrl->ltsk, sig);
+    len = seal_sub_tlv("PS-Msg05", key, ctrl->id, ctrl->ltpk, sig, sub, sizeof(sub));
+    tlv_start(&tlv, c->buf, sizeof(c->buf));
+    state = STATE_M5;
+    add_tlv(&tlv, kTLVType_State, 1, &state);
+    add_tlv(&tlv, kTLVType_EncryptedData, len, sub);
+    if (request(c, EVENT_PAIR_SETUP, tlv.curlen) < 0 || !resp_ok(c, STATE_M6) ||
+            (len = get_value_from_tlv(c->buf, c->len, kTLVType_EncryptedData, sub, sizeof(sub))) < 0 ||
+            !unseal("PS-Msg06", key, sub, len)) {
+        return false;
+    }
+    len -= POLY_AUTHTAG_LEN;
+    if (get_value_from_tlv(sub, len, kTLVType_Identifier, acc_id, sizeof(acc_id) - 1) < 0 ||
+            get_value_from_tlv(sub, len, kTLVType_PublicKey, acc_ltpk, sizeof(acc_ltpk)) != sizeof(acc_ltpk) ||
+            get_value_from_tlv(sub, len, kTLVType_Signature, sig, sizeof(sig)) != sizeof(sig)) {
+        return false;
+    }
+    derive("Pair-Setup-Accessory-Sign-Salt", K, sizeof(K), "Pair-Setup-Accessory-Sign-Info", x, sizeof(x));
+    return !strcmp(acc_id, hap_priv.acc_id) && !memcmp(acc_ltpk, hap_priv.ltpka, ED_KEY_LEN) &&
+           verify_info(x, acc_id, acc_ltpk, acc_ltpk, sig);
+}
+
+/* M1 to M4, after which the session is the controller's */
+static bool pair_verify(client_t *c, const controller_t *ctrl)
+{
+    hap_tlv_data_t tlv;
+    uint8_t state, sk[CURVE_KEY_LEN], pk[CURVE_KEY_LEN], acc_pk[CURVE_KEY_LEN];
+    uint8_t shared[CURVE_KEY_LEN], key[32], sig[ED_SIGN_LEN], sub[256];
+    char acc_id[HAP_ACC_ID_LEN] = { 0 };
+    int len;
+
+    esp_fill_random(sk, sizeof(sk));
+    crypto_scalarmult_curve25519_base(pk, sk);
+    tlv_start(&tlv, c->buf, sizeof(c->buf));
+    state = STATE_M1;
+    add_tlv(&tlv, kTLVType_State, 1, &state);
+    add_tlv(&tlv, kTLVType_PublicKey, sizeof(pk), pk);
+    if (request(c, EVENT_PAIR_VERIFY, tlv.curlen) < 0 || !resp_ok(c, STATE_M2) ||
+            get_value_from_tlv(c->buf, c->len, kTLVType_PublicKey, acc_pk, sizeof(acc_pk)) != sizeof(acc_pk) ||
+            (len = get_value_from_tlv(c->buf, c->len, kTLVType_EncryptedData, sub, sizeof(sub))) < 0) {
+        return false;
+    }
+    if (crypto_scalarmult_curve25519(shared, sk, acc_pk) != 0) {
+        return false;
+    }
+    derive("Pair-Verify-Encrypt-Salt", shared, sizeof(shared), "Pair-Verify-Encrypt-Info", key, sizeof(key));
+    if (!unseal("PV-Msg02", key, sub, len)) {
+        return false;
+    }
+    len -= POLY_AUTHTAG_LEN;
+    if (get_value_from_tlv(sub, len, kTLVType_Identifier, acc_id, sizeof(acc_id) - 1) < 0 ||
+            get_value_from_tlv(sub, len, kTLVType_Signature, sig, sizeof(sig)) != sizeof(sig) ||
+            !verify_info(acc_pk, acc_id, pk, hap_priv.ltpka, sig)) {
+        return false;
+    }
+
+    sign_info(pk, ctrl->id, acc_pk, ctrl->ltsk, sig);
+    len = seal_sub_tlv("PV-Msg03", key, ctrl->id, NULL, sig, sub, sizeof(sub));
+    tlv_start(&tlv, c->buf, sizeof(c->buf));
+    state = STATE_M3;
+    add_tlv(&tlv, kTLVType_State, 1, &state);
+    add_tlv(&tlv, kTLVType_EncryptedData, len, sub);
+    return request(c, EVENT_PAIR_VERIFY, tlv.curlen) >= 0 && resp_ok(c, STATE_M4);
+}
+
+static bool pairings(client_t *c, uint8_t method, const controller_t *ctrl, uint8_t perms, double *latency)
+{
+    hap_tlv_data_t tlv;
+    uint8_t state = STATE_M1;
+
+    tlv_start(&tlv, c->buf, sizeof(c->buf));
+    add_tlv(&tlv, kTLVType_State, 1, &state);
+    add_tlv(&tlv, kTLVType_Method, 1, &method);
+    if (ctrl) {
+        add_tlv(&tlv, kTLVType_Identifier, strlen(ctrl->id), (void *)ctrl->id);
+    }
+    if (method == HAP_METHOD_ADD_PAIRING) {
+        add_tlv(&tlv, kTLVType_PublicKey, ED_KEY_LEN, (void *)ctrl->ltpk);
+        add_tlv(&tlv, kTLVType_Permissions, 1, &perms);
+    }
+    if (request(c, EVENT_PAIRINGS, tlv.curlen) < 0) {
+        return false;
+    }
+    if (latency) {
+        *latency = c->resp_us - c->sent_us;
+    }
+    return resp_ok(c, STATE_M2);
+}
+
+/* The identifiers in a List Pairings response */
+static int listed(client_t *c)
+{
+    int count = 0;
+    for (int i = 0; i + 1 < c->len; i += 2 + c->buf[i + 1]) {
+        count += c->buf[i] == kTLVType_Identifier;
+    }
+    return count;
+}
+
+static void controller_init(controller_t *ctrl, int n)
+{
+    uint8_t seed[32];
+    snprintf(ctrl->id, sizeof(ctrl->id), "%08X-0000-4000-8000-00000000CAFE", n);
+    esp_fill_random(seed, sizeof(seed));
+    crypto_sign_ed25519_seed_keypair(ctrl->ltpk, ctrl->ltsk, seed);
+}
+
+static int active_sessions(void)
+{
+    int count = 0;
+    for (int i = 0; i < HAP_MAX_SESSIONS; i++) {
+        count += hap_priv.sessions[i] != NULL;
+    }
+    return count;
+}
+
+static controller_t admin, extra, others[VERIFIERS];
+
+/* The admin pairs, pair verifies, and removes its own pairing, which leaves
+ * the accessory unpaired for the next round.
+ */
+static bool pair_cycle(void)
+{
+    client_t c;
+    bool ok;
+
+    client_open(&c);
+    ok = pair_setup(&c, &admin);
+    client_close(&c, false);
+    if (!ok) {
+        return false;
+    }
+    client_open(&c);
+    ok = pair_verify(&c, &admin) && pairings(&c, HAP_METHOD_REMOVE_PAIRING, &admin, 0, NULL);
+    /* The server closes the sessions of a removed controller */
+    ok = client_close(&c, ok) && ok;
+    return ok && !is_accessory_paired() && active_sessions() == 0;
+}
+
+typedef struct {
+    controller_t *ctrl;
+    int verified;
+    sem_t done;
+} verifier_t;
+
+static void verifier_task(void *arg)
+{
+    verifier_t *v = arg;
+    client_t c;
+
+    for (int i = 0; i < VERIFY_ROUNDS; i++) {
+        client_open(&c);
+        v->verified += pair_verify(&c, v->ctrl);
+        client_close(&c, false);
+    }
+    sem_post(&v->done);
+}
+
+typedef struct {
+    client_t *c;
+    atomic_int stop;
+    int ok, ops;
+    double samples[MAX_SAMPLES];
+    int num_samples;
+    sem_t done;
+} admin_t;
+
+/* Lists, adds, lists and removes again, one request a period */
+static void admin_task(void *arg)
+{
+    admin_t *a = arg;
+    struct timespec next;
+    double latency;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (int i = 0; !a->stop; i++) {
+        bool ok;
+        switch (i % 4) {
+        case 0:
+            ok = pairings(a->c, HAP_METHOD_LIST_PAIRINGS, NULL, 0, &latency) && listed(a->c) == VERIFIERS + 1;
+            break;
+        case 1:
+            ok = pairings(a->c, HAP_METHOD_ADD_PAIRING, &extra, 0, &latency);
+            break;
+        case 2:
+            ok = pairings(a->c, HAP_METHOD_LIST_PAIRINGS, NULL, 0, &latency) && listed(a->c) == VERIFIERS + 2;
+            break;
+        default:
+            ok = pairings(a->c, HAP_METHOD_REMOVE_PAIRING, &extra, 0, &latency);
+            break;
+        }
+        a->ok += ok;
+        a->ops++;
+        if (a->num_samples < MAX_SAMPLES) {
+            a->samples[a->num_samples++] = latency;
+        }
+        /* Ends on a full round, without the extra pairing */
+        if (i % 4 == 3 && a->stop) {
+            break;
+        }
+        next.tv_nsec += PAIRINGS_PERIOD_US * 1000;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    sem_post(&a->done);
+}
+
+/* /pairings removes the controller after the worker has looked it up, and
+ * before the session is handed back. The handshake goes through, but the
+ * session is closed rather than kept.
+ */
+static void test_removed_while_verifying(client_t *admin_c)
+{
+    controller_t *victim = &others[0];
+    client_t c;
+    int sessions_before = active_sessions();
+
+    remove_client = admin_c;
+    remove_done = 0;
+    remove_victim = victim;
+    client_open(&c);
+    CHECK(pair_verify(&c, victim));
+    CHECK(client_close(&c, true));
+    CHECK(remove_done == 1);
+    CHECK(remove_victim == NULL);
+    CHECK(!hap_get_controller(victim->id));
+    CHECK(active_sessions() == sessions_before);
+    CHECK(pairings(admin_c, HAP_METHOD_ADD_PAIRING, victim, 0, NULL));
+}
+
+/* The worker cannot hand the session back, and drops the connection */
+static void test_work_refused(void)
+{
+    client_t c;
+    hap_tlv_data_t tlv;
+    uint8_t state = STATE_M1, pk[CURVE_KEY_LEN] = { 9 };
+    struct pollfd pfd;
+    char byte;
+
+    client_open(&c);
+    refuse_work = 1;
+    tlv_start(&tlv, c.buf, sizeof(c.buf));
+    add_tlv(&tlv, kTLVType_State, 1, &state);
+    add_tlv(&tlv, kTLVType_PublicKey, sizeof(pk), pk);
+    CHECK(request(&c, EVENT_PAIR_VERIFY, tlv.curlen) > 0);
+    CHECK(resp_ok(&c, STATE_M2));
+    pfd.fd = c.peer;
+    pfd.events = POLLIN;
+    CHECK(poll(&pfd, 1, 5000) == 1);
+    CHECK(recv(c.peer, &byte, 1, MSG_DONTWAIT) == 0);
+    refuse_work = 0;
+    CHECK(client_close(&c, false));
+}
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    double put_p99;
+    double pairings_p99;
+} result_t;
+
+static double print_latency(const char *what, double *samples, int count)
+{
+    CHECK(count > 0);
+    if (!count) {
+        return 0;
+    }
+    qsort(samples, count, sizeof(samples[0]), compare);
+    printf("  %s: %d, latency p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", what, count,
+           samples[count / 2] / 1e3, samples[count * 99 / 100] / 1e3, samples[count - 1] / 1e3);
+    return samples[count * 99 / 100];
+}
+
+static result_t run(const char *name, bool worker)
+{
+    static admin_t a;
+    static verifier_t verifiers[VERIFIERS];
+    client_t admin_c;
+    result_t result;
+    double start;
+    int setups = 0, verified = 0;
+
+    printf("%s:\n", name);
+
+    /* Pair setup, with the PUTs */
+    num_put_samples = 0;
+    recording = 1;
+    start = now_us();
+    for (int i = 0; i < SETUPS; i++) {
+        setups += pair_cycle();
+    }
+    recording = 0;
+    /* Let the last PUTs through before reading the samples */
+    usleep(10000);
+    printf("  %d pair setups, verifies and removals in %.0f ms\n", setups, (now_us() - start) / 1e3);
+    CHECK(setups == SETUPS);
+    result.put_p99 = print_latency("PUTs", put_samples, num_put_samples);
+
+    /* Pair verify, with /pairings, and no PUTs for it to wait behind */
+    puts_paused = 1;
+    client_open(&admin_c);
+    CHECK(pair_setup(&admin_c, &admin));
+    client_close(&admin_c, false);
+    client_open(&admin_c);
+    CHECK(pair_verify(&admin_c, &admin));
+    for (int i = 0; i < VERIFIERS; i++) {
+        CHECK(pairings(&admin_c, HAP_METHOD_ADD_PAIRING, &others[i], 0, NULL));
+    }
+    memset(&a, 0, sizeof(a));
+    a.c = &admin_c;
+    sem_init(&a.done, 0, 0);
+    start = now_us();
+    CHECK(xTaskCreate(admin_task, "admin", 0, &a, PAIRINGS_PRIORITY, NULL) == pdPASS);
+    for (int i = 0; i < VERIFIERS; i++) {
+        verifiers[i].ctrl = &others[i];
+        verifiers[i].verified = 0;
+        sem_init(&verifiers[i].done, 0, 0);
+        CHECK(xTaskCreate(verifier_task, "verifier", 0, &verifiers[i], VERIFIER_PRIORITY, NULL) == pdPASS);
+    }
+    for (int i = 0; i < VERIFIERS; i++) {
+        sem_wait(&verifiers[i].done);
+        sem_destroy(&verifiers[i].done);
+        verified += verifiers[i].verified;
+    }
+    a.stop = 1;
+    sem_wait(&a.done);
+    sem_destroy(&a.done);
+    printf("  %d pair verifies in %.0f ms\n", verified, (now_us() - start) / 1e3);
+    CHECK(verified == VERIFIERS * VERIFY_ROUNDS);
+    CHECK(a.ok == a.ops);
+    result.pairings_p99 = print_latency("/pairings", a.samples, a.num_samples);
+    puts_paused = 0;
+
+    if (worker) {
+        test_removed_while_verifying(&admin_c);
+        test_work_refused();
+    }
+
+    /* The last admin goes, and the other controllers with it */
+    CHECK(pairings(&admin_c, HAP_METHOD_REMOVE_PAIRING, &admin, 0, NULL));
+    CHECK(client_close(&admin_c, true));
+    CHECK(!is_accessory_paired());
+    CHECK(active_sessions() == 0);
+    return result;
+}
+
+static void accessory_init(void)
+{
+    uint8_t seed[32], sk[64];
+    char *salt, *verifier;
+    int len;
+
+    hap_priv.server = &server_handle;
+    hap_priv.cfg.recv_timeout = 10;
+    hap_priv.cfg.send_timeout = 10;
+    strcpy(hap_priv.acc_id, "11:22:33:44:55:66");
+    /* The secret key is ltska and ltpka together, as libsodium has it */
+    esp_fill_random(seed, sizeof(seed));
+    crypto_sign_ed25519_seed_keypair(hap_priv.ltpka, sk, seed);
+    memcpy(hap_priv.ltska, sk, ED_KEY_LEN);
+
+    static hap_setup_info_t setup_info;
+    CHECK(mu_srp_gen_salt_verifier("Pair-Setup", SETUP_CODE, strlen(SETUP_CODE), sizeof(setup_info.salt),
+                &salt, &verifier, &len) == 0);
+    memcpy(setup_info.salt, salt, sizeof(setup_info.salt));
+    memcpy(setup_info.verifier + sizeof(setup_info.verifier) - len, verifier, len);
+    free(salt);
+    free(verifier);
+    hap_priv.setup_info = &setup_info;
+}
+
+int main(void)
+{
+    cpu_set_t cpus;
+    result_t inline_result, worker_result;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(0, &cpus);
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+    CHECK(sodium_init() >= 0);
+
+    accessory_init();
+    controller_init(&admin, 0);
+    controller_init(&extra, 1);
+    for (int i = 0; i < VERIFIERS; i++) {
+        controller_init(&others[i], 2 + i);
+    }
+
+    server_queue = xQueueCreate(64, sizeof(event_t));
+    CHECK(server_queue != NULL);
+    CHECK(xTaskCreate(server_task, "httpd", 0, NULL, SERVER_PRIORITY, NULL) == pdPASS);
+    CHECK(xTaskCreate(put_client_task, "put", 0, NULL, PUT_PRIORITY, NULL) == pdPASS);
+    if (failures) {
+        return 1;
+    }
+
+    inline_result = run("on the server task", false);
+    CHECK(hap_pair_worker_init() == HAP_SUCCESS);
+    worker_result = run("on the pair worker", true);
+
+    printf("crypto under the pairing lock: %d times\n", (int)crypto_under_lock);
+    CHECK(crypto_under_lock == 0);
+    printf("real-time priorities: %s\n", server_realtime ? "yes" : "no");
+    if (server_realtime) {
+        /* The server preempts the worker for each request */
+        CHECK(worker_result.put_p99 < 2000);
+        CHECK(worker_result.put_p99 * 4 < inline_result.put_p99);
+        CHECK(worker_result.pairings_p99 * 2 < inline_result.pairings_p99);
+    } else {
+        /* Only the host's time slices to go by */
+        CHECK(worker_result.put_p99 < inline_result.put_p99);
+    }
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,330 @@
+/*
+ * Host test of the saving and restoring of persistent characteristic values.
+ *
+ * A lightbulb keeps its on state, brightness and hue. The values saved before
+ * are restored by aid, iid and format, a burst of changes is saved once when
+ * it is over, a flush that would write the same blob again is skipped, and a
+ * change made from an interrupt handler restarts the timer the way an ISR may.
+ *
+ * Build and run with "make test" in this directory.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "esp_hap_acc.h"
+#include "esp_hap_char.h"
+#include "esp_hap_database.h"
+#include "esp_hap_main.h"
+#include "esp_hap_persist.h"
+#include "esp_system.h"
+#include "esp_wifi.h"
+
+#define BURST_UPDATES   200
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* The layout esp_hap_persist.c writes */
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t count;
+} persist_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t aid;
+    uint8_t format;
+    uint8_t reserved;
+    uint32_t iid;
+    uint32_t val;
+} persist_rec_t;
+
+static QueueHandle_t flush_queue;
+static shutdown_handler_t shutdown_handler;
+static uint8_t stored[256];
+static size_t stored_len;
+static int keystore_writes;
+
+/* The rest of the core, as far as the persistent values need it */
+hap_priv_t hap_priv;
+static int next_aid = 2;
+
+int hap_get_next_aid(void) { return next_aid++; }
+int hap_update_config_number(void) { return HAP_SUCCESS; }
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t *mac) { return ESP_FAIL; }
+hap_char_t *hap_char_accessory_flags_create(uint32_t flags) { return NULL; }
+hap_char_t *hap_char_product_data_create(hap_data_val_t *product_data) { return NULL; }
+uint16_t hap_platform_os_get_msec_per_tick(void) { return 1; }
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler)
+{
+    shutdown_handler = handler;
+    return ESP_OK;
+}
+
+/* The HAP loop, which does the flush, is the test itself */
+int hap_send_event(hap_internal_event_t event)
+{
+    if (event != HAP_INTERNAL_EVENT_PERSIST_FLUSH) {
+        return HAP_SUCCESS;
+    }
+    return xQueueSend(flush_queue, &event, 0) == pdPASS ? HAP_SUCCESS : HAP_FAIL;
+}
+
+/* The keystore holds only the characteristic values */
+static bool is_values_key(const char *name_space, const char *key)
+{
+    return !strcmp(name_space, "hap_chars") && !strcmp(key, "values");
+}
+
+int hap_keystore_get(const char *name_space, const char *key, uint8_t *val, size_t *val_size)
+{
+    if (!is_values_key(name_space, key) || !stored_len) {
+        return HAP_FAIL;
+    }
+    if (val) {
+        if (*val_size < stored_len) {
+            return HAP_FAIL;
+        }
+        memcpy(val, stored, stored_len);
+    }
+    *val_size = stored_len;
+    return HAP_SUCCESS;
+}
+
+int hap_keystore_set(const char *name_space, const char *key, const uint8_t *val, const size_t val_len)
+{
+    if (!is_values_key(name_space, key) || val_len > sizeof(stored)) {
+        return HAP_FAIL;
+    }
+    memcpy(stored, val, val_len);
+    stored_len = val_len;
+    keystore_writes++;
+    return HAP_SUCCESS;
+}
+
+static hap_acc_t *acc;
+static hap_char_t *on, *brightness, *hue, *saturation;
+
+static void lightbulb_create(void)
+{
+    hap_acc_cfg_t cfg = {
+        .name = "Lamp",
+        .model = "Test",
+        .manufacturer = "Test",
+        .serial_num = "1",
+        .fw_rev = "1.0",
+    };
+    acc = hap_acc_create(&cfg);
+    hap_serv_t *hs = hap_serv_create("43");
+
+    on = hap_char_bool_create("25", HAP_CHAR_PERM_PR | HAP_CHAR_PERM_PW | HAP_CHAR_PERM_PERSIST, false);
+    brightness = hap_char_int_create("8", HAP_CHAR_PERM_PR | HAP_CHAR_PERM_PW | HAP_CHAR_PERM_PERSIST, 100);
+    hue = hap_char_float_create("13", HAP_CHAR_PERM_PR | HAP_CHAR_PERM_PW, 0);
+    hap_char_set_persistent(hue, true);
+    saturation = hap_char_float_create("2F", HAP_CHAR_PERM_PR | HAP_CHAR_PERM_PW, 0);
+    hap_serv_add_char(hs, on);
+    hap_serv_add_char(hs, brightness);
+    hap_serv_add_char(hs, hue);
+    hap_serv_add_char(hs, saturation);
+    hap_acc_add_serv(acc, hs);
+    hap_add_accessory(acc);
+}
+
+static void add_record(uint8_t *blob, int i, hap_char_t *hc, hap_char_format_t format, uint32_t val)
+{
+    persist_rec_t rec = {
+        .aid = 1,
+        .format = format,
+        .iid = hc ? hap_char_get_iid(hc) : 9999,
+        .val = val,
+    };
+    memcpy(blob + sizeof(persist_hdr_t) + i * sizeof(rec), &rec, sizeof(rec));
+}
+
+/* The value saved for a characteristic, or -1 if it is not in the blob */
+static int64_t saved_val(hap_char_t *hc)
+{
+    persist_hdr_t hdr;
+    memcpy(&hdr, stored, sizeof(hdr));
+    for (int i = 0; i < hdr.count; i++) {
+        persist_rec_t rec;
+        memcpy(&rec, stored + sizeof(hdr) + i * sizeof(rec), sizeof(rec));
+        if (rec.aid == 1 && rec.iid == hap_char_get_iid(hc)) {
+            return rec.val;
+        }
+    }
+    return -1;
+}
+
+static uint32_t float_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+/* Waits for the timer to ask for a flush, for up to the given time */
+static bool wait_flush_event(int ms)
+{
+    hap_internal_event_t event;
+
+    for (; ms > 0; ms -= 5) {
+        if (xQueueReceive(flush_queue, &event, 0) == pdPASS) {
+            return true;
+        }
+        usleep(5000);
+    }
+    return false;
+}
+
+static void update_int(hap_char_t *hc, int val)
+{
+    hap_val_t v = { .i = val };
+    hap_char_update_val(hc, &v);
+}
+
+/* What was saved before the restart is back, apart from what no longer matches */
+static void test_restore(void)
+{
+    uint8_t blob[sizeof(persist_hdr_t) + 5 * sizeof(persist_rec_t)];
+    persist_hdr_t hdr = { .version = 1, .count = 5 };
+
+    memcpy(blob, &hdr, sizeof(hdr));
+    add_record(blob, 0, on, HAP_CHAR_FORMAT_BOOL, 1);
+    add_record(blob, 1, brightness, HAP_CHAR_FORMAT_INT, 42);
+    /* Saved by a firmware where hue was an integer */
+    add_record(blob, 2, hue, HAP_CHAR_FORMAT_INT, 120);
+    /* Saturation is not persistent, and the last one is gone */
+    add_record(blob, 3, saturation, HAP_CHAR_FORMAT_FLOAT, float_bits(50));
+    add_record(blob, 4, NULL, HAP_CHAR_FORMAT_INT, 7);
+    memcpy(stored, blob, sizeof(blob));
+    stored_len = sizeof(blob);
+
+    CHECK(hap_persist_init() == HAP_SUCCESS);
+    CHECK(shutdown_handler != NULL);
+    hap_persist_restore();
+    CHECK(hap_char_get_val(on)->b == true);
+    CHECK(hap_char_get_val(brightness)->i == 42);
+    CHECK(hap_char_get_val(hue)->f == 0);
+    CHECK(hap_char_get_val(saturation)->f == 0);
+
+    /* Restoring is not a change */
+    CHECK(!wait_flush_event(300));
+    hap_persist_flush();
+    CHECK(keystore_writes == 0);
+}
+
+/* A slider being dragged: only the last value is written, once */
+static void test_burst(void)
+{
+    int early = 0;
+
+    for (int i = 0; i < BURST_UPDATES; i++) {
+        update_int(brightness, i % 100);
+        early += wait_flush_event(1);
+    }
+    update_int(brightness, 73);
+    CHECK(early == 0);
+    CHECK(wait_flush_event(1000));
+    hap_persist_flush();
+    CHECK(keystore_writes == 1);
+    CHECK(!wait_flush_event(300));
+
+    CHECK(saved_val(on) == 1);
+    CHECK(saved_val(brightness) == 73);
+    CHECK(saved_val(hue) == 0);
+    CHECK(saved_val(saturation) == -1);
+    printf("%d brightness changes saved with %d write\n", BURST_UPDATES + 1, keystore_writes);
+}
+
+/* Changes that end where they started leave the flash alone */
+static void test_unchanged(void)
+{
+    update_int(brightness, 10);
+    update_int(brightness, 73);
+    CHECK(wait_flush_event(1000));
+    hap_persist_flush();
+    CHECK(keystore_writes == 1);
+}
+
+static void *isr_task(void *arg)
+{
+    hap_val_t v = { .b = false };
+
+    host_in_isr = 1;
+    hap_char_update_val(on, &v);
+    return NULL;
+}
+
+/* A button handler turning the lamp off from its interrupt */
+static void test_isr(void)
+{
+    pthread_t isr;
+
+    pthread_create(&isr, NULL, isr_task, NULL);
+    pthread_join(isr, NULL);
+    CHECK(wait_flush_event(1000));
+    hap_persist_flush();
+    CHECK(keystore_writes == 2);
+    CHECK(saved_val(on) == 0);
+}
+
+/* A restart writes out what the timer has not got to yet */
+static void test_shutdown(void)
+{
+    hap_val_t v = { .f = 240 };
+
+    hap_char_update_val(hue, &v);
+    shutdown_handler();
+    CHECK(keystore_writes == 3);
+    CHECK(saved_val(hue) == float_bits(240));
+    CHECK(wait_flush_event(1000));
+    hap_persist_flush();
+    CHECK(keystore_writes == 3);
+}
+
+/* After the keystore is erased, pending changes are dropped */
+static void test_discard(void)
+{
+    update_int(brightness, 5);
+    hap_persist_discard();
+    CHECK(!wait_flush_event(300));
+    hap_persist_flush();
+    CHECK(keystore_writes == 3);
+}
+
+int main(int argc, char **argv)
+{
+    flush_queue = xQueueCreate(4, sizeof(hap_internal_event_t));
+    CHECK(hap_acc_index_init() == HAP_SUCCESS);
+    lightbulb_create();
+
+    test_restore();
+    test_burst();
+    test_unchanged();
+    test_isr();
+    test_shutdown();
+    test_discard();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
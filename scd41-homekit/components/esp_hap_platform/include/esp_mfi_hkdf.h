@@ -0,0 +1,124 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2020 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef ESP_MFI_HKDF_H_
+#define ESP_MFI_HKDF_H_
+
+#include <stdint.h>
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/*
+ * HMAC-SHA512 and HKDF-SHA512 over the mbedTLS SHA-512, which uses the SHA
+ * accelerator where the chip has SHA-512 in it.
+ *
+ * A key holds the SHA-512 states after the key block xored with ipad and
+ * opad, so that keys used again, like the constant salts of the HAP key
+ * derivations, are hashed in only once. An HMAC of a short message with
+ * such a key then takes two SHA-512 blocks instead of four.
+ */
+typedef void* esp_mfi_hmac_sha512_key_t;
+
+/**
+ * @brief Create HMAC-SHA512 key
+ *
+ * @param key pointer of the key
+ * @param len key length
+ *
+ * @return the key, or NULL if out of memory
+ */
+esp_mfi_hmac_sha512_key_t esp_mfi_hmac_sha512_key_new(const uint8_t *key, int len);
+
+/**
+ * @brief Free HMAC-SHA512 key
+ *
+ * @param key the key
+ */
+void esp_mfi_hmac_sha512_key_free(esp_mfi_hmac_sha512_key_t key);
+
+/**
+ * @brief HMAC-SHA512 of a message
+ *
+ * @param key the key
+ * @param msg pointer of the message
+ * @param len message length
+ * @param mac pointer of the output, of MFI_SHA512_SIZE bytes
+ *
+ * @return 0 on success, -1 on bad arguments
+ */
+int esp_mfi_hmac_sha512(esp_mfi_hmac_sha512_key_t key, const uint8_t *msg, int len, uint8_t *mac);
+
+/**
+ * @brief HKDF-SHA512 extract
+ *
+ * The pseudorandom key comes as an HMAC-SHA512 key, ready for any number of
+ * esp_mfi_hkdf_sha512_expand() with different infos.
+ *
+ * @param salt the salt, as an HMAC-SHA512 key
+ * @param ikm pointer of the input keying material
+ * @param ikm_len input keying material length
+ *
+ * @return the pseudorandom key, to free with esp_mfi_hmac_sha512_key_free(),
+ *         or NULL if out of memory
+ */
+esp_mfi_hmac_sha512_key_t esp_mfi_hkdf_sha512_extract(esp_mfi_hmac_sha512_key_t salt,
+                                                      const uint8_t *ikm, int ikm_len);
+
+/**
+ * @brief HKDF-SHA512 expand
+ *
+ * @param prk the pseudorandom key from esp_mfi_hkdf_sha512_extract()
+ * @param info pointer of the info
+ * @param info_len info length
+ * @param okm pointer of the output keying material
+ * @param okm_len output keying material length, up to 255 * MFI_SHA512_SIZE
+ *
+ * @return 0 on success, -1 on bad arguments
+ */
+int esp_mfi_hkdf_sha512_expand(esp_mfi_hmac_sha512_key_t prk, const uint8_t *info, int info_len,
+                               uint8_t *okm, int okm_len);
+
+/**
+ * @brief HKDF-SHA512, extract then expand
+ *
+ * @param salt the salt, as an HMAC-SHA512 key
+ * @param ikm pointer of the input keying material
+ * @param ikm_len input keying material length
+ * @param info pointer of the info
+ * @param info_len info length
+ * @param okm pointer of the output keying material
+ * @param okm_len output keying material length
+ *
+ * @return 0 on success, -1 on failure
+ */
+int esp_mfi_hkdf_sha512(esp_mfi_hmac_sha512_key_t salt, const uint8_t *ikm, int ikm_len,
+                        const uint8_t *info, int info_len, uint8_t *okm, int okm_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ESP_MFI_HKDF_H_ */
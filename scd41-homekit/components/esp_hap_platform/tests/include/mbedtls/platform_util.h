@@ -0,0 +1,9 @@
+/* See sha512.h */
+#ifndef MBEDTLS_PLATFORM_UTIL_H
+#define MBEDTLS_PLATFORM_UTIL_H
+
+#include <stddef.h>
+
+void mbedtls_platform_zeroize(void *buf, size_t len);
+
+#endif /* MBEDTLS_PLATFORM_UTIL_H */
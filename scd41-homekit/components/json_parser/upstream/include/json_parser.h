@@ -32,17 +32,51 @@ extern "C"
 typedef jsmn_parser json_parser_t;
 typedef jsmntok_t json_tok_t;
 
+/** Reusable token storage for json_parse_start_with_arena().
+ *
+ * Initialise with json_tok_arena_init(), optionally preallocating some tokens, and
+ * release with json_tok_arena_free(). The tokens are grown only when a JSON string
+ * needs more tokens than currently available. The same arena can be reused for any
+ * number of parses, but only for one at a time.
+ */
+typedef struct {
+	json_tok_t *tokens;
+	int num_tokens;
+} json_tok_arena_t;
+
 typedef struct {
 	json_parser_t parser;
 	char *js;
 	json_tok_t *tokens;
 	json_tok_t *cur;
 	int num_tokens;
+	json_tok_arena_t *arena;
 } jparse_ctx_t;
 
+/** Cursor for walking the elements of an array in order.
+ *
+ * json_arr_get_*() search from the first element of the array on every call, so reading
+ * all N elements by index costs O(N^2) token walks. The iterator remembers where the next
+ * element starts, so that a complete walk costs O(N). Initialise it with json_arr_iter_begin()
+ * while the array is the current element, and call json_arr_iter_next() to move to each
+ * element in turn. Objects and arrays are entered by json_arr_iter_next(), so that the
+ * json_obj_*()/json_arr_*() APIs can be used on them directly, while primitive and string
+ * elements can be read with json_arr_iter_get_*().
+ */
+typedef struct {
+	json_tok_t *arr;
+	json_tok_t *elem;
+	json_tok_t *next;
+	int remaining;
+} json_arr_iter_t;
+
 int json_parse_start(jparse_ctx_t *jctx, char *js, int len);
 int json_parse_end(jparse_ctx_t *jctx);
 
+int json_tok_arena_init(json_tok_arena_t *arena, int num_tokens);
+void json_tok_arena_free(json_tok_arena_t *arena);
+int json_parse_start_with_arena(jparse_ctx_t *jctx, char *js, int len, json_tok_arena_t *arena);
+
 int json_obj_get_array(jparse_ctx_t *jctx, char *name, int *num_elem);
 int json_obj_leave_array(jparse_ctx_t *jctx);
 int json_obj_get_object(jparse_ctx_t *jctx, char *name);
@@ -69,6 +103,16 @@ int json_arr_get_float(jparse_ctx_t *jctx, uint32_t index, float *val);
 int json_arr_get_string(jparse_ctx_t *jctx, uint32_t index, char *val, int size);
 int json_arr_get_strlen(jparse_ctx_t *jctx, uint32_t index, int *strlen);
 
+int json_arr_iter_begin(jparse_ctx_t *jctx, json_arr_iter_t *iter);
+int json_arr_iter_next(jparse_ctx_t *jctx, json_arr_iter_t *iter);
+void json_arr_iter_end(jparse_ctx_t *jctx, json_arr_iter_t *iter);
+int json_arr_iter_get_bool(jparse_ctx_t *jctx, json_arr_iter_t *iter, bool *val);
+int json_arr_iter_get_int(jparse_ctx_t *jctx, json_arr_iter_t *iter, int *val);
+int json_arr_iter_get_int64(jparse_ctx_t *jctx, json_arr_iter_t *iter, int64_t *val);
+int json_arr_iter_get_float(jparse_ctx_t *jctx, json_arr_iter_t *iter, float *val);
+int json_arr_iter_get_string(jparse_ctx_t *jctx, json_arr_iter_t *iter, char *val, int size);
+int json_arr_iter_get_strlen(jparse_ctx_t *jctx, json_arr_iter_t *iter, int *strlen);
+
 #ifdef __cplusplus
 }
 #endif
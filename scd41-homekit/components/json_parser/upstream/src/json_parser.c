@@ -366,6 +366,101 @@ int json_arr_get_strlen(jparse_ctx_t *jctx, uint32_t index, int *strlen)
 	return OS_SUCCESS;
 }
 
+int json_arr_iter_begin(jparse_ctx_t *jctx, json_arr_iter_t *iter)
+{
+	json_tok_t *tok = jctx->cur;
+	if (tok->type != JSMN_ARRAY)
+		return -OS_FAIL;
+	iter->arr = tok;
+	iter->elem = NULL;
+	iter->remaining = tok->size;
+	/* The first element, if any, immediately follows the array token */
+	iter->next = (tok->size > 0) ? tok + 1 : NULL;
+	return OS_SUCCESS;
+}
+
+int json_arr_iter_next(jparse_ctx_t *jctx, json_arr_iter_t *iter)
+{
+	/* Go back to the array, so that the iterator can be called irrespective of
+	 * whether the previous element was entered or not.
+	 */
+	jctx->cur = iter->arr;
+	if (iter->remaining <= 0) {
+		iter->elem = NULL;
+		return -OS_FAIL;
+	}
+	iter->elem = iter->next;
+	iter->remaining--;
+	/* Skip over the current element once, so that the next call need not search */
+	iter->next = iter->remaining ? json_skip_elem(iter->elem) + 1 : NULL;
+	if ((iter->elem->type == JSMN_OBJECT) || (iter->elem->type == JSMN_ARRAY))
+		jctx->cur = iter->elem;
+	return OS_SUCCESS;
+}
+
+void json_arr_iter_end(jparse_ctx_t *jctx, json_arr_iter_t *iter)
+{
+	jctx->cur = iter->arr;
+	iter->elem = NULL;
+	iter->remaining = 0;
+}
+
+static json_tok_t *json_arr_iter_get_val_tok(json_arr_iter_t *iter, jsmntype_t type)
+{
+	if (!iter->elem || (iter->elem->type != type))
+		return NULL;
+	return iter->elem;
+}
+
+int json_arr_iter_get_bool(jparse_ctx_t *jctx, json_arr_iter_t *iter, bool *val)
+{
+	json_tok_t *tok = json_arr_iter_get_val_tok(iter, JSMN_PRIMITIVE);
+	if (!tok)
+		return -OS_FAIL;
+	return json_tok_to_bool(jctx, tok, val);
+}
+
+int json_arr_iter_get_int(jparse_ctx_t *jctx, json_arr_iter_t *iter, int *val)
+{
+	json_tok_t *tok = json_arr_iter_get_val_tok(iter, JSMN_PRIMITIVE);
+	if (!tok)
+		return -OS_FAIL;
+	return json_tok_to_int(jctx, tok, val);
+}
+
+int json_arr_iter_get_int64(jparse_ctx_t *jctx, json_arr_iter_t *iter, int64_t *val)
+{
+	json_tok_t *tok = json_arr_iter_get_val_tok(iter, JSMN_PRIMITIVE);
+	if (!tok)
+		return -OS_FAIL;
+	return json_tok_to_int64(jctx, tok, val);
+}
+
+int json_arr_iter_get_float(jparse_ctx_t *jctx, json_arr_iter_t *iter, float *val)
+{
+	json_tok_t *tok = json_arr_iter_get_val_tok(iter, JSMN_PRIMITIVE);
+	if (!tok)
+		return -OS_FAIL;
+	return json_tok_to_float(jctx, tok, val);
+}
+
+int json_arr_iter_get_string(jparse_ctx_t *jctx, json_arr_iter_t *iter, char *val, int size)
+{
+	json_tok_t *tok = json_arr_iter_get_val_tok(iter, JSMN_STRING);
+	if (!tok)
+		return -OS_FAIL;
+	return json_tok_to_string(jctx, tok, val, size);
+}
+
+int json_arr_iter_get_strlen(jparse_ctx_t *jctx, json_arr_iter_t *iter, int *strlen)
+{
+	json_tok_t *tok = json_arr_iter_get_val_tok(iter, JSMN_STRING);
+	if (!tok)
+		return -OS_FAIL;
+	*strlen = tok->end - tok->start;
+	return OS_SUCCESS;
+}
+
 int json_parse_start(jparse_ctx_t *jctx, char *js, int len)
 {
 	memset(jctx, 0, sizeof(jparse_ctx_t));
@@ -389,9 +484,75 @@ int json_parse_start(jparse_ctx_t *jctx, char *js, int len)
 	return OS_SUCCESS;
 }
 
+#define JSON_ARENA_MIN_TOKENS	16
+
+int json_tok_arena_init(json_tok_arena_t *arena, int num_tokens)
+{
+	arena->tokens = NULL;
+	arena->num_tokens = 0;
+	if (num_tokens > 0) {
+		arena->tokens = calloc(num_tokens, sizeof(json_tok_t));
+		if (!arena->tokens)
+			return -OS_FAIL;
+		arena->num_tokens = num_tokens;
+	}
+	return OS_SUCCESS;
+}
+
+void json_tok_arena_free(json_tok_arena_t *arena)
+{
+	if (arena->tokens)
+		free(arena->tokens);
+	arena->tokens = NULL;
+	arena->num_tokens = 0;
+}
+
+static int json_tok_arena_grow(json_tok_arena_t *arena)
+{
+	int num_tokens = arena->num_tokens ? arena->num_tokens * 2 : JSON_ARENA_MIN_TOKENS;
+	json_tok_t *tokens = realloc(arena->tokens, num_tokens * sizeof(json_tok_t));
+	if (!tokens)
+		return -OS_FAIL;
+	arena->tokens = tokens;
+	arena->num_tokens = num_tokens;
+	return OS_SUCCESS;
+}
+
+/* Parses the JSON in a single pass, using the tokens of the arena. jsmn keeps its
+ * state on running out of tokens, so if the arena is exhausted, it is grown and
+ * the parsing resumes from where it stopped. Tokens refer to their parents by
+ * index, so moving them during the grow is fine.
+ */
+int json_parse_start_with_arena(jparse_ctx_t *jctx, char *js, int len, json_tok_arena_t *arena)
+{
+	memset(jctx, 0, sizeof(jparse_ctx_t));
+	if (!arena)
+		return -OS_FAIL;
+	if (!arena->tokens && json_tok_arena_grow(arena) != OS_SUCCESS)
+		return -OS_FAIL;
+	jsmn_init(&jctx->parser);
+	int ret;
+	while ((ret = jsmn_parse(&jctx->parser, js, len, arena->tokens, arena->num_tokens))
+			== JSMN_ERROR_NOMEM) {
+		if (json_tok_arena_grow(arena) != OS_SUCCESS)
+			break;
+	}
+	if (ret <= 0) {
+		memset(jctx, 0, sizeof(jparse_ctx_t));
+		return -OS_FAIL;
+	}
+	jctx->js = js;
+	jctx->tokens = arena->tokens;
+	jctx->num_tokens = ret;
+	jctx->arena = arena;
+	jctx->cur = jctx->tokens;
+	return OS_SUCCESS;
+}
+
 int json_parse_end(jparse_ctx_t *jctx)
 {
-	if (jctx->tokens)
+	/* Tokens from an arena are owned by the arena and are reused */
+	if (jctx->tokens && !jctx->arena)
 		free(jctx->tokens);
 	memset(jctx, 0, sizeof(jparse_ctx_t));
 	return OS_SUCCESS;
@@ -0,0 +1,136 @@
+/*
+ *    Copyright 2020 Piyush Shah <shahpiyushv@gmail.com>
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/* Walks the characteristics array of a PUT /characteristics body by index
+ * and with the array iterator, for 1, 32 and 256 writes.
+ * Build and run with "make bench" in this directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <json_parser.h>
+
+#define ELEM_FMT	"{\"aid\":%d,\"iid\":%d,\"value\":%d}"
+
+static char *make_body(int num)
+{
+	char *buf = malloc(32 + num * 48);
+	int len = sprintf(buf, "{\"characteristics\":[");
+	int i;
+	for (i = 0; i < num; i++) {
+		len += sprintf(buf + len, i ? "," ELEM_FMT : ELEM_FMT, i + 1, i + 9, i & 1);
+	}
+	sprintf(buf + len, "]}");
+	return buf;
+}
+
+static long walk_by_index(jparse_ctx_t *jctx)
+{
+	long sum = 0;
+	int num_elem, i;
+	if (json_obj_get_array(jctx, "characteristics", &num_elem) != OS_SUCCESS)
+		return -1;
+	for (i = 0; i < num_elem; i++) {
+		int aid = 0, iid = 0;
+		if (json_arr_get_object(jctx, i) != OS_SUCCESS)
+			return -1;
+		json_obj_get_int(jctx, "aid", &aid);
+		json_obj_get_int(jctx, "iid", &iid);
+		sum += aid + iid;
+		json_arr_leave_object(jctx);
+	}
+	json_obj_leave_array(jctx);
+	return sum;
+}
+
+static long walk_by_iter(jparse_ctx_t *jctx)
+{
+	json_arr_iter_t iter;
+	long sum = 0;
+	int num_elem;
+	if (json_obj_get_array(jctx, "characteristics", &num_elem) != OS_SUCCESS)
+		return -1;
+	json_arr_iter_begin(jctx, &iter);
+	while (json_arr_iter_next(jctx, &iter) == OS_SUCCESS) {
+		int aid = 0, iid = 0;
+		json_obj_get_int(jctx, "aid", &aid);
+		json_obj_get_int(jctx, "iid", &iid);
+		sum += aid + iid;
+	}
+	json_obj_leave_array(jctx);
+	return sum;
+}
+
+static double now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double time_walk(jparse_ctx_t *jctx, long (*walk)(jparse_ctx_t *), int iters, long *sum)
+{
+	double start = now_us();
+	int i;
+	for (i = 0; i < iters; i++)
+		*sum = walk(jctx);
+	return (now_us() - start) / iters;
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = {1, 32, 256};
+	json_tok_arena_t arena;
+	int failures = 0;
+	unsigned i;
+
+	if (json_tok_arena_init(&arena, 16) != OS_SUCCESS) {
+		printf("Arena allocation failed\n");
+		return -1;
+	}
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		int num = sizes[i];
+		int iters = 200000 / num / num + 100;
+		char *body = make_body(num);
+		jparse_ctx_t jctx;
+		long expected = (long)num * (num + 1) / 2 + (long)num * (num + 17) / 2;
+		long by_index = 0, by_iter = 0;
+		double t_index, t_iter;
+
+		if (json_parse_start_with_arena(&jctx, body, strlen(body), &arena) != OS_SUCCESS) {
+			printf("Parser failed for %d elements\n", num);
+			return -1;
+		}
+		t_index = time_walk(&jctx, walk_by_index, iters, &by_index);
+		t_iter = time_walk(&jctx, walk_by_iter, iters, &by_iter);
+		json_parse_end(&jctx);
+		free(body);
+
+		if (by_index != expected || by_iter != expected) {
+			printf("FAIL: %d elements summed to %ld by index and %ld by iterator, expected %ld\n",
+					num, by_index, by_iter, expected);
+			failures++;
+		}
+		printf("%3d elements: %8.2f us by index, %8.2f us with the iterator\n", num, t_index, t_iter);
+	}
+	json_tok_arena_free(&arena);
+	if (failures)
+		return 1;
+	printf("All checks passed\n");
+	return 0;
+}
@@ -29,6 +29,10 @@
 			"\"arrays\":\"yes\"},\n"\
 			"\"int_64\":109174583252}"
 
+#define json_test_arr_str	"{\"characteristics\":[{\"aid\":1,\"iid\":9,\"value\":true}," \
+			"{\"aid\":2,\"iid\":10,\"value\":[1,2]}," \
+			"{\"aid\":3,\"iid\":11}],\"names\":[\"first\",\"second\"]}"
+
 int main(int argc, char **argv)
 {
 	jparse_ctx_t jctx;
@@ -76,6 +80,50 @@ int main(int argc, char **argv)
 		printf("int64_val %lld\n", int64_val);
 
 	json_parse_end(&jctx);
+
+	/* Parse again with a small arena, which has to grow during the parse */
+	json_tok_arena_t arena;
+	if (json_tok_arena_init(&arena, 4) != OS_SUCCESS) {
+		printf("Arena allocation failed\n");
+		return -1;
+	}
+	ret = json_parse_start_with_arena(&jctx, json_test_str, strlen(json_test_str), &arena);
+	if (ret != OS_SUCCESS) {
+		printf("Arena parser failed\n");
+		return -1;
+	}
+	if (json_obj_get_int64(&jctx, "int_64", &int64_val) == OS_SUCCESS)
+		printf("arena int64_val %lld, tokens %d\n", int64_val, jctx.num_tokens);
+	json_parse_end(&jctx);
+
+	/* Walk arrays with the iterator, reusing the same arena */
+	ret = json_parse_start_with_arena(&jctx, json_test_arr_str, strlen(json_test_arr_str), &arena);
+	if (ret != OS_SUCCESS) {
+		printf("Arena parser failed\n");
+		return -1;
+	}
+	json_arr_iter_t iter;
+	if (json_obj_get_array(&jctx, "characteristics", &num_elem) == OS_SUCCESS) {
+		json_arr_iter_begin(&jctx, &iter);
+		while (json_arr_iter_next(&jctx, &iter) == OS_SUCCESS) {
+			int aid = 0, iid = 0;
+			json_obj_get_int(&jctx, "aid", &aid);
+			json_obj_get_int(&jctx, "iid", &iid);
+			printf("iter aid %d iid %d%s\n", aid, iid,
+					json_obj_get_bool(&jctx, "value", &bool_val) == OS_SUCCESS ? " bool" : "");
+		}
+		json_obj_leave_array(&jctx);
+	}
+	if (json_obj_get_array(&jctx, "names", &num_elem) == OS_SUCCESS) {
+		json_arr_iter_begin(&jctx, &iter);
+		while (json_arr_iter_next(&jctx, &iter) == OS_SUCCESS) {
+			if (json_arr_iter_get_string(&jctx, &iter, str_val, sizeof(str_val)) == OS_SUCCESS)
+				printf("iter name %s\n", str_val);
+		}
+		json_obj_leave_array(&jctx);
+	}
+	json_parse_end(&jctx);
+	json_tok_arena_free(&arena);
 	return 0;
 
 }
@@ -1,7 +1,20 @@
 #include <string.h>
+#include "sdkconfig.h"
 #include "hkdf-sha.h"
 #include "mu_bignum.h"
 #include "mu_srp.h"
+#include "mu_fixed_base.h"
+
+/* g^b and g^x go through a comb table of the powers of g, unless turned off
+ * with CONFIG_MU_SRP_FIXED_BASE.
+ */
+#ifndef MU_SRP_FIXED_BASE
+#ifdef CONFIG_MU_SRP_FIXED_BASE
+#define MU_SRP_FIXED_BASE 1
+#else
+#define MU_SRP_FIXED_BASE 0
+#endif
+#endif
 
 #ifdef SRP_DEBUG
 #include <stdio.h>
@@ -74,6 +87,12 @@ static const char N_3072[] = {
 };
 char g_3072[] = { 5 };
 
+#if MU_SRP_FIXED_BASE
+/* For b, of 256 bits, and x, a SHA-512 digest */
+#define G_3072_EXP_BITS 512
+static mu_fixed_base_t *g_3072_base;
+#endif
+
 
 int mu_srp_init(mu_srp_handle_t *hd, mu_ng_type_t ng)
 {
@@ -160,47 +179,34 @@ static mu_bn_t *calculate_x(char *bytes_salt, int salt_len, const char *username
 	return mu_bn_new_from_bin((char *)digest, sizeof(digest));
 }
 
+/* Zeroes to pad with, fed to the hash a block at a time */
+static const unsigned char zero_pad[SHA512_Message_Block_Size];
+
+static void SHA512_pad(SHA512Context *ctx, int len)
+{
+	while (len > 0) {
+		int n = len < (int)sizeof(zero_pad) ? len : (int)sizeof(zero_pad);
+		SHA512Input(ctx, zero_pad, n);
+		len -= n;
+	}
+}
+
 static mu_bn_t *calculate_padded_hash(mu_srp_handle_t *hd, const char *a, int len_a, char *b, int len_b)
 {
 	unsigned char digest[SHA512HashSize];
 	SHA512Context ctx;
-	int pad_len;
-	char *s = NULL;
-
-	if (len_a > len_b) {
-		pad_len = hd->len_n - len_b;
-	} else {
-		pad_len = hd->len_n - len_a;
-	}
-
-    if (pad_len) {
-        s = malloc(pad_len);
-        if (s) {
-            memset(s, 0, pad_len);
-        }
-    }
 
 	SHA512Reset(&ctx);
 	/* PAD (a) */
-	if (s && (len_a != hd->len_n)) {
-		SHA512Input(&ctx, (unsigned char *)s, hd->len_n - len_a);
-	}
-
+	SHA512_pad(&ctx, hd->len_n - len_a);
 	SHA512Input(&ctx, (unsigned char *)a, len_a);
 
 	/* PAD (b) */
-	if (s && (len_b != hd->len_n)) {
-		SHA512Input(&ctx, (unsigned char *)s, hd->len_n - len_b);
-	}
-
+	SHA512_pad(&ctx, hd->len_n - len_b);
 	SHA512Input(&ctx, (unsigned char *)b, len_b);
 
 	SHA512Result(&ctx, digest);
 
-    if (s) {
-        free(s);
-    }
-
 	hex_dbg("value", digest, sizeof(digest));
 	return mu_bn_new_from_bin((char *)digest, sizeof(digest));
 }
@@ -211,8 +217,27 @@ static mu_bn_t *calculate_padded_hash(mu_srp_handle_t *hd, const char *a, int le
  */
 static mu_bn_t *calculate_k(mu_srp_handle_t *hd)
 {
+	/* Only depends on the group, so it is worked out once */
+	static char bytes_k[SHA512HashSize];
+	static int have_k;
+	mu_bn_t *k;
+
+	if (have_k)
+		return mu_bn_new_from_bin(bytes_k, sizeof(bytes_k));
 	srp_print("k-->");
-	return calculate_padded_hash(hd, hd->bytes_n, hd->len_n, hd->bytes_g, hd->len_g);
+	k = calculate_padded_hash(hd, hd->bytes_n, hd->len_n, hd->bytes_g, hd->len_g);
+	if (k && mu_bn_sizeof(k) <= sizeof(bytes_k)) {
+		char *bytes;
+		int len;
+		bytes = mu_bn_to_bin(k, &len);
+		if (bytes) {
+			memset(bytes_k, 0, sizeof(bytes_k));
+			memcpy(bytes_k + sizeof(bytes_k) - len, bytes, len);
+			free(bytes);
+			have_k = 1;
+		}
+	}
+	return k;
 }
 
 static mu_bn_t *calculate_u(mu_srp_handle_t *hd, char *A, int len_A)
@@ -221,7 +246,43 @@ static mu_bn_t *calculate_u(mu_srp_handle_t *hd, char *A, int len_A)
 	return calculate_padded_hash(hd, A, len_A, hd->bytes_B, hd->len_B);
 }
 
-int __mu_srp_srv_pubkey(mu_srp_handle_t *hd, char **bytes_B, int *len_B)
+/* g^e % N */
+static mu_bn_t *calculate_g_exp(mu_srp_handle_t *hd, mu_bn_t *e)
+{
+	mu_bn_t *r;
+#if MU_SRP_FIXED_BASE
+	/* Built on first use and kept for all the sessions. Ephemerals may be
+	 * generated in another task than the sessions, so if two tables get
+	 * built at the same time, only one is kept.
+	 */
+	mu_fixed_base_t *fb = __atomic_load_n(&g_3072_base, __ATOMIC_ACQUIRE);
+	if (!fb) {
+		mu_fixed_base_t *expected = NULL;
+		fb = mu_fixed_base_new(g_3072, sizeof(g_3072), N_3072, sizeof(N_3072),
+				       G_3072_EXP_BITS);
+		if (fb && !__atomic_compare_exchange_n(&g_3072_base, &expected, fb, false,
+						       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			mu_fixed_base_free(fb);
+			fb = expected;
+		}
+	}
+	if (fb) {
+		r = mu_fixed_base_exp(fb, e);
+		if (r)
+			return r;
+	}
+#endif
+	r = mu_bn_new();
+	if (r)
+		mu_bn_a_exp_b_mod_c(r, hd->g, e, hd->n, hd->ctx);
+	return r;
+}
+
+/* B = kv + g^b, with b and g^b generated now, or ahead of the session if
+ * bytes_b is set.
+ */
+static int srv_pubkey(mu_srp_handle_t *hd, const char *bytes_b, int len_b, const char *bytes_gb, int len_gb,
+		      char **bytes_B, int *len_B)
 {
 	mu_bn_t *k = calculate_k(hd);
 	mu_bn_t *kv = NULL;
@@ -229,20 +290,26 @@ int __mu_srp_srv_pubkey(mu_srp_handle_t *hd, char **bytes_B, int *len_B)
 	if (!k)
 		goto error;
 
-	hd->b = mu_bn_new();
-	if (!hd->b)
-		goto error;
-	mu_bn_get_rand(hd->b, 256, -1, 0);
+	if (bytes_b) {
+		hd->b = mu_bn_new_from_bin(bytes_b, len_b);
+		gb = mu_bn_new_from_bin(bytes_gb, len_gb);
+		if (!hd->b || !gb)
+			goto error;
+	} else {
+		hd->b = mu_bn_new();
+		if (!hd->b)
+			goto error;
+		mu_bn_get_rand(hd->b, 256, -1, 0);
+		gb = calculate_g_exp(hd, hd->b);
+	}
 	hex_dbg_bn("b", hd->b);
 
 	/* B = kv + g^b */
 	kv = mu_bn_new();
-	gb = mu_bn_new();
 	hd->B = mu_bn_new();
 	if (!kv || !gb || ! hd->B)
 		goto error;
 	mu_bn_a_mul_b_mod_c(kv, k, hd->v, hd->n, hd->ctx);
-	mu_bn_a_exp_b_mod_c(gb, hd->g, hd->b, hd->n, hd->ctx);
 	mu_bn_a_add_b_mod_c(hd->B, kv, gb, hd->n, hd->ctx);
 	hd->bytes_B = mu_bn_to_bin(hd->B, len_B);
 	hd->len_B = *len_B;
@@ -268,7 +335,11 @@ int __mu_srp_srv_pubkey(mu_srp_handle_t *hd, char **bytes_B, int *len_B)
 		hd->b = NULL;
 	}
 	return -1;
-	
+}
+
+int __mu_srp_srv_pubkey(mu_srp_handle_t *hd, char **bytes_B, int *len_B)
+{
+	return srv_pubkey(hd, NULL, 0, NULL, 0, bytes_B, len_B);
 }
 
 int mu_srp_srv_pubkey(mu_srp_handle_t *hd, const char *username, const char *pass, int pass_len, int salt_len,
@@ -295,10 +366,9 @@ int mu_srp_srv_pubkey(mu_srp_handle_t *hd, const char *username, const char *pas
 	hex_dbg_bn("x", x);
 	
 	/* v = g^x % N */
-	hd->v = mu_bn_new();
+	hd->v = calculate_g_exp(hd, x);
 	if (! hd->v)
 		goto error;
-	mu_bn_a_exp_b_mod_c(hd->v, hd->g, x, hd->n, hd->ctx);
 	hex_dbg_bn("Verifier", hd->v);
 
 	if (__mu_srp_srv_pubkey(hd, bytes_B, len_B) < 0 )
@@ -334,6 +404,119 @@ int mu_srp_srv_pubkey_from_salt_verifier(mu_srp_handle_t *hd, char **bytes_B, in
     return __mu_srp_srv_pubkey(hd, bytes_B, len_B);
 }
 
+int mu_srp_gen_ephemeral(char **bytes_b, int *len_b, char **bytes_gb, int *len_gb)
+{
+	mu_srp_handle_t hd = { 0 };
+	mu_bn_t *b = NULL, *gb = NULL;
+
+	*bytes_b = NULL;
+	*bytes_gb = NULL;
+	if (mu_srp_init(&hd, MU_NG_3072) < 0)
+		return -1;
+	b = mu_bn_new();
+	if (!b)
+		goto error;
+	mu_bn_get_rand(b, 256, -1, 0);
+	gb = calculate_g_exp(&hd, b);
+	if (!gb)
+		goto error;
+	*bytes_b = mu_bn_to_bin(b, len_b);
+	*bytes_gb = mu_bn_to_bin(gb, len_gb);
+	if (!*bytes_b || !*bytes_gb)
+		goto error;
+
+	mu_bn_free(b);
+	mu_bn_free(gb);
+	mu_srp_free(&hd);
+	return 0;
+
+error:
+	if (b)
+		mu_bn_free(b);
+	if (gb)
+		mu_bn_free(gb);
+	if (*bytes_b) {
+		free(*bytes_b);
+		*bytes_b = NULL;
+	}
+	if (*bytes_gb) {
+		free(*bytes_gb);
+		*bytes_gb = NULL;
+	}
+	mu_srp_free(&hd);
+	return -1;
+}
+
+int mu_srp_srv_pubkey_from_ephemeral(mu_srp_handle_t *hd, const char *bytes_b, int len_b,
+				     const char *bytes_gb, int len_gb, char **bytes_B, int *len_B)
+{
+	return srv_pubkey(hd, bytes_b, len_b, bytes_gb, len_gb, bytes_B, len_B);
+}
+
+int mu_srp_gen_salt_verifier(const char *username, const char *pass, int pass_len, int salt_len,
+			     char **bytes_salt, char **bytes_verifier, int *len_verifier)
+{
+	mu_srp_handle_t hd = { 0 };
+	mu_bn_t *s = NULL, *x = NULL, *v = NULL;
+	char *bytes = NULL;
+	int len;
+
+	*bytes_salt = NULL;
+	*bytes_verifier = NULL;
+	if (mu_srp_init(&hd, MU_NG_3072) < 0)
+		return -1;
+
+	/* The salt as salt_len bytes, even with leading zeroes, as x is
+	 * computed over those bytes.
+	 */
+	*bytes_salt = calloc(1, salt_len);
+	s = mu_bn_new();
+	if (!*bytes_salt || !s)
+		goto error;
+	mu_bn_get_rand(s, 8 * salt_len, -1, 0);
+	bytes = mu_bn_to_bin(s, &len);
+	if (!bytes || len > salt_len)
+		goto error;
+	memcpy(*bytes_salt + salt_len - len, bytes, len);
+	hex_dbg("Salt", *bytes_salt, salt_len);
+
+	x = calculate_x(*bytes_salt, salt_len, username, pass, pass_len);
+	if (!x)
+		goto error;
+
+	/* v = g^x % N */
+	v = calculate_g_exp(&hd, x);
+	if (!v)
+		goto error;
+	*bytes_verifier = mu_bn_to_bin(v, len_verifier);
+	if (!*bytes_verifier)
+		goto error;
+	hex_dbg_bn("Verifier", v);
+
+	free(bytes);
+	mu_bn_free(s);
+	mu_bn_free(x);
+	mu_bn_free(v);
+	mu_srp_free(&hd);
+	return 0;
+
+error:
+	if (bytes)
+		free(bytes);
+	if (s)
+		mu_bn_free(s);
+	if (x)
+		mu_bn_free(x);
+	if (v)
+		mu_bn_free(v);
+	if (*bytes_salt) {
+		free(*bytes_salt);
+		*bytes_salt = NULL;
+	}
+	mu_srp_free(&hd);
+	return -1;
+}
+
 int mu_srp_set_salt_verifier(mu_srp_handle_t *hd, const char *salt, int salt_len,
         const char *verifier, int verifier_len)
 {
@@ -0,0 +1,4 @@
+/* Host stand-in of the ESP-IDF header, for the tests */
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
@@ -0,0 +1,39 @@
+/*
+ * The part of the mbedTLS 2.28 bignum API that mu_srp uses, to build against
+ * the host's libmbedcrypto, which comes without its headers. Only for
+ * x86_64 hosts.
+ */
+#ifndef MBEDTLS_BIGNUM_H
+#define MBEDTLS_BIGNUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint64_t mbedtls_mpi_uint;
+typedef unsigned int mbedtls_t_udbl __attribute__((mode(TI)));
+#define MBEDTLS_HAVE_UDBL
+
+typedef struct mbedtls_mpi {
+	int s;
+	size_t n;
+	mbedtls_mpi_uint *p;
+} mbedtls_mpi;
+
+void mbedtls_mpi_init(mbedtls_mpi *X);
+void mbedtls_mpi_free(mbedtls_mpi *X);
+int mbedtls_mpi_copy(mbedtls_mpi *X, const mbedtls_mpi *Y);
+int mbedtls_mpi_read_string(mbedtls_mpi *X, int radix, const char *s);
+int mbedtls_mpi_read_binary(mbedtls_mpi *X, const unsigned char *buf, size_t buflen);
+int mbedtls_mpi_write_binary(const mbedtls_mpi *X, unsigned char *buf, size_t buflen);
+size_t mbedtls_mpi_size(const mbedtls_mpi *X);
+int mbedtls_mpi_cmp_mpi(const mbedtls_mpi *X, const mbedtls_mpi *Y);
+int mbedtls_mpi_add_mpi(mbedtls_mpi *X, const mbedtls_mpi *A, const mbedtls_mpi *B);
+int mbedtls_mpi_sub_mpi(mbedtls_mpi *X, const mbedtls_mpi *A, const mbedtls_mpi *B);
+int mbedtls_mpi_mul_mpi(mbedtls_mpi *X, const mbedtls_mpi *A, const mbedtls_mpi *B);
+int mbedtls_mpi_mod_mpi(mbedtls_mpi *R, const mbedtls_mpi *A, const mbedtls_mpi *B);
+int mbedtls_mpi_exp_mod(mbedtls_mpi *X, const mbedtls_mpi *A, const mbedtls_mpi *E,
+			const mbedtls_mpi *N, mbedtls_mpi *_RR);
+int mbedtls_mpi_fill_random(mbedtls_mpi *X, size_t size,
+			    int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+
+#endif /* MBEDTLS_BIGNUM_H */
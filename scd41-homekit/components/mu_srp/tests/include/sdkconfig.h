@@ -0,0 +1,5 @@
+/* Host stand-in of the generated configuration, for the tests. The Makefile
+ * sets MU_SRP_FIXED_BASE itself, to build with and without the table.
+ */
+#pragma once
+#define CONFIG_MU_SRP_FIXED_BASE    1
@@ -12,6 +12,15 @@ static hap_char_t *g_temp_char = NULL;
 static hap_char_t *g_humidity_char = NULL;
 static hap_char_t *g_co2_detected_char = NULL;
 static hap_char_t *g_co2_level_char = NULL;
+static hap_char_t *g_mode_char = NULL;
+static hap_char_t *g_current_char = NULL;
+
+/* Custom service with the measurement mode of the sensor and its average
+ * current, as the mode changes with the CO2 trend on battery powered units.
+ */
+#define HAP_SERV_CUSTOM_UUID_SENSOR_DIAGNOSTICS  "6c5ae5ec-1a6e-4693-8c0a-f910048cba33"
+#define HAP_CHAR_CUSTOM_UUID_MEASUREMENT_MODE    "bec930c2-cf41-4968-9a9f-6d426d887ff8"
+#define HAP_CHAR_CUSTOM_UUID_AVERAGE_CURRENT     "29ce652f-103e-4b52-ba64-da65226e9c56"
 
 int accessory_identify_routine(hap_acc_t *accessory)
 {
@@ -51,6 +60,26 @@ int update_hap_climate(float temperature, float humidity, float co2)
     return HAP_SUCCESS;
 }
 
+int update_hap_diagnostics(int mode, float current_ma)
+{
+    if (g_mode_char)
+    {
+        hap_val_t mode_val = {.u = mode};
+        hap_char_update_val(g_mode_char, &mode_val);
+        hap_val_t current_val = {.f = current_ma};
+        hap_char_update_val(g_current_char, &current_val);
+    }
+    return HAP_SUCCESS;
+}
+
+bool hap_climate_subscribed(void)
+{
+    return (g_temp_char && hap_char_has_subscribers(g_temp_char)) ||
+           (g_humidity_char && hap_char_has_subscribers(g_humidity_char)) ||
+           (g_co2_detected_char && hap_char_has_subscribers(g_co2_detected_char)) ||
+           (g_co2_level_char && hap_char_has_subscribers(g_co2_level_char));
+}
+
 int create_accessories_and_services(void)
 {
     hap_acc_cfg_t cfg = {
@@ -82,6 +111,17 @@ int create_accessories_and_services(void)
     hap_acc_add_serv(accessory, temperature_service);
     hap_acc_add_serv(accessory, co2_service);
 
+    hap_serv_t *diagnostics_service = hap_serv_create(HAP_SERV_CUSTOM_UUID_SENSOR_DIAGNOSTICS);
+    g_mode_char = hap_char_uint8_create(HAP_CHAR_CUSTOM_UUID_MEASUREMENT_MODE, HAP_CHAR_PERM_PR | HAP_CHAR_PERM_EV, 0);
+    hap_char_int_set_constraints(g_mode_char, 0, 2, 1);
+    hap_char_add_description(g_mode_char, "Measurement Mode");
+    g_current_char = hap_char_float_create(HAP_CHAR_CUSTOM_UUID_AVERAGE_CURRENT, HAP_CHAR_PERM_PR | HAP_CHAR_PERM_EV, 0);
+    hap_char_float_set_constraints(g_current_char, 0, 100, 0.001);
+    hap_char_add_description(g_current_char, "Average Current (mA)");
+    hap_serv_add_char(diagnostics_service, g_mode_char);
+    hap_serv_add_char(diagnostics_service, g_current_char);
+    hap_acc_add_serv(accessory, diagnostics_service);
+
     hap_acc_add_wifi_transport_service(accessory, 0);
 
     return HAP_SUCCESS;
@@ -3,4 +3,8 @@
 #include <stdbool.h>
 
 int update_hap_climate(float temperature, float humidity, float co2);
+// Mode is one of scd4x_mode_t.
+int update_hap_diagnostics(int mode, float current_ma);
+// Whether a controller listens for changes of any of the readings.
+bool hap_climate_subscribed(void);
 int start_homekit(void);
@@ -9,6 +9,7 @@
 #include "esp_flash.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include <hap.h>
 #include <hap_apple_servs.h>
@@ -20,6 +21,7 @@
 #include "sensirion_i2c_hal.h"
 
 #include "homekit.h"
+#include "scheduler.h"
 #include "wifi.h"
 
 static const char *TAG = "main";
@@ -49,70 +51,95 @@ static esp_err_t i2c_master_init(void)
     return i2c_driver_install(I2C_MASTER_NUM, conf.mode, 0, 0, 0);
 }
 
+// The sensor is ready for commands a second after power up.
+#define SCD4X_POWER_UP_MS 1000
+// Longest wait between runs of the scheduler, so that it notices a
+// controller subscribing while it idles between single shots.
+#define SCD4X_CHECK_MS 5000
+
+static int64_t scd4x_clock(void)
+{
+    return esp_timer_get_time();
+}
+
+static void scd4x_report(const scheduler_sample_t *sample, scheduler_t *scheduler)
+{
+    float temperature = (sample->temperature_m_deg_c / 1000.0f) - 7.0f;
+    ESP_LOGI(TAG, "Raw Temperature: %" PRId32 ", Adjusted Temperature: %.2f °C", sample->temperature_m_deg_c, temperature);
+    float humidity = sample->humidity_m_percent_rh / 1000.0f;
+    float co2 = (float)sample->co2;
+    if (update_hap_climate(temperature, humidity, co2) != HAP_SUCCESS)
+    {
+        ESP_LOGE(TAG, "Failed to update HomeKit values");
+        return;
+    }
+
+    // From the estimated moment the sensor had the measurement to the
+    // notifications being queued.
+    ESP_LOGI(TAG, "Measurement to notification: %" PRId64 " ms (%" PRIu32 " polls missed in %" PRIu32 ")",
+             (esp_timer_get_time() - sample->ready_us) / 1000, scheduler->sampler.misses, scheduler->sampler.hits);
+
+    uint32_t current = scheduler_get_average_current(scheduler);
+    ESP_LOGI(TAG, "CO2 trend %" PRId32 " ppm/min, average current %" PRIu32 " uA",
+             scheduler->rate_ppm_per_min, current);
+    update_hap_diagnostics(scheduler_get_mode(scheduler), current / 1000.0f);
+}
+
 static void scd4x_i2c_task(void *arg)
 {
+    static scheduler_t scheduler;
+    const scheduler_config_t config = {
+#ifdef CONFIG_SCD4X_ADAPTIVE
+        .adaptive = true,
+        .single_shot_interval_s = CONFIG_SCD4X_SINGLE_SHOT_INTERVAL,
+        .rise_ppm_per_min = CONFIG_SCD4X_RISE_PPM_PER_MIN,
+#endif
+#ifdef CONFIG_SCD4X_LOW_POWER
+        .fixed_mode = SCD4X_MODE_LOW_POWER,
+#else
+        .fixed_mode = SCD4X_MODE_PERIODIC,
+#endif
+    };
+
+    int64_t up_ms = esp_timer_get_time() / 1000;
+    if (up_ms < SCD4X_POWER_UP_MS)
+        vTaskDelay(pdMS_TO_TICKS(SCD4X_POWER_UP_MS - up_ms));
+
+    scheduler_init(&scheduler, &config, scd4x_clock);
+    int shown_mode = -1;
     while (1)
     {
-        static uint16_t raw_co2;
-        static int32_t raw_temperature, raw_humidity;
-        static bool data_ready = false;
+        scheduler_result_t result;
+        scheduler_run(&scheduler, hap_climate_subscribed(), &result);
 
-        esp_err_t ret = scd4x_get_data_ready_flag(&data_ready);
-        if (ret == 0 && data_ready)
-        {
-            ret = scd4x_read_measurement(&raw_co2, &raw_temperature, &raw_humidity);
-            if (ret == 0)
-            {
-                float temperature = (raw_temperature / 1000.0f) - 7.0f;
-                ESP_LOGI(TAG, "Raw Temperature: %" PRId32 ", Adjusted Temperature: %.2f °C", raw_temperature, temperature);
-                float humidity = raw_humidity / 1000.0f;
-                float co2 = (float)raw_co2;
-                ret = update_hap_climate(temperature, humidity, co2);
-                if (ret != HAP_SUCCESS)
-                {
-                    ESP_LOGE(TAG, "Failed to update HomeKit values");
-                }
-            }
-            else
-            {
-                ESP_LOGW(TAG, "Failed to read measurement");
-            }
-        }
-        else if (ret != 0)
-        {
-            ESP_LOGW(TAG, "Failed to get data ready flag");
-        }
-        else
+        if (result.error)
+            ESP_LOGW(TAG, "SCD4x command failed: %d", result.error);
+        scd4x_mode_t mode = scheduler_get_mode(&scheduler);
+        if (scheduler.started && (int)mode != shown_mode)
         {
-            ESP_LOGI(TAG, "Data not ready yet");
+            ESP_LOGI(TAG, "Measuring in %s mode", scheduler_mode_name(mode));
+            update_hap_diagnostics(mode, scheduler_get_average_current(&scheduler) / 1000.0f);
+            shown_mode = mode;
         }
-
-        vTaskDelay(pdMS_TO_TICKS(5000));
+        if (result.have_sample)
+            scd4x_report(&result.sample, &scheduler);
+
+        int64_t wait_ms = (result.next_us - esp_timer_get_time() + 999) / 1000;
+        if (wait_ms > SCD4X_CHECK_MS)
+            wait_ms = SCD4X_CHECK_MS;
+        if (wait_ms > 0)
+            vTaskDelay(pdMS_TO_TICKS(wait_ms));
     }
 }
 
+// Returns straight away; the task waits for the sensor to power up and for
+// the first measurement while Wi-Fi and HomeKit start.
 void start_i2c_sdc4x()
 {
     ESP_LOGI(TAG, "Initializing I2C & SCD4x");
     ESP_ERROR_CHECK(i2c_master_init());
     ESP_LOGI(TAG, "Initialized I2C & SCD4x");
 
-    ESP_LOGI(TAG, "Waiting for sensor to initialize");
-    vTaskDelay(pdMS_TO_TICKS(2000));
-    ESP_LOGI(TAG, "Waited for sensor to initialize");
-
-    ESP_LOGI(TAG, "Stopping any ongoing measurements");
-    ESP_ERROR_CHECK(scd4x_stop_periodic_measurement());
-    ESP_LOGI(TAG, "Stopped any ongoing measurements");
-
-    ESP_LOGI(TAG, "Starting SCD4X periodic measurement");
-    ESP_ERROR_CHECK(scd4x_start_periodic_measurement());
-    ESP_LOGI(TAG, "Started SCD4X periodic measurement");
-
-    ESP_LOGI(TAG, "Waiting for first measurement");
-    vTaskDelay(pdMS_TO_TICKS(5000));
-    ESP_LOGI(TAG, "Waited for first measurement");
-
     ESP_LOGI(TAG, "Starting SCD4X task");
     xTaskCreate(scd4x_i2c_task, "scd4x_i2c_task", 4096, NULL, 5, NULL);
     ESP_LOGI(TAG, "Started SCD4X task");
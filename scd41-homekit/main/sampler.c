@@ -0,0 +1,74 @@
+#include "sampler.h"
+
+void sampler_start(sampler_t *s, uint32_t period_ms, int64_t now_us)
+{
+    s->nominal_ms = period_ms;
+    s->period_us = (int64_t)period_ms * 1000;
+    s->expected_us = now_us + s->period_us;
+    s->missed_us = 0;
+    s->locked_us = 0;
+    s->locked_periods = 0;
+    s->creep_ms = SAMPLER_CREEP_MS;
+    s->hits = 0;
+    s->misses = 0;
+}
+
+int64_t sampler_next_poll(const sampler_t *s)
+{
+    if (s->missed_us)
+        return s->missed_us + SAMPLER_RETRY_MS * 1000;
+    return s->expected_us;
+}
+
+// Takes the period from two moments the data was seen to get ready, as long
+// as it is within a tenth of the nominal one.
+static void measure_period(sampler_t *s, int64_t ready_us)
+{
+    if (s->locked_us && s->locked_periods)
+    {
+        int64_t period_us = (ready_us - s->locked_us) / s->locked_periods;
+        int64_t nominal_us = (int64_t)s->nominal_ms * 1000;
+        if (period_us > nominal_us - nominal_us / 10 && period_us < nominal_us + nominal_us / 10)
+            s->period_us = period_us;
+    }
+    s->locked_us = ready_us;
+    s->locked_periods = 0;
+}
+
+int64_t sampler_polled(sampler_t *s, int64_t now_us, bool ready)
+{
+    if (!ready)
+    {
+        s->missed_us = now_us;
+        s->misses++;
+        return 0;
+    }
+
+    // After a miss the data got ready between that poll and this one. A poll
+    // which finds data straight away only tells that it was at the latest
+    // now; taking the prediction then keeps the estimate from jumping
+    // around with the lateness of the task, and the next poll goes in
+    // earlier to find out.
+    int64_t ready_us;
+    if (s->missed_us)
+    {
+        ready_us = s->missed_us + (now_us - s->missed_us) / 2;
+        measure_period(s, ready_us);
+        s->creep_ms = SAMPLER_CREEP_MS;
+    }
+    else
+    {
+        ready_us = s->expected_us < now_us ? s->expected_us : now_us;
+        if (s->creep_ms < s->nominal_ms / 4)
+            s->creep_ms *= 2;
+    }
+    s->locked_periods++;
+
+    s->expected_us = ready_us + s->period_us - (int64_t)s->creep_ms * 1000;
+    // Polled so late that periods went by; the data is the latest one.
+    while (s->expected_us <= now_us)
+        s->expected_us += s->period_us;
+    s->missed_us = 0;
+    s->hits++;
+    return ready_us;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Keeps the reads in step with the measurement clock of the SCD4x, which has
+// a new measurement every 5 s (30 s in low power mode) by its own oscillator,
+// a percent or two off ours. The sampler predicts when the next one is ready
+// and polls the data ready flag then. Predictions are a little early, and
+// more so after each poll that already finds data, so that the polls close in
+// on the moment the data gets ready. A poll which finds no data is repeated
+// shortly after, which finds that moment again; the time between two such
+// moments gives the period of the sensor.
+typedef struct
+{
+    uint32_t nominal_ms;
+    // Period of the sensor as measured, in our time.
+    int64_t period_us;
+    // Predicted time the next measurement is ready.
+    int64_t expected_us;
+    // Last poll of this period which found no data, or 0.
+    int64_t missed_us;
+    // Last time the data was found to get ready between two polls, and the
+    // measurements since.
+    int64_t locked_us;
+    uint32_t locked_periods;
+    uint32_t creep_ms;
+    uint32_t hits;
+    uint32_t misses;
+} sampler_t;
+
+// Time between the polls while waiting for data that is late.
+#define SAMPLER_RETRY_MS 50
+// Least lead of a poll on the predicted moment.
+#define SAMPLER_CREEP_MS 10
+
+// Measurement was started at now_us, the first one is ready a period later.
+void sampler_start(sampler_t *s, uint32_t period_ms, int64_t now_us);
+int64_t sampler_next_poll(const sampler_t *s);
+// Takes the result of a poll at now_us. Once the data is ready, returns the
+// estimated time it got ready, and 0 before.
+int64_t sampler_polled(sampler_t *s, int64_t now_us, bool ready);
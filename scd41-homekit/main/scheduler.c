@@ -0,0 +1,241 @@
+#include "scheduler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "scd4x_i2c.h"
+
+#define PERIODIC_MS 5000
+#define LOW_POWER_MS 30000
+#define WINDOW_MS 60000
+// Trend windows the CO2 has to stay steady for before measuring less often.
+#define STEADY_WINDOWS 3
+// Wait before trying again after the sensor did not answer.
+#define RETRY_MS 1000
+
+// Typical supply currents at 3.3 V from the datasheet, in uA. A single shot
+// is charged on top of the idle current; its charge, in uA ms, is what makes
+// up the datasheet's 0.45 mA average for one shot every 5 minutes.
+#define PERIODIC_UA 15000
+#define LOW_POWER_UA 3200
+#define IDLE_UA 200
+#define SINGLE_SHOT_CHARGE (75000ULL * 1000)
+
+static uint32_t mode_current(const scheduler_t *s)
+{
+    if (!s->started)
+        return IDLE_UA;
+    switch (s->mode)
+    {
+    case SCD4X_MODE_PERIODIC:
+        return PERIODIC_UA;
+    case SCD4X_MODE_LOW_POWER:
+        return LOW_POWER_UA;
+    default:
+        return IDLE_UA;
+    }
+}
+
+static void charge_until(scheduler_t *s, int64_t now)
+{
+    if (now > s->charged_us)
+    {
+        s->charge += (uint64_t)mode_current(s) * (now - s->charged_us) / 1000;
+        s->charged_us = now;
+    }
+}
+
+void scheduler_init(scheduler_t *s, const scheduler_config_t *config, int64_t (*clock)(void))
+{
+    memset(s, 0, sizeof(*s));
+    s->config = *config;
+    s->clock = clock;
+    s->mode = config->adaptive ? SCD4X_MODE_PERIODIC : config->fixed_mode;
+    s->since_us = s->charged_us = clock();
+}
+
+static int16_t start_mode(scheduler_t *s, scd4x_mode_t mode)
+{
+    int16_t error = 0;
+
+    charge_until(s, s->clock());
+    // Periodic measurement has to be stopped before any other command, and
+    // may still be running from before a restart.
+    if (!s->started || s->mode != SCD4X_MODE_SINGLE_SHOT)
+        error = scd4x_stop_periodic_measurement();
+    s->started = false;
+    if (!error && mode == SCD4X_MODE_PERIODIC)
+        error = scd4x_start_periodic_measurement();
+    else if (!error && mode == SCD4X_MODE_LOW_POWER)
+        error = scd4x_start_low_power_periodic_measurement();
+    if (error)
+        return error;
+
+    int64_t now = s->clock();
+    charge_until(s, now);
+    if (mode != s->mode)
+        s->mode_changes++;
+    s->mode = mode;
+    s->started = true;
+    s->steady_windows = 0;
+    if (mode == SCD4X_MODE_SINGLE_SHOT)
+        s->next_shot_us = now + (int64_t)s->config.single_shot_interval_s * 1000000;
+    else
+        sampler_start(&s->sampler, mode == SCD4X_MODE_PERIODIC ? PERIODIC_MS : LOW_POWER_MS, now);
+    return 0;
+}
+
+static void read_sample(scheduler_t *s, int64_t ready_us, scheduler_result_t *result)
+{
+    scheduler_sample_t *sample = &result->sample;
+    result->error = scd4x_read_measurement(&sample->co2, &sample->temperature_m_deg_c,
+                                           &sample->humidity_m_percent_rh);
+    if (result->error)
+        return;
+    sample->ready_us = ready_us;
+    result->have_sample = true;
+}
+
+static void run_periodic(scheduler_t *s, scheduler_result_t *result)
+{
+    if (s->clock() < sampler_next_poll(&s->sampler))
+        return;
+
+    bool ready = false;
+    int16_t error = scd4x_get_data_ready_flag(&ready);
+    int64_t now = s->clock();
+    if (error)
+    {
+        // Starts over, a second from now, rather than polling a sensor that
+        // does not answer every few milliseconds.
+        sampler_start(&s->sampler, s->sampler.nominal_ms, now);
+        s->sampler.expected_us = now + RETRY_MS * 1000;
+        result->error = error;
+        return;
+    }
+
+    int64_t ready_us = sampler_polled(&s->sampler, now, ready);
+    if (ready_us)
+        read_sample(s, ready_us, result);
+}
+
+static void run_single_shot(scheduler_t *s, scheduler_result_t *result)
+{
+    int64_t now = s->clock();
+    if (now < s->next_shot_us)
+        return;
+
+    s->next_shot_us = now + (int64_t)s->config.single_shot_interval_s * 1000000;
+    result->error = scd4x_measure_single_shot();
+    if (result->error)
+        return;
+    s->charge += SINGLE_SHOT_CHARGE;
+    read_sample(s, s->clock(), result);
+}
+
+// Returns true when a trend window has been completed.
+static bool update_trend(scheduler_t *s, const scheduler_sample_t *sample)
+{
+    if (!s->have_window)
+    {
+        s->have_window = true;
+        s->window_co2 = sample->co2;
+        s->window_us = sample->ready_us;
+        return false;
+    }
+
+    int64_t window_us = sample->ready_us - s->window_us;
+    if (window_us < WINDOW_MS * 1000LL)
+        return false;
+
+    s->rate_ppm_per_min = ((int64_t)sample->co2 - s->window_co2) * 60000000LL / window_us;
+    s->window_co2 = sample->co2;
+    s->window_us = sample->ready_us;
+    return true;
+}
+
+static scd4x_mode_t choose_mode(scheduler_t *s)
+{
+    int32_t rise = s->config.rise_ppm_per_min;
+
+    if (s->rate_ppm_per_min >= rise)
+    {
+        s->steady_windows = 0;
+        return SCD4X_MODE_PERIODIC;
+    }
+    // Falling fast, as when airing the room, or rising slowly: stay, but
+    // take a closer look at a rise which a single shot only caught part of.
+    if (abs(s->rate_ppm_per_min) * 2 >= rise)
+    {
+        s->steady_windows = 0;
+        if (s->mode == SCD4X_MODE_SINGLE_SHOT && s->rate_ppm_per_min > 0)
+            return SCD4X_MODE_LOW_POWER;
+        return s->mode;
+    }
+    if (++s->steady_windows < STEADY_WINDOWS)
+        return s->mode;
+    return s->mode == SCD4X_MODE_PERIODIC ? SCD4X_MODE_LOW_POWER : SCD4X_MODE_SINGLE_SHOT;
+}
+
+void scheduler_run(scheduler_t *s, bool subscribed, scheduler_result_t *result)
+{
+    memset(result, 0, sizeof(*result));
+    charge_until(s, s->clock());
+
+    if (!s->started)
+    {
+        result->error = start_mode(s, s->mode);
+    }
+    else
+    {
+        // A controller listening gets a reading every 5 s straight away.
+        if (s->config.adaptive && subscribed && s->mode != SCD4X_MODE_PERIODIC)
+            result->error = start_mode(s, SCD4X_MODE_PERIODIC);
+
+        if (s->started && s->mode == SCD4X_MODE_SINGLE_SHOT)
+            run_single_shot(s, result);
+        else if (s->started)
+            run_periodic(s, result);
+
+        if (result->have_sample && update_trend(s, &result->sample) && s->config.adaptive)
+        {
+            scd4x_mode_t mode = subscribed ? SCD4X_MODE_PERIODIC : choose_mode(s);
+            if (mode != s->mode)
+                result->error = start_mode(s, mode);
+        }
+    }
+
+    if (!s->started)
+        result->next_us = s->clock() + RETRY_MS * 1000;
+    else if (s->mode == SCD4X_MODE_SINGLE_SHOT)
+        result->next_us = s->next_shot_us;
+    else
+        result->next_us = sampler_next_poll(&s->sampler);
+}
+
+scd4x_mode_t scheduler_get_mode(const scheduler_t *s)
+{
+    return s->mode;
+}
+
+const char *scheduler_mode_name(scd4x_mode_t mode)
+{
+    switch (mode)
+    {
+    case SCD4X_MODE_PERIODIC:
+        return "periodic";
+    case SCD4X_MODE_LOW_POWER:
+        return "low power periodic";
+    case SCD4X_MODE_SINGLE_SHOT:
+        return "single shot";
+    }
+    return "unknown";
+}
+
+uint32_t scheduler_get_average_current(scheduler_t *s)
+{
+    int64_t now = s->clock();
+    charge_until(s, now);
+    int64_t elapsed_ms = (now - s->since_us) / 1000;
+    return elapsed_ms > 0 ? s->charge / elapsed_ms : mode_current(s);
+}
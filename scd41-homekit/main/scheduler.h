@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sampler.h"
+
+// Picks how the SCD4x measures. While the room is stable the sensor idles
+// between single shots every few minutes, which takes a few percent of the
+// current of measuring every 5 s. It measures every 5 s again as soon as the
+// CO2 rises fast or a controller subscribes to the readings, and steps back
+// down through the 30 s low power mode once the CO2 has been steady for a
+// few minutes.
+//
+// Only talks to the sensor through the driver, so that it can run on the
+// host against a mocked I2C HAL.
+typedef enum
+{
+    SCD4X_MODE_PERIODIC,
+    SCD4X_MODE_LOW_POWER,
+    SCD4X_MODE_SINGLE_SHOT,
+} scd4x_mode_t;
+
+typedef struct
+{
+    bool adaptive;
+    // The one mode used when not adaptive.
+    scd4x_mode_t fixed_mode;
+    uint32_t single_shot_interval_s;
+    // Rise of the CO2, in ppm per minute, from which it measures every 5 s.
+    uint32_t rise_ppm_per_min;
+} scheduler_config_t;
+
+typedef struct
+{
+    uint16_t co2;
+    int32_t temperature_m_deg_c;
+    int32_t humidity_m_percent_rh;
+    // Estimated time the sensor had the measurement.
+    int64_t ready_us;
+} scheduler_sample_t;
+
+typedef struct
+{
+    // Error of the driver, 0 if none.
+    int16_t error;
+    bool have_sample;
+    scheduler_sample_t sample;
+    // Time scheduler_run() has something to do next.
+    int64_t next_us;
+} scheduler_result_t;
+
+typedef struct
+{
+    scheduler_config_t config;
+    int64_t (*clock)(void);
+    scd4x_mode_t mode;
+    // Whether the sensor was set up for the mode.
+    bool started;
+    sampler_t sampler;
+    int64_t next_shot_us;
+    // The CO2 trend is taken over windows of at least a minute.
+    bool have_window;
+    uint16_t window_co2;
+    int64_t window_us;
+    int32_t rate_ppm_per_min;
+    uint32_t steady_windows;
+    uint32_t mode_changes;
+    // Charge drawn by the sensor since since_us, in uA ms.
+    uint64_t charge;
+    int64_t since_us;
+    int64_t charged_us;
+} scheduler_t;
+
+void scheduler_init(scheduler_t *s, const scheduler_config_t *config, int64_t (*clock)(void));
+// Does what is due, which may be to wait for the driver for up to 5 s, and
+// says when to call again. A subscribed controller is only noticed when
+// called, so a caller waiting for a single shot minutes away should call
+// again every few seconds.
+void scheduler_run(scheduler_t *s, bool subscribed, scheduler_result_t *result);
+scd4x_mode_t scheduler_get_mode(const scheduler_t *s);
+const char *scheduler_mode_name(scd4x_mode_t mode);
+// Average current of the sensor since the start, in uA.
+uint32_t scheduler_get_average_current(scheduler_t *s);
@@ -0,0 +1,241 @@
+/*
+ * Host test of the SCD4x measurement scheduler against the mocked I2C HAL.
+ *
+ * Build and run with "make test" in this directory.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mock_i2c_hal.h"
+#include "scheduler.h"
+
+#define SEC ((int64_t)1000000)
+#define MIN (60 * SEC)
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+typedef struct {
+    uint32_t samples;
+    uint32_t errors;
+    int64_t max_latency_us;
+    int64_t last_sample_us;
+    int64_t min_gap_us;
+    int64_t max_gap_us;
+} stats_t;
+
+static scheduler_t scheduler;
+static bool subscribed;
+
+/* Runs the scheduler the way the sensor task does, until the clock reaches
+ * end_us or the mode becomes until_mode. Waking up takes a millisecond.
+ */
+static void run(int64_t end_us, int until_mode, stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->min_gap_us = INT64_MAX;
+    while (mock.now_us < end_us) {
+        scheduler_result_t result;
+        scheduler_run(&scheduler, subscribed, &result);
+        if (result.error)
+            stats->errors++;
+        if (result.have_sample) {
+            int64_t latency = mock.now_us - mock.measured_us;
+            if (latency > stats->max_latency_us)
+                stats->max_latency_us = latency;
+            if (stats->samples) {
+                int64_t gap = mock.measured_us - stats->last_sample_us;
+                if (gap < stats->min_gap_us)
+                    stats->min_gap_us = gap;
+                if (gap > stats->max_gap_us)
+                    stats->max_gap_us = gap;
+            }
+            stats->last_sample_us = mock.measured_us;
+            stats->samples++;
+        }
+        if (scheduler.started && (int)scheduler_get_mode(&scheduler) == until_mode)
+            return;
+
+        int64_t next = result.next_us;
+        if (next > mock.now_us + 5 * SEC)
+            next = mock.now_us + 5 * SEC;
+        if (next > mock.now_us)
+            mock.now_us = next;
+        mock.now_us += 1000;
+    }
+}
+
+static void start(bool adaptive, scd4x_mode_t fixed_mode, double drift)
+{
+    const scheduler_config_t config = {
+        .adaptive = adaptive,
+        .fixed_mode = fixed_mode,
+        .single_shot_interval_s = 300,
+        .rise_ppm_per_min = 30,
+    };
+    mock_reset();
+    mock.drift = drift;
+    subscribed = false;
+    scheduler_init(&scheduler, &config, mock_clock);
+}
+
+/* The periodic modes read each measurement once, soon after it is ready,
+ * also with the sensor's clock off from ours.
+ */
+static void test_fixed(void)
+{
+    const double drifts[] = {-0.02, 0.0, 0.015};
+    stats_t stats;
+
+    for (int i = 0; i < 3; i++) {
+        start(false, SCD4X_MODE_PERIODIC, drifts[i]);
+        int64_t start_us = mock.now_us;
+        run(61 * MIN, -1, &stats);
+        double period = 5 * SEC * (1 + drifts[i]);
+        uint32_t expected = (mock.now_us - start_us) / period - 1;
+        printf("periodic, drift %+.3f: %" PRIu32 " samples, %" PRIu32 " polls, "
+               "latency up to %" PRId64 " ms\n", drifts[i], stats.samples, mock.polls,
+               stats.max_latency_us / 1000);
+        CHECK(stats.samples >= expected && stats.samples <= expected + 2);
+        CHECK(stats.max_gap_us < period + 1000);
+        CHECK(stats.max_latency_us < 300000);
+        CHECK(mock.polls < stats.samples * 2);
+        CHECK(scheduler_get_mode(&scheduler) == SCD4X_MODE_PERIODIC);
+        CHECK(stats.errors == 0 && mock.bad_commands == 0);
+    }
+
+    start(false, SCD4X_MODE_LOW_POWER, 0.01);
+    run(61 * MIN, -1, &stats);
+    CHECK(stats.samples >= 118 && stats.samples <= 121);
+    CHECK(stats.max_latency_us < 300000);
+    CHECK(mock.bad_commands == 0);
+    uint32_t current = scheduler_get_average_current(&scheduler);
+    CHECK(current > 3000 && current < 3300);
+}
+
+static uint16_t co2_steady(int64_t us)
+{
+    /* Sensor noise of a few ppm */
+    return 600 + (us / SEC) % 7;
+}
+
+static int64_t ramp_start_us;
+
+static uint16_t co2_ramp(int64_t us)
+{
+    if (us < ramp_start_us)
+        return co2_steady(us);
+    return co2_steady(us) + (us - ramp_start_us) * 100 / MIN;
+}
+
+static void test_adaptive(void)
+{
+    stats_t stats;
+
+    start(true, SCD4X_MODE_PERIODIC, 0.01);
+    mock.co2 = co2_steady;
+
+    /* Steps down while the CO2 stays put */
+    run(mock.now_us + 10 * MIN, SCD4X_MODE_LOW_POWER, &stats);
+    printf("adaptive: low power after %" PRId64 " s\n", mock.now_us / SEC);
+    CHECK(scheduler_get_mode(&scheduler) == SCD4X_MODE_LOW_POWER);
+    CHECK(mock.now_us < 5 * MIN);
+    run(mock.now_us + 10 * MIN, SCD4X_MODE_SINGLE_SHOT, &stats);
+    printf("adaptive: single shot after %" PRId64 " s\n", mock.now_us / SEC);
+    CHECK(scheduler_get_mode(&scheduler) == SCD4X_MODE_SINGLE_SHOT);
+    CHECK(mock.now_us < 9 * MIN);
+
+    /* and stays there, with a shot every 5 minutes */
+    run(2 * 60 * MIN, -1, &stats);
+    uint32_t current = scheduler_get_average_current(&scheduler);
+    printf("adaptive: %" PRIu32 " shots, %" PRIu32 " uA on average over 2 hours\n",
+           mock.shots, current);
+    CHECK(scheduler_get_mode(&scheduler) == SCD4X_MODE_SINGLE_SHOT);
+    CHECK(stats.min_gap_us >= 300 * SEC && stats.max_gap_us < 306 * SEC);
+    CHECK(current < 1200);
+
+    /* A rise of 100 ppm a minute goes back to 5 s within one shot */
+    ramp_start_us = mock.now_us;
+    mock.co2 = co2_ramp;
+    run(mock.now_us + 20 * MIN, SCD4X_MODE_PERIODIC, &stats);
+    printf("adaptive: periodic %" PRId64 " s into the rise\n", (mock.now_us - ramp_start_us) / SEC);
+    CHECK(scheduler_get_mode(&scheduler) == SCD4X_MODE_PERIODIC);
+    CHECK(mock.now_us - ramp_start_us <= 306 * SEC);
+
+    /* and stays at it while the CO2 climbs */
+    run(mock.now_us + 10 * MIN, SCD4X_MODE_LOW_POWER, &stats);
+    CHECK(scheduler_get_mode(&scheduler) == SCD4X_MODE_PERIODIC);
+    CHECK(stats.samples >= 118);
+    CHECK(stats.errors == 0 && mock.bad_commands == 0);
+}
+
+static void test_subscribed(void)
+{
+    stats_t stats;
+
+    start(true, SCD4X_MODE_PERIODIC, 0.0);
+    mock.co2 = co2_steady;
+    run(mock.now_us + 20 * MIN, SCD4X_MODE_SINGLE_SHOT, &stats);
+    CHECK(scheduler_get_mode(&scheduler) == SCD4X_MODE_SINGLE_SHOT);
+
+    /* A controller subscribing is noticed within the 5 s the task sleeps */
+    int64_t subscribed_us = mock.now_us + 37 * SEC;
+    run(subscribed_us, -1, &stats);
+    subscribed = true;
+    run(mock.now_us + 10 * MIN, SCD4X_MODE_PERIODIC, &stats);
+    CHECK(scheduler_get_mode(&scheduler) == SCD4X_MODE_PERIODIC);
+    CHECK(mock.now_us - subscribed_us <= 5 * SEC + 5000);
+
+    /* and it stays at 5 s while subscribed, steady or not */
+    run(mock.now_us + 30 * MIN, SCD4X_MODE_LOW_POWER, &stats);
+    CHECK(scheduler_get_mode(&scheduler) == SCD4X_MODE_PERIODIC);
+    CHECK(mock.bad_commands == 0);
+}
+
+/* A sensor that stops answering for a while is picked up again */
+static void test_errors(void)
+{
+    stats_t stats;
+
+    start(false, SCD4X_MODE_PERIODIC, 0.0);
+    run(mock.now_us + 2 * MIN, -1, &stats);
+    uint32_t before = stats.samples;
+
+    mock.fail = 5;
+    run(mock.now_us + 2 * MIN, -1, &stats);
+    CHECK(stats.errors > 0);
+    CHECK(stats.samples >= before - 2);
+    printf("errors: %" PRIu32 " samples, %" PRIu32 " before\n", stats.samples, before);
+    CHECK(mock.bad_commands == 0);
+
+    /* also when starting */
+    start(true, SCD4X_MODE_PERIODIC, 0.0);
+    mock.fail = 3;
+    run(mock.now_us + 2 * MIN, -1, &stats);
+    CHECK(stats.errors == 3);
+    CHECK(stats.samples >= 20);
+    CHECK(mock.bad_commands == 0);
+}
+
+int main(int argc, char **argv)
+{
+    test_fixed();
+    test_adaptive();
+    test_subscribed();
+    test_errors();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return -1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <string.h>
+
+#include "mock_i2c_hal.h"
+#include "sensirion_i2c.h"
+#include "sensirion_i2c_hal.h"
+
+#define MOCK_IDLE 0
+#define MOCK_PERIODIC 1
+#define MOCK_LOW_POWER 2
+
+mock_scd4x_t mock;
+
+void mock_reset(void)
+{
+    memset(&mock, 0, sizeof(mock));
+    mock.now_us = 1000000;
+}
+
+int64_t mock_clock(void)
+{
+    return mock.now_us;
+}
+
+static int64_t period_us(void)
+{
+    return (int64_t)((mock.mode == MOCK_LOW_POWER ? 30000000 : 5000000) * (1 + mock.drift));
+}
+
+/* Index of the latest periodic measurement, 0 before the first */
+static long latest_index(void)
+{
+    return (mock.now_us - mock.started_us) / period_us();
+}
+
+int16_t sensirion_i2c_hal_select_bus(uint8_t bus_idx)
+{
+    return 0;
+}
+
+void sensirion_i2c_hal_init(void)
+{
+}
+
+void sensirion_i2c_hal_free(void)
+{
+}
+
+int8_t sensirion_i2c_hal_write(uint8_t address, const uint8_t *data, uint16_t count)
+{
+    if (mock.fail) {
+        mock.fail--;
+        return -1;
+    }
+
+    uint16_t cmd = data[0] << 8 | data[1];
+    bool periodic = mock.mode != MOCK_IDLE;
+    mock.cmd = cmd;
+    switch (cmd) {
+    case 0x21B1: /* start_periodic_measurement */
+    case 0x21AC: /* start_low_power_periodic_measurement */
+        if (periodic)
+            break;
+        mock.mode = cmd == 0x21B1 ? MOCK_PERIODIC : MOCK_LOW_POWER;
+        mock.started_us = mock.now_us;
+        mock.read_index = 0;
+        return 0;
+    case 0x3F86: /* stop_periodic_measurement */
+        mock.mode = MOCK_IDLE;
+        return 0;
+    case 0x219D: /* measure_single_shot */
+        if (periodic)
+            break;
+        mock.shot_ready_us = mock.now_us + 5000000;
+        mock.shots++;
+        return 0;
+    case 0xE4B8: /* get_data_ready_status */
+        mock.polls++;
+        return 0;
+    case 0xEC05: /* read_measurement */
+        return 0;
+    }
+    mock.bad_commands++;
+    return -1;
+}
+
+static void put_word(uint8_t *data, uint16_t word)
+{
+    data[0] = word >> 8;
+    data[1] = word;
+    data[2] = sensirion_i2c_generate_crc(data, 2);
+}
+
+int8_t sensirion_i2c_hal_read(uint8_t address, uint8_t *data, uint16_t count)
+{
+    if (mock.fail) {
+        mock.fail--;
+        return -1;
+    }
+
+    bool ready;
+    int64_t measured_us;
+    if (mock.mode != MOCK_IDLE) {
+        long index = latest_index();
+        ready = index > mock.read_index;
+        measured_us = mock.started_us + index * period_us();
+    } else {
+        ready = mock.shot_ready_us && mock.now_us >= mock.shot_ready_us;
+        measured_us = mock.shot_ready_us;
+    }
+
+    if (mock.cmd == 0xE4B8 && count == 3) {
+        put_word(data, ready ? 0x8006 : 0x8000);
+        return 0;
+    }
+    if (mock.cmd == 0xEC05 && count == 9 && ready) {
+        /* 22 °C and 45 %RH */
+        put_word(data, mock.co2 ? mock.co2(measured_us) : 600);
+        put_word(data + 3, 25090);
+        put_word(data + 6, 29491);
+        if (mock.mode != MOCK_IDLE)
+            mock.read_index = latest_index();
+        else
+            mock.shot_ready_us = 0;
+        mock.measured_us = measured_us;
+        mock.reads++;
+        return 0;
+    }
+    mock.bad_commands++;
+    return -1;
+}
+
+void sensirion_i2c_hal_sleep_usec(uint32_t useconds)
+{
+    mock.now_us += useconds;
+}
@@ -0,0 +1,38 @@
+/*
+ * Mocked I2C HAL for the host tests, with an SCD41 on the other end. Time is
+ * simulated: the driver's sleeps move the clock on, and the sensor keeps its
+ * own measurement clock, which may run off from ours.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    int64_t now_us;
+    /* Fraction the sensor's period is off from the nominal one */
+    double drift;
+    /* CO2 the sensor measures at a time */
+    uint16_t (*co2)(int64_t us);
+    /* Number of transfers to fail from now on */
+    int fail;
+
+    /* Emulated sensor */
+    int mode;
+    int64_t started_us;
+    long read_index;
+    int64_t shot_ready_us;
+    uint16_t cmd;
+
+    /* What happened */
+    int64_t measured_us;    /* time of the measurement last read */
+    uint32_t polls;
+    uint32_t reads;
+    uint32_t shots;
+    uint32_t bad_commands;
+} mock_scd4x_t;
+
+extern mock_scd4x_t mock;
+
+void mock_reset(void);
+int64_t mock_clock(void);
@@ -1480,3 +1480,41 @@ hap_char_t *hap_char_air_particulate_size_create(uint8_t air_particulate_size)
 
     return hc;
 }
+
+/* Char: Characteristic Value Transition Control */
+hap_char_t *hap_char_characteristic_value_transition_control_create(hap_tlv8_val_t *transition_control)
+{
+    hap_char_t *hc = hap_char_tlv8_create(HAP_CHAR_UUID_CHARACTERISTIC_VALUE_TRANSITION_CONTROL,
+                                          HAP_CHAR_PERM_PR | HAP_CHAR_PERM_PW | HAP_CHAR_PERM_WR, transition_control);
+    if (!hc) {
+        return NULL;
+    }
+
+    return hc;
+}
+
+/* Char: Supported Characteristic Value Transition Configuration */
+hap_char_t *hap_char_supported_characteristic_value_transition_configuration_create(hap_tlv8_val_t *supported_config)
+{
+    hap_char_t *hc = hap_char_tlv8_create(HAP_CHAR_UUID_SUPPORTED_CHARACTERISTIC_VALUE_TRANSITION_CONFIGURATION,
+                                          HAP_CHAR_PERM_PR , supported_config);
+    if (!hc) {
+        return NULL;
+    }
+
+    return hc;
+}
+
+/* Char: Characteristic Value Active Transition Count */
+hap_char_t *hap_char_characteristic_value_active_transition_count_create(uint8_t active_transition_count)
+{
+    hap_char_t *hc = hap_char_uint8_create(HAP_CHAR_UUID_CHARACTERISTIC_VALUE_ACTIVE_TRANSITION_COUNT,
+                                           HAP_CHAR_PERM_PR | HAP_CHAR_PERM_EV , active_transition_count);
+    if (!hc) {
+        return NULL;
+    }
+
+    hap_char_int_set_constraints(hc, 0, 255, 1);
+
+    return hc;
+}
@@ -162,6 +162,13 @@ typedef struct {
 /** Characteristic supports write response */
 #define HAP_CHAR_PERM_WR        (1 << 7)
 
+/** Characteristic value is saved to flash and restored at hap_start().
+ * Not a HAP permission, so it is not reported to controllers. Changes are
+ * collected and saved together once they stop for CONFIG_HAP_CHAR_PERSIST_DELAY_MS,
+ * or on a restart. Supported for bool, int, uint8, uint16, uint32 and float.
+ */
+#define HAP_CHAR_PERM_PERSIST   (1 << 8)
+
 /** HAP object handle */
 typedef size_t                  hap_handle_t;
 
@@ -857,6 +864,19 @@ hap_char_t *hap_serv_get_first_char(hap_serv_t *hs);
  */
 uint32_t hap_char_get_iid(hap_char_t *hc);
 
+/**
+ * @brief Check if any controller has enabled event notifications for a characteristic
+ *
+ * This is useful for sensors which can save power by measuring less often
+ * while no controller is listening for changes.
+ *
+ * @param[in] hc HAP Characteristic Object handle
+ *
+ * @return true if at least one controller session is subscribed
+ * @return false otherwise
+ */
+bool hap_char_has_subscribers(hap_char_t *hc);
+
 /**
  * @brief Get the type UUID for the given characteristic
  *
@@ -970,6 +990,18 @@ void hap_char_add_description(hap_char_t *hc, const char *description);
  */
 void hap_char_add_unit(hap_char_t *hc, const char *unit);
 
+/**
+ * @brief Set or clear the persistent flag of a Characteristic
+ *
+ * Same as creating the characteristic with HAP_CHAR_PERM_PERSIST, for
+ * characteristics created by the helpers of the Apple profiles.
+ * Should be called before hap_start(), for the saved value to be restored.
+ *
+ * @param[in] hc HAP Characteristic Object handle
+ * @param[in] persistent true to save and restore the value, false otherwise
+ */
+void hap_char_set_persistent(hap_char_t *hc, bool persistent);
+
 /**
  * @brief Add Valid Values for Characteristic
  *
@@ -22,6 +22,8 @@
  *
  */
 #include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <esp_wifi.h>
 #include <hap_platform_memory.h>
 #include <esp_hap_acc.h>
@@ -37,8 +39,182 @@
 /* Primary Accessory Pointer */
 static __hap_acc_t *primary_acc;
 
+/* Sorted (aid, iid) index of all the characteristics in the database, so that
+ * lookups for GET/PUT /characteristics do not have to walk all the accessory,
+ * service and characteristic lists. It is marked invalid on any change in the
+ * database and rebuilt lazily on the next lookup.
+ *
+ * Lookups come from the httpd task, but also from application tasks through
+ * hap_acc_get_by_aid() and from restoring persistent values, while bridged
+ * accessories can be added or removed from yet another task. The mutex
+ * keeps a rebuild from freeing the index under a lookup.
+ */
+typedef struct {
+    uint32_t aid;
+    uint32_t iid;
+    hap_char_t *hc;
+} hap_char_index_entry_t;
+
+static hap_char_index_entry_t *hap_char_index;
+static int hap_char_index_cnt;
+static bool hap_char_index_valid;
+static SemaphoreHandle_t hap_char_index_mutex;
+
+/* Incremented on every change to the attribute database, so that cached
+ * representations of it can detect that they are stale.
+ */
+static uint32_t hap_acc_db_gen;
+
 /*****************************************************************************************************/
 
+void hap_acc_db_mark_changed(void)
+{
+    hap_acc_db_gen++;
+}
+
+uint32_t hap_acc_db_get_gen(void)
+{
+    return hap_acc_db_gen;
+}
+
+int hap_acc_index_init(void)
+{
+    if (!hap_char_index_mutex) {
+        hap_char_index_mutex = xSemaphoreCreateMutex();
+        if (!hap_char_index_mutex) {
+            return HAP_FAIL;
+        }
+    }
+    return HAP_SUCCESS;
+}
+
+static void hap_char_index_lock(void)
+{
+    if (hap_char_index_mutex) {
+        xSemaphoreTake(hap_char_index_mutex, portMAX_DELAY);
+    }
+}
+
+static void hap_char_index_unlock(void)
+{
+    if (hap_char_index_mutex) {
+        xSemaphoreGive(hap_char_index_mutex);
+    }
+}
+
+void hap_acc_index_invalidate(void)
+{
+    /* Waits for a rebuild in progress, which may have walked the lists
+     * before the change, so that it cannot mark the index valid after this.
+     */
+    hap_char_index_lock();
+    hap_char_index_valid = false;
+    hap_char_index_unlock();
+    hap_acc_db_mark_changed();
+}
+
+static int hap_char_index_cmp(const void *a, const void *b)
+{
+    const hap_char_index_entry_t *e1 = a;
+    const hap_char_index_entry_t *e2 = b;
+    if (e1->aid != e2->aid) {
+        return e1->aid < e2->aid ? -1 : 1;
+    }
+    if (e1->iid != e2->iid) {
+        return e1->iid < e2->iid ? -1 : 1;
+    }
+    return 0;
+}
+
+static int hap_char_index_build(void)
+{
+    int cnt = 0;
+    __hap_acc_t *_ha;
+    hap_serv_t *hs;
+    hap_char_t *hc;
+    for (_ha = primary_acc; _ha; _ha = _ha->next) {
+        for (hs = _ha->servs; hs; hs = hap_serv_get_next(hs)) {
+            for (hc = hap_serv_get_first_char(hs); hc; hc = hap_char_get_next(hc)) {
+                cnt++;
+            }
+        }
+    }
+    if (hap_char_index) {
+        hap_platform_memory_free(hap_char_index);
+        hap_char_index = NULL;
+        hap_char_index_cnt = 0;
+    }
+    if (cnt) {
+        hap_char_index = hap_platform_memory_malloc(cnt * sizeof(hap_char_index_entry_t));
+        if (!hap_char_index) {
+            ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Failed to allocate characteristics index");
+            return HAP_FAIL;
+        }
+    }
+    int i = 0;
+    for (_ha = primary_acc; _ha; _ha = _ha->next) {
+        for (hs = _ha->servs; hs; hs = hap_serv_get_next(hs)) {
+            for (hc = hap_serv_get_first_char(hs); hc; hc = hap_char_get_next(hc)) {
+                hap_char_index[i].aid = _ha->aid;
+                hap_char_index[i].iid = ((__hap_char_t *)hc)->iid;
+                hap_char_index[i].hc = hc;
+                i++;
+            }
+        }
+    }
+    hap_char_index_cnt = cnt;
+    qsort(hap_char_index, hap_char_index_cnt, sizeof(hap_char_index_entry_t), hap_char_index_cmp);
+    hap_char_index_valid = true;
+    return HAP_SUCCESS;
+}
+
+/* Returns the position of the first index entry which is not less than (aid, iid) */
+static int hap_char_index_lower_bound(uint32_t aid, uint32_t iid)
+{
+    int lo = 0, hi = hap_char_index_cnt;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        hap_char_index_entry_t *e = &hap_char_index[mid];
+        if (e->aid < aid || (e->aid == aid && e->iid < iid)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* To be called with the index locked */
+static bool hap_char_index_ready(void)
+{
+    if (!hap_char_index_valid) {
+        if (hap_char_index_build() != HAP_SUCCESS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief get target characteristics by AID and IID
+ */
+hap_char_t *hap_get_char_by_aid_iid(int32_t aid, int32_t iid)
+{
+    hap_char_t *hc = NULL;
+    hap_char_index_lock();
+    if (!hap_char_index_ready()) {
+        hap_char_index_unlock();
+        return hap_acc_get_char_by_iid(hap_acc_get_by_aid(aid), iid);
+    }
+    int pos = hap_char_index_lower_bound(aid, iid);
+    if (pos < hap_char_index_cnt && hap_char_index[pos].aid == (uint32_t)aid
+            && hap_char_index[pos].iid == (uint32_t)iid) {
+        hc = hap_char_index[pos].hc;
+    }
+    hap_char_index_unlock();
+    return hc;
+}
+
 hap_acc_t *hap_get_first_acc()
 {
     return (hap_acc_t *)primary_acc;
@@ -332,6 +508,7 @@ int hap_acc_add_serv(hap_acc_t *ha, hap_serv_t *hs)
 		_hc = (__hap_char_t *)_hc->next_char;
 	}
     _hs->parent = ha;
+    hap_acc_index_invalidate();
     return 0;
 }
 
@@ -387,6 +564,7 @@ void hap_add_accessory(hap_acc_t *ha)
     __hap_acc_t *_ha = (__hap_acc_t *)ha;
     _ha->aid = 1;
     primary_acc = _ha;
+    hap_acc_index_invalidate();
     if (hap_priv.cfg.unique_param >= UNIQUE_NAME) {
         char name[74];
         uint8_t eth_mac[6];
@@ -414,6 +592,7 @@ void hap_add_bridged_accessory(hap_acc_t *ha, int aid)
     }
 
     hap_add_acc_to_list(primary_acc, _ha);
+    hap_acc_index_invalidate();
     if (!hap_priv.cfg.disable_config_num_update) {
         hap_update_config_number();
     }
@@ -426,6 +605,7 @@ void hap_remove_bridged_accessory(hap_acc_t *ha)
     } else {
         if (ha) {
             hap_remove_acc_from_list(primary_acc, (__hap_acc_t *)ha);
+            hap_acc_index_invalidate();
             if (!hap_priv.cfg.disable_config_num_update) {
                 hap_update_config_number();
             }
@@ -443,6 +623,7 @@ void hap_acc_delete(hap_acc_t *ha)
 	 */
 	if (!ha)
 		return;
+	hap_acc_index_invalidate();
 	__hap_acc_t *_ha = (__hap_acc_t *)ha;
 	__hap_serv_t *_hs = (__hap_serv_t *)_ha->servs;
 	while (_hs) {
@@ -481,6 +662,20 @@ void hap_delete_all_accessories(void)
  */
 hap_acc_t *hap_acc_get_by_aid(int32_t aid)
 {
+    /* Every accessory has at least the Accessory Information characteristics,
+     * so the first index entry with this aid leads to the accessory.
+     */
+    hap_char_index_lock();
+    if (hap_char_index_ready()) {
+        hap_acc_t *ha = NULL;
+        int pos = hap_char_index_lower_bound(aid, 0);
+        if (pos < hap_char_index_cnt && hap_char_index[pos].aid == (uint32_t)aid) {
+            ha = hap_serv_get_parent(hap_char_get_parent(hap_char_index[pos].hc));
+        }
+        hap_char_index_unlock();
+        return ha;
+    }
+    hap_char_index_unlock();
 	hap_acc_t *ha;
 	for (ha = hap_get_first_acc(); ha; ha = hap_acc_get_next(ha)) {
         if (((__hap_acc_t *)ha)->aid == aid) {
@@ -0,0 +1,239 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2020 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <sodium/crypto_scalarmult_curve25519.h>
+#include <sodium/utils.h>
+#include <mu_srp.h>
+#include <hap.h>
+
+#include <esp_mfi_debug.h>
+#include <esp_mfi_rand.h>
+#include <esp_hap_controllers.h>
+#include <esp_hap_ephemeral.h>
+
+/* Pair verify, on every reconnection of a controller, and pair setup both
+ * start by generating an ephemeral secret and its public key. A few of them
+ * are generated ahead, by a task at a lower priority than anything else of
+ * HomeKit, so that the handshakes find them ready. SRP ones are only kept
+ * while the accessory is not paired, as there is no pair setup otherwise.
+ */
+#ifdef CONFIG_HAP_EPHEMERAL_POOL_SIZE
+#define HAP_EPHEMERAL_POOL_SIZE     CONFIG_HAP_EPHEMERAL_POOL_SIZE
+#else
+#define HAP_EPHEMERAL_POOL_SIZE     4
+#endif
+#define HAP_EPHEMERAL_SRP_POOL_SIZE 1
+#define HAP_EPHEMERAL_TASK_STACK    (4 * 1024)
+#define HAP_EPHEMERAL_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+
+typedef struct {
+    uint8_t sk[CURVE_KEY_LEN];
+    uint8_t pk[CURVE_KEY_LEN];
+} hap_curve_ephemeral_t;
+
+typedef struct {
+    uint8_t b[HAP_SRP_B_LEN];
+    uint8_t gb[HAP_SRP_GB_LEN];
+} hap_srp_ephemeral_t;
+
+#if HAP_EPHEMERAL_POOL_SIZE > 0
+static hap_curve_ephemeral_t hap_curve_pool[HAP_EPHEMERAL_POOL_SIZE];
+static hap_srp_ephemeral_t hap_srp_pool[HAP_EPHEMERAL_SRP_POOL_SIZE];
+static int hap_curve_pool_count;
+static int hap_srp_pool_count;
+static SemaphoreHandle_t hap_ephemeral_lock;
+static TaskHandle_t hap_ephemeral_task_handle;
+#endif
+
+static int hap_gen_curve25519(hap_curve_ephemeral_t *e)
+{
+    /* This particular value of basepoint is required to generate the public key
+     * from secret key
+     */
+    static const uint8_t basepoint[32] = {9};
+    esp_mfi_get_random(e->sk, sizeof(e->sk));
+    if (crypto_scalarmult_curve25519(e->pk, e->sk, basepoint) == -1) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Curve25519 Error");
+        return HAP_FAIL;
+    }
+    return HAP_SUCCESS;
+}
+
+/* b and g^b left padded to their full lengths */
+static int hap_gen_srp(hap_srp_ephemeral_t *e)
+{
+    char *bytes_b, *bytes_gb;
+    int len_b, len_gb;
+    if (mu_srp_gen_ephemeral(&bytes_b, &len_b, &bytes_gb, &len_gb) < 0) {
+        return HAP_FAIL;
+    }
+    int ret = HAP_FAIL;
+    if ((size_t)len_b <= sizeof(e->b) && (size_t)len_gb <= sizeof(e->gb)) {
+        memset(e, 0, sizeof(*e));
+        memcpy(e->b + sizeof(e->b) - len_b, bytes_b, len_b);
+        memcpy(e->gb + sizeof(e->gb) - len_gb, bytes_gb, len_gb);
+        ret = HAP_SUCCESS;
+    }
+    sodium_memzero(bytes_b, len_b);
+    free(bytes_b);
+    free(bytes_gb);
+    return ret;
+}
+
+#if HAP_EPHEMERAL_POOL_SIZE > 0
+static void hap_ephemeral_refill()
+{
+    hap_curve_ephemeral_t curve;
+    hap_srp_ephemeral_t srp;
+
+    /* Generated out of the lock, so that a handshake never waits for it.
+     * Only this task adds to the pools, so the room it saw stays there.
+     */
+    while (1) {
+        xSemaphoreTake(hap_ephemeral_lock, portMAX_DELAY);
+        bool need_curve = hap_curve_pool_count < HAP_EPHEMERAL_POOL_SIZE;
+        bool need_srp = hap_srp_pool_count < HAP_EPHEMERAL_SRP_POOL_SIZE;
+        xSemaphoreGive(hap_ephemeral_lock);
+        need_srp = need_srp && !is_accessory_paired();
+        if (!need_curve && !need_srp) {
+            break;
+        }
+        if (need_curve) {
+            if (hap_gen_curve25519(&curve) != HAP_SUCCESS) {
+                break;
+            }
+            xSemaphoreTake(hap_ephemeral_lock, portMAX_DELAY);
+            hap_curve_pool[hap_curve_pool_count++] = curve;
+            xSemaphoreGive(hap_ephemeral_lock);
+        }
+        if (need_srp) {
+            if (hap_gen_srp(&srp) != HAP_SUCCESS) {
+                break;
+            }
+            xSemaphoreTake(hap_ephemeral_lock, portMAX_DELAY);
+            hap_srp_pool[hap_srp_pool_count++] = srp;
+            xSemaphoreGive(hap_ephemeral_lock);
+        }
+    }
+    sodium_memzero(&curve, sizeof(curve));
+    sodium_memzero(&srp, sizeof(srp));
+}
+
+static void hap_ephemeral_task(void *arg)
+{
+    while (1) {
+        hap_ephemeral_refill();
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+#endif /* HAP_EPHEMERAL_POOL_SIZE > 0 */
+
+int hap_ephemeral_init()
+{
+#if HAP_EPHEMERAL_POOL_SIZE > 0
+    if (hap_ephemeral_task_handle) {
+        return HAP_SUCCESS;
+    }
+    hap_ephemeral_lock = xSemaphoreCreateMutex();
+    if (!hap_ephemeral_lock) {
+        return HAP_FAIL;
+    }
+    if (xTaskCreate(hap_ephemeral_task, "hap-ephemeral", HAP_EPHEMERAL_TASK_STACK, NULL,
+                HAP_EPHEMERAL_TASK_PRIORITY, &hap_ephemeral_task_handle) != pdPASS) {
+        vSemaphoreDelete(hap_ephemeral_lock);
+        hap_ephemeral_lock = NULL;
+        return HAP_FAIL;
+    }
+#endif
+    return HAP_SUCCESS;
+}
+
+void hap_ephemeral_wake()
+{
+#if HAP_EPHEMERAL_POOL_SIZE > 0
+    if (hap_ephemeral_task_handle) {
+        xTaskNotifyGive(hap_ephemeral_task_handle);
+    }
+#endif
+}
+
+int hap_ephemeral_get_curve25519(uint8_t sk[CURVE_KEY_LEN], uint8_t pk[CURVE_KEY_LEN])
+{
+    hap_curve_ephemeral_t e;
+    int ret = HAP_FAIL;
+#if HAP_EPHEMERAL_POOL_SIZE > 0
+    if (hap_ephemeral_lock) {
+        xSemaphoreTake(hap_ephemeral_lock, portMAX_DELAY);
+        if (hap_curve_pool_count) {
+            hap_curve_ephemeral_t *slot = &hap_curve_pool[--hap_curve_pool_count];
+            e = *slot;
+            sodium_memzero(slot, sizeof(*slot));
+            ret = HAP_SUCCESS;
+        }
+        xSemaphoreGive(hap_ephemeral_lock);
+        xTaskNotifyGive(hap_ephemeral_task_handle);
+    }
+#endif
+    if (ret != HAP_SUCCESS) {
+        ret = hap_gen_curve25519(&e);
+    }
+    if (ret == HAP_SUCCESS) {
+        memcpy(sk, e.sk, CURVE_KEY_LEN);
+        memcpy(pk, e.pk, CURVE_KEY_LEN);
+    }
+    sodium_memzero(&e, sizeof(e));
+    return ret;
+}
+
+int hap_ephemeral_get_srp(uint8_t b[HAP_SRP_B_LEN], uint8_t gb[HAP_SRP_GB_LEN])
+{
+    hap_srp_ephemeral_t e;
+    int ret = HAP_FAIL;
+#if HAP_EPHEMERAL_POOL_SIZE > 0
+    if (hap_ephemeral_lock) {
+        xSemaphoreTake(hap_ephemeral_lock, portMAX_DELAY);
+        if (hap_srp_pool_count) {
+            hap_srp_ephemeral_t *slot = &hap_srp_pool[--hap_srp_pool_count];
+            e = *slot;
+            sodium_memzero(slot, sizeof(*slot));
+            ret = HAP_SUCCESS;
+        }
+        xSemaphoreGive(hap_ephemeral_lock);
+        xTaskNotifyGive(hap_ephemeral_task_handle);
+    }
+#endif
+    if (ret != HAP_SUCCESS) {
+        ret = hap_gen_srp(&e);
+    }
+    if (ret == HAP_SUCCESS) {
+        memcpy(b, e.b, HAP_SRP_B_LEN);
+        memcpy(gb, e.gb, HAP_SRP_GB_LEN);
+    }
+    sodium_memzero(&e, sizeof(e));
+    return ret;
+}
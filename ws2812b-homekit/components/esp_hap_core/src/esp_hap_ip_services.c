@@ -29,6 +29,7 @@
 #include <esp_hap_main.h>
 #include <esp_hap_pair_setup.h>
 #include <esp_hap_pair_verify.h>
+#include <esp_hap_pair_worker.h>
 #include <esp_hap_pairings.h>
 #include <esp_hap_network_io.h>
 #include <esp_hap_secure_message.h>
@@ -59,6 +60,12 @@
 
 static bool http_debug;
 
+/* JSON tokens for parsing request bodies. All the HAP handlers run on the single
+ * httpd task, so one arena is enough and it gets reused across requests. It only
+ * grows if a request has more tokens than seen so far.
+ */
+static json_tok_arena_t hap_httpd_tok_arena;
+
 int hap_http_session_not_authorized(httpd_req_t *req)
 {
     char buf[50];
@@ -83,52 +90,15 @@ int hap_httpd_get_data(httpd_req_t *req, char *buffer, int len)
     return read_len;
 }
 
-static int hap_http_pair_setup_handler(httpd_req_t *req)
+static int hap_http_pair_handler(httpd_req_t *req, bool verify)
 {
-	uint8_t buf[1200];
-	int ret, ret1, outlen;
-	void *ctx = (hap_secure_session_t *)hap_platform_httpd_get_sess_ctx(req);
-    int fd = httpd_req_to_sockfd(req);
     ESP_MFI_DEBUG_PLAIN("Socket fd: %d; HTTP Request %s %s\n", httpd_req_to_sockfd(req), hap_platform_httpd_get_req_method(req), hap_platform_httpd_get_req_uri(req));
-	if (!ctx) {
-		if (hap_pair_setup_context_init(fd, &ctx, buf, sizeof(buf), &outlen) == HAP_SUCCESS) {
-            hap_platform_httpd_set_sess_ctx(req, ctx, hap_pair_setup_ctx_clean, true);
-		} else {
-			httpd_resp_set_type(req, "application/pairing+tlv8");
-			httpd_resp_send(req, (char *)buf, outlen);
-			return HAP_SUCCESS;
-		}
-	}
-	int data_len = httpd_req_recv(req, (char *)buf, sizeof(buf));
-	ret = hap_pair_setup_process(&ctx, buf, data_len, sizeof(buf), &outlen);
-	httpd_resp_set_type(req, "application/pairing+tlv8");
-	ret1 = httpd_resp_send(req, (char *)buf, outlen);
-	if (ret != HAP_SUCCESS) {
-		hap_pair_setup_ctx_clean(ctx);
-		ctx = NULL;
-	} else {
-        /* A pair verify function is called here, because for Software Token Authentication,
-         * secure session keys are generated at the step M4 of Pair Setup, and there onwards,
-         * the behavior is like a pair verified session.
-         */
-		if (hap_pair_verify_get_state(ctx) == STATE_VERIFIED) {
-			/* Saving socket fd since it will later be required for
-			 * event notifications.
-			 */
-			((hap_secure_session_t *)ctx)->conn_identifier = fd;
-            hap_platform_httpd_set_sess_ctx(req, ctx, hap_free_session, true);
-            httpd_sess_set_send_override(hap_priv.server, fd, hap_httpd_send);
-            httpd_sess_set_recv_override(hap_priv.server, fd, hap_httpd_recv);
-		}
-    }
-	/* Context will be NULL, either if there was an error and a cleanup was required,
-	 * or if the pair_setup_process cleared it after successful pairing.
-	 * For both the cases, we will set the sess_ctx and free_ctx to NULL
-	 */
-	if (!ctx) {
-        hap_platform_httpd_set_sess_ctx(req, NULL, NULL, true);
-	}
-	return ret1;
+    return hap_pair_req_handle(req, verify);
+}
+
+static int hap_http_pair_setup_handler(httpd_req_t *req)
+{
+    return hap_http_pair_handler(req, false);
 }
 static struct httpd_uri hap_pair_setup = {
 	.uri = "/pair-setup",
@@ -138,78 +108,7 @@ static struct httpd_uri hap_pair_setup = {
 
 static int hap_http_pair_verify_handler(httpd_req_t *req)
 {
-	uint8_t buf[512];
-	int ret, outlen;
-	void *ctx = hap_platform_httpd_get_sess_ctx(req);
-    ESP_MFI_DEBUG_PLAIN("Socket fd: %d; HTTP Request %s %s\n", httpd_req_to_sockfd(req), hap_platform_httpd_get_req_method(req), hap_platform_httpd_get_req_uri(req));
-	if (!ctx) {
-		if (hap_pair_verify_context_init(&ctx, buf, sizeof(buf), &outlen) == HAP_SUCCESS) {
-            hap_platform_httpd_set_sess_ctx(req, ctx, NULL, true);
-		}
-	}
-	int data_len = httpd_req_recv(req, (char *)buf, sizeof(buf));
-	ret = hap_pair_verify_process(&ctx, buf, data_len, sizeof(buf), &outlen);
-	httpd_resp_set_type(req, "application/pairing+tlv8");
-	int ret1 = httpd_resp_send(req, (char *)buf, outlen);
-	if (ret == HAP_SUCCESS) {
-		if (hap_pair_verify_get_state(ctx) == STATE_VERIFIED) {
-			/* Saving socket fd since it will later be required for
-			 * event notifications.
-			 */
-            int fd = httpd_req_to_sockfd(req);
-			((hap_secure_session_t *)ctx)->conn_identifier = fd;
-
-            struct timeval timeout;
-            timeout.tv_sec = hap_priv.cfg.recv_timeout;
-            timeout.tv_usec = 0;
-            if (setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout,
-                        sizeof(timeout)) < 0) {
-                 ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for SO_RCVTIMEO");
-            }
-
-            timeout.tv_sec = hap_priv.cfg.send_timeout;
-            timeout.tv_usec = 0;
-            if (setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout,
-                        sizeof(timeout)) < 0) {
-                 ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for SO_SNDTIMEO");
-            }
-#ifdef CONFIG_HAP_SESSION_KEEP_ALIVE_ENABLE
-            ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Enabling Keep-Alive on Pair Verify Session");
-            const int yes = 1; /* enable sending keepalive probes for socket */
-            if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes)) < 0 ) {
-                 ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for SO_KEEPALIVE");
-            }
-
-            const int idle = 180; /* 180 sec idle before start sending probes */
-            if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) < 0) {
-                 ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for TCP_KEEPIDLE");
-            }
-
-            const int interval = 30; /* 30 sec between probes */
-            if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) < 0) {
-                 ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for TCP_KEEPINTVL");
-            }
-
-            const int maxpkt = 4; /* Drop connection after 4 probes without response */
-            if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &maxpkt, sizeof(maxpkt)) < 0) {
-                 ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "setsockopt on pair verified socket failed for TCP_KEEPCNT");
-            }
-#endif
-            hap_platform_httpd_set_sess_ctx(req, ctx, hap_free_session, true);
-            httpd_sess_set_send_override(hap_priv.server, fd, hap_httpd_send);
-            httpd_sess_set_recv_override(hap_priv.server, fd, hap_httpd_recv);
-		}
-	} else {
-        if (req->sess_ctx) {
-            if (req->free_ctx) {
-                req->free_ctx(req->sess_ctx);
-            } else {
-                free(req->sess_ctx);
-            }
-        }
-        hap_platform_httpd_set_sess_ctx(req, NULL, NULL, true);
-    }
-	return ret1;
+    return hap_http_pair_handler(req, true);
 }
 
 static struct httpd_uri hap_pair_verify = {
@@ -386,12 +285,11 @@ static int hap_add_char_valid_vals(__hap_char_t *hc, json_gen_str_t *jptr)
     return HAP_SUCCESS;
 }
 
-static int hap_prepare_char_db(__hap_char_t *hc, json_gen_str_t *jptr, int session_index)
+/* Adds the fields of a characteristic which can change without any change in the
+ * database, i.e. the value and the event notification state for the session.
+ */
+static int hap_add_char_live_fields(__hap_char_t *hc, json_gen_str_t *jptr, int session_index)
 {
-	json_gen_start_object(jptr);
-
-	json_gen_obj_set_int(jptr, "iid", hc->iid);
-
     /* If the Update API has not been called from the service read routine,
      * reset the owner controller value.
      * Else, the controller will  miss the next notification.
@@ -416,20 +314,34 @@ static int hap_prepare_char_db(__hap_char_t *hc, json_gen_str_t *jptr, int sessi
             hap_add_char_val_json(hc->format, "value", &hc->val, jptr);
         }
 	}
+	hap_add_char_ev(hc, jptr, session_index);
+	return HAP_SUCCESS;
+}
+
+static int hap_add_char_static_fields(__hap_char_t *hc, json_gen_str_t *jptr)
+{
 	hap_add_char_type(hc, jptr);
 	hap_add_char_perms(hc, jptr);
-	hap_add_char_ev(hc, jptr, session_index);
 	hap_add_char_meta(hc, jptr);
     hap_add_char_valid_vals(hc, jptr);
+	return HAP_SUCCESS;
+}
+
+static int hap_prepare_char_db(__hap_char_t *hc, json_gen_str_t *jptr, int session_index)
+{
+	json_gen_start_object(jptr);
+
+	json_gen_obj_set_int(jptr, "iid", hc->iid);
+	hap_add_char_static_fields(hc, jptr);
+	hap_add_char_live_fields(hc, jptr, session_index);
 
 	json_gen_end_object(jptr);
 
 	return HAP_SUCCESS;
 }
 
-static int hap_prepare_serv_db(__hap_serv_t *hs, json_gen_str_t *jptr, int session_index)
+static int hap_add_serv_static_fields(__hap_serv_t *hs, json_gen_str_t *jptr)
 {
-	json_gen_start_object(jptr);
 	json_gen_obj_set_int(jptr, "iid", hs->iid);
 	json_gen_obj_set_string(jptr, "type", hs->type_uuid);
 	if (hs->hidden)
@@ -445,8 +357,14 @@ static int hap_prepare_serv_db(__hap_serv_t *hs, json_gen_str_t *jptr, int sessi
         }
         json_gen_pop_array(jptr);
     }
+	return HAP_SUCCESS;
+}
 
-	json_gen_push_array(jptr, "characteristics");
+/* Reads all the readable characteristics of the service in one go, so that the
+ * database reports their latest values
+ */
+static int hap_serv_read_for_db(__hap_serv_t *hs, int session_index)
+{
     int char_cnt = 0;
 	hap_char_t *hc;
     for (hc = hap_serv_get_first_char((hap_serv_t *)hs); hc; hc = hap_char_get_next(hc)) {
@@ -483,6 +401,19 @@ static int hap_prepare_serv_db(__hap_serv_t *hs, json_gen_str_t *jptr, int sessi
         hap_platform_memory_free(read_arr);
         hap_platform_memory_free(status_codes);
     }
+    return HAP_SUCCESS;
+}
+
+static int hap_prepare_serv_db(__hap_serv_t *hs, json_gen_str_t *jptr, int session_index)
+{
+	json_gen_start_object(jptr);
+	hap_add_serv_static_fields(hs, jptr);
+
+	json_gen_push_array(jptr, "characteristics");
+    if (hap_serv_read_for_db(hs, session_index) != HAP_SUCCESS) {
+        return HAP_FAIL;
+    }
+	hap_char_t *hc;
     for (hc = hap_serv_get_first_char((hap_serv_t *)hs); hc; hc = hap_char_get_next(hc)) {
 		hap_prepare_char_db((__hap_char_t *)hc, jptr, session_index);
 	}
@@ -529,6 +460,268 @@ static int hap_prepare_json_database(char *buf, int bufsize, json_gen_flush_cb_t
 	return HAP_SUCCESS;
 }
 
+/* Grows a heap buffer (by doubling) to hold at least needed elements, keeping its contents */
+static int hap_mem_grow(void **buf, int *size, int needed, int elem_size)
+{
+    if (needed <= *size) {
+        return HAP_SUCCESS;
+    }
+    int new_size = *size ? *size : 64;
+    while (new_size < needed) {
+        new_size *= 2;
+    }
+    void *new_buf = hap_platform_memory_malloc(new_size * elem_size);
+    if (!new_buf) {
+        return HAP_FAIL;
+    }
+    if (*buf) {
+        memcpy(new_buf, *buf, *size * elem_size);
+        hap_platform_memory_free(*buf);
+    }
+    *buf = new_buf;
+    *size = new_size;
+    return HAP_SUCCESS;
+}
+
+/* Buffer for JSON of arbitrary size. It grows as required and is never shrunk,
+ * so that it can be reset and reused without any further allocations.
+ * Once an allocation fails, oom stays set until the buffer is reset.
+ */
+typedef struct {
+    char *buf;
+    int len;
+    int size;
+    bool oom;
+} hap_json_buf_t;
+
+static void hap_json_buf_reset(hap_json_buf_t *jbuf)
+{
+    jbuf->len = 0;
+    jbuf->oom = false;
+}
+
+static int hap_json_buf_add(hap_json_buf_t *jbuf, const char *data, int len)
+{
+    if (jbuf->oom || (hap_mem_grow((void **)&jbuf->buf, &jbuf->size,
+                    jbuf->len + len, sizeof(char)) != HAP_SUCCESS)) {
+        jbuf->oom = true;
+        return HAP_FAIL;
+    }
+    memcpy(jbuf->buf + jbuf->len, data, len);
+    jbuf->len += len;
+    return HAP_SUCCESS;
+}
+
+/* Reserves len bytes at the end of the buffer, to be filled in later */
+static int hap_json_buf_skip(hap_json_buf_t *jbuf, int len)
+{
+    if (jbuf->oom || (hap_mem_grow((void **)&jbuf->buf, &jbuf->size,
+                    jbuf->len + len, sizeof(char)) != HAP_SUCCESS)) {
+        jbuf->oom = true;
+        return HAP_FAIL;
+    }
+    jbuf->len += len;
+    return HAP_SUCCESS;
+}
+
+/* json_gen flush callback to append the generated JSON to a hap_json_buf_t */
+static void hap_json_buf_flush(char *data, void *priv)
+{
+    hap_json_buf_add((hap_json_buf_t *)priv, data, strlen(data));
+}
+
+static void hap_json_buf_free(hap_json_buf_t *jbuf)
+{
+    if (jbuf->buf) {
+        hap_platform_memory_free(jbuf->buf);
+    }
+    memset(jbuf, 0, sizeof(hap_json_buf_t));
+}
+
+/* Cached JSON of the attribute database, without the fields added by
+ * hap_add_char_live_fields(). The database changes only along with the config
+ * number (or the database generation, which changes first), so for GET /accessories,
+ * the skeleton is generated once and the live fields of each characteristic are
+ * inserted at its splice offset, just before the closing brace of its object.
+ */
+typedef struct {
+    hap_char_t *hc;
+    int offset;
+} hap_acc_db_splice_t;
+
+typedef struct {
+    hap_json_buf_t skel;
+    hap_acc_db_splice_t *splices;
+    int splice_cnt;
+    int splice_size;
+    uint32_t config_num;
+    uint32_t db_gen;
+    bool valid;
+    bool oom;
+} hap_acc_db_cache_t;
+
+static hap_acc_db_cache_t hap_acc_db_cache;
+
+static void hap_acc_db_cache_add_splice(hap_acc_db_cache_t *cache, json_gen_str_t *jptr, hap_char_t *hc)
+{
+    if (cache->oom || (hap_mem_grow((void **)&cache->splices, &cache->splice_size,
+                    cache->splice_cnt + 1, sizeof(hap_acc_db_splice_t)) != HAP_SUCCESS)) {
+        cache->oom = true;
+        return;
+    }
+    /* Part of the skeleton may still be in the generator's buffer, which has not been flushed yet */
+    cache->splices[cache->splice_cnt].offset = cache->skel.len + (jptr->free_ptr - jptr->buf);
+    cache->splices[cache->splice_cnt].hc = hc;
+    cache->splice_cnt++;
+}
+
+static int hap_acc_db_cache_build(hap_acc_db_cache_t *cache)
+{
+    char buf[256];
+    cache->valid = false;
+    cache->oom = false;
+    hap_json_buf_reset(&cache->skel);
+    cache->splice_cnt = 0;
+    /* Read these before walking the database, so that any change during the walk
+     * makes the cache stale rather than going unnoticed.
+     */
+    cache->config_num = hap_priv.config_num;
+    cache->db_gen = hap_acc_db_get_gen();
+
+	json_gen_str_t jstr;
+	json_gen_str_start(&jstr, buf, sizeof(buf), hap_json_buf_flush, &cache->skel);
+	json_gen_start_object(&jstr);
+	json_gen_push_array(&jstr, "accessories");
+	hap_acc_t *ha;
+	for (ha = hap_get_first_acc(); ha; ha = hap_acc_get_next(ha)) {
+        json_gen_start_object(&jstr);
+        json_gen_obj_set_int(&jstr, "aid", ((__hap_acc_t *)ha)->aid);
+        json_gen_push_array(&jstr, "services");
+        hap_serv_t *hs;
+        for (hs = hap_acc_get_first_serv(ha); hs; hs = hap_serv_get_next(hs)) {
+            json_gen_start_object(&jstr);
+            hap_add_serv_static_fields((__hap_serv_t *)hs, &jstr);
+            json_gen_push_array(&jstr, "characteristics");
+            hap_char_t *hc;
+            for (hc = hap_serv_get_first_char(hs); hc; hc = hap_char_get_next(hc)) {
+                json_gen_start_object(&jstr);
+                json_gen_obj_set_int(&jstr, "iid", ((__hap_char_t *)hc)->iid);
+                hap_add_char_static_fields((__hap_char_t *)hc, &jstr);
+                hap_acc_db_cache_add_splice(cache, &jstr, hc);
+                json_gen_end_object(&jstr);
+            }
+            json_gen_pop_array(&jstr);
+            json_gen_end_object(&jstr);
+        }
+        json_gen_pop_array(&jstr);
+        json_gen_end_object(&jstr);
+	}
+	json_gen_pop_array(&jstr);
+	json_gen_end_object(&jstr);
+	json_gen_str_end(&jstr);
+
+    if (cache->oom || cache->skel.oom) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_WARN, "No memory to cache the accessory database");
+        return HAP_FAIL;
+    }
+    cache->valid = true;
+    ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Cached accessory database: %d bytes, %d characteristics",
+            cache->skel.len, cache->splice_cnt);
+	return HAP_SUCCESS;
+}
+
+static void hap_acc_db_cache_free(hap_acc_db_cache_t *cache)
+{
+    hap_json_buf_free(&cache->skel);
+    if (cache->splices) {
+        hap_platform_memory_free(cache->splices);
+    }
+    memset(cache, 0, sizeof(hap_acc_db_cache_t));
+}
+
+/* Coalesces the pieces of a response into chunks of the given buffer's size */
+typedef struct {
+    char *buf;
+    int buf_size;
+    int len;
+    httpd_req_t *req;
+} hap_http_chunk_buf_t;
+
+static void hap_http_chunk_buf_flush(hap_http_chunk_buf_t *cbuf)
+{
+    if (cbuf->len) {
+        ESP_MFI_DEBUG_PLAIN("%.*s", cbuf->len, cbuf->buf);
+        httpd_resp_send_chunk(cbuf->req, cbuf->buf, cbuf->len);
+        cbuf->len = 0;
+    }
+}
+
+static void hap_http_chunk_buf_add(hap_http_chunk_buf_t *cbuf, const char *data, int len)
+{
+    while (len) {
+        int copy_len = cbuf->buf_size - cbuf->len;
+        if (copy_len > len) {
+            copy_len = len;
+        }
+        memcpy(cbuf->buf + cbuf->len, data, copy_len);
+        cbuf->len += copy_len;
+        data += copy_len;
+        len -= copy_len;
+        if (cbuf->len == cbuf->buf_size) {
+            hap_http_chunk_buf_flush(cbuf);
+        }
+    }
+}
+
+static void hap_http_chunk_buf_add_str(char *data, void *priv)
+{
+    hap_http_chunk_buf_add((hap_http_chunk_buf_t *)priv, data, strlen(data));
+}
+
+static int hap_send_cached_json_database(char *buf, int bufsize, httpd_req_t *req)
+{
+    hap_secure_session_t *session = (hap_secure_session_t *)hap_platform_httpd_get_sess_ctx(req);
+    if (!session) {
+        return HAP_FAIL;
+    }
+    hap_acc_db_cache_t *cache = &hap_acc_db_cache;
+    if (!cache->valid || (cache->config_num != hap_priv.config_num)
+            || (cache->db_gen != hap_acc_db_get_gen())) {
+        if (hap_acc_db_cache_build(cache) != HAP_SUCCESS) {
+            return HAP_FAIL;
+        }
+    }
+
+    int session_index = hap_get_ctrl_session_index(session);
+    hap_http_chunk_buf_t cbuf = {
+        .buf = buf,
+        .buf_size = bufsize,
+        .req = req,
+    };
+    char live_buf[64];
+    hap_serv_t *hs = NULL;
+    int offset = 0;
+    int i;
+    for (i = 0; i < cache->splice_cnt; i++) {
+        hap_acc_db_splice_t *splice = &cache->splices[i];
+        if (hap_char_get_parent(splice->hc) != hs) {
+            hs = hap_char_get_parent(splice->hc);
+            hap_serv_read_for_db((__hap_serv_t *)hs, session_index);
+        }
+        hap_http_chunk_buf_add(&cbuf, cache->skel.buf + offset, splice->offset - offset);
+        offset = splice->offset;
+        /* The cached type and perms always precede the live fields */
+        hap_http_chunk_buf_add(&cbuf, ",", 1);
+        json_gen_str_t jstr;
+        json_gen_str_start(&jstr, live_buf, sizeof(live_buf), hap_http_chunk_buf_add_str, &cbuf);
+        hap_add_char_live_fields((__hap_char_t *)splice->hc, &jstr, session_index);
+        json_gen_str_end(&jstr);
+    }
+    hap_http_chunk_buf_add(&cbuf, cache->skel.buf + offset, cache->skel.len - offset);
+    hap_http_chunk_buf_flush(&cbuf);
+    return HAP_SUCCESS;
+}
+
 static void hap_http_json_flush_chunk(char *data, void *priv)
 {
     ESP_MFI_DEBUG_PLAIN("%s", data);
@@ -545,8 +738,12 @@ static int hap_http_get_accessories(httpd_req_t *req)
     }
 	httpd_resp_set_type(req, "application/hap+json");
     ESP_MFI_DEBUG_PLAIN("Generating HTTP Response\n");
-    /* Using chunked encoding since the response can be large, especially for bridges */
-	hap_prepare_json_database(buf, sizeof(buf), hap_http_json_flush_chunk, req);
+    /* Using chunked encoding since the response can be large, especially for bridges.
+     * If the database cannot be cached, generate it completely.
+     */
+    if (hap_send_cached_json_database(buf, sizeof(buf), req) != HAP_SUCCESS) {
+        hap_prepare_json_database(buf, sizeof(buf), hap_http_json_flush_chunk, req);
+    }
     /* This indicates the last chunk */
     httpd_resp_send_chunk(req, NULL, 0);
     ESP_MFI_DEBUG_PLAIN("\n");
@@ -654,24 +851,21 @@ static int hap_http_handle_set_char(jparse_ctx_t *jctx, char *outbuf, int buf_si
 
 	json_gen_str_t jstr;
 	json_gen_str_start(&jstr, outbuf, buf_size, hap_http_json_flush_chunk, req);
-    /* Dummy get, so that the loop can start by leaving the previous
-     * object and getting newer one
+    /* Walk the array with an iterator rather than by index, since every
+     * indexed get searches again from the start of the array.
      */
-    json_arr_get_object(jctx, 0);
+    json_arr_iter_t iter;
+    json_arr_iter_begin(jctx, &iter);
 	/* Loop through all characteristic objects {aid,iid,value}, handle
 	 * errors if any, and if there are no errors, put the characteristic
 	 * pointer and value in an array (with char_cnt)
 	 */
-	for (i = 0; i < cnt; i++) {
-        /* Leave the previous object and get a newer one from the array */
-        json_arr_leave_object(jctx);
+	while (json_arr_iter_next(jctx, &iter) == OS_SUCCESS) {
 		int aid = 0, iid = 0;
-		json_arr_get_object(jctx, i);
 		json_obj_get_int(jctx, "aid", &aid);
 		json_obj_get_int(jctx, "iid", &iid);
-		hap_acc_t *ha = hap_acc_get_by_aid(aid);
-		__hap_char_t *hc = (__hap_char_t *)hap_acc_get_char_by_iid(ha, iid);
-		if (!ha || !hc) {
+		__hap_char_t *hc = (__hap_char_t *)hap_get_char_by_aid_iid(aid, iid);
+		if (!hc) {
 			hap_set_char_report_status(&include_status, &jstr,
 					aid, iid, HAP_STATUS_RES_ABSENT);
 			continue;
@@ -985,7 +1179,7 @@ static int hap_http_put_characteristics(httpd_req_t *req)
 	}
     ESP_MFI_DEBUG_PLAIN("Data Received: %s\n", inbuf);
 	jparse_ctx_t jctx;
-	if (json_parse_start(&jctx, inbuf, data_len) != HAP_SUCCESS) {
+	if (json_parse_start_with_arena(&jctx, inbuf, data_len, &hap_httpd_tok_arena) != HAP_SUCCESS) {
 		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Failed to parse HTTPD JSON Data");
 		httpd_resp_set_status(req, HTTPD_500);
         if (heap_inbuf) {
@@ -1153,7 +1347,7 @@ static int hap_http_get_characteristics(httpd_req_t *req)
 		p = strsep(&val_ptr, ",");
 		iid = atoi(p);
 		p = strsep(&val_ptr, ".");
-		hap_char_t *hc = hap_acc_get_char_by_iid(hap_acc_get_by_aid(aid), iid);
+		hap_char_t *hc = hap_get_char_by_aid_iid(aid, iid);
 		if (!hc) {
 			hap_set_char_report_status(&include_status, &jstr,
 					aid, iid, HAP_STATUS_RES_ABSENT);
@@ -1312,7 +1506,9 @@ static int hap_http_pairings_handler(httpd_req_t *req)
          */
         httpd_resp_set_status(req, "470 Connection Authorization Required");
     }
+	hap_pairing_lock();
 	hap_pairings_process(ctx, buf, data_len, sizeof(buf), &outlen);
+	hap_pairing_unlock();
 	httpd_resp_set_type(req, "application/pairing+tlv8");
 	return httpd_resp_send(req, (char *)buf, outlen);
 }
@@ -1364,7 +1560,7 @@ static int hap_http_put_prepare(httpd_req_t *req)
 	}
     ESP_MFI_DEBUG_PLAIN("Data Received: %s\n", buf);
 	jparse_ctx_t jctx;
-	if (json_parse_start(&jctx, buf, data_len) != HAP_SUCCESS) {
+	if (json_parse_start_with_arena(&jctx, buf, data_len, &hap_httpd_tok_arena) != HAP_SUCCESS) {
 		ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Failed to parse HTTPD JSON Data");
 		httpd_resp_set_status(req, HTTPD_500);
 		return httpd_resp_send(req, NULL, 0);
@@ -1393,17 +1589,41 @@ static struct httpd_uri hap_prepare = {
     .handler = hap_http_put_prepare,
 };
 
+#define HTTPD_HDR_STR      "EVENT/1.0 200 OK\r\n"                   \
+		"Content-Type: application/hap+json\r\n"           \
+		"Content-Length: %d\r\n\r\n"
+#define HTTPD_HDR_MAX_LEN  128
+
+/* Buffers reused by all the notification batches. They are used only from the
+ * httpd task, so need no locking.
+ * hap_notif_frags holds the {"aid":..,"iid":..,"value":..} fragments of all the
+ * characteristics in a batch, so that each value is serialised only once, and
+ * hap_notif_msg is where the event for each controller is assembled from them.
+ */
+static hap_json_buf_t hap_notif_frags;
+static hap_json_buf_t hap_notif_msg;
+
 static void hap_send_notification(void *arg)
 {
     int num_char = hap_priv.cfg.max_event_notif_chars;
     hap_char_t *hc;
     hap_char_t **char_arr = hap_platform_memory_calloc(num_char, sizeof(hap_char_t *));
+    /* The fragment of char_arr[j] is from frag_offsets[j] to frag_offsets[j + 1] */
+    int *frag_offsets = hap_platform_memory_calloc(num_char + 1, sizeof(int));
 
-    if (!char_arr) {
+    if (!char_arr || !frag_offsets) {
+        if (char_arr) {
+            hap_platform_memory_free(char_arr);
+        }
+        if (frag_offsets) {
+            hap_platform_memory_free(frag_offsets);
+        }
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "No memory for the notification batch");
+        hap_notif_trigger_reset();
         return;
     }
 
-    int i, num_notif_chars;
+    int i, j, num_notif_chars;
     for (i = 0; i < num_char; i++) {
         hc = hap_get_pending_notif_char();
         if (hc) {
@@ -1414,30 +1634,53 @@ static void hap_send_notification(void *arg)
     }
     /* If no characteristic notifications are pending, free char_arr and exit */ 
     if (i == 0) {
-	hap_platform_memory_free(char_arr); 
-        return;
+        goto notif_end;
     }
     num_notif_chars = i;
+
+    char gen_buf[64];
+    json_gen_str_t jstr;
+    hap_json_buf_reset(&hap_notif_frags);
+    for (j = 0; j < num_notif_chars; j++) {
+        __hap_char_t *_hc = (__hap_char_t *)char_arr[j];
+        frag_offsets[j] = hap_notif_frags.len;
+        /* No need to serialise values which no controller has subscribed to */
+        if (!_hc->ev_ctrls) {
+            continue;
+        }
+        json_gen_str_start(&jstr, gen_buf, sizeof(gen_buf), hap_json_buf_flush, &hap_notif_frags);
+        json_gen_start_object(&jstr);
+        hap_acc_t *ha = hap_serv_get_parent(hap_char_get_parent(char_arr[j]));
+        json_gen_obj_set_int(&jstr, "aid", ((__hap_acc_t *)ha)->aid);
+        json_gen_obj_set_int(&jstr, "iid", _hc->iid);
+        hap_add_char_val_json(_hc->format, "value", &_hc->val, &jstr);
+        json_gen_end_object(&jstr);
+        json_gen_str_end(&jstr);
+    }
+    frag_offsets[num_notif_chars] = hap_notif_frags.len;
+    if (hap_notif_frags.oom) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "No memory to serialise %d notification(s)", num_notif_chars);
+        goto notif_end;
+    }
+
 	hap_secure_session_t *session;
     /* Flag to indicate if any controller was connected */
     bool ctrl_connected = false;
-	char buf[250];
 	for (i = 0; i < HAP_MAX_SESSIONS; i++) {
 		session = hap_priv.sessions[i];
 		if (!session)
 			continue;
         ctrl_connected = true;
 		int fd = session->conn_identifier;
-#define HTTPD_HDR_STR      "EVENT/1.0 200 OK\r\n"                   \
-		"Content-Type: application/hap+json\r\n"           \
-		"Content-Length: %d\r\n"
-		char notif_json[1024];
-		json_gen_str_t jstr;
-		json_gen_str_start(&jstr, notif_json, sizeof(notif_json), NULL, NULL);
-		json_gen_start_object(&jstr);
-		json_gen_push_array(&jstr, "characteristics");
+        /* The header and the JSON body are assembled in a single buffer, so that
+         * the whole event goes out in as few encrypted frames as possible. The
+         * header depends on the length of the body, so it is placed just before
+         * the body, in the headroom left for it, once the body is complete.
+         */
+        hap_json_buf_reset(&hap_notif_msg);
+        hap_json_buf_skip(&hap_notif_msg, HTTPD_HDR_MAX_LEN);
+        hap_json_buf_add(&hap_notif_msg, "{\"characteristics\":[", strlen("{\"characteristics\":["));
 
-        int j;
         bool notif_to_send = false;
         for (j = 0; j < num_notif_chars; j++) {
             hc = char_arr[j];
@@ -1453,33 +1696,38 @@ static void hap_send_notification(void *arg)
             if (!hap_char_is_ctrl_subscribed(hc, i))
                 continue;
 
-            json_gen_start_object(&jstr);
-            hap_acc_t *ha = hap_serv_get_parent(hap_char_get_parent(hc));
-            int aid = ((__hap_acc_t *)ha)->aid;
-            json_gen_obj_set_int(&jstr, "aid", aid);
-            json_gen_obj_set_int(&jstr, "iid", _hc->iid);
-            hap_add_char_val_json(_hc->format, "value", &_hc->val, &jstr);
-            json_gen_end_object(&jstr);
+            if (notif_to_send) {
+                hap_json_buf_add(&hap_notif_msg, ",", 1);
+            }
+            hap_json_buf_add(&hap_notif_msg, hap_notif_frags.buf + frag_offsets[j],
+                    frag_offsets[j + 1] - frag_offsets[j]);
             notif_to_send = true;
         }
         if (!notif_to_send) {
             /* No notification required for this controller. Just continue */
             continue;
         }
+        hap_json_buf_add(&hap_notif_msg, "]}", 2);
+        if (hap_notif_msg.oom) {
+            ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "No memory for the notification to Socket fd: %d", fd);
+            continue;
+        }
 
-        json_gen_pop_array(&jstr);
-		json_gen_end_object(&jstr);
-		json_gen_str_end(&jstr);
-
-		snprintf(buf, sizeof(buf), HTTPD_HDR_STR,
-				strlen(notif_json));
-		hap_httpd_send(hap_priv.server, fd, buf, strlen(buf), 0);
-		/* Space for sending additional headers based on set_header */
-		hap_httpd_send(hap_priv.server, fd, "\r\n", strlen("\r\n"), 0);
-		hap_httpd_send(hap_priv.server, fd, notif_json, strlen(notif_json), 0);
+		char *notif_json = hap_notif_msg.buf + HTTPD_HDR_MAX_LEN;
+		int json_len = hap_notif_msg.len - HTTPD_HDR_MAX_LEN;
+		char hdr[HTTPD_HDR_MAX_LEN];
+		int hdr_len = snprintf(hdr, sizeof(hdr), HTTPD_HDR_STR, json_len);
+		char *msg = notif_json - hdr_len;
+		memcpy(msg, hdr, hdr_len);
+		int msg_len = hdr_len + json_len;
+		int num_frames = hap_httpd_send_notif(hap_priv.server, fd, msg, msg_len);
         httpd_sess_update_lru_counter(hap_priv.server, fd);
-		ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Notification Sent");
-        ESP_MFI_DEBUG_PLAIN("Socket fd: %d; Event message: %s\n", fd, notif_json);
+		if (num_frames < 0) {
+			ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Failed to send the notification to Socket fd: %d", fd);
+			continue;
+		}
+		ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Notification Sent in %d frame(s)", num_frames);
+        ESP_MFI_DEBUG_PLAIN("Socket fd: %d; Event message: %.*s\n", fd, json_len, notif_json);
 	}
     /* If no controller was connected and no disconnected event was sent,
      * reannaounce mDNS. That will increment state number as required
@@ -1489,7 +1737,15 @@ static void hap_send_notification(void *arg)
         hap_mdns_announce(false);
         hap_priv.disconnected_event_sent = true;
     }
+notif_end:
     hap_platform_memory_free(char_arr);
+    hap_platform_memory_free(frag_offsets);
+    /* More characteristics may have become pending than what could be sent
+     * in this batch. Schedule another run for them.
+     */
+    if (hap_is_notif_pending()) {
+        hap_http_send_notif();
+    }
 }
 
 void hap_http_debug_enable()
@@ -1504,7 +1760,10 @@ void hap_http_debug_disable()
 
 void hap_http_send_notif()
 {
-	httpd_queue_work(hap_priv.server, hap_send_notification, NULL);
+    if (httpd_queue_work(hap_priv.server, hap_send_notification, NULL) != ESP_OK) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Failed to schedule the notifications");
+        hap_notif_trigger_reset();
+    }
 }
 
 static bool hap_http_registered;
@@ -1705,6 +1964,7 @@ int hap_ip_services_stop()
     if (hap_ip_services_started) {
         hap_mdns_deannounce();
         hap_unregister_http_handlers();
+        hap_acc_db_cache_free(&hap_acc_db_cache);
         hap_ip_services_started = false;
     }
     return HAP_SUCCESS;
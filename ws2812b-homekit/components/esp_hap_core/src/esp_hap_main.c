@@ -33,6 +33,7 @@
 #include <esp_hap_char.h>
 #include <esp_hap_database.h>
 #include <esp_hap_ip_services.h>
+#include <esp_hap_pair_worker.h>
 #include <esp_hap_wifi.h>
 #include <esp_hap_mdns.h>
 #include <esp_hap_keystore.h>
@@ -40,6 +41,8 @@
 #include <esp_hap_wac.h>
 #include <esp_hap_bct_priv.h>
 #include <esp_hap_pair_verify.h>
+#include <esp_hap_persist.h>
+#include <esp_hap_ephemeral.h>
 #include <hap_platform_os.h>
 
 static QueueHandle_t xQueue;
@@ -102,6 +105,7 @@ static void hap_common_sm(hap_internal_event_t event)
             hap_close_all_sessions();
             hap_mdns_deannounce();
             hap_keystore_erase_all_data();
+            hap_persist_discard();
             reboot_reason = HAP_REBOOT_REASON_RESET_TO_FACTORY;
             break;
         case HAP_INTERNAL_EVENT_RESET_HOMEKIT_DATA:
@@ -141,6 +145,9 @@ static void hap_common_sm(hap_internal_event_t event)
  */
             hap_http_send_notif();
             return;
+        case HAP_INTERNAL_EVENT_PERSIST_FLUSH:
+            hap_persist_flush();
+            return;
         case HAP_INTERNAL_EVENT_NETWORK_SWITCH:
             ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "Taking the network down");
             /* wait for some time, close all the active sessions and then
@@ -277,6 +284,18 @@ int hap_init(hap_transport_t method)
         ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "HAP Database Init failed");
         return ret;
     }
+
+    ret = hap_acc_index_init();
+    if (ret != 0 ) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "HAP Characteristics Index Init failed");
+        return ret;
+    }
+
+    ret = hap_persist_init();
+    if (ret != 0 ) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "HAP Persistent Characteristics Init failed");
+        return ret;
+    }
     ESP_MFI_DEBUG(ESP_MFI_DEBUG_INFO, "HAP Initialization succeeded. Version : %s", hap_get_version());
 
     return ret;
@@ -350,12 +369,26 @@ int hap_start(void)
         return HAP_FAIL;
     }
 
+    hap_persist_restore();
+
     ret = hap_acc_setup_init();
     if (ret != HAP_SUCCESS) {
          ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "Accessory Setup init failed");
          return ret;
     }
 
+    /* Not fatal, the handshakes then generate their keys themselves */
+    if (hap_ephemeral_init() != HAP_SUCCESS) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_WARN, "Failed to start the ephemeral key pool");
+    }
+
+#ifdef HAP_PAIR_WORKER
+    /* Nor is this, the handshakes then run on the HTTP server task */
+    if (hap_pair_worker_init() != HAP_SUCCESS) {
+        ESP_MFI_DEBUG(ESP_MFI_DEBUG_WARN, "Failed to start the pair worker");
+    }
+#endif
+
     ret = hap_httpd_start();
     if (ret != HAP_SUCCESS) {
          ESP_MFI_DEBUG(ESP_MFI_DEBUG_ERR, "HTTPD START Failed [%d]", ret);
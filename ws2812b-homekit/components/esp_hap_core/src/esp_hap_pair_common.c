@@ -125,3 +125,32 @@ void hap_prepare_error_tlv(uint8_t state, uint8_t error, void *buf, int bufsize,
 	add_tlv(&tlv_data, kTLVType_Error, sizeof(error), &error);
 	*outlen = tlv_data.curlen;
 }
+
+esp_mfi_hmac_sha512_key_t hap_hkdf_salt_key(esp_mfi_hmac_sha512_key_t *salt_key, const char *salt)
+{
+	esp_mfi_hmac_sha512_key_t key = __atomic_load_n(salt_key, __ATOMIC_ACQUIRE);
+	esp_mfi_hmac_sha512_key_t expected = NULL;
+
+	if (key)
+		return key;
+	key = esp_mfi_hmac_sha512_key_new((const uint8_t *)salt, strlen(salt));
+	if (!key)
+		return NULL;
+	/* Another task may have made it meanwhile */
+	if (!__atomic_compare_exchange_n(salt_key, &expected, key, false,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		esp_mfi_hmac_sha512_key_free(key);
+		key = expected;
+	}
+	return key;
+}
+
+int hap_hkdf(esp_mfi_hmac_sha512_key_t *salt_key, const char *salt, const uint8_t *ikm, int ikm_len,
+		const char *info, uint8_t *okm, int okm_len)
+{
+	esp_mfi_hmac_sha512_key_t key = hap_hkdf_salt_key(salt_key, salt);
+
+	if (!key)
+		return -1;
+	return esp_mfi_hkdf_sha512(key, ikm, ikm_len, (const uint8_t *)info, strlen(info), okm, okm_len);
+}
@@ -31,6 +31,7 @@ void hap_serv_mark_primary(hap_serv_t *hs)
 {
     if (hs) {
         ((__hap_serv_t *)hs)->primary = true;
+        hap_acc_db_mark_changed();
     }
 }
 
@@ -38,6 +39,7 @@ void hap_serv_mark_hidden(hap_serv_t *hs)
 {
     if (hs) {
         ((__hap_serv_t *)hs)->hidden = true;
+        hap_acc_db_mark_changed();
     }
 }
 
@@ -57,6 +59,7 @@ void hap_serv_set_iid(hap_serv_t *hs, int32_t iid)
 {
     if (hs) {
         ((__hap_serv_t *)hs)->iid = iid;
+        hap_acc_db_mark_changed();
     }
 }
 
@@ -171,6 +174,7 @@ int hap_serv_link_serv(hap_serv_t *hs, hap_serv_t *linked_serv)
 
     __hap_serv_t *_hs = (__hap_serv_t *)hs;
     hap_linked_serv_t *linked = _hs->linked_servs;
+    hap_acc_db_mark_changed();
 
     if (!linked) {
         _hs->linked_servs = cur;
@@ -267,6 +271,7 @@ int hap_serv_add_char(hap_serv_t *hs, hap_char_t *hc)
     }
     if (_hs->parent) {
         _hc->iid = ((__hap_acc_t *)(_hs->parent))->next_iid++;
+        hap_acc_index_invalidate();
     }
     _hc->parent = hs;
     return 0;
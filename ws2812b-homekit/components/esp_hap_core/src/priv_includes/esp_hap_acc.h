@@ -42,6 +42,11 @@ typedef struct esp_mfi_accessory {
 } __hap_acc_t;
 hap_char_t *hap_acc_get_char_by_iid(hap_acc_t *ha, int32_t iid);
 hap_acc_t *hap_acc_get_by_aid(int32_t aid);
+hap_char_t *hap_get_char_by_aid_iid(int32_t aid, int32_t iid);
+int hap_acc_index_init(void);
+void hap_acc_index_invalidate(void);
+void hap_acc_db_mark_changed(void);
+uint32_t hap_acc_db_get_gen(void);
 int hap_acc_get_info(hap_acc_cfg_t *acc_cfg);
 const hap_val_t *hap_get_product_data();
 #ifdef __cplusplus
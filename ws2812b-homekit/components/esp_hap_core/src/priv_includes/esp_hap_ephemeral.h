@@ -0,0 +1,53 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2020 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _HAP_EPHEMERAL_H_
+#define _HAP_EPHEMERAL_H_
+
+#include <stdint.h>
+#include <esp_hap_pair_common.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HAP_SRP_B_LEN       32
+#define HAP_SRP_GB_LEN      384
+
+int hap_ephemeral_init();
+/* Tops the pools up again. To be called when the accessory becomes unpaired,
+ * as only then is an SRP one kept for the next pair setup.
+ */
+void hap_ephemeral_wake();
+/* Each call hands out a new key or secret, from the pool if there is one
+ * ready, or generated there and then. The caller wipes it after use.
+ */
+int hap_ephemeral_get_curve25519(uint8_t sk[CURVE_KEY_LEN], uint8_t pk[CURVE_KEY_LEN]);
+int hap_ephemeral_get_srp(uint8_t b[HAP_SRP_B_LEN], uint8_t gb[HAP_SRP_GB_LEN]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HAP_EPHEMERAL_H_ */
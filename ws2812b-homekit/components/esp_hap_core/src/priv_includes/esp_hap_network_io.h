@@ -25,7 +25,26 @@
 #define _HAP_NETWORK_IO_H_
 #include <stdint.h>
 #include <hap_platform_httpd.h>
+#include <esp_hap_pair_common.h>
+
+#define HAP_MAX_NW_FRAME_SIZE	1024 /* As per HAP Specifications */
+
 int hap_httpd_send(httpd_handle_t hd, int sockfd, const char *buf, unsigned buf_len, int flags);
 int hap_httpd_recv(httpd_handle_t hd, int sockfd, char *buf, unsigned buf_len, int flags);
+void hap_session_io_release(hap_secure_session_t *session);
+
+/* Event notifications sent since boot, or since the last reset */
+typedef struct {
+	uint32_t notifications;	/* Events sent */
+	uint32_t frames;	/* Encrypted frames they took */
+	uint32_t failed;	/* Events that could not be sent */
+} hap_notif_stats_t;
+
+/* Sends an event on a verified session and counts it. Returns the number of
+ * frames it took, or HAP_FAIL.
+ */
+int hap_httpd_send_notif(httpd_handle_t hd, int sockfd, const char *buf, unsigned buf_len);
+void hap_notif_stats_get(hap_notif_stats_t *stats);
+void hap_notif_stats_reset();
 
 #endif /* _HAP_NETWORK_IO_H_ */
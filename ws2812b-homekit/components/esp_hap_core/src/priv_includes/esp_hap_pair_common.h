@@ -26,6 +26,7 @@
 
 #include <stdint.h>
 #include <esp_hap_controllers.h>
+#include <esp_mfi_hkdf.h>
 #define ENCRYPT_KEY_LEN		32
 #define POLY_AUTHTAG_LEN	16
 #define CURVE_KEY_LEN		32
@@ -92,6 +93,12 @@ typedef struct {
 	int curlen;
 } hap_tlv_data_t;
 
+/* Defined in esp_hap_network_io.c. Each verified session owns one frame
+ * from a fixed pool so that partially read frames of concurrent sessions
+ * never clobber each other.
+ */
+struct hap_decrypt_frame;
+
 typedef struct {
 	uint8_t state;
 	uint8_t encrypt_key[ENCRYPT_KEY_LEN];
@@ -107,6 +114,10 @@ typedef struct {
 	 * Need to make this generic later.
 	 */
 	int conn_identifier;
+	struct hap_decrypt_frame *decrypt_frame;
+	/* Reusable buffer into which outgoing frames are encrypted */
+	uint8_t *send_buf;
+	int send_buf_size;
 } hap_secure_session_t;
 
 void hap_tlv_data_init(hap_tlv_data_t *tlv_data, uint8_t *buf, int buf_size);
@@ -114,4 +125,14 @@ int get_value_from_tlv(uint8_t *buf, int buf_len, uint8_t type, void *val, int v
 int get_tlv_length(uint8_t *buf, int buflen, uint8_t type);
 int add_tlv(hap_tlv_data_t *tlv_data, uint8_t type, int len, void *val);
 void hap_prepare_error_tlv(uint8_t state, uint8_t error, void *buf, int buf_size, int *out_len);
+
+/* The key of a constant HKDF salt, made on first use into *salt_key and
+ * kept there, so that the salt is only hashed in once.
+ */
+esp_mfi_hmac_sha512_key_t hap_hkdf_salt_key(esp_mfi_hmac_sha512_key_t *salt_key, const char *salt);
+/* HKDF-SHA512 with a constant salt and info. Returns 0 on success, -1 if
+ * out of memory.
+ */
+int hap_hkdf(esp_mfi_hmac_sha512_key_t *salt_key, const char *salt, const uint8_t *ikm, int ikm_len,
+		const char *info, uint8_t *okm, int okm_len);
 #endif /* _HAP_PAIR_COMMON_H_ */
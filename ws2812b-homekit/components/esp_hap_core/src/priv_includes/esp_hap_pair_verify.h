@@ -29,6 +29,7 @@ int hap_pair_verify_context_init(void **ctx, uint8_t *buf, int bufsize, int *out
 void hap_pair_verify_context_deinit(void *pv_ctx);
 int hap_pair_verify_process(void **ctx, uint8_t *buf, int inlen, int bufsize, int *outlen);
 uint8_t hap_pair_verify_get_state(void *ctx);
+void hap_add_secure_session(hap_secure_session_t *session);
 void hap_free_session(void *session);
 int hap_get_ctrl_session_index(hap_secure_session_t *session);
 int hap_close_session(hap_secure_session_t *session);
@@ -0,0 +1,327 @@
+/*
+ * Host stand-in of the FreeRTOS tasks, queues, mutexes, timers and
+ * critical sections, over pthreads.
+ *
+ * Tasks get SCHED_FIFO at their FreeRTOS priority where the host lets us,
+ * so that with the process on one CPU they preempt each other as they do on
+ * the ESP32-C6. Otherwise they run as normal threads.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    UBaseType_t len, item_size, head, count;
+    uint8_t *items;
+};
+
+struct host_mutex {
+    pthread_mutex_t lock;
+};
+
+struct host_timer {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    TickType_t period;
+    UBaseType_t auto_reload;
+    TimerCallbackFunction_t cb;
+    void *id;
+    int active;
+    int deleted;
+    struct timespec expiry;
+};
+
+static pthread_mutex_t critical_lock = PTHREAD_MUTEX_INITIALIZER;
+
+__thread int host_in_isr;
+
+static void host_assert_not_isr(const char *fn)
+{
+    if (host_in_isr) {
+        printf("ASSERT %s() called from an ISR\n", fn);
+        abort();
+    }
+}
+
+BaseType_t xPortInIsrContext(void)
+{
+    return host_in_isr ? pdTRUE : pdFALSE;
+}
+
+static void *task_main(void *arg)
+{
+    struct host_task *task = arg;
+    task->fn(task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    struct host_task *task = calloc(1, sizeof(*task));
+    struct sched_param param = { .sched_priority = 1 + priority };
+    pthread_attr_t attr;
+    int ret;
+
+    if (!task) {
+        return pdFAIL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+    ret = pthread_create(&task->thread, &attr, task_main, task);
+    pthread_attr_destroy(&attr);
+    if (ret) {
+        ret = pthread_create(&task->thread, NULL, task_main, task);
+    }
+    if (ret) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    if (handle) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size)
+{
+    struct host_queue *q = calloc(1, sizeof(*q));
+
+    if (!q) {
+        return NULL;
+    }
+    q->items = malloc(len * item_size);
+    if (!q->items) {
+        free(q);
+        return NULL;
+    }
+    q->len = len;
+    q->item_size = item_size;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    free(q->items);
+    free(q);
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t wait)
+{
+    host_assert_not_isr(__func__);
+    pthread_mutex_lock(&q->lock);
+    if (q->count == q->len) {
+        pthread_mutex_unlock(&q->lock);
+        return pdFAIL;
+    }
+    memcpy(q->items + ((q->head + q->count) % q->len) * q->item_size, item, q->item_size);
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t wait)
+{
+    pthread_mutex_lock(&q->lock);
+    while (!q->count) {
+        if (!wait) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFAIL;
+        }
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % q->len;
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    struct host_mutex *m = calloc(1, sizeof(*m));
+    pthread_mutexattr_t attr;
+
+    if (!m) {
+        return NULL;
+    }
+    /* FreeRTOS mutexes inherit priority */
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&m->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return m;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t m, TickType_t wait)
+{
+    return pthread_mutex_lock(&m->lock) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t m)
+{
+    return pthread_mutex_unlock(&m->lock) == 0 ? pdTRUE : pdFALSE;
+}
+
+void host_enter_critical(portMUX_TYPE *mux)
+{
+    pthread_mutex_lock(&critical_lock);
+}
+
+void host_exit_critical(portMUX_TYPE *mux)
+{
+    pthread_mutex_unlock(&critical_lock);
+}
+
+static void timer_restart(struct host_timer *timer)
+{
+    clock_gettime(CLOCK_MONOTONIC, &timer->expiry);
+    timer->expiry.tv_sec += timer->period / 1000;
+    timer->expiry.tv_nsec += (timer->period % 1000) * 1000000L;
+    if (timer->expiry.tv_nsec >= 1000000000L) {
+        timer->expiry.tv_nsec -= 1000000000L;
+        timer->expiry.tv_sec++;
+    }
+    timer->active = 1;
+    pthread_cond_signal(&timer->changed);
+}
+
+static void *timer_main(void *arg)
+{
+    struct host_timer *timer = arg;
+    struct timespec now;
+
+    pthread_mutex_lock(&timer->lock);
+    for (;;) {
+        while (!timer->active && !timer->deleted) {
+            pthread_cond_wait(&timer->changed, &timer->lock);
+        }
+        if (timer->deleted) {
+            break;
+        }
+        if (pthread_cond_timedwait(&timer->changed, &timer->lock, &timer->expiry) == 0) {
+            /* Reset or stopped */
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!timer->active || now.tv_sec < timer->expiry.tv_sec ||
+                (now.tv_sec == timer->expiry.tv_sec && now.tv_nsec < timer->expiry.tv_nsec)) {
+            continue;
+        }
+        timer->active = 0;
+        pthread_mutex_unlock(&timer->lock);
+        timer->cb(timer);
+        pthread_mutex_lock(&timer->lock);
+        if (timer->auto_reload && !timer->active) {
+            timer_restart(timer);
+        }
+    }
+    pthread_mutex_unlock(&timer->lock);
+    pthread_mutex_destroy(&timer->lock);
+    pthread_cond_destroy(&timer->changed);
+    free(timer);
+    return NULL;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload,
+                           void *id, TimerCallbackFunction_t cb)
+{
+    struct host_timer *timer = calloc(1, sizeof(*timer));
+    pthread_condattr_t attr;
+
+    if (!timer) {
+        return NULL;
+    }
+    timer->period = period;
+    timer->auto_reload = auto_reload;
+    timer->cb = cb;
+    timer->id = id;
+    pthread_mutex_init(&timer->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer->changed, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&timer->thread, NULL, timer_main, timer)) {
+        free(timer);
+        return NULL;
+    }
+    pthread_detach(timer->thread);
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait)
+{
+    return xTimerReset(timer, wait);
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait)
+{
+    host_assert_not_isr(__func__);
+    pthread_mutex_lock(&timer->lock);
+    timer_restart(timer);
+    pthread_mutex_unlock(&timer->lock);
+    return pdPASS;
+}
+
+BaseType_t xTimerResetFromISR(TimerHandle_t timer, BaseType_t *woken)
+{
+    pthread_mutex_lock(&timer->lock);
+    timer_restart(timer);
+    pthread_mutex_unlock(&timer->lock);
+    return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+    host_assert_not_isr(__func__);
+    pthread_mutex_lock(&timer->lock);
+    timer->active = 0;
+    pthread_cond_signal(&timer->changed);
+    pthread_mutex_unlock(&timer->lock);
+    return pdPASS;
+}
+
+/* The thread frees the timer once it sees it deleted */
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t wait)
+{
+    host_assert_not_isr(__func__);
+    pthread_mutex_lock(&timer->lock);
+    timer->deleted = 1;
+    pthread_cond_signal(&timer->changed);
+    pthread_mutex_unlock(&timer->lock);
+    return pdPASS;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->id;
+}
@@ -0,0 +1,9 @@
+/* Host stand-in of the ESP-IDF header, for the tests */
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include "esp_err.h"
+
+typedef void (*shutdown_handler_t)(void);
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handler);
@@ -0,0 +1,6 @@
+/* See FreeRTOS.h */
+#pragma once
+#include "FreeRTOS.h"
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg,
+                       UBaseType_t priority, TaskHandle_t *handle);
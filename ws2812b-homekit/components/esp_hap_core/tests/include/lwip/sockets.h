@@ -0,0 +1,6 @@
+/* Host stand-in of the lwIP sockets header, for the tests */
+#pragma once
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
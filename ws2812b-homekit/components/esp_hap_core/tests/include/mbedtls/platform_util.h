@@ -0,0 +1,4 @@
+/* See sha512.h */
+#pragma once
+#include <stddef.h>
+void mbedtls_platform_zeroize(void *buf, size_t len);
@@ -0,0 +1,5 @@
+/* Host stand-in of the generated configuration, for the tests */
+#pragma once
+#define CONFIG_HAP_PAIR_WORKER_ENABLE   1
+#define CONFIG_HAP_HTTP_STACK_SIZE      12288
+#define CONFIG_MU_SRP_FIXED_BASE        1
@@ -0,0 +1,224 @@
+/*
+ * Host stress test of the pending notification list of the characteristics.
+ *
+ * Two tasks, standing in for the sensor task and the LED write path, update
+ * their characteristics 10000 times between them. A HAP loop task of lower
+ * priority sends the notifications in batches, as hap_send_notification()
+ * does, whenever the updates let it run. All of them share one CPU. Every
+ * characteristic must end up notified with its last value, and values must
+ * never go backwards. The second run also makes scheduling the
+ * notifications fail now and then.
+ *
+ * Build and run with "make test" in this directory.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+
+#include "esp_hap_main.h"
+#include "esp_hap_char.h"
+
+#define UPDATES         10000
+#define TASKS           2
+#define CHARS_PER_TASK  8
+#define CHARS           (TASKS * CHARS_PER_TASK)
+#define BATCH           8
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static QueueHandle_t loop_queue;
+static hap_char_t *chars[CHARS];
+static uint32_t notified[CHARS];
+static atomic_int notifications, backwards, failed_runs;
+static atomic_int inject_failures, loop_busy, updates_done;
+static atomic_uint event_calls, run_calls;
+
+/* The rest of the core, as far as the characteristics need it */
+void hap_acc_db_mark_changed(void) {}
+void hap_acc_index_invalidate(void) {}
+void hap_persist_mark_changed(void) {}
+hap_acc_t *hap_get_first_acc(void) { return NULL; }
+hap_acc_t *hap_acc_get_next(hap_acc_t *ha) { return NULL; }
+hap_serv_t *hap_acc_get_first_serv(hap_acc_t *ha) { return NULL; }
+hap_serv_t *hap_serv_get_next(hap_serv_t *hs) { return NULL; }
+hap_char_t *hap_serv_get_first_char(hap_serv_t *hs) { return NULL; }
+
+static bool inject_failure(atomic_uint *counter, unsigned period)
+{
+    return inject_failures && (*counter)++ % period == 0;
+}
+
+int hap_send_event(hap_internal_event_t event)
+{
+    if (inject_failure(&event_calls, 7)) {
+        return HAP_FAIL;
+    }
+    return xQueueSend(loop_queue, &event, 0) == pdPASS ? HAP_SUCCESS : HAP_FAIL;
+}
+
+/* hap_http_send_notif() and hap_send_notification(), without the JSON */
+static void send_notifications(void)
+{
+    hap_char_t *batch[BATCH];
+    int i, num;
+
+    do {
+        if (inject_failure(&run_calls, 5)) {
+            /* httpd_queue_work() or the batch allocation failed */
+            failed_runs++;
+            hap_notif_trigger_reset();
+            return;
+        }
+        for (num = 0; num < BATCH; num++) {
+            batch[num] = hap_get_pending_notif_char();
+            if (!batch[num]) {
+                break;
+            }
+        }
+        for (i = 0; i < num; i++) {
+            int index;
+            uint32_t val = hap_char_get_val(batch[i])->u;
+            for (index = 0; chars[index] != batch[i]; index++)
+                ;
+            if (val < notified[index]) {
+                backwards++;
+            }
+            notified[index] = val;
+            notifications++;
+        }
+    } while (hap_is_notif_pending());
+}
+
+static void loop_task(void *arg)
+{
+    hap_internal_event_t event;
+
+    while (1) {
+        xQueueReceive(loop_queue, &event, portMAX_DELAY);
+        loop_busy = 1;
+        if (event == HAP_INTERNAL_EVENT_TRIGGER_NOTIF) {
+            send_notifications();
+        }
+        loop_busy = 0;
+    }
+}
+
+static void update_task(void *arg)
+{
+    int first = (intptr_t)arg * CHARS_PER_TASK;
+    int i;
+
+    for (i = 1; i <= UPDATES / TASKS; i++) {
+        hap_val_t val = {
+            .u = i,
+        };
+        CHECK(hap_char_update_val(chars[first + i % CHARS_PER_TASK], &val) == HAP_SUCCESS);
+        if (i % 64 == 0) {
+            /* Let the loop run now and then */
+            usleep(10);
+        }
+    }
+    updates_done++;
+}
+
+static void wait_idle(void)
+{
+    int i;
+
+    for (i = 0; i < 5000; i++) {
+        if (!hap_is_notif_pending() && !loop_busy) {
+            return;
+        }
+        usleep(1000);
+    }
+}
+
+static void run(bool with_failures)
+{
+    int i;
+
+    memset(notified, 0, sizeof(notified));
+    notifications = backwards = failed_runs = updates_done = 0;
+    for (i = 0; i < CHARS; i++) {
+        hap_val_t val = {
+            .u = 0,
+        };
+        hap_char_update_val(chars[i], &val);
+    }
+    wait_idle();
+    notifications = 0;
+
+    inject_failures = with_failures;
+    for (i = 0; i < TASKS; i++) {
+        CHECK(xTaskCreate(update_task, "update", 0, (void *)(intptr_t)i, 3, NULL) == pdPASS);
+    }
+    while (updates_done < TASKS) {
+        usleep(1000);
+    }
+    /* A run that failed leaves the characteristics pending for the next
+     * update, so make one last update of each that gets through.
+     */
+    inject_failures = 0;
+    for (i = 0; i < CHARS; i++) {
+        hap_val_t val = {
+            .u = UPDATES / TASKS + 1,
+        };
+        CHECK(hap_char_update_val(chars[i], &val) == HAP_SUCCESS);
+    }
+    wait_idle();
+
+    printf("%s: %d updates, %d notifications, %d failed runs\n",
+           with_failures ? "with failures" : "clean", UPDATES + CHARS, (int)notifications,
+           (int)failed_runs);
+    CHECK(!hap_is_notif_pending());
+    CHECK(backwards == 0);
+    CHECK(notifications >= CHARS && notifications <= UPDATES + CHARS);
+    for (i = 0; i < CHARS; i++) {
+        CHECK(notified[i] == UPDATES / TASKS + 1);
+    }
+    if (with_failures) {
+        CHECK(failed_runs > 0);
+    }
+}
+
+int main(void)
+{
+    cpu_set_t cpus;
+    int i;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(0, &cpus);
+    sched_setaffinity(0, sizeof(cpus), &cpus);
+
+    loop_queue = xQueueCreate(16, sizeof(hap_internal_event_t));
+    CHECK(hap_event_queue_init() == HAP_SUCCESS);
+    for (i = 0; i < CHARS; i++) {
+        chars[i] = hap_char_uint32_create("25", HAP_CHAR_PERM_PR | HAP_CHAR_PERM_EV, 0);
+    }
+    CHECK(xTaskCreate(loop_task, "hap-loop", 0, NULL, 2, NULL) == pdPASS);
+
+    run(false);
+    run(true);
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
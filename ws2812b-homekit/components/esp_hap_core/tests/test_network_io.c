@@ -0,0 +1,323 @@
+/*
+ * Host test of the encrypted framing of HAP sessions, over socket pairs.
+ *
+ * The controller ends of the pairs encrypt with the keys the other way
+ * round, so that what one end sends with hap_httpd_send() the other end
+ * reads with hap_httpd_recv().
+ *
+ * Notifications are counted, with the frames they take, and the counters
+ * are checked against what the controller end reads back.
+ *
+ * Build and run with "make test" in this directory. It also benchmarks
+ * sending responses, with the frames batched into each send() and with a
+ * send() per frame as before.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_hap_database.h"
+#include "esp_hap_network_io.h"
+
+#define MAX_FDS         64
+#define STREAM_LEN      6000
+#define BENCH_BYTES     (16 * 1024 * 1024)
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+hap_priv_t hap_priv;
+
+static hap_secure_session_t *sessions_by_fd[MAX_FDS];
+static int closed_sessions;
+
+void *httpd_sess_get_ctx(httpd_handle_t handle, int sockfd)
+{
+    return sockfd < MAX_FDS ? sessions_by_fd[sockfd] : NULL;
+}
+
+void hap_close_session(hap_secure_session_t *session)
+{
+    closed_sessions++;
+}
+
+/* The core's send() calls, counted. The Makefile links them through here. */
+static atomic_long send_calls, bytes_out, bytes_drained;
+
+ssize_t __real_send(int sockfd, const void *buf, size_t len, int flags);
+
+ssize_t __wrap_send(int sockfd, const void *buf, size_t len, int flags)
+{
+    ssize_t ret = __real_send(sockfd, buf, len, flags);
+    send_calls++;
+    if (ret > 0) {
+        bytes_out += ret;
+    }
+    return ret;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    hap_secure_session_t acc, ctrl;
+    int acc_fd, ctrl_fd;
+    uint8_t sent[STREAM_LEN];
+    int len_sent, len_read;
+} pair_t;
+
+static void pair_open(pair_t *p)
+{
+    int fds[2];
+    int i;
+
+    memset(p, 0, sizeof(*p));
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    p->acc_fd = fds[0];
+    p->ctrl_fd = fds[1];
+    for (i = 0; i < ENCRYPT_KEY_LEN; i++) {
+        p->acc.encrypt_key[i] = p->ctrl.decrypt_key[i] = rand();
+        p->acc.decrypt_key[i] = p->ctrl.encrypt_key[i] = rand();
+    }
+    p->acc.state = p->ctrl.state = STATE_VERIFIED;
+    p->acc.conn_identifier = p->acc_fd;
+    p->ctrl.conn_identifier = p->ctrl_fd;
+    sessions_by_fd[p->acc_fd] = &p->acc;
+    sessions_by_fd[p->ctrl_fd] = &p->ctrl;
+}
+
+static void pair_close(pair_t *p)
+{
+    hap_session_io_release(&p->acc);
+    hap_session_io_release(&p->ctrl);
+    sessions_by_fd[p->acc_fd] = sessions_by_fd[p->ctrl_fd] = NULL;
+    close(p->acc_fd);
+    close(p->ctrl_fd);
+}
+
+/* The controller sends len random bytes, in one or more frames */
+static void pair_send(pair_t *p, int len)
+{
+    uint8_t *buf = p->sent + p->len_sent;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = rand();
+    }
+    CHECK(hap_httpd_send(NULL, p->ctrl_fd, (char *)buf, len, 0) == len);
+    p->len_sent += len;
+}
+
+/* The accessory reads up to len bytes of what was sent */
+static void pair_read(pair_t *p, int len)
+{
+    char buf[STREAM_LEN];
+    int ret;
+
+    if (len > p->len_sent - p->len_read) {
+        len = p->len_sent - p->len_read;
+    }
+    ret = hap_httpd_recv(NULL, p->acc_fd, buf, len, 0);
+    CHECK(ret > 0 && ret <= len);
+    if (ret <= 0) {
+        return;
+    }
+    CHECK(memcmp(buf, p->sent + p->len_read, ret) == 0);
+    p->len_read += ret;
+}
+
+/* Reads of different sessions interleave in the middle of their frames, as
+ * when several controllers talk to the accessory at once.
+ */
+static void test_interleaved(void)
+{
+    pair_t pairs[HAP_MAX_SESSIONS];
+    int i, left, total = 0;
+
+    for (i = 0; i < HAP_MAX_SESSIONS; i++) {
+        pair_open(&pairs[i]);
+        /* Frames of all sizes, some full and some short */
+        while (pairs[i].len_sent < STREAM_LEN - 1500) {
+            pair_send(&pairs[i], 1 + rand() % 1500);
+        }
+    }
+    closed_sessions = 0;
+    do {
+        left = 0;
+        for (i = 0; i < HAP_MAX_SESSIONS; i++) {
+            pair_t *p = &pairs[rand() % HAP_MAX_SESSIONS];
+            if (p->len_read < p->len_sent) {
+                pair_read(p, 1 + rand() % 300);
+            }
+        }
+        for (i = 0; i < HAP_MAX_SESSIONS; i++) {
+            left += pairs[i].len_sent - pairs[i].len_read;
+        }
+    } while (left && !failures);
+    CHECK(closed_sessions == 0);
+    for (i = 0; i < HAP_MAX_SESSIONS; i++) {
+        CHECK(pairs[i].acc.decrypt_frame != NULL);
+        CHECK(i == 0 || pairs[i].acc.decrypt_frame != pairs[i - 1].acc.decrypt_frame);
+        total += pairs[i].len_read;
+    }
+    printf("interleaved: %d sessions read back %d bytes\n", HAP_MAX_SESSIONS, total);
+
+    /* One session more than there are frames has to wait for one */
+    pair_t extra;
+    char buf[100];
+    pair_open(&extra);
+    pair_send(&extra, 100);
+    CHECK(hap_httpd_recv(NULL, extra.acc_fd, buf, sizeof(buf), 0) < 0);
+    CHECK(closed_sessions == 1);
+    pair_close(&pairs[0]);
+    sessions_by_fd[extra.acc_fd] = &extra.acc;
+    extra.acc.state = STATE_VERIFIED;
+    pair_send(&extra, 100);
+    pair_read(&extra, 100);
+    CHECK(extra.len_read == 100);
+    pair_close(&extra);
+
+    for (i = 1; i < HAP_MAX_SESSIONS; i++) {
+        pair_close(&pairs[i]);
+    }
+}
+
+/* The controller reads a whole message, frame after frame */
+static void ctrl_read_all(pair_t *p, char *buf, int len)
+{
+    int ret, got = 0;
+
+    while (got < len) {
+        ret = hap_httpd_recv(NULL, p->ctrl_fd, buf + got, len - got, 0);
+        CHECK(ret > 0);
+        if (ret <= 0) {
+            return;
+        }
+        got += ret;
+    }
+}
+
+/* Events of one frame, of just over one and of several batches of frames */
+static void test_notif_stats(void)
+{
+    static const int sizes[] = { 120, HAP_MAX_NW_FRAME_SIZE, HAP_MAX_NW_FRAME_SIZE + 1, 5000 };
+    static char msg[5000], got[5000];
+    hap_notif_stats_t stats;
+    int i, frames = 0;
+    pair_t p, unverified;
+
+    hap_notif_stats_reset();
+    pair_open(&p);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        int expected = (sizes[i] + HAP_MAX_NW_FRAME_SIZE - 1) / HAP_MAX_NW_FRAME_SIZE;
+        memset(msg, 'a' + i, sizes[i]);
+        CHECK(hap_httpd_send_notif(NULL, p.acc_fd, msg, sizes[i]) == expected);
+        ctrl_read_all(&p, got, sizes[i]);
+        CHECK(memcmp(got, msg, sizes[i]) == 0);
+        frames += expected;
+    }
+    hap_notif_stats_get(&stats);
+    CHECK(stats.notifications == 4);
+    CHECK(stats.frames == frames);
+    CHECK(stats.failed == 0);
+
+    /* No events before pair verify, and none counted when the controller has gone */
+    pair_open(&unverified);
+    unverified.acc.state = STATE_INVALID;
+    CHECK(hap_httpd_send_notif(NULL, unverified.acc_fd, msg, 100) == HAP_FAIL);
+    pair_close(&unverified);
+    close(p.ctrl_fd);
+    CHECK(hap_httpd_send_notif(NULL, p.acc_fd, msg, 100) == HAP_FAIL);
+    hap_notif_stats_get(&stats);
+    CHECK(stats.notifications == 4);
+    CHECK(stats.frames == frames);
+    CHECK(stats.failed == 1);
+    printf("notifications: %u sent in %u frames, %u failed\n",
+           stats.notifications, stats.frames, stats.failed);
+    sessions_by_fd[p.ctrl_fd] = NULL;
+    hap_session_io_release(&p.acc);
+    sessions_by_fd[p.acc_fd] = NULL;
+    close(p.acc_fd);
+
+    hap_notif_stats_reset();
+    hap_notif_stats_get(&stats);
+    CHECK(stats.notifications == 0 && stats.frames == 0 && stats.failed == 0);
+}
+
+/* The controller's end, which takes the frames as fast as they come */
+static void *drain_task(void *arg)
+{
+    int fd = *(int *)arg;
+    char buf[65536];
+    ssize_t len;
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        bytes_drained += len;
+    }
+    return NULL;
+}
+
+/* Responses from a short status to a large /accessories */
+static void bench_send(void)
+{
+    static const int sizes[] = { 100, 1024, 4096, 16384, 65536 };
+    static char buf[65536];
+    pthread_t drain;
+    pair_t p;
+    int i, j;
+
+    pair_open(&p);
+    pthread_create(&drain, NULL, drain_task, &p.ctrl_fd);
+    memset(buf, 'x', sizeof(buf));
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        int responses = BENCH_BYTES / sizes[i];
+        double start;
+
+        send_calls = bytes_out = bytes_drained = 0;
+        start = now_s();
+        for (j = 0; j < responses; j++) {
+            CHECK(hap_httpd_send(NULL, p.acc_fd, buf, sizes[i], 0) == sizes[i]);
+        }
+        while (bytes_drained < bytes_out)
+            ;
+        printf("%5d byte responses: %6.1f MB/s, %.2f send() calls per response\n", sizes[i],
+               (double)BENCH_BYTES / (now_s() - start) / 1e6, (double)send_calls / responses);
+    }
+    shutdown(p.acc_fd, SHUT_WR);
+    pthread_join(drain, NULL);
+    pair_close(&p);
+}
+
+int main(void)
+{
+    /* Sends to a closed socket fail with EPIPE, as with lwIP */
+    signal(SIGPIPE, SIG_IGN);
+    srand(1);
+    test_interleaved();
+    test_notif_stats();
+    bench_send();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * ESPRESSIF MIT License
+ *
+ * Copyright (c) 2020 <ESPRESSIF SYSTEMS (SHANGHAI) PTE LTD>
+ *
+ * Permission is hereby granted for use on ESPRESSIF SYSTEMS products only, in which case,
+ * it is free of charge, to any person obtaining a copy of this software and associated
+ * documentation files (the "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the Software is furnished
+ * to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or
+ * substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mbedtls/sha512.h"
+#include "mbedtls/platform_util.h"
+
+#include "esp_mfi_sha.h"
+#include "esp_mfi_hkdf.h"
+
+#ifdef CONFIG_IDF_TARGET_ESP8266
+#define mbedtls_sha512_starts mbedtls_sha512_starts_ret
+#define mbedtls_sha512_update mbedtls_sha512_update_ret
+#define mbedtls_sha512_finish mbedtls_sha512_finish_ret
+#endif
+
+#define SHA512_BLOCK_SIZE   128
+#define HMAC_IPAD           0x36
+#define HMAC_OPAD           0x5c
+
+typedef struct {
+    mbedtls_sha512_context inner;
+    mbedtls_sha512_context outer;
+} hmac_sha512_key_t;
+
+/* Hashes in a padded key block and keeps the state in a clone. The context
+ * the block went through is freed, as it may hold the SHA engine until then.
+ */
+static void hmac_sha512_pad_state(mbedtls_sha512_context *state, const uint8_t *block)
+{
+    mbedtls_sha512_context ctx;
+
+    mbedtls_sha512_init(&ctx);
+    mbedtls_sha512_starts(&ctx, 0);
+    mbedtls_sha512_update(&ctx, block, SHA512_BLOCK_SIZE);
+    mbedtls_sha512_init(state);
+    mbedtls_sha512_clone(state, &ctx);
+    mbedtls_sha512_free(&ctx);
+}
+
+/* HMAC of the concatenation of the parts of a message */
+static void hmac_sha512_parts(const hmac_sha512_key_t *k, const uint8_t **msg, const int *len,
+                              int parts, uint8_t *mac)
+{
+    mbedtls_sha512_context ctx;
+    uint8_t digest[MFI_SHA512_SIZE];
+    int i;
+
+    mbedtls_sha512_init(&ctx);
+    mbedtls_sha512_clone(&ctx, &k->inner);
+    for (i = 0; i < parts; i++) {
+        if (len[i] > 0)
+            mbedtls_sha512_update(&ctx, msg[i], len[i]);
+    }
+    mbedtls_sha512_finish(&ctx, digest);
+    mbedtls_sha512_free(&ctx);
+
+    mbedtls_sha512_init(&ctx);
+    mbedtls_sha512_clone(&ctx, &k->outer);
+    mbedtls_sha512_update(&ctx, digest, sizeof(digest));
+    mbedtls_sha512_finish(&ctx, mac);
+    mbedtls_sha512_free(&ctx);
+    mbedtls_platform_zeroize(digest, sizeof(digest));
+}
+
+esp_mfi_hmac_sha512_key_t esp_mfi_hmac_sha512_key_new(const uint8_t *key, int len)
+{
+    hmac_sha512_key_t *k;
+    uint8_t block[SHA512_BLOCK_SIZE];
+    uint8_t digest[MFI_SHA512_SIZE];
+    int i;
+
+    if (key == NULL && len > 0)
+        return NULL;
+    k = (hmac_sha512_key_t *) malloc(sizeof(hmac_sha512_key_t));
+    if (k == NULL)
+        return NULL;
+
+    /* Keys longer than a block are hashed first */
+    if (len > SHA512_BLOCK_SIZE) {
+        mbedtls_sha512_context ctx;
+        mbedtls_sha512_init(&ctx);
+        mbedtls_sha512_starts(&ctx, 0);
+        mbedtls_sha512_update(&ctx, key, len);
+        mbedtls_sha512_finish(&ctx, digest);
+        mbedtls_sha512_free(&ctx);
+        key = digest;
+        len = sizeof(digest);
+    }
+
+    memset(block, HMAC_IPAD, sizeof(block));
+    for (i = 0; i < len; i++)
+        block[i] ^= key[i];
+    hmac_sha512_pad_state(&k->inner, block);
+    for (i = 0; i < SHA512_BLOCK_SIZE; i++)
+        block[i] ^= HMAC_IPAD ^ HMAC_OPAD;
+    hmac_sha512_pad_state(&k->outer, block);
+
+    mbedtls_platform_zeroize(block, sizeof(block));
+    mbedtls_platform_zeroize(digest, sizeof(digest));
+    return k;
+}
+
+void esp_mfi_hmac_sha512_key_free(esp_mfi_hmac_sha512_key_t key)
+{
+    hmac_sha512_key_t *k = (hmac_sha512_key_t *) key;
+
+    if (k) {
+        mbedtls_sha512_free(&k->inner);
+        mbedtls_sha512_free(&k->outer);
+        free(k);
+    }
+}
+
+int esp_mfi_hmac_sha512(esp_mfi_hmac_sha512_key_t key, const uint8_t *msg, int len, uint8_t *mac)
+{
+    if (key == NULL || (msg == NULL && len > 0) || mac == NULL)
+        return -1;
+
+    hmac_sha512_parts((hmac_sha512_key_t *) key, &msg, &len, 1, mac);
+    return 0;
+}
+
+esp_mfi_hmac_sha512_key_t esp_mfi_hkdf_sha512_extract(esp_mfi_hmac_sha512_key_t salt,
+                                                      const uint8_t *ikm, int ikm_len)
+{
+    esp_mfi_hmac_sha512_key_t prk;
+    uint8_t prk_bytes[MFI_SHA512_SIZE];
+
+    if (esp_mfi_hmac_sha512(salt, ikm, ikm_len, prk_bytes) != 0)
+        return NULL;
+    prk = esp_mfi_hmac_sha512_key_new(prk_bytes, sizeof(prk_bytes));
+    mbedtls_platform_zeroize(prk_bytes, sizeof(prk_bytes));
+    return prk;
+}
+
+int esp_mfi_hkdf_sha512_expand(esp_mfi_hmac_sha512_key_t prk, const uint8_t *info, int info_len,
+                               uint8_t *okm, int okm_len)
+{
+    uint8_t t[MFI_SHA512_SIZE];
+    uint8_t counter;
+    const uint8_t *msg[3] = { t, info, &counter };
+    int len[3] = { 0, info_len, 1 };
+    int done;
+
+    if (prk == NULL || (info == NULL && info_len > 0) || okm == NULL ||
+            okm_len < 0 || okm_len > 255 * MFI_SHA512_SIZE)
+        return -1;
+
+    /* T(i) = HMAC(PRK, T(i - 1) | info | i), with an empty T(0) */
+    for (done = 0, counter = 1; done < okm_len; done += MFI_SHA512_SIZE, counter++) {
+        int n = okm_len - done < MFI_SHA512_SIZE ? okm_len - done : MFI_SHA512_SIZE;
+
+        hmac_sha512_parts((hmac_sha512_key_t *) prk, msg, len, 3, t);
+        len[0] = sizeof(t);
+        memcpy(okm + done, t, n);
+    }
+    mbedtls_platform_zeroize(t, sizeof(t));
+    return 0;
+}
+
+int esp_mfi_hkdf_sha512(esp_mfi_hmac_sha512_key_t salt, const uint8_t *ikm, int ikm_len,
+                        const uint8_t *info, int info_len, uint8_t *okm, int okm_len)
+{
+    esp_mfi_hmac_sha512_key_t prk = esp_mfi_hkdf_sha512_extract(salt, ikm, ikm_len);
+    int ret;
+
+    if (prk == NULL)
+        return -1;
+    ret = esp_mfi_hkdf_sha512_expand(prk, info, info_len, okm, okm_len);
+    esp_mfi_hmac_sha512_key_free(prk);
+    return ret;
+}
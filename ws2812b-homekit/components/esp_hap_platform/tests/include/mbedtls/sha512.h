@@ -0,0 +1,30 @@
+/*
+ * The part of the mbedTLS 2.28 SHA-512 API that esp_mfi_hkdf.c uses, to
+ * build against the host's libmbedcrypto, which comes without its headers.
+ * The calls are mapped to the _ret ones as on the ESP8266.
+ */
+#ifndef MBEDTLS_SHA512_H
+#define MBEDTLS_SHA512_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct mbedtls_sha512_context {
+    uint64_t total[2];
+    uint64_t state[8];
+    unsigned char buffer[128];
+    int is384;
+} mbedtls_sha512_context;
+
+void mbedtls_sha512_init(mbedtls_sha512_context *ctx);
+void mbedtls_sha512_free(mbedtls_sha512_context *ctx);
+void mbedtls_sha512_clone(mbedtls_sha512_context *dst, const mbedtls_sha512_context *src);
+int mbedtls_sha512_starts_ret(mbedtls_sha512_context *ctx, int is384);
+int mbedtls_sha512_update_ret(mbedtls_sha512_context *ctx, const unsigned char *input, size_t ilen);
+int mbedtls_sha512_finish_ret(mbedtls_sha512_context *ctx, unsigned char output[64]);
+
+#define mbedtls_sha512_starts mbedtls_sha512_starts_ret
+#define mbedtls_sha512_update mbedtls_sha512_update_ret
+#define mbedtls_sha512_finish mbedtls_sha512_finish_ret
+
+#endif /* MBEDTLS_SHA512_H */
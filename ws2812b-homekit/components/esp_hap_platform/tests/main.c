@@ -0,0 +1,279 @@
+/*
+ * Host test of the HMAC-SHA512 and HKDF-SHA512 of esp_mfi_hkdf.c against the
+ * RFC 6234 test vectors and code, and benchmark of the key derivations of
+ * pair setup and pair verify with either.
+ *
+ * Build and run with "make test" in this directory.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_mfi_hkdf.h"
+
+/* The test vectors of shatest.c, without its main() */
+#define main shatest_main
+#include "shatest.c"
+#undef main
+
+#define ITERATIONS	20000
+
+#define PAIR_SETUP_ENCRYPT_SALT		"Pair-Setup-Encrypt-Salt"
+#define PAIR_SETUP_ENCRYPT_INFO		"Pair-Setup-Encrypt-Info"
+#define PAIR_SETUP_CTRL_SIGN_SALT	"Pair-Setup-Controller-Sign-Salt"
+#define PAIR_SETUP_CTRL_SIGN_INFO	"Pair-Setup-Controller-Sign-Info"
+#define PAIR_SETUP_ACC_SIGN_SALT	"Pair-Setup-Accessory-Sign-Salt"
+#define PAIR_SETUP_ACC_SIGN_INFO	"Pair-Setup-Accessory-Sign-Info"
+#define PAIR_VERIFY_ENCRYPT_SALT	"Pair-Verify-Encrypt-Salt"
+#define PAIR_VERIFY_ENCRYPT_INFO	"Pair-Verify-Encrypt-Info"
+#define CONTROL_SALT			"Control-Salt"
+#define CONTROL_READ_INFO		"Control-Read-Encryption-Key"
+#define CONTROL_WRITE_INFO		"Control-Write-Encryption-Key"
+
+#define S(str)	(const uint8_t *)(str), (int)strlen(str)
+
+static int failures;
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL line %d: %s\n", __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static uint32_t rand_state = 0x2545F491;
+
+static uint32_t rand32(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static void rand_bytes(uint8_t *buf, int len)
+{
+	while (len--)
+		*buf++ = rand32();
+}
+
+/* The HMAC-SHA-512 cases of shatest.c, the RFC 4231 ones */
+static void test_hmac_vectors(void)
+{
+	int i;
+
+	for (i = 0; i < HMACTESTCOUNT; i++) {
+		const struct hmachash *h = &hmachashes[i];
+		const char *key = h->keyarray[4] ? h->keyarray[4] :
+				  h->keyarray[1] ? h->keyarray[1] : h->keyarray[0];
+		int key_len = h->keylength[4] ? h->keylength[4] :
+			      h->keylength[1] ? h->keylength[1] : h->keylength[0];
+		const char *data = h->dataarray[4] ? h->dataarray[4] :
+				   h->dataarray[1] ? h->dataarray[1] : h->dataarray[0];
+		int data_len = h->datalength[4] ? h->datalength[4] :
+			       h->datalength[1] ? h->datalength[1] : h->datalength[0];
+		esp_mfi_hmac_sha512_key_t k;
+		uint8_t mac[USHAMaxHashSize];
+
+		k = esp_mfi_hmac_sha512_key_new((const uint8_t *)key, key_len);
+		CHECK(k != NULL);
+		CHECK(esp_mfi_hmac_sha512(k, (const uint8_t *)data, data_len, mac) == 0);
+		/* Some of the cases only check a truncated MAC */
+		CHECK(checkmatch(mac, h->resultarray[4], h->resultlength[4]));
+		/* and the same key again */
+		CHECK(esp_mfi_hmac_sha512(k, (const uint8_t *)data, data_len, mac) == 0);
+		CHECK(checkmatch(mac, h->resultarray[4], h->resultlength[4]));
+		esp_mfi_hmac_sha512_key_free(k);
+	}
+}
+
+/* HKDF-SHA512 as the RFC 6234 code does it, for salts, keys, infos and
+ * outputs of all the lengths around the block sizes.
+ */
+static void test_hkdf(void)
+{
+	uint8_t salt[300], ikm[300], info[300], okm[600], expected[600];
+	int i;
+
+	for (i = 0; i < 500; i++) {
+		int salt_len = rand32() % sizeof(salt);
+		int ikm_len = rand32() % sizeof(ikm);
+		int info_len = rand32() % sizeof(info);
+		/* The RFC 6234 code takes no empty output */
+		int okm_len = i < 130 ? i + 1 : 1 + (int)(rand32() % (sizeof(okm) - 1));
+		esp_mfi_hmac_sha512_key_t k;
+
+		rand_bytes(salt, salt_len);
+		rand_bytes(ikm, ikm_len);
+		rand_bytes(info, info_len);
+		CHECK(hkdf(SHA512, salt, salt_len, ikm, ikm_len, info, info_len,
+			   expected, okm_len) == shaSuccess);
+		k = esp_mfi_hmac_sha512_key_new(salt, salt_len);
+		memset(okm, 0, sizeof(okm));
+		CHECK(esp_mfi_hkdf_sha512(k, ikm, ikm_len, info, info_len, okm, okm_len) == 0);
+		CHECK(memcmp(okm, expected, okm_len) == 0);
+		CHECK(okm[okm_len] == 0);
+		esp_mfi_hmac_sha512_key_free(k);
+	}
+
+	/* One extract for two expands, as for the session keys */
+	{
+		esp_mfi_hmac_sha512_key_t salt_key = esp_mfi_hmac_sha512_key_new(S(CONTROL_SALT));
+		esp_mfi_hmac_sha512_key_t prk;
+		uint8_t read_key[32], write_key[32];
+
+		rand_bytes(ikm, 32);
+		prk = esp_mfi_hkdf_sha512_extract(salt_key, ikm, 32);
+		CHECK(prk != NULL);
+		CHECK(esp_mfi_hkdf_sha512_expand(prk, S(CONTROL_READ_INFO), read_key, 32) == 0);
+		CHECK(esp_mfi_hkdf_sha512_expand(prk, S(CONTROL_WRITE_INFO), write_key, 32) == 0);
+		hkdf(SHA512, S(CONTROL_SALT), ikm, 32, S(CONTROL_READ_INFO), expected, 32);
+		CHECK(memcmp(read_key, expected, 32) == 0);
+		hkdf(SHA512, S(CONTROL_SALT), ikm, 32, S(CONTROL_WRITE_INFO), expected, 32);
+		CHECK(memcmp(write_key, expected, 32) == 0);
+		CHECK(esp_mfi_hkdf_sha512_expand(prk, NULL, 0, okm, 255 * 64 + 1) == -1);
+		esp_mfi_hmac_sha512_key_free(prk);
+		esp_mfi_hmac_sha512_key_free(salt_key);
+	}
+}
+
+static uint32_t fnv1a(uint32_t h, const uint8_t *buf, int len)
+{
+	while (len--) {
+		h ^= *buf++;
+		h *= 16777619;
+	}
+	return h;
+}
+
+/* Pair verify: SessionKey, then the read and write keys of the session */
+static double bench_verify_ref(uint32_t *transcript)
+{
+	uint8_t secret[32] = { 0 }, key[32];
+	double start = now_ms();
+	int i;
+
+	for (i = 0; i < ITERATIONS; i++) {
+		secret[0] = i;
+		hkdf(SHA512, S(PAIR_VERIFY_ENCRYPT_SALT), secret, sizeof(secret),
+		     S(PAIR_VERIFY_ENCRYPT_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+		hkdf(SHA512, S(CONTROL_SALT), secret, sizeof(secret),
+		     S(CONTROL_READ_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+		hkdf(SHA512, S(CONTROL_SALT), secret, sizeof(secret),
+		     S(CONTROL_WRITE_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+	}
+	return (now_ms() - start) * 1000 / ITERATIONS;
+}
+
+static double bench_verify(uint32_t *transcript)
+{
+	esp_mfi_hmac_sha512_key_t encrypt_salt = esp_mfi_hmac_sha512_key_new(S(PAIR_VERIFY_ENCRYPT_SALT));
+	esp_mfi_hmac_sha512_key_t control_salt = esp_mfi_hmac_sha512_key_new(S(CONTROL_SALT));
+	uint8_t secret[32] = { 0 }, key[32];
+	double start = now_ms();
+	int i;
+
+	for (i = 0; i < ITERATIONS; i++) {
+		esp_mfi_hmac_sha512_key_t prk;
+
+		secret[0] = i;
+		esp_mfi_hkdf_sha512(encrypt_salt, secret, sizeof(secret),
+				    S(PAIR_VERIFY_ENCRYPT_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+		prk = esp_mfi_hkdf_sha512_extract(control_salt, secret, sizeof(secret));
+		esp_mfi_hkdf_sha512_expand(prk, S(CONTROL_READ_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+		esp_mfi_hkdf_sha512_expand(prk, S(CONTROL_WRITE_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+		esp_mfi_hmac_sha512_key_free(prk);
+	}
+	esp_mfi_hmac_sha512_key_free(encrypt_salt);
+	esp_mfi_hmac_sha512_key_free(control_salt);
+	return (now_ms() - start) * 1000 / ITERATIONS;
+}
+
+/* Pair setup: SessionKey, iOSDeviceX and AccessoryX from the SRP secret */
+static double bench_setup_ref(uint32_t *transcript)
+{
+	uint8_t secret[64] = { 0 }, key[32];
+	double start = now_ms();
+	int i;
+
+	for (i = 0; i < ITERATIONS; i++) {
+		secret[0] = i;
+		hkdf(SHA512, S(PAIR_SETUP_ENCRYPT_SALT), secret, sizeof(secret),
+		     S(PAIR_SETUP_ENCRYPT_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+		hkdf(SHA512, S(PAIR_SETUP_CTRL_SIGN_SALT), secret, sizeof(secret),
+		     S(PAIR_SETUP_CTRL_SIGN_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+		hkdf(SHA512, S(PAIR_SETUP_ACC_SIGN_SALT), secret, sizeof(secret),
+		     S(PAIR_SETUP_ACC_SIGN_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+	}
+	return (now_ms() - start) * 1000 / ITERATIONS;
+}
+
+static double bench_setup(uint32_t *transcript)
+{
+	esp_mfi_hmac_sha512_key_t encrypt_salt = esp_mfi_hmac_sha512_key_new(S(PAIR_SETUP_ENCRYPT_SALT));
+	esp_mfi_hmac_sha512_key_t ctrl_salt = esp_mfi_hmac_sha512_key_new(S(PAIR_SETUP_CTRL_SIGN_SALT));
+	esp_mfi_hmac_sha512_key_t acc_salt = esp_mfi_hmac_sha512_key_new(S(PAIR_SETUP_ACC_SIGN_SALT));
+	uint8_t secret[64] = { 0 }, key[32];
+	double start = now_ms();
+	int i;
+
+	for (i = 0; i < ITERATIONS; i++) {
+		secret[0] = i;
+		esp_mfi_hkdf_sha512(encrypt_salt, secret, sizeof(secret),
+				    S(PAIR_SETUP_ENCRYPT_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+		esp_mfi_hkdf_sha512(ctrl_salt, secret, sizeof(secret),
+				    S(PAIR_SETUP_CTRL_SIGN_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+		esp_mfi_hkdf_sha512(acc_salt, secret, sizeof(secret),
+				    S(PAIR_SETUP_ACC_SIGN_INFO), key, sizeof(key));
+		*transcript = fnv1a(*transcript, key, sizeof(key));
+	}
+	esp_mfi_hmac_sha512_key_free(encrypt_salt);
+	esp_mfi_hmac_sha512_key_free(ctrl_salt);
+	esp_mfi_hmac_sha512_key_free(acc_salt);
+	return (now_ms() - start) * 1000 / ITERATIONS;
+}
+
+int main(void)
+{
+	uint32_t ref_transcript = 2166136261u, transcript = 2166136261u;
+	double verify_ref, verify, setup_ref, setup;
+
+	test_hmac_vectors();
+	test_hkdf();
+
+	verify_ref = bench_verify_ref(&ref_transcript);
+	verify = bench_verify(&transcript);
+	setup_ref = bench_setup_ref(&ref_transcript);
+	setup = bench_setup(&transcript);
+	CHECK(transcript == ref_transcript);
+
+	printf("pair verify keys: %.1f us with RFC 6234, %.1f us\n", verify_ref, verify);
+	printf("pair setup keys: %.1f us with RFC 6234, %.1f us\n", setup_ref, setup);
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,2 @@
+COMPONENT_SRCDIRS := upstream/src
+COMPONENT_ADD_INCLUDEDIRS := upstream/include upstream
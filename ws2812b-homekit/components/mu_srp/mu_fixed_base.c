@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <string.h>
+#include "mu_fixed_base.h"
+
+/* Limbs of the native width of the bignum library where it has a double
+ * width type to multiply them into.
+ */
+#if defined(BIGNUM_MBEDTLS) && defined(MBEDTLS_HAVE_UDBL)
+typedef mbedtls_mpi_uint mu_limb_t;
+typedef mbedtls_t_udbl mu_dlimb_t;
+#else
+typedef uint32_t mu_limb_t;
+typedef uint64_t mu_dlimb_t;
+#endif
+#define LIMB_BITS	(8 * sizeof(mu_limb_t))
+
+/* Lim-Lee comb: the exponent is cut into layers of COMB_TEETH rows of
+ * COMB_SPACING bits, and each layer has the 2^COMB_TEETH products of its row
+ * bases. An exponentiation is then COMB_SPACING squarings and one
+ * multiplication per layer for each of them.
+ */
+#define COMB_TEETH	4
+#define COMB_SPACING	64
+#define COMB_ENTRIES	(1 << COMB_TEETH)
+#define COMB_LAYER_BITS	(COMB_TEETH * COMB_SPACING)
+
+struct mu_fixed_base {
+	int limbs;
+	int layers;
+	mu_limb_t n0inv;
+	mu_limb_t *n;
+	/* R mod n, which is 1 in Montgomery form */
+	mu_limb_t *one;
+	/* layers * COMB_ENTRIES entries in Montgomery form */
+	mu_limb_t *table;
+};
+
+static void wipe(void *buf, size_t len)
+{
+	volatile unsigned char *p = buf;
+	while (len--)
+		*p++ = 0;
+}
+
+static void load_bytes(mu_limb_t *r, int limbs, const unsigned char *bytes, int len)
+{
+	int i;
+	memset(r, 0, limbs * sizeof(mu_limb_t));
+	for (i = 0; i < len; i++) {
+		int k = len - 1 - i;
+		r[k / sizeof(mu_limb_t)] |= (mu_limb_t)bytes[i] << (8 * (k % sizeof(mu_limb_t)));
+	}
+}
+
+static void store_bytes(unsigned char *bytes, int len, const mu_limb_t *a)
+{
+	int i;
+	for (i = 0; i < len; i++) {
+		int k = len - 1 - i;
+		bytes[i] = (unsigned char)(a[k / sizeof(mu_limb_t)] >> (8 * (k % sizeof(mu_limb_t))));
+	}
+}
+
+/* r = a - b, returns the borrow */
+static mu_limb_t sub_limbs(mu_limb_t *r, const mu_limb_t *a, const mu_limb_t *b, int limbs)
+{
+	mu_limb_t borrow = 0;
+	int i;
+	for (i = 0; i < limbs; i++) {
+		mu_limb_t d = a[i] - b[i];
+		mu_limb_t c = d > a[i];
+		r[i] = d - borrow;
+		borrow = c | (r[i] > d);
+	}
+	return borrow;
+}
+
+/* a = 2a mod n, for a < n. Only used on public values. */
+static void double_mod(mu_fixed_base_t *fb, mu_limb_t *a, mu_limb_t *t)
+{
+	mu_limb_t carry = 0;
+	int i;
+	for (i = 0; i < fb->limbs; i++) {
+		mu_limb_t top = a[i] >> (LIMB_BITS - 1);
+		a[i] = (a[i] << 1) | carry;
+		carry = top;
+	}
+	if (sub_limbs(t, a, fb->n, fb->limbs) <= carry)
+		memcpy(a, t, fb->limbs * sizeof(mu_limb_t));
+}
+
+/* r = a * b / R mod n, for a, b < n. r may be a or b. t has limbs + 2
+ * limbs. Runs in the same time whatever the values.
+ */
+static void mont_mul(const mu_fixed_base_t *fb, mu_limb_t *r, const mu_limb_t *a,
+		     const mu_limb_t *b, mu_limb_t *t)
+{
+	int limbs = fb->limbs;
+	const mu_limb_t *n = fb->n;
+	mu_limb_t carry, m, borrow, mask;
+	mu_dlimb_t d;
+	int i, j;
+
+	memset(t, 0, (limbs + 2) * sizeof(mu_limb_t));
+	for (i = 0; i < limbs; i++) {
+		carry = 0;
+		for (j = 0; j < limbs; j++) {
+			d = (mu_dlimb_t)a[j] * b[i] + t[j] + carry;
+			t[j] = (mu_limb_t)d;
+			carry = (mu_limb_t)(d >> LIMB_BITS);
+		}
+		d = (mu_dlimb_t)t[limbs] + carry;
+		t[limbs] = (mu_limb_t)d;
+		t[limbs + 1] = (mu_limb_t)(d >> LIMB_BITS);
+
+		m = t[0] * fb->n0inv;
+		d = (mu_dlimb_t)m * n[0] + t[0];
+		carry = (mu_limb_t)(d >> LIMB_BITS);
+		for (j = 1; j < limbs; j++) {
+			d = (mu_dlimb_t)m * n[j] + t[j] + carry;
+			t[j - 1] = (mu_limb_t)d;
+			carry = (mu_limb_t)(d >> LIMB_BITS);
+		}
+		d = (mu_dlimb_t)t[limbs] + carry;
+		t[limbs - 1] = (mu_limb_t)d;
+		t[limbs] = t[limbs + 1] + (mu_limb_t)(d >> LIMB_BITS);
+	}
+
+	/* t < 2n, keep t - n unless it went below 0 */
+	borrow = sub_limbs(r, t, n, limbs);
+	mask = (mu_limb_t)0 - (mu_limb_t)(borrow > t[limbs]);
+	for (i = 0; i < limbs; i++)
+		r[i] = (r[i] & ~mask) | (t[i] & mask);
+}
+
+static void comb_select(const mu_fixed_base_t *fb, mu_limb_t *r, const mu_limb_t *layer, unsigned digit)
+{
+	int limbs = fb->limbs;
+	unsigned d;
+	int i;
+
+	memset(r, 0, limbs * sizeof(mu_limb_t));
+	for (d = 0; d < COMB_ENTRIES; d++) {
+		mu_limb_t mask = (mu_limb_t)0 - (mu_limb_t)(d == digit);
+		for (i = 0; i < limbs; i++)
+			r[i] |= layer[d * limbs + i] & mask;
+	}
+}
+
+mu_fixed_base_t *mu_fixed_base_new(const char *g, int len_g, const char *n, int len_n, int max_bits)
+{
+	mu_fixed_base_t *fb;
+	mu_limb_t *p = NULL, *t = NULL, inv;
+	int limbs, i, j, k;
+
+	if (len_n <= 0 || !(n[len_n - 1] & 1) || len_g > len_n)
+		return NULL;
+	fb = calloc(1, sizeof(*fb));
+	if (!fb)
+		return NULL;
+	limbs = (len_n + sizeof(mu_limb_t) - 1) / sizeof(mu_limb_t);
+	fb->limbs = limbs;
+	fb->layers = (max_bits + COMB_LAYER_BITS - 1) / COMB_LAYER_BITS;
+	fb->n = malloc(limbs * sizeof(mu_limb_t));
+	fb->one = malloc(limbs * sizeof(mu_limb_t));
+	fb->table = malloc((size_t)fb->layers * COMB_ENTRIES * limbs * sizeof(mu_limb_t));
+	p = malloc(limbs * sizeof(mu_limb_t));
+	t = malloc((limbs + 2) * sizeof(mu_limb_t));
+	if (!fb->n || !fb->one || !fb->table || !p || !t)
+		goto error;
+	load_bytes(fb->n, limbs, (const unsigned char *)n, len_n);
+
+	/* -1/n mod 2^LIMB_BITS, each Newton step doubles the correct bits */
+	inv = fb->n[0];
+	for (i = 0; i < 6; i++)
+		inv *= 2 - fb->n[0] * inv;
+	fb->n0inv = (mu_limb_t)0 - inv;
+
+	/* R mod n, then R^2 mod n into p */
+	memset(fb->one, 0, limbs * sizeof(mu_limb_t));
+	fb->one[0] = 1;
+	for (i = 0; i < limbs * (int)LIMB_BITS; i++)
+		double_mod(fb, fb->one, t);
+	memcpy(p, fb->one, limbs * sizeof(mu_limb_t));
+	for (i = 0; i < limbs * (int)LIMB_BITS; i++)
+		double_mod(fb, p, t);
+
+	/* p = g in Montgomery form, the base of the first row */
+	load_bytes(fb->table, limbs, (const unsigned char *)g, len_g);
+	mont_mul(fb, p, fb->table, p, t);
+
+	for (j = 0; j < fb->layers; j++) {
+		mu_limb_t *layer = fb->table + (size_t)j * COMB_ENTRIES * limbs;
+		memcpy(layer, fb->one, limbs * sizeof(mu_limb_t));
+		for (i = 0; i < COMB_TEETH; i++) {
+			memcpy(layer + (1 << i) * limbs, p, limbs * sizeof(mu_limb_t));
+			for (k = 0; k < COMB_SPACING; k++)
+				mont_mul(fb, p, p, p, t);
+		}
+		for (i = 3; i < COMB_ENTRIES; i++) {
+			if (!(i & (i - 1)))
+				continue;
+			mont_mul(fb, layer + i * limbs, layer + (i & (i - 1)) * limbs,
+				 layer + (i & -i) * limbs, t);
+		}
+	}
+	free(p);
+	free(t);
+	return fb;
+ error:
+	free(p);
+	free(t);
+	mu_fixed_base_free(fb);
+	return NULL;
+}
+
+void mu_fixed_base_free(mu_fixed_base_t *fb)
+{
+	if (!fb)
+		return;
+	free(fb->n);
+	free(fb->one);
+	free(fb->table);
+	free(fb);
+}
+
+static unsigned exp_bit(const unsigned char *e, int len, int bit)
+{
+	if (bit >= 8 * len)
+		return 0;
+	return (e[len - 1 - bit / 8] >> (bit % 8)) & 1;
+}
+
+mu_bn_t *mu_fixed_base_exp(mu_fixed_base_t *fb, mu_bn_t *e)
+{
+	int limbs = fb->limbs;
+	int len_e, len_n = limbs * sizeof(mu_limb_t);
+	unsigned char *bytes_e, *bytes_r = NULL;
+	mu_limb_t *acc = NULL, *sel, *t;
+	mu_bn_t *r = NULL;
+	int layers, c, i, j;
+
+	bytes_e = (unsigned char *)mu_bn_to_bin(e, &len_e);
+	if (!bytes_e || 8 * len_e > fb->layers * COMB_LAYER_BITS)
+		goto done;
+	acc = malloc((3 * limbs + 2) * sizeof(mu_limb_t));
+	bytes_r = malloc(len_n);
+	if (!acc || !bytes_r)
+		goto done;
+	sel = acc + limbs;
+	t = sel + limbs;
+	/* Only the layers the exponent reaches, its length is no secret */
+	layers = (8 * len_e + COMB_LAYER_BITS - 1) / COMB_LAYER_BITS;
+
+	memcpy(acc, fb->one, limbs * sizeof(mu_limb_t));
+	for (c = COMB_SPACING - 1; c >= 0; c--) {
+		mont_mul(fb, acc, acc, acc, t);
+		for (j = 0; j < layers; j++) {
+			unsigned digit = 0;
+			for (i = 0; i < COMB_TEETH; i++)
+				digit |= exp_bit(bytes_e, len_e, j * COMB_LAYER_BITS + i * COMB_SPACING + c) << i;
+			comb_select(fb, sel, fb->table + (size_t)j * COMB_ENTRIES * limbs, digit);
+			mont_mul(fb, acc, acc, sel, t);
+		}
+	}
+
+	/* Out of Montgomery form */
+	memset(sel, 0, limbs * sizeof(mu_limb_t));
+	sel[0] = 1;
+	mont_mul(fb, acc, acc, sel, t);
+	store_bytes(bytes_r, len_n, acc);
+	r = mu_bn_new_from_bin((char *)bytes_r, len_n);
+ done:
+	if (bytes_e) {
+		wipe(bytes_e, len_e);
+		free(bytes_e);
+	}
+	if (acc) {
+		wipe(acc, (3 * limbs + 2) * sizeof(mu_limb_t));
+		free(acc);
+	}
+	if (bytes_r) {
+		wipe(bytes_r, len_n);
+		free(bytes_r);
+	}
+	return r;
+}
@@ -0,0 +1,29 @@
+#ifndef _MU_FIXED_BASE_H_
+#define _MU_FIXED_BASE_H_
+
+#include "mu_bignum.h"
+
+/* Exponentiation of a fixed base modulo a fixed odd modulus.
+ *
+ * The powers of the base are precomputed once into a comb table kept in
+ * Montgomery form, so that g^e mod n takes a quarter of the squarings of a
+ * generic exponentiation, and the Montgomery constants of n are worked out
+ * only once for all the exponentiations. The table entries are selected in
+ * constant time, as the exponents are secret.
+ */
+typedef struct mu_fixed_base mu_fixed_base_t;
+
+/* Builds the table for exponents of up to max_bits bits. It takes
+ * 16 * len_n bytes per 256 exponent bits, and about as long to build as a
+ * generic exponentiation with a max_bits exponent.
+ */
+mu_fixed_base_t *mu_fixed_base_new(const char *g, int len_g, const char *n, int len_n, int max_bits);
+
+void mu_fixed_base_free(mu_fixed_base_t *fb);
+
+/* Returns g^e mod n, or NULL if out of memory or e is longer than the
+ * table is for.
+ */
+mu_bn_t *mu_fixed_base_exp(mu_fixed_base_t *fb, mu_bn_t *e);
+
+#endif /* ! _MU_FIXED_BASE_H_ */
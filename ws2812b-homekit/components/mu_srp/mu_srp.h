@@ -59,6 +59,15 @@ void mu_srp_free(mu_srp_handle_t *hd);
 int mu_srp_srv_pubkey(mu_srp_handle_t *hd, const char *username, const char *pass, int pass_len, int salt_len,
 		      char **bytes_B, int *len_B, char **bytes_salt);
 
+/* Generates a random salt of salt_len bytes and the verifier for the password,
+ * to be given to mu_srp_set_salt_verifier() later, so that the verifier does
+ * not have to be computed for each session.
+ *
+ * *bytes_salt and *bytes_verifier MUST BE FREED BY THE CALLER
+ */
+int mu_srp_gen_salt_verifier(const char *username, const char *pass, int pass_len, int salt_len,
+			     char **bytes_salt, char **bytes_verifier, int *len_verifier);
+
 /* Set the Salt and Verifier pre-generated for a given password.
  * This should be used only if the actual password is not available.
  * The public key can then be generated using mu_srp_srv_pubkey_from_salt_verifier()
@@ -73,6 +82,22 @@ int mu_srp_set_salt_verifier(mu_srp_handle_t *hd, const char *salt, int salt_len
  */
 int mu_srp_srv_pubkey_from_salt_verifier(mu_srp_handle_t *hd, char **bytes_B, int *len_B);
 
+/* Generates the server's secret b and g^b ahead of a session, as they do not
+ * depend on the salt and verifier. Each pair MUST BE USED FOR ONE SESSION
+ * ONLY.
+ *
+ * *bytes_b and *bytes_gb MUST BE FREED BY THE CALLER
+ */
+int mu_srp_gen_ephemeral(char **bytes_b, int *len_b, char **bytes_gb, int *len_gb);
+
+/* Returns B (pub key) like mu_srp_srv_pubkey_from_salt_verifier(), from a b
+ * and g^b generated with mu_srp_gen_ephemeral()
+ *
+ * *bytes_B MUST NOT BE FREED BY THE CALLER
+ */
+int mu_srp_srv_pubkey_from_ephemeral(mu_srp_handle_t *hd, const char *bytes_b, int len_b,
+				     const char *bytes_gb, int len_gb, char **bytes_B, int *len_B);
+
 /* Returns bytes_key
  * *bytes_key MUST NOT BE FREED BY THE CALLER
  */
@@ -0,0 +1,4 @@
+/* Host stand-in of the ESP-IDF header, for the tests */
+#pragma once
+#define ESP_IDF_VERSION_VAL(major, minor, patch) (((major) << 16) | ((minor) << 8) | (patch))
+#define ESP_IDF_VERSION ESP_IDF_VERSION_VAL(5, 1, 0)
@@ -0,0 +1,20 @@
+/* Host stand-in of the ESP-IDF header, for the tests. The numbers come from
+ * a fixed seed, so that runs can be compared.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+extern uint64_t test_random_state;
+
+static inline void esp_fill_random(void *buf, size_t len)
+{
+	uint8_t *p = buf;
+	while (len--) {
+		/* xorshift64* */
+		test_random_state ^= test_random_state >> 12;
+		test_random_state ^= test_random_state << 25;
+		test_random_state ^= test_random_state >> 27;
+		*p++ = (uint8_t)((test_random_state * 0x2545F4914F6CDD1DULL) >> 56);
+	}
+}
@@ -0,0 +1,315 @@
+/*
+ * Host test of the fixed base exponentiation against mbedTLS, and benchmark
+ * of the SRP work between pair setup M1 and M2.
+ *
+ * Build and run with "make test" in this directory. It builds the benchmark
+ * both with and without the comb table, and checks that they come to the
+ * same B for the same random numbers.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "hkdf-sha.h"
+#include "mu_srp.h"
+#include "mu_fixed_base.h"
+
+#define ITERATIONS	50
+
+uint64_t test_random_state = 0x9E3779B97F4A7C15ULL;
+
+static int failures;
+
+#define CHECK(cond) do { \
+		if (!(cond)) { \
+			printf("FAIL line %d: %s\n", __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int rand_below(int n)
+{
+	uint8_t b[4];
+	esp_fill_random(b, sizeof(b));
+	return ((uint32_t)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3]) % n;
+}
+
+static mu_bn_t *rand_bn(int len)
+{
+	char buf[512];
+	esp_fill_random(buf, len);
+	return mu_bn_new_from_bin(buf, len);
+}
+
+static void test_base(const char *g, int len_g, mu_srp_handle_t *hd)
+{
+	mu_fixed_base_t *fb = mu_fixed_base_new(g, len_g, hd->bytes_n, hd->len_n, 512);
+	mu_bn_t *base = mu_bn_new_from_bin(g, len_g);
+	int i;
+
+	CHECK(fb != NULL);
+	if (!fb)
+		return;
+	for (i = 0; i < 100; i++) {
+		/* Every length up to the limit, then random ones */
+		mu_bn_t *e = rand_bn(i <= 64 ? i : 1 + rand_below(64));
+		mu_bn_t *expected = mu_bn_new();
+		mu_bn_t *r;
+
+		mu_bn_a_exp_b_mod_c(expected, base, e, hd->n, hd->ctx);
+		r = mu_fixed_base_exp(fb, e);
+		CHECK(r != NULL);
+		if (r) {
+			CHECK(mbedtls_mpi_cmp_mpi(r, expected) == 0);
+			mu_bn_free(r);
+		}
+		mu_bn_free(e);
+		mu_bn_free(expected);
+	}
+
+	/* Longer than the table is for */
+	{
+		char buf[65];
+		mu_bn_t *e;
+		memset(buf, 0xA5, sizeof(buf));
+		e = mu_bn_new_from_bin(buf, sizeof(buf));
+		CHECK(mu_fixed_base_exp(fb, e) == NULL);
+		mu_bn_free(e);
+	}
+	mu_bn_free(base);
+	mu_fixed_base_free(fb);
+}
+
+static void test_fixed_base(void)
+{
+	mu_srp_handle_t hd = { 0 };
+	char big[384];
+
+	CHECK(mu_srp_init(&hd, MU_NG_3072) == 0);
+	test_base(hd.bytes_g, hd.len_g, &hd);
+	/* A base as wide as N, below it */
+	esp_fill_random(big, sizeof(big));
+	big[0] = 0x7F;
+	test_base(big, sizeof(big), &hd);
+	mu_srp_free(&hd);
+}
+
+/* The verifier is g^x with x = H(salt | H("Pair-Setup:" | code)) */
+static void test_gen_salt_verifier(void)
+{
+	mu_srp_handle_t hd = { 0 };
+	char *salt, *verifier;
+	int i, len_verifier;
+
+	mu_srp_init(&hd, MU_NG_3072);
+	for (i = 0; i < 20; i++) {
+		uint8_t digest[SHA512HashSize];
+		SHA512Context ctx;
+		mu_bn_t *x, *expected, *v;
+
+		CHECK(mu_srp_gen_salt_verifier("Pair-Setup", "111-22-333", 10, 16,
+					       &salt, &verifier, &len_verifier) == 0);
+		SHA512Reset(&ctx);
+		SHA512Input(&ctx, (const uint8_t *)"Pair-Setup:111-22-333", 21);
+		SHA512Result(&ctx, digest);
+		SHA512Reset(&ctx);
+		SHA512Input(&ctx, (const uint8_t *)salt, 16);
+		SHA512Input(&ctx, digest, sizeof(digest));
+		SHA512Result(&ctx, digest);
+
+		x = mu_bn_new_from_bin((char *)digest, sizeof(digest));
+		expected = mu_bn_new();
+		mu_bn_a_exp_b_mod_c(expected, hd.g, x, hd.n, hd.ctx);
+		v = mu_bn_new_from_bin(verifier, len_verifier);
+		CHECK(mbedtls_mpi_cmp_mpi(v, expected) == 0);
+		mu_bn_free(x);
+		mu_bn_free(expected);
+		mu_bn_free(v);
+		free(salt);
+		free(verifier);
+	}
+	mu_srp_free(&hd);
+}
+
+/* kv = B - g^b of a session */
+static mu_bn_t *session_kv(mu_srp_handle_t *hd, char *B, int len_B)
+{
+	mu_bn_t *bn_B = mu_bn_new_from_bin(B, len_B);
+	mu_bn_t *gb = mu_bn_new(), *diff = mu_bn_new(), *kv = mu_bn_new();
+
+	mu_bn_a_exp_b_mod_c(gb, hd->g, hd->b, hd->n, hd->ctx);
+	mbedtls_mpi_sub_mpi(diff, bn_B, gb);
+	mbedtls_mpi_mod_mpi(kv, diff, hd->n);
+	mu_bn_free(bn_B);
+	mu_bn_free(gb);
+	mu_bn_free(diff);
+	return kv;
+}
+
+/* b and g^b from mu_srp_gen_ephemeral() give the B of a session which
+ * generates them itself.
+ */
+static void test_ephemeral(void)
+{
+	mu_srp_handle_t hd = { 0 }, hd2 = { 0 };
+	char *salt, *verifier, *b, *gb, *B, *B2;
+	int len_verifier, len_b, len_gb, len_B, len_B2;
+	mu_bn_t *bn_b, *bn_gb, *expected, *kv, *kv2;
+
+	CHECK(mu_srp_gen_salt_verifier("Pair-Setup", "111-22-333", 10, 16,
+				       &salt, &verifier, &len_verifier) == 0);
+	CHECK(mu_srp_gen_ephemeral(&b, &len_b, &gb, &len_gb) == 0);
+	CHECK(len_b <= 32 && len_gb <= 384);
+
+	mu_srp_init(&hd, MU_NG_3072);
+	bn_b = mu_bn_new_from_bin(b, len_b);
+	bn_gb = mu_bn_new_from_bin(gb, len_gb);
+	expected = mu_bn_new();
+	mu_bn_a_exp_b_mod_c(expected, hd.g, bn_b, hd.n, hd.ctx);
+	CHECK(mbedtls_mpi_cmp_mpi(bn_gb, expected) == 0);
+
+	mu_srp_set_salt_verifier(&hd, salt, 16, verifier, len_verifier);
+	CHECK(mu_srp_srv_pubkey_from_ephemeral(&hd, b, len_b, gb, len_gb, &B, &len_B) == 0);
+	CHECK(mbedtls_mpi_cmp_mpi(hd.b, bn_b) == 0);
+	mu_srp_init(&hd2, MU_NG_3072);
+	mu_srp_set_salt_verifier(&hd2, salt, 16, verifier, len_verifier);
+	CHECK(mu_srp_srv_pubkey_from_salt_verifier(&hd2, &B2, &len_B2) == 0);
+	kv = session_kv(&hd, B, len_B);
+	kv2 = session_kv(&hd2, B2, len_B2);
+	CHECK(mbedtls_mpi_cmp_mpi(kv, kv2) == 0);
+
+	mu_bn_free(kv);
+	mu_bn_free(kv2);
+	mu_bn_free(bn_b);
+	mu_bn_free(bn_gb);
+	mu_bn_free(expected);
+	mu_srp_free(&hd);
+	mu_srp_free(&hd2);
+	free(salt);
+	free(verifier);
+	free(b);
+	free(gb);
+}
+
+static uint32_t fnv1a(uint32_t h, const char *buf, int len)
+{
+	while (len--) {
+		h ^= (uint8_t)*buf++;
+		h *= 16777619;
+	}
+	return h;
+}
+
+/* M1 -> M2: the salt, the verifier and B, from the setup code */
+static double bench_pubkey(uint32_t *transcript, int iterations)
+{
+	double total = 0;
+	int i;
+
+	for (i = 0; i < iterations; i++) {
+		mu_srp_handle_t hd = { 0 };
+		char *bytes_B, *bytes_salt;
+		int len_B;
+		double start = now_ms();
+
+		mu_srp_init(&hd, MU_NG_3072);
+		CHECK(mu_srp_srv_pubkey(&hd, "Pair-Setup", "111-22-333", 10, 16,
+					&bytes_B, &len_B, &bytes_salt) == 0);
+		total += now_ms() - start;
+		*transcript = fnv1a(*transcript, bytes_B, len_B);
+		mu_srp_free(&hd);
+	}
+	return total / iterations;
+}
+
+/* M1 -> M2 with a salt and verifier set up beforehand */
+static double bench_pubkey_from_verifier(uint32_t *transcript)
+{
+	mu_srp_handle_t hd = { 0 };
+	char *salt, *verifier, *bytes_B;
+	int len_verifier, len_B;
+	double total = 0;
+	int i;
+
+	mu_srp_gen_salt_verifier("Pair-Setup", "111-22-333", 10, 16, &salt, &verifier, &len_verifier);
+	for (i = 0; i < ITERATIONS; i++) {
+		double start = now_ms();
+
+		mu_srp_init(&hd, MU_NG_3072);
+		CHECK(mu_srp_set_salt_verifier(&hd, salt, 16, verifier, len_verifier) == 0);
+		CHECK(mu_srp_srv_pubkey_from_salt_verifier(&hd, &bytes_B, &len_B) == 0);
+		total += now_ms() - start;
+		*transcript = fnv1a(*transcript, bytes_B, len_B);
+		mu_srp_free(&hd);
+	}
+	free(salt);
+	free(verifier);
+	return total / ITERATIONS;
+}
+
+/* M1 -> M2 with b and g^b generated ahead, as from the HAP core's pool */
+static double bench_pubkey_from_ephemeral(uint32_t *transcript)
+{
+	mu_srp_handle_t hd = { 0 };
+	char *salt, *verifier, *b, *gb, *bytes_B;
+	int len_verifier, len_b, len_gb, len_B;
+	double total = 0;
+	int i;
+
+	mu_srp_gen_salt_verifier("Pair-Setup", "111-22-333", 10, 16, &salt, &verifier, &len_verifier);
+	for (i = 0; i < ITERATIONS; i++) {
+		double start;
+
+		mu_srp_gen_ephemeral(&b, &len_b, &gb, &len_gb);
+		start = now_ms();
+		mu_srp_init(&hd, MU_NG_3072);
+		CHECK(mu_srp_set_salt_verifier(&hd, salt, 16, verifier, len_verifier) == 0);
+		CHECK(mu_srp_srv_pubkey_from_ephemeral(&hd, b, len_b, gb, len_gb, &bytes_B, &len_B) == 0);
+		total += now_ms() - start;
+		*transcript = fnv1a(*transcript, bytes_B, len_B);
+		mu_srp_free(&hd);
+		free(b);
+		free(gb);
+	}
+	free(salt);
+	free(verifier);
+	return total / ITERATIONS;
+}
+
+int main(void)
+{
+	uint32_t transcript = 2166136261u;
+	double first, pubkey, from_verifier, from_ephemeral;
+
+	/* The first one builds the table, if there is one */
+	first = bench_pubkey(&transcript, 1);
+	pubkey = bench_pubkey(&transcript, ITERATIONS);
+	from_verifier = bench_pubkey_from_verifier(&transcript);
+	from_ephemeral = bench_pubkey_from_ephemeral(&transcript);
+
+	test_fixed_base();
+	test_gen_salt_verifier();
+	test_ephemeral();
+
+	printf("comb table: %s\n", MU_SRP_FIXED_BASE ? "yes" : "no");
+	printf("M1 -> M2 from the setup code: %.2f ms, first %.2f ms\n", pubkey, first);
+	printf("M1 -> M2 from the verifier: %.2f ms\n", from_verifier);
+	printf("M1 -> M2 with b generated ahead: %.3f ms\n", from_ephemeral);
+	printf("transcript %08x\n", transcript);
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,472 @@
+#include "adaptive.h"
+
+#include <math.h>
+#include <string.h>
+
+// Characteristic Value Transition Control
+#define TLV_CONTROL_READ 0x01
+#define TLV_CONTROL_UPDATE 0x02
+#define TLV_UPDATE_CONFIG 0x01
+#define TLV_CONFIG_IID 0x01
+#define TLV_CONFIG_PARAMS 0x02
+#define TLV_CONFIG_CURVE 0x05
+#define TLV_CONFIG_INTERVAL 0x06
+#define TLV_PARAMS_START 0x02
+#define TLV_CURVE_ENTRY 0x01
+#define TLV_CURVE_ADJUST_IID 0x02
+#define TLV_CURVE_ADJUST_RANGE 0x03
+#define TLV_ENTRY_FACTOR 0x01
+#define TLV_ENTRY_VALUE 0x02
+#define TLV_ENTRY_OFFSET 0x03
+#define TLV_ENTRY_DURATION 0x04
+#define TLV_RANGE_MIN 0x01
+#define TLV_RANGE_MAX 0x02
+#define TLV_STATUS 0x01
+#define TLV_STATUS_IID 0x01
+#define TLV_STATUS_PARAMS 0x02
+#define TLV_STATUS_ELAPSED 0x03
+
+// Supported Characteristic Value Transition Configuration
+#define TLV_SUPPORTED_CONFIG 0x01
+#define TLV_SUPPORTED_IID 0x01
+#define TLV_SUPPORTED_TYPE 0x02
+
+#define TLV_SEPARATOR 0x00
+#define TLV_FRAGMENT 255
+
+typedef struct
+{
+    uint8_t *p;
+    uint8_t *end;
+} tlv_iter_t;
+
+static void tlv_iter_init(tlv_iter_t *it, uint8_t *buf, size_t len)
+{
+    it->p = buf;
+    it->end = buf + len;
+}
+
+// Returns the next item. A value longer than 255 bytes comes as a run of items
+// of the same type, all but the last 255 bytes long; the run is joined by
+// moving the rest of the items over the headers in between. That only shifts
+// bytes inside the value this iterator walks, which the enclosing iterators
+// have already stepped over.
+static bool tlv_next(tlv_iter_t *it, uint8_t *type, uint8_t **val, size_t *len)
+{
+    if (it->end - it->p < 2)
+        return false;
+
+    uint8_t t = it->p[0];
+    size_t l = it->p[1];
+    size_t frag = l;
+    uint8_t *v = it->p + 2;
+    if (l > (size_t)(it->end - v))
+        return false;
+
+    while (frag == TLV_FRAGMENT && it->end - (v + l) >= 2 && v[l] == t)
+    {
+        uint8_t *next = v + l;
+        frag = next[1];
+        if (frag > (size_t)(it->end - next - 2))
+            return false;
+        memmove(next, next + 2, it->end - next - 2);
+        it->end -= 2;
+        l += frag;
+    }
+
+    *type = t;
+    *val = v;
+    *len = l;
+    it->p = v + l;
+    return true;
+}
+
+// Integers are little endian, in as many bytes as they need.
+static uint64_t tlv_uint(const uint8_t *val, size_t len)
+{
+    uint64_t u = 0;
+    if (len > 8)
+        len = 8;
+    for (size_t i = len; i > 0; --i)
+        u = (u << 8) | val[i - 1];
+    return u;
+}
+
+static float tlv_float(const uint8_t *val, size_t len)
+{
+    float f = 0;
+    if (len == sizeof(f))
+        memcpy(&f, val, sizeof(f));
+    return f;
+}
+
+typedef struct
+{
+    uint8_t *p;
+    uint8_t *end;
+    bool overflow;
+} tlv_writer_t;
+
+static void tlv_put(tlv_writer_t *w, uint8_t type, const uint8_t *val, size_t len)
+{
+    do
+    {
+        size_t frag = len > TLV_FRAGMENT ? TLV_FRAGMENT : len;
+        if ((size_t)(w->end - w->p) < frag + 2)
+        {
+            w->overflow = true;
+            return;
+        }
+        *w->p++ = type;
+        *w->p++ = frag;
+        memcpy(w->p, val, frag);
+        w->p += frag;
+        val += frag;
+        len -= frag;
+    } while (len);
+}
+
+static void tlv_put_uint(tlv_writer_t *w, uint8_t type, uint64_t u)
+{
+    uint8_t val[8];
+    size_t len = u <= UINT8_MAX ? 1 : u <= UINT16_MAX ? 2 : u <= UINT32_MAX ? 4 : 8;
+    for (size_t i = 0; i < len; ++i)
+        val[i] = u >> (8 * i);
+    tlv_put(w, type, val, len);
+}
+
+// Items are nested by writing the inner ones first and then the header in
+// front of them, which needs them to fit in one item.
+static uint8_t *tlv_open(tlv_writer_t *w)
+{
+    uint8_t *start = w->p;
+    if (w->end - w->p < 2)
+        w->overflow = true;
+    else
+        w->p += 2;
+    return start;
+}
+
+static void tlv_close(tlv_writer_t *w, uint8_t *start, uint8_t type)
+{
+    if (w->overflow)
+        return;
+    size_t len = w->p - start - 2;
+    if (len > TLV_FRAGMENT)
+    {
+        w->overflow = true;
+        return;
+    }
+    start[0] = type;
+    start[1] = len;
+}
+
+static bool parse_entry(uint8_t *buf, size_t len, adaptive_entry_t *entry)
+{
+    tlv_iter_t it;
+    uint8_t type, *val;
+    size_t l;
+    bool have_value = false;
+
+    memset(entry, 0, sizeof(*entry));
+    tlv_iter_init(&it, buf, len);
+    while (tlv_next(&it, &type, &val, &l))
+    {
+        switch (type)
+        {
+        case TLV_ENTRY_FACTOR:
+            entry->factor = tlv_float(val, l);
+            break;
+        case TLV_ENTRY_VALUE:
+            entry->value = tlv_float(val, l);
+            have_value = true;
+            break;
+        case TLV_ENTRY_OFFSET:
+            entry->offset_ms = tlv_uint(val, l);
+            break;
+        case TLV_ENTRY_DURATION:
+            entry->duration_ms = tlv_uint(val, l);
+            break;
+        }
+    }
+    return have_value;
+}
+
+static bool parse_curve(uint8_t *buf, size_t len, adaptive_curve_t *curve)
+{
+    tlv_iter_t it;
+    uint8_t type, *val;
+    size_t l;
+
+    curve->entry_count = 0;
+    curve->adjust_min = 0;
+    curve->adjust_max = 100;
+    tlv_iter_init(&it, buf, len);
+    while (tlv_next(&it, &type, &val, &l))
+    {
+        if (type == TLV_CURVE_ENTRY)
+        {
+            if (curve->entry_count == ADAPTIVE_MAX_ENTRIES ||
+                !parse_entry(val, l, &curve->entries[curve->entry_count]))
+                return false;
+            curve->entry_count++;
+        }
+        else if (type == TLV_CURVE_ADJUST_IID)
+        {
+            curve->adjust_iid = tlv_uint(val, l);
+        }
+        else if (type == TLV_CURVE_ADJUST_RANGE)
+        {
+            tlv_iter_t range;
+            uint8_t rtype, *rval;
+            size_t rl;
+            tlv_iter_init(&range, val, l);
+            while (tlv_next(&range, &rtype, &rval, &rl))
+            {
+                if (rtype == TLV_RANGE_MIN)
+                    curve->adjust_min = (int32_t)tlv_uint(rval, rl);
+                else if (rtype == TLV_RANGE_MAX)
+                    curve->adjust_max = (int32_t)tlv_uint(rval, rl);
+            }
+        }
+    }
+    return curve->entry_count > 0;
+}
+
+static bool parse_params(uint8_t *buf, size_t len, adaptive_curve_t *curve)
+{
+    tlv_iter_t it;
+    uint8_t type, *val;
+    size_t l;
+
+    if (len > sizeof(curve->params))
+        return false;
+    // Copied before it is walked, in case the walk joins fragments.
+    memcpy(curve->params, buf, len);
+    curve->params_len = len;
+    curve->start_ms = 0;
+    tlv_iter_init(&it, buf, len);
+    while (tlv_next(&it, &type, &val, &l))
+    {
+        if (type == TLV_PARAMS_START)
+            curve->start_ms = tlv_uint(val, l);
+    }
+    return true;
+}
+
+static adaptive_req_t parse_update(uint8_t *buf, size_t len, adaptive_curve_t *curve,
+                                   uint32_t *iid)
+{
+    tlv_iter_t it;
+    uint8_t type, *val;
+    size_t l;
+    bool have_iid = false, have_params = false, have_curve = false;
+
+    curve->interval_ms = ADAPTIVE_DEFAULT_INTERVAL_MS;
+    curve->adjust_iid = 0;
+    tlv_iter_init(&it, buf, len);
+    while (tlv_next(&it, &type, &val, &l))
+    {
+        switch (type)
+        {
+        case TLV_CONFIG_IID:
+            *iid = curve->target_iid = tlv_uint(val, l);
+            have_iid = true;
+            break;
+        case TLV_CONFIG_PARAMS:
+            if (!parse_params(val, l, curve))
+                return ADAPTIVE_REQ_INVALID;
+            have_params = true;
+            break;
+        case TLV_CONFIG_CURVE:
+            if (!parse_curve(val, l, curve))
+                return ADAPTIVE_REQ_INVALID;
+            have_curve = true;
+            break;
+        case TLV_CONFIG_INTERVAL:
+            curve->interval_ms = tlv_uint(val, l);
+            break;
+        }
+    }
+
+    if (!have_iid)
+        return ADAPTIVE_REQ_INVALID;
+    // A configuration with only the iid switches the transition off.
+    if (!have_params && !have_curve)
+        return ADAPTIVE_REQ_STOP;
+    if (!have_params || !have_curve || !curve->interval_ms)
+        return ADAPTIVE_REQ_INVALID;
+    return ADAPTIVE_REQ_START;
+}
+
+adaptive_req_t adaptive_parse_control(uint8_t *buf, size_t len, adaptive_curve_t *curve,
+                                      uint32_t *iid)
+{
+    tlv_iter_t it;
+    uint8_t type, *val;
+    size_t l;
+
+    tlv_iter_init(&it, buf, len);
+    if (!tlv_next(&it, &type, &val, &l))
+        return ADAPTIVE_REQ_INVALID;
+
+    if (type == TLV_CONTROL_READ)
+    {
+        tlv_iter_t read;
+        uint8_t rtype, *rval;
+        size_t rl;
+        tlv_iter_init(&read, val, l);
+        while (tlv_next(&read, &rtype, &rval, &rl))
+        {
+            if (rtype == TLV_CONFIG_IID)
+            {
+                *iid = tlv_uint(rval, rl);
+                return ADAPTIVE_REQ_READ;
+            }
+        }
+    }
+    else if (type == TLV_CONTROL_UPDATE)
+    {
+        // Only the first configuration is taken, as the lamp runs one curve
+        // per light.
+        tlv_iter_t update;
+        uint8_t utype, *uval;
+        size_t ul;
+        tlv_iter_init(&update, val, l);
+        while (tlv_next(&update, &utype, &uval, &ul))
+        {
+            if (utype == TLV_UPDATE_CONFIG)
+                return parse_update(uval, ul, curve, iid);
+        }
+    }
+    return ADAPTIVE_REQ_INVALID;
+}
+
+size_t adaptive_build_status(const adaptive_curve_t *curve, uint64_t elapsed_ms,
+                             uint8_t *buf, size_t size)
+{
+    tlv_writer_t w = {.p = buf, .end = buf + size};
+
+    uint8_t *status = tlv_open(&w);
+    tlv_put_uint(&w, TLV_STATUS_IID, curve->target_iid);
+    tlv_put(&w, TLV_STATUS_PARAMS, curve->params, curve->params_len);
+    tlv_put_uint(&w, TLV_STATUS_ELAPSED, elapsed_ms);
+    tlv_close(&w, status, TLV_STATUS);
+
+    return w.overflow ? 0 : w.p - buf;
+}
+
+size_t adaptive_build_supported(const uint32_t *iids, const uint8_t *types, int count,
+                                uint8_t *buf, size_t size)
+{
+    tlv_writer_t w = {.p = buf, .end = buf + size};
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (i)
+            tlv_put(&w, TLV_SEPARATOR, NULL, 0);
+        uint8_t *config = tlv_open(&w);
+        tlv_put_uint(&w, TLV_SUPPORTED_IID, iids[i]);
+        tlv_put(&w, TLV_SUPPORTED_TYPE, &types[i], 1);
+        tlv_close(&w, config, TLV_SUPPORTED_CONFIG);
+    }
+
+    return w.overflow ? 0 : w.p - buf;
+}
+
+static float entry_value(const adaptive_entry_t *entry, int32_t adjust)
+{
+    return entry->value + entry->factor * adjust;
+}
+
+bool adaptive_curve_value(const adaptive_curve_t *curve, uint64_t elapsed_ms,
+                          int32_t adjust, float *value)
+{
+    if (adjust < curve->adjust_min)
+        adjust = curve->adjust_min;
+    if (adjust > curve->adjust_max)
+        adjust = curve->adjust_max;
+
+    // The offset of the first entry is a wait before the curve starts, during
+    // which the first entry holds.
+    const adaptive_entry_t *prev = &curve->entries[0];
+    uint64_t t = prev->offset_ms + (uint64_t)prev->duration_ms;
+    if (elapsed_ms < t)
+    {
+        *value = entry_value(prev, adjust);
+        return true;
+    }
+
+    for (int i = 1; i < curve->entry_count; ++i)
+    {
+        const adaptive_entry_t *entry = &curve->entries[i];
+        if (elapsed_ms < t + entry->offset_ms)
+        {
+            float from = entry_value(prev, adjust);
+            float to = entry_value(entry, adjust);
+            *value = from + (to - from) * (float)(elapsed_ms - t) / entry->offset_ms;
+            return true;
+        }
+        t += entry->offset_ms;
+        if (elapsed_ms < t + entry->duration_ms)
+        {
+            *value = entry_value(entry, adjust);
+            return true;
+        }
+        t += entry->duration_ms;
+        prev = entry;
+    }
+
+    *value = entry_value(prev, adjust);
+    return false;
+}
+
+static float clamp_channel(float c)
+{
+    return c < 0 ? 0 : c > 255 ? 255 : c;
+}
+
+// Tanner Helland's fit of the colour of a black body, good enough for the
+// 2000 K to 7000 K that HomeKit asks for.
+void adaptive_mired_to_hs(uint32_t mired, float *hue, float *saturation)
+{
+    float t = 10000.0f / (mired ? mired : 1);
+    float r, g, b;
+
+    if (t <= 66)
+    {
+        r = 255;
+        g = 99.4708025861f * logf(t) - 161.1195681661f;
+    }
+    else
+    {
+        r = 329.698727446f * powf(t - 60, -0.1332047592f);
+        g = 288.1221695283f * powf(t - 60, -0.0755148492f);
+    }
+    if (t >= 66)
+        b = 255;
+    else if (t <= 19)
+        b = 0;
+    else
+        b = 138.5177312231f * logf(t - 10) - 305.0447927307f;
+
+    r = clamp_channel(r);
+    g = clamp_channel(g);
+    b = clamp_channel(b);
+
+    float max = fmaxf(r, fmaxf(g, b));
+    float min = fminf(r, fminf(g, b));
+    float d = max - min;
+    float h = 0;
+    if (d > 0)
+    {
+        if (max == r)
+            h = fmodf((g - b) / d + 6, 6);
+        else if (max == g)
+            h = (b - r) / d + 2;
+        else
+            h = (r - g) / d + 4;
+    }
+    *hue = h * 60;
+    *saturation = max > 0 ? d / max * 100 : 0;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Adaptive Lighting: the controller writes a curve of target values over the
+// day to the Characteristic Value Transition Control characteristic once, and
+// the lamp steps through it by itself instead of being sent every change.
+// This file only deals with the TLV8 encoding and the curve, so that it can
+// be tested on the host.
+
+#define ADAPTIVE_MAX_ENTRIES 48
+#define ADAPTIVE_MAX_PARAMS 48
+#define ADAPTIVE_DEFAULT_INTERVAL_MS 60000
+
+// Transition types of the Supported Characteristic Value Transition
+// Configuration characteristic.
+#define ADAPTIVE_TYPE_BRIGHTNESS 1
+#define ADAPTIVE_TYPE_COLOR_TEMPERATURE 2
+
+// One point of the curve. The curve ramps from the previous entry to this one
+// over offset_ms, and then holds it for duration_ms. The target at a point is
+// value + factor * adjustment, where the adjustment is the value of another
+// characteristic, in practice the brightness.
+typedef struct
+{
+    float factor;
+    float value;
+    uint32_t offset_ms;
+    uint32_t duration_ms;
+} adaptive_entry_t;
+
+typedef struct
+{
+    uint32_t target_iid;
+    uint32_t adjust_iid;
+    int32_t adjust_min;
+    int32_t adjust_max;
+    uint32_t interval_ms;
+    // Start of the curve, in ms since 2001-01-01 00:00 UTC.
+    uint64_t start_ms;
+    // The transition parameters are echoed back as received.
+    uint8_t params[ADAPTIVE_MAX_PARAMS];
+    size_t params_len;
+    int entry_count;
+    adaptive_entry_t entries[ADAPTIVE_MAX_ENTRIES];
+} adaptive_curve_t;
+
+typedef enum
+{
+    ADAPTIVE_REQ_INVALID,
+    // Read of the transition of the characteristic in the iid.
+    ADAPTIVE_REQ_READ,
+    // A new curve, filled in.
+    ADAPTIVE_REQ_START,
+    // Ends the transition of the characteristic in the iid.
+    ADAPTIVE_REQ_STOP,
+} adaptive_req_t;
+
+// Parses a write to the control characteristic. Fragmented items are joined
+// in place, so the buffer is modified.
+adaptive_req_t adaptive_parse_control(uint8_t *buf, size_t len, adaptive_curve_t *curve,
+                                      uint32_t *iid);
+
+// Builds the status of a running curve, which is both the write response and
+// the answer to a read. Returns the length, or 0 if it does not fit.
+size_t adaptive_build_status(const adaptive_curve_t *curve, uint64_t elapsed_ms,
+                             uint8_t *buf, size_t size);
+
+// Builds the value of the Supported Characteristic Value Transition
+// Configuration characteristic for the given iids and types.
+size_t adaptive_build_supported(const uint32_t *iids, const uint8_t *types, int count,
+                                uint8_t *buf, size_t size);
+
+// Target of the curve elapsed_ms after its start, for the given adjustment.
+// Returns false once the curve has come to its end, with the last target.
+bool adaptive_curve_value(const adaptive_curve_t *curve, uint64_t elapsed_ms,
+                          int32_t adjust, float *value);
+
+// Hue and saturation with the colour of a white of the colour temperature,
+// in mireds, for lamps which have no white LEDs.
+void adaptive_mired_to_hs(uint32_t mired, float *hue, float *saturation);
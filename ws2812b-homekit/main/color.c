@@ -0,0 +1,96 @@
+#include "color.h"
+#include "transition.h"
+
+// (i / 256)^2.8 * 255, in Q8, for i in 0..256. The extra entry at the end lets
+// color_scale_gamma() interpolate up to full scale without a bounds check.
+// Generated with: [round((i / 256) ** 2.8 * 255 * 256) for i in range(257)]
+static const uint16_t gamma_lut[257] = {
+    0, 0, 0, 0, 1, 1, 2, 3, 4, 6,
+    7, 10, 12, 16, 19, 23, 28, 33, 39, 45,
+    52, 59, 68, 77, 86, 97, 108, 120, 133, 147,
+    161, 177, 193, 211, 229, 248, 269, 290, 313, 336,
+    361, 387, 414, 442, 471, 502, 534, 567, 601, 637,
+    674, 713, 753, 794, 836, 880, 926, 973, 1022, 1072,
+    1123, 1177, 1231, 1288, 1346, 1406, 1467, 1530, 1595, 1661,
+    1730, 1800, 1872, 1945, 2021, 2098, 2178, 2259, 2342, 2427,
+    2514, 2603, 2694, 2787, 2882, 2979, 3078, 3180, 3283, 3388,
+    3496, 3606, 3718, 3832, 3949, 4068, 4189, 4312, 4438, 4565,
+    4696, 4828, 4964, 5101, 5241, 5383, 5528, 5675, 5825, 5977,
+    6132, 6289, 6449, 6612, 6777, 6945, 7115, 7288, 7464, 7643,
+    7824, 8008, 8194, 8384, 8576, 8771, 8969, 9170, 9373, 9580,
+    9789, 10002, 10217, 10435, 10656, 10880, 11108, 11338, 11571, 11807,
+    12047, 12289, 12535, 12783, 13035, 13290, 13549, 13810, 14075, 14343,
+    14614, 14888, 15166, 15447, 15731, 16019, 16310, 16605, 16902, 17204,
+    17508, 17816, 18128, 18443, 18762, 19084, 19409, 19739, 20071, 20408,
+    20747, 21091, 21438, 21789, 22143, 22502, 22864, 23229, 23598, 23972,
+    24348, 24729, 25114, 25502, 25894, 26290, 26690, 27093, 27501, 27913,
+    28328, 28748, 29171, 29598, 30030, 30465, 30905, 31348, 31796, 32248,
+    32703, 33163, 33627, 34096, 34568, 35044, 35525, 36010, 36499, 36993,
+    37491, 37993, 38499, 39010, 39525, 40044, 40568, 41096, 41628, 42165,
+    42706, 43252, 43802, 44357, 44916, 45480, 46048, 46621, 47198, 47780,
+    48367, 48958, 49554, 50154, 50759, 51369, 51983, 52602, 53226, 53855,
+    54488, 55126, 55769, 56416, 57069, 57726, 58388, 59055, 59727, 60404,
+    61086, 61772, 62464, 63161, 63862, 64569, 65280,
+};
+
+// Converts a fully bright colour, given as hue in 1/65536 of a turn and saturation
+// in 1/256 percent, to RGB with 16 bit channels. Works in fixed point, so it needs
+// neither floating point nor a divide, apart from one for the saturation. The
+// channels are only cut to 8 bits after gamma correction, where the steep top of
+// the curve would otherwise turn one step of rounding here into three.
+void color_hsv_to_rgb(uint16_t hue, uint16_t saturation, uint16_t *r, uint16_t *g, uint16_t *b)
+{
+    uint32_t h6 = (uint32_t)hue * 6;
+    uint32_t sector = h6 >> 16;
+    uint32_t f = h6 & 0xFFFF;
+    // Saturation in Q15, so that its products with f and 1 - f (in Q16) fit 32 bits
+    uint32_t s = ((uint32_t)saturation << 15) / (100 * LIGHT_FX_PERCENT);
+    if (s > 0x8000)
+        s = 0x8000;
+
+    uint32_t v = 0xFFFF;
+    uint32_t p = (v * (0x8000 - s)) >> 15;
+    uint32_t q = (v * (0x8000 - ((s * f) >> 16))) >> 15;
+    uint32_t t = (v * (0x8000 - ((s * (0x10000 - f)) >> 16))) >> 15;
+
+    switch (sector)
+    {
+    case 0:
+        *r = v, *g = t, *b = p;
+        break;
+    case 1:
+        *r = q, *g = v, *b = p;
+        break;
+    case 2:
+        *r = p, *g = v, *b = t;
+        break;
+    case 3:
+        *r = p, *g = q, *b = v;
+        break;
+    case 4:
+        *r = t, *g = p, *b = v;
+        break;
+    default:
+        *r = v, *g = p, *b = q;
+        break;
+    }
+}
+
+// Converts a level in 1/256 percent to the Q16 scale used by color_scale_gamma(),
+// so that the divide is done once per frame rather than per channel.
+uint32_t color_level_to_scale(uint16_t level)
+{
+    return ((uint32_t)level << 16) / (100 * LIGHT_FX_PERCENT);
+}
+
+// Scales a 16 bit channel by a Q16 brightness and gamma corrects it. The scaled
+// value is kept at 16 bits and the gamma curve interpolated between table entries,
+// so dim colours keep their hue rather than collapsing onto a few 8 bit steps.
+uint8_t color_scale_gamma(uint16_t c, uint32_t scale)
+{
+    uint32_t linear = ((uint32_t)c * scale) >> 16;
+    uint32_t i = linear >> 8;
+    uint32_t frac = linear & 0xFF;
+    uint32_t out = gamma_lut[i] + (((gamma_lut[i + 1] - gamma_lut[i]) * frac) >> 8);
+    return (out + 128) >> 8;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+
+void color_hsv_to_rgb(uint16_t hue, uint16_t saturation, uint16_t *r, uint16_t *g, uint16_t *b);
+uint8_t color_scale_gamma(uint16_t c, uint32_t scale);
+uint32_t color_level_to_scale(uint16_t level);
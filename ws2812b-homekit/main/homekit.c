@@ -1,164 +1,239 @@
 #include "homekit.h"
 #include "leds.h"
+#include "adaptive.h"
 
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 #include <hap.h>
 #include <hap_apple_servs.h>
 #include <hap_apple_chars.h>
 
 #include "esp_log.h"
-#include <nvs.h>
+#include "esp_timer.h"
 
 static const char *TAG = "homekit";
 
-#define NVS_NAMESPACE "homekit_state"
-#define KEY_ON "hk_on"
-#define KEY_BRIGHTNESS "hk_bright"
-#define KEY_LAST_BRIGHTNESS "hk_last_bright"
-#define KEY_HUE "hk_hue"
-#define KEY_SATURATION "hk_sat"
-
-static hap_char_t
-    *on_char,
-    *brightness_char,
-    *hue_char,
-    *saturation_char;
-static int32_t last_brightness;
-
-static esp_err_t open_nvs_handle(nvs_handle_t *handle)
-{
-    return nvs_open(NVS_NAMESPACE, NVS_READWRITE, handle);
-}
+// Colour temperature range in mireds, as the Home app expects it for
+// Adaptive Lighting.
+#define COLOR_TEMPERATURE_MIN 140
+#define COLOR_TEMPERATURE_MAX 500
 
-static void save_bool_nvs(nvs_handle_t nvs_handle, const char *key, bool value)
+// The start times of the curves count from 2001-01-01, and a clock before
+// CLOCK_SET_S has not been set yet.
+#define EPOCH_2001_MS 978307200000LL
+#define CLOCK_SET_S 1600000000
+
+// The characteristics of the lightbulb service of one LED segment.
+typedef struct
 {
-    if (nvs_handle)
-    {
-        nvs_set_u8(nvs_handle, key, (uint8_t)value);
-    }
-    else
+    int segment;
+    hap_char_t *on_char;
+    hap_char_t *brightness_char;
+    hap_char_t *hue_char;
+    hap_char_t *saturation_char;
+    hap_char_t *color_temperature_char;
+    hap_char_t *transition_control_char;
+    hap_char_t *transition_count_char;
+    // Brightness to go back to when switched on after a write of brightness 0.
+    int32_t last_brightness;
+    // Whether the colour follows the colour temperature, which was written
+    // last, rather than hue and saturation.
+    bool use_color_temperature;
+    // Adaptive Lighting curve, stepped from the timer while it runs.
+    adaptive_curve_t *curve;
+    int64_t curve_start_us;
+    esp_timer_handle_t curve_timer;
+    // The control and supported configuration characteristics point at these.
+    uint8_t control_response[16 + ADAPTIVE_MAX_PARAMS];
+    uint8_t supported_config[32];
+} light_t;
+
+static light_t lights[WS2812_MAX_SEGMENTS];
+static int light_count;
+// Held by the writes and the curve timer, which both step the curves.
+static SemaphoreHandle_t curve_lock;
+
+// Posts the state of all the characteristics of a light to the renderer as
+// one update. The renderer picks up the updates of all the lights written in
+// one request together, and renders a single frame for them.
+static void sync_leds_to_homekit(const light_t *light)
+{
+    ws2812_state_t state = {
+        .power = hap_char_get_val(light->on_char)->b,
+        .brightness = hap_char_get_val(light->brightness_char)->i,
+        .hue = hap_char_get_val(light->hue_char)->f,
+        .saturation = hap_char_get_val(light->saturation_char)->f,
+    };
+    if (light->use_color_temperature)
     {
-        ESP_LOGE(TAG, "Invalid NVS handle to save key: %s", key);
+        adaptive_mired_to_hs(hap_char_get_val(light->color_temperature_char)->u,
+                             &state.hue, &state.saturation);
     }
+    ws2812_set_state(light->segment, &state);
 }
 
-static void save_int32_nvs(nvs_handle_t nvs_handle, const char *key, int32_t value)
+// The characteristics a curve can drive, or adjust by.
+static hap_char_t *curve_char_by_iid(const light_t *light, uint32_t iid)
 {
-    if (nvs_handle)
-    {
-        nvs_set_i32(nvs_handle, key, value);
-    }
-    else
-    {
-        ESP_LOGE(TAG, "Invalid NVS handle to save key: %s", key);
-    }
+    if (iid == hap_char_get_iid(light->brightness_char))
+        return light->brightness_char;
+    if (iid == hap_char_get_iid(light->color_temperature_char))
+        return light->color_temperature_char;
+    return NULL;
 }
 
-static void save_float_nvs(nvs_handle_t nvs_handle, const char *key, float value)
+static void set_transition_count(light_t *light, uint8_t count)
 {
-    if (nvs_handle)
+    if (hap_char_get_val(light->transition_count_char)->u != count)
     {
-        uint32_t u32_val;
-        memcpy(&u32_val, &value, sizeof(u32_val));
-        nvs_set_u32(nvs_handle, key, u32_val);
-    }
-    else
-    {
-        ESP_LOGE(TAG, "Invalid NVS handle to save key: %s", key);
+        hap_val_t v = {.u = count};
+        hap_char_update_val(light->transition_count_char, &v);
     }
 }
 
-static bool load_bool_nvs(const char *key, bool default_value)
+static void end_curve(light_t *light)
 {
-    nvs_handle_t nvs_handle;
-    uint8_t value_u8;
-    if (open_nvs_handle(&nvs_handle) == ESP_OK)
-    {
-        esp_err_t err = nvs_get_u8(nvs_handle, key, &value_u8);
-        nvs_close(nvs_handle);
-        if (err == ESP_OK)
-            return (bool)value_u8;
-        if (err == ESP_ERR_NVS_NOT_FOUND)
-            ESP_LOGI(TAG, "NVS: Key '%s' not found, using default.", key);
-        else
-            ESP_LOGE(TAG, "NVS: Error (%s) reading key '%s'", esp_err_to_name(err), key);
-    }
-    else
-    {
-        ESP_LOGE(TAG, "Failed to open NVS to load key: %s", key);
-    }
-    return default_value;
+    if (!light->curve)
+        return;
+    esp_timer_stop(light->curve_timer);
+    free(light->curve);
+    light->curve = NULL;
+    set_transition_count(light, 0);
+    ESP_LOGI(TAG, "Light %d: transition ended", light->segment + 1);
 }
 
-static int32_t load_int32_nvs(const char *key, int32_t default_value)
+static uint64_t curve_elapsed_ms(const light_t *light)
 {
-    nvs_handle_t nvs_handle;
-    int32_t value;
-    if (open_nvs_handle(&nvs_handle) == ESP_OK)
-    {
-        esp_err_t err = nvs_get_i32(nvs_handle, key, &value);
-        nvs_close(nvs_handle);
-        if (err == ESP_OK)
-            return value;
-        if (err == ESP_ERR_NVS_NOT_FOUND)
-            ESP_LOGI(TAG, "NVS: Key '%s' not found, using default.", key);
-        else
-            ESP_LOGE(TAG, "NVS: Error (%s) reading key '%s'", esp_err_to_name(err), key);
-    }
-    else
-    {
-        ESP_LOGE(TAG, "Failed to open NVS to load key: %s", key);
-    }
-    return default_value;
+    int64_t elapsed_us = esp_timer_get_time() - light->curve_start_us;
+    return elapsed_us > 0 ? elapsed_us / 1000 : 0;
 }
 
-static float load_float_nvs(const char *key, float default_value)
+// Sets the target of the curve for now. The characteristic only changes, and
+// notifies the controllers, when the step moves it by a whole unit.
+static void step_curve(light_t *light)
 {
-    nvs_handle_t nvs_handle;
-    uint32_t u32_val;
-    float value_float;
-    if (open_nvs_handle(&nvs_handle) == ESP_OK)
+    const adaptive_curve_t *curve = light->curve;
+    hap_char_t *target = curve_char_by_iid(light, curve->target_iid);
+    hap_char_t *adjust = curve_char_by_iid(light, curve->adjust_iid);
+    int32_t adjust_val = 0;
+    if (adjust == light->brightness_char)
+        adjust_val = hap_char_get_val(adjust)->i;
+    else if (adjust)
+        adjust_val = hap_char_get_val(adjust)->u;
+
+    float value;
+    bool running = adaptive_curve_value(curve, curve_elapsed_ms(light), adjust_val, &value);
+    int32_t v = lroundf(value);
+    if (target == light->brightness_char)
     {
-        esp_err_t err = nvs_get_u32(nvs_handle, key, &u32_val);
-        nvs_close(nvs_handle);
-        if (err == ESP_OK)
+        v = v < 0 ? 0 : v > 100 ? 100 : v;
+        if (v != hap_char_get_val(target)->i)
         {
-            memcpy(&value_float, &u32_val, sizeof(value_float));
-            return value_float;
+            hap_val_t val = {.i = v};
+            hap_char_update_val(target, &val);
         }
-        if (err == ESP_ERR_NVS_NOT_FOUND)
-            ESP_LOGI(TAG, "NVS: Key '%s' not found, using default.", key);
-        else
-            ESP_LOGE(TAG, "NVS: Error (%s) reading key '%s'", esp_err_to_name(err), key);
     }
     else
     {
-        ESP_LOGE(TAG, "Failed to open NVS to load key: %s", key);
+        v = v < COLOR_TEMPERATURE_MIN ? COLOR_TEMPERATURE_MIN
+          : v > COLOR_TEMPERATURE_MAX ? COLOR_TEMPERATURE_MAX : v;
+        if ((uint32_t)v != hap_char_get_val(target)->u)
+        {
+            hap_val_t val = {.u = v};
+            hap_char_update_val(target, &val);
+        }
+        light->use_color_temperature = true;
     }
-    return default_value;
+    sync_leds_to_homekit(light);
+
+    if (!running)
+        end_curve(light);
 }
 
-static void persist_all_hap_characteristics()
+static void curve_timer_cb(void *arg)
 {
-    const hap_val_t *val;
-    nvs_handle_t nvs_handle;
-    open_nvs_handle(&nvs_handle);
+    light_t *light = arg;
+    xSemaphoreTake(curve_lock, portMAX_DELAY);
+    if (light->curve)
+        step_curve(light);
+    xSemaphoreGive(curve_lock);
+}
+
+static hap_status_t start_curve(light_t *light, const adaptive_curve_t *curve)
+{
+    if (!light->curve)
+    {
+        light->curve = malloc(sizeof(*light->curve));
+        if (!light->curve)
+            return HAP_STATUS_OO_RES;
+    }
+    *light->curve = *curve;
+
+    // The curve started at the controller's start time. Without a set clock
+    // that cannot be placed, and the curve starts on receipt instead.
+    light->curve_start_us = esp_timer_get_time();
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec > CLOCK_SET_S)
+    {
+        int64_t now_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 - EPOCH_2001_MS;
+        light->curve_start_us -= (now_ms - (int64_t)curve->start_ms) * 1000;
+    }
 
-    val = hap_char_get_val(on_char);
-    save_bool_nvs(nvs_handle, KEY_ON, val->b);
+    esp_timer_stop(light->curve_timer);
+    esp_timer_start_periodic(light->curve_timer, (uint64_t)curve->interval_ms * 1000);
+    set_transition_count(light, 1);
+    ESP_LOGI(TAG, "Light %d: transition of %d entries, every %" PRIu32 " ms",
+             light->segment + 1, curve->entry_count, curve->interval_ms);
+    step_curve(light);
+    return HAP_STATUS_SUCCESS;
+}
 
-    val = hap_char_get_val(brightness_char);
-    save_int32_nvs(nvs_handle, KEY_BRIGHTNESS, val->i);
-    save_int32_nvs(nvs_handle, KEY_LAST_BRIGHTNESS, last_brightness);
+// Handles a write to the Characteristic Value Transition Control, whose
+// response is read back from the value of the characteristic.
+static hap_status_t control_transition(light_t *light, hap_tlv8_val_t *req)
+{
+    // Only the HTTP server task writes, under the curve lock.
+    static adaptive_curve_t curve;
+    hap_status_t status = HAP_STATUS_SUCCESS;
+    uint32_t iid = 0;
+    size_t len = 0;
 
-    val = hap_char_get_val(hue_char);
-    save_float_nvs(nvs_handle, KEY_HUE, val->f);
+    switch (adaptive_parse_control(req->buf, req->buflen, &curve, &iid))
+    {
+    case ADAPTIVE_REQ_READ:
+        break;
+    case ADAPTIVE_REQ_STOP:
+        if (light->curve && light->curve->target_iid == iid)
+            end_curve(light);
+        break;
+    case ADAPTIVE_REQ_START:
+        if (!curve_char_by_iid(light, iid))
+            status = HAP_STATUS_VAL_INVALID;
+        else
+            status = start_curve(light, &curve);
+        break;
+    default:
+        status = HAP_STATUS_VAL_INVALID;
+        break;
+    }
 
-    val = hap_char_get_val(saturation_char);
-    save_float_nvs(nvs_handle, KEY_SATURATION, val->f);
-    nvs_commit(nvs_handle);
-    nvs_close(nvs_handle);
+    if (status == HAP_STATUS_SUCCESS && light->curve && light->curve->target_iid == iid)
+    {
+        len = adaptive_build_status(light->curve, curve_elapsed_ms(light),
+                                    light->control_response, sizeof(light->control_response));
+    }
+    hap_val_t v = {.t = {.buf = light->control_response, .buflen = len}};
+    hap_char_update_val(light->transition_control_char, &v);
+    return status;
 }
 
 static int ws2812_read(hap_char_t *hc, hap_status_t *status_code,
@@ -174,6 +249,10 @@ static int ws2812_read(hap_char_t *hc, hap_status_t *status_code,
         strcmp(char_uuid, HAP_CHAR_UUID_BRIGHTNESS) == 0 ||
         strcmp(char_uuid, HAP_CHAR_UUID_HUE) == 0 ||
         strcmp(char_uuid, HAP_CHAR_UUID_SATURATION) == 0 ||
+        strcmp(char_uuid, HAP_CHAR_UUID_COLOR_TEMPERATURE) == 0 ||
+        strcmp(char_uuid, HAP_CHAR_UUID_CHARACTERISTIC_VALUE_TRANSITION_CONTROL) == 0 ||
+        strcmp(char_uuid, HAP_CHAR_UUID_SUPPORTED_CHARACTERISTIC_VALUE_TRANSITION_CONFIGURATION) == 0 ||
+        strcmp(char_uuid, HAP_CHAR_UUID_CHARACTERISTIC_VALUE_ACTIVE_TRANSITION_COUNT) == 0 ||
         strcmp(char_uuid, HAP_CHAR_UUID_NAME) == 0)
     {
 
@@ -200,9 +279,11 @@ static int ws2812_read(hap_char_t *hc, hap_status_t *status_code,
 static int ws2812_write(hap_write_data_t write_data[], int count,
                         void *serv_priv, void *write_priv)
 {
+    light_t *light = serv_priv;
     int i, ret = HAP_SUCCESS;
     hap_write_data_t *write;
     bool state_changed = false;
+    xSemaphoreTake(curve_lock, portMAX_DELAY);
     for (i = 0; i < count; i++)
     {
         write = &write_data[i];
@@ -210,20 +291,16 @@ static int ws2812_write(hap_write_data_t write_data[], int count,
         const char *char_uuid = hap_char_get_type_uuid(write->hc);
         if (!strcmp(char_uuid, HAP_CHAR_UUID_ON))
         {
+            // Switching off leaves the brightness alone, so that it is saved
+            // along with the on state and comes back when switched on.
             bool new_on = write->val.b;
-            if (!new_on)
+            if (new_on && hap_char_get_val(light->brightness_char)->i == 0)
             {
-                last_brightness = hap_char_get_val(brightness_char)->i;
-                hap_val_t zero = {.i = 0};
-                hap_char_update_val(brightness_char, &zero);
-            }
-            else
-            {
-                hap_val_t v = {.i = last_brightness};
-                hap_char_update_val(brightness_char, &v);
+                hap_val_t v = {.i = light->last_brightness ? light->last_brightness : 100};
+                hap_char_update_val(light->brightness_char, &v);
             }
 
-            hap_char_update_val(on_char, &write->val);
+            hap_char_update_val(light->on_char, &write->val);
             *(write->status) = HAP_STATUS_SUCCESS;
             state_changed = true;
         }
@@ -233,31 +310,42 @@ static int ws2812_write(hap_write_data_t write_data[], int count,
 
             if (new_b > 0)
             {
-                last_brightness = new_b;
+                light->last_brightness = new_b;
                 hap_val_t onv = {.b = true};
-                hap_char_update_val(on_char, &onv);
+                hap_char_update_val(light->on_char, &onv);
             }
             else
             {
                 hap_val_t offv = {.b = false};
-                hap_char_update_val(on_char, &offv);
+                hap_char_update_val(light->on_char, &offv);
             }
 
-            hap_char_update_val(brightness_char, &write->val);
+            hap_char_update_val(light->brightness_char, &write->val);
             *(write->status) = HAP_STATUS_SUCCESS;
             state_changed = true;
+
+            // A curve of the colour temperature follows the new brightness
+            // right away, one of the brightness gives way to it.
+            if (light->curve && curve_char_by_iid(light, light->curve->target_iid) == light->brightness_char)
+                end_curve(light);
+            else if (light->curve)
+                step_curve(light);
         }
-        else if (!strcmp(char_uuid, HAP_CHAR_UUID_HUE))
+        else if (!strcmp(char_uuid, HAP_CHAR_UUID_HUE) ||
+                 !strcmp(char_uuid, HAP_CHAR_UUID_SATURATION) ||
+                 !strcmp(char_uuid, HAP_CHAR_UUID_COLOR_TEMPERATURE))
         {
-            hap_char_update_val(hue_char, &(write->val));
+            // Setting a colour by hand ends a curve of the colour temperature.
+            if (light->curve && curve_char_by_iid(light, light->curve->target_iid) == light->color_temperature_char)
+                end_curve(light);
+            light->use_color_temperature = write->hc == light->color_temperature_char;
+            hap_char_update_val(write->hc, &(write->val));
             *(write->status) = HAP_STATUS_SUCCESS;
             state_changed = true;
         }
-        else if (!strcmp(char_uuid, HAP_CHAR_UUID_SATURATION))
+        else if (!strcmp(char_uuid, HAP_CHAR_UUID_CHARACTERISTIC_VALUE_TRANSITION_CONTROL))
         {
-            hap_char_update_val(saturation_char, &(write->val));
-            *(write->status) = HAP_STATUS_SUCCESS;
-            state_changed = true;
+            *(write->status) = control_transition(light, &write->val.t);
         }
         else
         {
@@ -273,8 +361,9 @@ static int ws2812_write(hap_write_data_t write_data[], int count,
 
     if (ret == HAP_SUCCESS && state_changed)
     {
-        persist_all_hap_characteristics();
+        sync_leds_to_homekit(light);
     }
+    xSemaphoreGive(curve_lock);
 
     return ret;
 }
@@ -303,54 +392,79 @@ int create_accessories_and_services(void)
 
     hap_acc_add_wifi_transport_service(accessory, 0);
 
-    hap_serv_t *light_service = hap_serv_lightbulb_create(true);
-    hap_serv_add_char(light_service, hap_char_name_create("ESP32 Lamp"));
-
-    int32_t initial_brightness = load_int32_nvs(KEY_LAST_BRIGHTNESS, load_int32_nvs(KEY_BRIGHTNESS, 100));
-    float initial_hue = load_float_nvs(KEY_HUE, 0.0f);
-    float initial_saturation = load_float_nvs(KEY_SATURATION, 0.0f);
-
-    on_char = hap_serv_get_char_by_uuid(light_service, HAP_CHAR_UUID_ON);
-    brightness_char = hap_char_brightness_create(initial_brightness);
-    hue_char = hap_char_hue_create(initial_hue);
-    saturation_char = hap_char_saturation_create(initial_saturation);
-
-    hap_serv_add_char(light_service, brightness_char);
-    hap_serv_add_char(light_service, hue_char);
-    hap_serv_add_char(light_service, saturation_char);
-
-    hap_serv_set_write_cb(light_service, ws2812_write);
-    hap_serv_set_read_cb(light_service, ws2812_read);
+    curve_lock = xSemaphoreCreateMutex();
 
-    hap_acc_add_serv(accessory, light_service);
-
-    return HAP_SUCCESS;
-}
-
-void sync_leds_to_homekit(void)
-{
-    const hap_val_t *val;
-
-    val = hap_char_get_val(on_char);
-    ws2812_set_power(val->b);
-
-    val = hap_char_get_val(brightness_char);
-    ws2812_set_brightness(val->i);
-
-    val = hap_char_get_val(hue_char);
-    ws2812_set_hue(val->f);
-
-    val = hap_char_get_val(saturation_char);
-    ws2812_set_saturation(val->f);
-}
-
-void led_sync_task(void *pvParameter)
-{
-    while (1)
+    light_count = ws2812_get_segment_count();
+    for (int i = 0; i < light_count; i++)
     {
-        sync_leds_to_homekit();
-        vTaskDelay(pdMS_TO_TICKS(200));
+        light_t *light = &lights[i];
+        char name[32];
+        light->segment = i;
+        if (light_count == 1)
+            snprintf(name, sizeof(name), "ESP32 Lamp");
+        else
+            snprintf(name, sizeof(name), "ESP32 Lamp %d", i + 1);
+
+        hap_serv_t *light_service = hap_serv_lightbulb_create(true);
+        hap_serv_add_char(light_service, hap_char_name_create(name));
+
+        // The core saves these and restores them in hap_start(), until then
+        // they hold the defaults for a lamp that has never been set.
+        light->on_char = hap_serv_get_char_by_uuid(light_service, HAP_CHAR_UUID_ON);
+        light->brightness_char = hap_char_brightness_create(100);
+        light->hue_char = hap_char_hue_create(0.0f);
+        light->saturation_char = hap_char_saturation_create(0.0f);
+        hap_char_set_persistent(light->on_char, true);
+        hap_char_set_persistent(light->brightness_char, true);
+        hap_char_set_persistent(light->hue_char, true);
+        hap_char_set_persistent(light->saturation_char, true);
+
+        hap_serv_add_char(light_service, light->brightness_char);
+        hap_serv_add_char(light_service, light->hue_char);
+        hap_serv_add_char(light_service, light->saturation_char);
+
+        // Adaptive Lighting. The colour temperature is not saved, as a curve
+        // moves it every minute; the hue and saturation come back instead.
+        light->color_temperature_char = hap_char_color_temperature_create(COLOR_TEMPERATURE_MIN);
+        hap_char_int_set_constraints(light->color_temperature_char,
+                                     COLOR_TEMPERATURE_MIN, COLOR_TEMPERATURE_MAX, 1);
+        hap_tlv8_val_t empty = {.buf = light->control_response, .buflen = 0};
+        light->transition_control_char = hap_char_characteristic_value_transition_control_create(&empty);
+        light->transition_count_char = hap_char_characteristic_value_active_transition_count_create(0);
+        hap_char_t *supported_char = hap_char_supported_characteristic_value_transition_configuration_create(&empty);
+        hap_serv_add_char(light_service, light->color_temperature_char);
+        hap_serv_add_char(light_service, light->transition_control_char);
+        hap_serv_add_char(light_service, supported_char);
+        hap_serv_add_char(light_service, light->transition_count_char);
+
+        const esp_timer_create_args_t timer_args = {
+            .callback = curve_timer_cb,
+            .arg = light,
+            .name = "curve",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &light->curve_timer));
+
+        hap_serv_set_priv(light_service, light);
+        hap_serv_set_write_cb(light_service, ws2812_write);
+        hap_serv_set_read_cb(light_service, ws2812_read);
+        if (i == 0)
+            hap_serv_mark_primary(light_service);
+
+        hap_acc_add_serv(accessory, light_service);
+
+        // The iids are only known once the service is on the accessory.
+        uint32_t iids[] = {
+            hap_char_get_iid(light->brightness_char),
+            hap_char_get_iid(light->color_temperature_char),
+        };
+        uint8_t types[] = {ADAPTIVE_TYPE_BRIGHTNESS, ADAPTIVE_TYPE_COLOR_TEMPERATURE};
+        hap_val_t supported = {.t = {.buf = light->supported_config}};
+        supported.t.buflen = adaptive_build_supported(iids, types, 2, light->supported_config,
+                                                      sizeof(light->supported_config));
+        hap_char_update_val(supported_char, &supported);
     }
+
+    return HAP_SUCCESS;
 }
 
 int start_homekit(void)
@@ -383,11 +497,11 @@ int start_homekit(void)
     }
     ESP_LOGI(TAG, "HomeKit started");
 
-    ESP_LOGI(TAG, "Starting LED sync task");
-    xTaskCreate(led_sync_task, "LED Sync Task", 2048, NULL, tskIDLE_PRIORITY + 1, NULL);
-    ESP_LOGI(TAG, "Started LED sync task");
-
     hap_val_t onv = {.b = true};
-    hap_char_update_val(on_char, &onv);
+    for (int i = 0; i < light_count; i++)
+    {
+        hap_char_update_val(lights[i].on_char, &onv);
+        sync_leds_to_homekit(&lights[i]);
+    }
     return HAP_SUCCESS;
 }
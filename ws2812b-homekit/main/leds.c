@@ -1,168 +1,579 @@
 #include "leds.h"
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <inttypes.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "led_strip.h"
+#include "sdkconfig.h"
+#include "soc/soc_caps.h"
+#include "color.h"
+#include "transition.h"
 
 #define TAG "ws2812"
-#define PIXEL_COUNT 144
-#define LED_GPIO_PIN GPIO_NUM_8
-
-static bool g_power = true;
-static double g_hue = 0;
-static double g_saturation = 0.0f;
-static double g_brightness = 70.0f;
-static uint8_t g_base_r, g_base_g, g_base_b;
-static uint8_t gamma_lut[256];
-
-static led_strip_handle_t strip;
-
-bool ws2812_get_power(void) { return g_power; }
-int ws2812_get_brightness(void) { return g_brightness; }
-float ws2812_get_hue(void) { return (float)g_hue; }
-float ws2812_get_saturation(void) { return (float)g_saturation; }
-
-void hsv2rgb(double h, double s, double v,
-             uint8_t *out_r, uint8_t *out_g, uint8_t *out_b)
-{
-    double hh = (fmod(h, 360.0)) / 60.0;
-    int i = (int)hh;
-    float f = hh - i;
-    float vv = v / 100.0f;
-    float ss = s / 100.0f;
-    float p = vv * (1 - ss);
-    float q = vv * (1 - ss * f);
-    float t = vv * (1 - ss * (1 - f));
-    float rf, gf, bf;
-
-    switch (i)
+
+#define STRIP_COUNT CONFIG_LED_STRIP_COUNT
+#if STRIP_COUNT > SOC_RMT_TX_CANDIDATES_PER_GROUP
+#error "More LED strips configured than this target has RMT TX channels"
+#endif
+#if STRIP_COUNT > 1
+#define LED_STRIP2_LENGTH CONFIG_LED_STRIP2_LENGTH
+#else
+#define LED_STRIP2_LENGTH 0
+#endif
+#if STRIP_COUNT > 2
+#define LED_STRIP3_LENGTH CONFIG_LED_STRIP3_LENGTH
+#else
+#define LED_STRIP3_LENGTH 0
+#endif
+#if STRIP_COUNT > 3
+#define LED_STRIP4_LENGTH CONFIG_LED_STRIP4_LENGTH
+#else
+#define LED_STRIP4_LENGTH 0
+#endif
+#define PIXEL_COUNT (CONFIG_LED_STRIP1_LENGTH + LED_STRIP2_LENGTH + LED_STRIP3_LENGTH + LED_STRIP4_LENGTH)
+
+// Strips fed from RMT memory share the TX channels' memory blocks between
+// them, so that each refill interrupt moves as many symbols as possible. With
+// DMA the buffer is in RAM and is made large enough to rarely need refilling.
+#define RMT_MEM_BLOCK_SYMBOLS (SOC_RMT_MEM_WORDS_PER_CHANNEL * (SOC_RMT_TX_CANDIDATES_PER_GROUP / STRIP_COUNT))
+#define RMT_DMA_BLOCK_SYMBOLS 1024
+#define STATS_PERIOD_US (10 * 1000 * 1000)
+
+#define RENDER_TASK_STACK 3072
+#define RENDER_TASK_PRIORITY (tskIDLE_PRIORITY + 4)
+#define FRAME_PERIOD_US (1000000 / CONFIG_LED_FRAME_RATE)
+
+// Guards the target state of the segments and the stream handshake.
+static portMUX_TYPE g_state_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// One physical strip, showing pixels [start, start + length) of the frame.
+typedef struct
+{
+    int gpio;
+    uint16_t start;
+    uint16_t length;
+    led_strip_handle_t handle;
+    // Time spent handing frames to the driver since the last stats report.
+    uint32_t frames;
+    uint32_t cpu_us;
+    uint32_t wait_us;
+} strip_t;
+
+static strip_t strips[STRIP_COUNT] = {
+    {.gpio = CONFIG_LED_STRIP1_GPIO, .start = 0, .length = CONFIG_LED_STRIP1_LENGTH},
+#if STRIP_COUNT > 1
+    {.gpio = CONFIG_LED_STRIP2_GPIO, .start = CONFIG_LED_STRIP1_LENGTH, .length = LED_STRIP2_LENGTH},
+#endif
+#if STRIP_COUNT > 2
+    {.gpio = CONFIG_LED_STRIP3_GPIO, .start = CONFIG_LED_STRIP1_LENGTH + LED_STRIP2_LENGTH, .length = LED_STRIP3_LENGTH},
+#endif
+#if STRIP_COUNT > 3
+    {.gpio = CONFIG_LED_STRIP4_GPIO, .start = CONFIG_LED_STRIP1_LENGTH + LED_STRIP2_LENGTH + LED_STRIP3_LENGTH, .length = LED_STRIP4_LENGTH},
+#endif
+};
+
+static TaskHandle_t render_task;
+
+// Whole render passes since the last stats report.
+static int64_t stats_start_us;
+static uint32_t stats_frames;
+static uint32_t stats_frame_us;
+static uint32_t stats_frame_max_us;
+
+// Paces the frames of a transition. It runs only while a transition is in
+// progress, so an idle lamp does not wake up at all.
+static esp_timer_handle_t frame_timer;
+static uint32_t g_transition_us = CONFIG_LED_TRANSITION_MS * 1000;
+
+// Gamma corrected RGB of every pixel, across all strips. This is the back
+// buffer: frames are rendered here while the driver's own pixel buffers, the
+// front buffers, are still being transmitted.
+static uint8_t frame[PIXEL_COUNT * 3];
+// Pixels [dirty_start, dirty_end) differ from what the strip shows.
+static uint16_t dirty_start = PIXEL_COUNT;
+static uint16_t dirty_end = 0;
+
+// A contiguous run of pixels showing one colour, controlled on its own.
+typedef struct
+{
+    uint16_t start;
+    uint16_t count;
+
+    // Target state, written by the setters from any task and read by the
+    // render task, under g_state_lock. changed is set by the setters and
+    // cleared once the render task picks up the new state, so that any number
+    // of changes to any number of segments before it gets to run cost one
+    // frame.
+    ws2812_state_t state;
+    bool changed;
+
+    // Only used by the render task. The colour shown trails the target state
+    // during a transition, and the pixels are only refilled when it changes.
+    transition_t transition;
+    light_fx_t current_fx;
+    bool have_current_fx;
+    bool filled;
+    uint8_t r, g, b;
+} segment_t;
+
+static segment_t segments[WS2812_MAX_SEGMENTS];
+static int segment_count;
+
+// While streaming, the frame buffer belongs to stream_task, which fills it and
+// then waits for the render task to hand it to the strips. Both handshakes
+// below are answered with a notification to stream_task. Guarded by
+// g_state_lock.
+static TaskHandle_t stream_task;
+static bool g_streaming;
+static bool g_stream_begin;
+static bool g_stream_frame;
+// The frame buffer holds streamed pixels. Only used by the render task.
+static bool stream_shown;
+
+int ws2812_get_segment_count(void) { return segment_count; }
+bool ws2812_get_power(int segment) { return segments[segment].state.power; }
+int ws2812_get_brightness(int segment) { return segments[segment].state.brightness; }
+float ws2812_get_hue(int segment) { return segments[segment].state.hue; }
+float ws2812_get_saturation(int segment) { return segments[segment].state.saturation; }
+
+static void mark_dirty(uint16_t start, uint16_t count)
+{
+    if (start < dirty_start)
+        dirty_start = start;
+    if (start + count > dirty_end)
+        dirty_end = start + count;
+}
+
+// Fills count pixels with one colour. Only the first pixel is written byte by
+// byte, the rest is copied from the already filled part, doubling each time,
+// so that the bulk of the work is done by word-wide memcpy.
+static void fill_rgb(uint8_t *dst, uint16_t count, uint8_t r, uint8_t g, uint8_t b)
+{
+    size_t total = (size_t)count * 3;
+    size_t filled = 3;
+    if (!count)
+        return;
+    dst[0] = r;
+    dst[1] = g;
+    dst[2] = b;
+    while (filled < total)
     {
-    case 0:
-        rf = vv;
-        gf = t;
-        bf = p;
-        break;
-    case 1:
-        rf = q;
-        gf = vv;
-        bf = p;
-        break;
-    case 2:
-        rf = p;
-        gf = vv;
-        bf = t;
-        break;
-    case 3:
-        rf = p;
-        gf = q;
-        bf = vv;
-        break;
-    case 4:
-        rf = t;
-        gf = p;
-        bf = vv;
-        break;
-    default:
-        rf = vv;
-        gf = p;
-        bf = q;
-        break;
+        size_t len = filled < total - filled ? filled : total - filled;
+        memcpy(dst + filled, dst, len);
+        filled += len;
     }
+}
 
-    *out_r = (uint8_t)(rf * 255);
-    *out_g = (uint8_t)(gf * 255);
-    *out_b = (uint8_t)(bf * 255);
+static void fill_segment(segment_t *seg, uint8_t r, uint8_t g, uint8_t b)
+{
+    if (seg->filled && seg->r == r && seg->g == g && seg->b == b)
+        return;
+    fill_rgb(&frame[seg->start * 3], seg->count, r, g, b);
+    seg->filled = true;
+    seg->r = r;
+    seg->g = g;
+    seg->b = b;
+    mark_dirty(seg->start, seg->count);
+}
+
+static void state_to_fx(const ws2812_state_t *state, light_fx_t *fx)
+{
+    fx->hue = (uint16_t)(uint32_t)(state->hue * (65536.0f / 360));
+    fx->saturation = (uint16_t)(state->saturation * LIGHT_FX_PERCENT);
+    fx->level = state->power ? state->brightness * LIGHT_FX_PERCENT : 0;
+}
+
+static void render_segment(segment_t *seg)
+{
+    // The colour is the same for every pixel, so scale and gamma correct it once.
+    const light_fx_t *fx = &seg->current_fx;
+    uint16_t base_r, base_g, base_b;
+    color_hsv_to_rgb(fx->hue, fx->saturation, &base_r, &base_g, &base_b);
+    uint32_t scale = color_level_to_scale(fx->level);
+    uint8_t r = color_scale_gamma(base_r, scale);
+    uint8_t g = color_scale_gamma(base_g, scale);
+    uint8_t b = color_scale_gamma(base_b, scale);
+    fill_segment(seg, r, g, b);
+}
+
+// Copies the changed pixels of one strip into its front buffer and starts
+// transmitting it. The previous transmission has to finish first, as the
+// driver encodes the front buffer while it is on the wire; by the time the
+// next frame has been rendered it usually has.
+static void flush_strip(strip_t *s)
+{
+    uint16_t start = dirty_start > s->start ? dirty_start : s->start;
+    uint16_t end = dirty_end < s->start + s->length ? dirty_end : s->start + s->length;
+    if (start >= end)
+        return;
+
+    int64_t t0 = esp_timer_get_time();
+    led_strip_refresh_wait_done(s->handle);
+    int64_t t1 = esp_timer_get_time();
+    for (int i = start; i < end; ++i)
+        led_strip_set_pixel(s->handle, i - s->start, frame[i * 3], frame[i * 3 + 1], frame[i * 3 + 2]);
+    led_strip_refresh_async(s->handle);
+    int64_t t2 = esp_timer_get_time();
+
+    s->frames++;
+    s->wait_us += t1 - t0;
+    s->cpu_us += t2 - t1;
+}
+
+static void flush_frame(void)
+{
+    if (dirty_start >= dirty_end)
+        return;
+    for (int i = 0; i < STRIP_COUNT; ++i)
+        flush_strip(&strips[i]);
+    dirty_start = PIXEL_COUNT;
+    dirty_end = 0;
 }
 
-void build_gamma_table(void)
+// Logs how long frames took to render and hand over, per strip and in total,
+// and what share of the CPU that took over the reporting period. A period is
+// counted as at least one frame period per frame, so that a lone frame is not
+// reported as having taken all of the CPU.
+static void report_stats(int64_t now)
 {
-    const float gamma = 2.8f;
-    for (int i = 0; i < 256; ++i)
+    uint32_t period_us = now - stats_start_us;
+    if (!stats_frames)
+        return;
+    if (period_us < stats_frames * FRAME_PERIOD_US)
+        period_us = stats_frames * FRAME_PERIOD_US;
+    ESP_LOGI(TAG, "%" PRIu32 " frames in %" PRIu32 " ms, %" PRIu32 " us/frame avg, %" PRIu32 " us max",
+             stats_frames, period_us / 1000, stats_frame_us / stats_frames, stats_frame_max_us);
+    for (int i = 0; i < STRIP_COUNT; ++i)
     {
-        float norm = i / 255.0f;
-        gamma_lut[i] = (uint8_t)(powf(norm, gamma) * 255.0f + 0.5f);
+        strip_t *s = &strips[i];
+        if (s->frames)
+            ESP_LOGI(TAG, "strip %d: %" PRIu32 " frames, %" PRIu32 " us/frame cpu (%" PRIu32 ".%02" PRIu32 "%%), %" PRIu32 " us/frame waiting for transmission",
+                     i + 1, s->frames, s->cpu_us / s->frames,
+                     (uint32_t)((uint64_t)s->cpu_us * 100 / period_us),
+                     (uint32_t)((uint64_t)s->cpu_us * 10000 / period_us % 100),
+                     s->wait_us / s->frames);
+        s->frames = s->cpu_us = s->wait_us = 0;
     }
+    stats_frames = stats_frame_us = stats_frame_max_us = 0;
 }
 
-void update_base_rgb(void)
+static void account_frame(int64_t start, bool idle)
 {
-    hsv2rgb(g_hue, g_saturation, 100, &g_base_r, &g_base_g, &g_base_b);
+    int64_t now = esp_timer_get_time();
+    uint32_t frame_us = now - start;
+    if (!stats_frames)
+        stats_start_us = start;
+    stats_frames++;
+    stats_frame_us += frame_us;
+    if (frame_us > stats_frame_max_us)
+        stats_frame_max_us = frame_us;
+    if (idle || now - stats_start_us >= STATS_PERIOD_US)
+        report_stats(now);
 }
 
-void update_pixels(void)
+static void render_task_fn(void *arg)
 {
-    uint8_t scale = g_power ? (uint16_t)g_brightness * 255 / 100 : 0;
-    for (int i = 0; i < PIXEL_COUNT; ++i)
+    while (1)
     {
-        uint8_t r = (uint16_t)g_base_r * scale / 255;
-        uint8_t g = (uint16_t)g_base_g * scale / 255;
-        uint8_t b = (uint16_t)g_base_b * scale / 255;
+        // Sleep until a setter posts a change. Notifications given meanwhile
+        // are collapsed into one, and the latest state is rendered. The HAP
+        // server runs at a higher priority, so the writes of one request are
+        // all posted before this task gets to run.
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        ws2812_state_t states[WS2812_MAX_SEGMENTS];
+        bool changed[WS2812_MAX_SEGMENTS];
+        bool streaming, stream_begin, stream_frame;
+        portENTER_CRITICAL(&g_state_lock);
+        streaming = g_streaming;
+        stream_begin = g_stream_begin;
+        stream_frame = g_stream_frame;
+        g_stream_begin = g_stream_frame = false;
+        for (int i = 0; i < segment_count; ++i)
+        {
+            states[i] = segments[i].state;
+            changed[i] = segments[i].changed;
+            if (!streaming)
+                segments[i].changed = false;
+        }
+        portEXIT_CRITICAL(&g_state_lock);
+
+        if (streaming)
+        {
+            if (stream_begin)
+            {
+                if (esp_timer_is_active(frame_timer))
+                    esp_timer_stop(frame_timer);
+                stream_shown = true;
+                xTaskNotifyGive(stream_task);
+            }
+            if (stream_frame)
+            {
+                int64_t start = esp_timer_get_time();
+                flush_frame();
+                xTaskNotifyGive(stream_task);
+                account_frame(start, false);
+            }
+            continue;
+        }
+        if (stream_shown)
+        {
+            // The stream has ended. The HomeKit state is shown again at once,
+            // as there is no colour to fade from.
+            stream_shown = false;
+            for (int i = 0; i < segment_count; ++i)
+            {
+                segments[i].filled = false;
+                segments[i].have_current_fx = false;
+                changed[i] = true;
+            }
+        }
+
+        // All the segments are rendered into the frame in one pass, and the
+        // frame is sent once, however many of them changed.
+        int64_t now = esp_timer_get_time();
+        bool rendered = false, running = false;
+        for (int i = 0; i < segment_count; ++i)
+        {
+            segment_t *seg = &segments[i];
+            if (!changed[i] && !seg->transition.active)
+                continue;
+            if (changed[i])
+            {
+                // A new target starts from whatever is shown at the moment,
+                // even in the middle of another transition.
+                light_fx_t target;
+                state_to_fx(&states[i], &target);
+                transition_start(&seg->transition, seg->have_current_fx ? &seg->current_fx : &target,
+                                 &target, now, seg->have_current_fx ? g_transition_us : 0);
+                seg->have_current_fx = true;
+            }
+            // Progress is taken from the clock, so a late frame catches up
+            // rather than stretching the transition.
+            running |= transition_step(&seg->transition, now, &seg->current_fx);
+            render_segment(seg);
+            rendered = true;
+        }
+        if (!rendered)
+            continue;
+        flush_frame();
+        account_frame(now, !running);
+
+        if (running && !esp_timer_is_active(frame_timer))
+            esp_timer_start_periodic(frame_timer, FRAME_PERIOD_US);
+        else if (!running && esp_timer_is_active(frame_timer))
+            esp_timer_stop(frame_timer);
+    }
+}
+
+static void frame_timer_cb(void *arg)
+{
+    xTaskNotifyGive(render_task);
+}
+
+void ws2812_refresh(void)
+{
+    if (render_task)
+        xTaskNotifyGive(render_task);
+}
 
-        uint8_t r_corr = gamma_lut[r];
-        uint8_t g_corr = gamma_lut[g];
-        uint8_t b_corr = gamma_lut[b];
+// Splits the pixels into the segments listed in CONFIG_LED_SEGMENTS, as
+// comma separated lengths. Pixels left over go to the last segment.
+static void init_segments(void)
+{
+    const char *p = CONFIG_LED_SEGMENTS;
+    uint16_t start = 0;
+    while (*p && segment_count < WS2812_MAX_SEGMENTS && start < PIXEL_COUNT)
+    {
+        char *end;
+        long count = strtol(p, &end, 10);
+        if (end == p)
+        {
+            ESP_LOGE(TAG, "Invalid segment list \"%s\"", CONFIG_LED_SEGMENTS);
+            break;
+        }
+        p = *end == ',' ? end + 1 : end;
+        if (count <= 0)
+            continue;
+        if (count > PIXEL_COUNT - start)
+            count = PIXEL_COUNT - start;
+        segments[segment_count].start = start;
+        segments[segment_count].count = count;
+        segment_count++;
+        start += count;
+    }
+    if (!segment_count)
+        segments[segment_count++].start = 0;
+    segments[segment_count - 1].count = PIXEL_COUNT - segments[segment_count - 1].start;
 
-        led_strip_set_pixel(strip, i, r_corr, g_corr, b_corr);
+    for (int i = 0; i < segment_count; ++i)
+    {
+        segments[i].state = (ws2812_state_t){
+            .power = true,
+            .brightness = 70,
+            .hue = 0,
+            .saturation = 0,
+        };
+        segments[i].changed = true;
+        ESP_LOGI(TAG, "segment %d: pixels %u-%u", i + 1, segments[i].start,
+                 segments[i].start + segments[i].count - 1);
     }
-    led_strip_refresh(strip);
 }
 
 void ws2812_init(void)
 {
-    led_strip_config_t strip_config = {
-        .strip_gpio_num = LED_GPIO_PIN,
-        .max_leds = PIXEL_COUNT,
-        .led_model = LED_MODEL_WS2812,
-        .color_component_format = LED_STRIP_COLOR_COMPONENT_FMT_GRB,
+    for (int i = 0; i < STRIP_COUNT; ++i)
+    {
+        strip_t *s = &strips[i];
+        led_strip_config_t strip_config = {
+            .strip_gpio_num = s->gpio,
+            .max_leds = s->length,
+            .led_model = LED_MODEL_WS2812,
+            .color_component_format = LED_STRIP_COLOR_COMPONENT_FMT_GRB,
+        };
+
+        led_strip_rmt_config_t rmt_config = {
+            .clk_src = RMT_CLK_SRC_DEFAULT,
+            .resolution_hz = 10 * 1000 * 1000,
+            .mem_block_symbols = RMT_MEM_BLOCK_SYMBOLS,
+        };
+#ifdef CONFIG_LED_RMT_DMA
+        if (i == 0)
+        {
+            rmt_config.mem_block_symbols = RMT_DMA_BLOCK_SYMBOLS;
+            rmt_config.flags.with_dma = true;
+        }
+#endif
+
+        ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &s->handle));
+        ESP_ERROR_CHECK(led_strip_clear(s->handle));
+        ESP_LOGI(TAG, "strip %d: %u pixels on GPIO %d%s", i + 1, s->length, s->gpio,
+                 rmt_config.flags.with_dma ? ", DMA" : "");
+    }
+
+    init_segments();
+    transition_init();
+    const esp_timer_create_args_t timer_args = {
+        .callback = frame_timer_cb,
+        .name = "led_frame",
     };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &frame_timer));
+    xTaskCreate(render_task_fn, "LED Render Task", RENDER_TASK_STACK, NULL, RENDER_TASK_PRIORITY, &render_task);
+    ws2812_refresh();
+}
 
-    led_strip_rmt_config_t rmt_config = {
-        .clk_src = RMT_CLK_SRC_DEFAULT,
-        .resolution_hz = 10 * 1000 * 1000,
-        .mem_block_symbols = 64,
-        .flags = {
-            .with_dma = false,
-        }};
+void ws2812_set_transition_time(uint32_t ms)
+{
+    // Keeps the progress computation in transition_step() within 32 bits.
+    if (ms > 10000)
+        ms = 10000;
+    g_transition_us = ms * 1000;
+}
 
-    ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &strip));
-    ESP_ERROR_CHECK(led_strip_clear(strip));
+static bool state_equal(const ws2812_state_t *a, const ws2812_state_t *b)
+{
+    return a->power == b->power && a->brightness == b->brightness &&
+           a->hue == b->hue && a->saturation == b->saturation;
+}
 
-    build_gamma_table();
-    update_base_rgb();
-    update_pixels();
+void ws2812_set_state(int segment, const ws2812_state_t *state)
+{
+    segment_t *seg = &segments[segment];
+    ws2812_state_t new_state = *state;
+    new_state.hue = fmodf(state->hue, 360);
+
+    portENTER_CRITICAL(&g_state_lock);
+    if (!state_equal(&seg->state, &new_state))
+    {
+        seg->state = new_state;
+        seg->changed = true;
+    }
+    portEXIT_CRITICAL(&g_state_lock);
+    ws2812_refresh();
 }
 
-void ws2812_set_power(bool on)
+// The single property setters update the target state in place, under the
+// lock, so that setters called from different tasks do not undo each other.
+void ws2812_set_power(int segment, bool on)
 {
-    if (g_power == on)
-        return;
-    g_power = on;
-    update_pixels();
+    segment_t *seg = &segments[segment];
+    portENTER_CRITICAL(&g_state_lock);
+    seg->changed |= seg->state.power != on;
+    seg->state.power = on;
+    portEXIT_CRITICAL(&g_state_lock);
+    ws2812_refresh();
 }
 
-void ws2812_set_brightness(int brightness)
+void ws2812_set_brightness(int segment, int brightness)
 {
-    if (g_brightness == brightness)
-        return;
-    g_brightness = brightness;
-    update_pixels();
+    segment_t *seg = &segments[segment];
+    portENTER_CRITICAL(&g_state_lock);
+    seg->changed |= seg->state.brightness != brightness;
+    seg->state.brightness = brightness;
+    portEXIT_CRITICAL(&g_state_lock);
+    ws2812_refresh();
 }
 
-void ws2812_set_hue(double hue)
+void ws2812_set_hue(int segment, double hue)
 {
-    if (g_hue == hue)
-        return;
-    g_hue = fmod(hue, 360);
-    update_base_rgb();
-    update_pixels();
+    segment_t *seg = &segments[segment];
+    float new_hue = fmodf(hue, 360);
+    portENTER_CRITICAL(&g_state_lock);
+    seg->changed |= seg->state.hue != new_hue;
+    seg->state.hue = new_hue;
+    portEXIT_CRITICAL(&g_state_lock);
+    ws2812_refresh();
+}
+
+void ws2812_set_saturation(int segment, double saturation)
+{
+    segment_t *seg = &segments[segment];
+    portENTER_CRITICAL(&g_state_lock);
+    seg->changed |= seg->state.saturation != saturation;
+    seg->state.saturation = saturation;
+    portEXIT_CRITICAL(&g_state_lock);
+    ws2812_refresh();
+}
+
+uint8_t *ws2812_stream_begin(size_t *len)
+{
+    portENTER_CRITICAL(&g_state_lock);
+    stream_task = xTaskGetCurrentTaskHandle();
+    g_streaming = true;
+    g_stream_begin = true;
+    portEXIT_CRITICAL(&g_state_lock);
+    ws2812_refresh();
+    // The render task may be in the middle of a frame, wait until it lets go.
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    *len = sizeof(frame);
+    return frame;
 }
 
-void ws2812_set_saturation(double saturation)
+void ws2812_stream_show(size_t offset, size_t len)
 {
-    if (g_saturation == saturation)
+    if (offset >= sizeof(frame) || !len)
         return;
-    g_saturation = saturation;
-    update_base_rgb();
-    update_pixels();
+    if (len > sizeof(frame) - offset)
+        len = sizeof(frame) - offset;
+    // The render task leaves the dirty range alone until it is notified.
+    mark_dirty(offset / 3, (offset + len + 2) / 3 - offset / 3);
+    portENTER_CRITICAL(&g_state_lock);
+    g_stream_frame = true;
+    portEXIT_CRITICAL(&g_state_lock);
+    ws2812_refresh();
+    // Returns once the frame has been copied out and is being transmitted, so
+    // that the buffer can take the next frame.
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+void ws2812_stream_end(void)
+{
+    portENTER_CRITICAL(&g_state_lock);
+    g_streaming = false;
+    portEXIT_CRITICAL(&g_state_lock);
+    ws2812_refresh();
 }
@@ -1,12 +1,41 @@
+#pragma once
+
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Complete state of the lamp, so that a change to several properties can be
+// posted to the renderer at once.
+typedef struct
+{
+    bool power;
+    int brightness;
+    float hue;
+    float saturation;
+} ws2812_state_t;
+
+// Most segments, each shown as its own light, that the strips can be split into.
+#define WS2812_MAX_SEGMENTS 8
 
 void ws2812_init(void);
-bool ws2812_get_power(void);
-int ws2812_get_brightness(void);
-float ws2812_get_hue(void);
-float ws2812_get_saturation(void);
-void ws2812_set_power(bool on);
-void ws2812_set_brightness(int brightness);
-void ws2812_set_hue(double hue);
-void ws2812_set_saturation(double saturation);
+int ws2812_get_segment_count(void);
+bool ws2812_get_power(int segment);
+int ws2812_get_brightness(int segment);
+float ws2812_get_hue(int segment);
+float ws2812_get_saturation(int segment);
+void ws2812_set_power(int segment, bool on);
+void ws2812_set_brightness(int segment, int brightness);
+void ws2812_set_hue(int segment, double hue);
+void ws2812_set_saturation(int segment, double saturation);
+void ws2812_set_state(int segment, const ws2812_state_t *state);
+void ws2812_set_transition_time(uint32_t ms);
+void ws2812_refresh(void);
+
+// Streaming hands the frame buffer to a single external source, which writes
+// RGB bytes into it directly. HomeKit changes are held back until the stream
+// ends, and are then applied at once.
+uint8_t *ws2812_stream_begin(size_t *len);
+void ws2812_stream_show(size_t offset, size_t len);
+void ws2812_stream_end(void);
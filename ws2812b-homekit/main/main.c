@@ -16,6 +16,7 @@
 #include "homekit.h"
 #include "wifi.h"
 #include "leds.h"
+#include "stream.h"
 
 static const char *TAG = "main";
 
@@ -49,8 +50,15 @@ void initialize_leds()
     ESP_LOGI(TAG, "Started LEDs");
 }
 
+void start_stream()
+{
+    ESP_LOGI(TAG, "Starting LED stream");
+    stream_init();
+}
+
 void app_main(void)
 {
     initialize_leds();
     start_wifi();
+    start_stream();
 }
@@ -0,0 +1,246 @@
+#include "stream.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+#include "leds.h"
+
+#define TAG "stream"
+
+#define STREAM_TASK_STACK 3072
+#define STREAM_TASK_PRIORITY (tskIDLE_PRIORITY + 5)
+// How often an idle socket wakes up to check for the stream timeout.
+#define STREAM_POLL_MS 100
+#define STREAM_TIMEOUT_US (CONFIG_LED_STREAM_TIMEOUT_MS * 1000)
+#define STATS_PERIOD_US (10 * 1000 * 1000)
+
+// DDP, the Distributed Display Protocol. A packet carries a run of RGB bytes
+// at a byte offset into the display, and the packet that ends a frame has the
+// push flag set. All integers are big endian. The data type is ignored, RGB
+// with 8 bits per channel is assumed, as sent by xLights, WLED and LedFx.
+#define DDP_HEADER_LEN 10
+#define DDP_TIMECODE_LEN 4
+#define DDP_FLAGS_VER_MASK 0xc0
+#define DDP_FLAGS_VER1 0x40
+#define DDP_FLAGS_TIMECODE 0x10
+#define DDP_FLAGS_STORAGE 0x08
+#define DDP_FLAGS_REPLY 0x04
+#define DDP_FLAGS_QUERY 0x02
+#define DDP_FLAGS_PUSH 0x01
+#define DDP_SEQ_MASK 0x0f
+#define DDP_ID_DISPLAY 1
+
+typedef struct
+{
+    uint8_t flags;
+    uint8_t seq;
+    uint32_t offset;
+    uint16_t len;
+    size_t header_len;
+} ddp_packet_t;
+
+// Counters for the stream statistics, reset after every report.
+typedef struct
+{
+    int64_t start_us;
+    uint32_t frames;
+    uint32_t dropped;
+    uint32_t late;
+    uint64_t latency_us;
+    uint32_t latency_max_us;
+} stream_stats_t;
+
+static bool ddp_parse(const uint8_t *buf, int len, ddp_packet_t *pkt)
+{
+    if (len < DDP_HEADER_LEN || (buf[0] & DDP_FLAGS_VER_MASK) != DDP_FLAGS_VER1)
+        return false;
+    // Queries, replies and storage commands are not supported.
+    if (buf[0] & (DDP_FLAGS_STORAGE | DDP_FLAGS_REPLY | DDP_FLAGS_QUERY) || buf[3] != DDP_ID_DISPLAY)
+        return false;
+    pkt->flags = buf[0];
+    pkt->seq = buf[1] & DDP_SEQ_MASK;
+    pkt->offset = (uint32_t)buf[4] << 24 | (uint32_t)buf[5] << 16 | (uint32_t)buf[6] << 8 | buf[7];
+    pkt->len = (uint16_t)buf[8] << 8 | buf[9];
+    pkt->header_len = DDP_HEADER_LEN;
+    if (pkt->flags & DDP_FLAGS_TIMECODE)
+        pkt->header_len += DDP_TIMECODE_LEN;
+    return len >= pkt->header_len;
+}
+
+// How far sequence number a is ahead of b. Numbers 1 to 7 ahead are taken as
+// newer, the rest as older; 0 means that the sender does not number packets.
+static int seq_ahead(uint8_t a, uint8_t b)
+{
+    return (a - b) & DDP_SEQ_MASK;
+}
+
+static void report_stats(stream_stats_t *stats, int64_t now)
+{
+    uint32_t total = stats->frames + stats->dropped;
+    if (total)
+        ESP_LOGI(TAG, "%" PRIu32 " frames in %" PRIu32 " ms, %" PRIu32 " dropped (%" PRIu32 "%%), %" PRIu32 " late packets, "
+                      "latency %" PRIu32 " us avg, %" PRIu32 " us max",
+                 stats->frames, (uint32_t)((now - stats->start_us) / 1000), stats->dropped,
+                 stats->dropped * 100 / total, stats->late,
+                 stats->frames ? (uint32_t)(stats->latency_us / stats->frames) : 0, stats->latency_max_us);
+    memset(stats, 0, sizeof(*stats));
+    stats->start_us = now;
+}
+
+static void stream_task_fn(void *arg)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0)
+    {
+        ESP_LOGE(TAG, "Failed to create socket: errno %d", errno);
+        vTaskDelete(NULL);
+        return;
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_LED_STREAM_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = STREAM_POLL_MS * 1000};
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+    {
+        ESP_LOGE(TAG, "Failed to listen on UDP port %d: errno %d", CONFIG_LED_STREAM_PORT, errno);
+        close(sock);
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Listening for DDP on UDP port %d", CONFIG_LED_STREAM_PORT);
+
+    // The frame buffer, while the stream owns it.
+    uint8_t *frame = NULL;
+    size_t frame_len = 0;
+    int64_t last_packet_us = 0;
+    // The frame being received: its sequence number, when its first packet
+    // came in, and the bytes written so far. Bytes written for a dropped frame
+    // stay in the range, as they are in the buffer all the same.
+    bool receiving = false;
+    uint8_t frame_seq = 0;
+    uint8_t shown_seq = 0;
+    int64_t frame_start_us = 0;
+    size_t dirty_start = SIZE_MAX, dirty_end = 0;
+    stream_stats_t stats = {0};
+
+    while (1)
+    {
+        // Only the header is looked at first, so that the data can then be
+        // received straight into its place in the frame buffer.
+        uint8_t header[DDP_HEADER_LEN + DDP_TIMECODE_LEN];
+        int n = recv(sock, header, sizeof(header), MSG_PEEK);
+        int64_t now = esp_timer_get_time();
+
+        if (frame && (n < 0 || now - stats.start_us >= STATS_PERIOD_US))
+        {
+            if (now - last_packet_us >= STREAM_TIMEOUT_US)
+            {
+                report_stats(&stats, now);
+                ESP_LOGI(TAG, "Stream timed out, back to HomeKit");
+                ws2812_stream_end();
+                frame = NULL;
+                receiving = false;
+                shown_seq = 0;
+                dirty_start = SIZE_MAX;
+                dirty_end = 0;
+            }
+            else if (now - stats.start_us >= STATS_PERIOD_US)
+                report_stats(&stats, now);
+        }
+        if (n < 0)
+            continue;
+
+        ddp_packet_t pkt;
+        if (!ddp_parse(header, n, &pkt))
+        {
+            // Receiving into a short buffer discards the rest of the datagram.
+            recv(sock, header, 1, 0);
+            continue;
+        }
+
+        bool late = false;
+        if (pkt.seq && receiving && pkt.seq != frame_seq)
+        {
+            // A packet of a newer frame means that the one being received will
+            // never be complete, one of an older frame is late.
+            if (seq_ahead(pkt.seq, frame_seq) < 8)
+            {
+                stats.dropped++;
+                receiving = false;
+            }
+            else
+                late = true;
+        }
+        else if (pkt.seq && !receiving && shown_seq &&
+                 (pkt.seq == shown_seq || seq_ahead(pkt.seq, shown_seq) >= 8))
+            late = true;
+        if (late)
+        {
+            stats.late++;
+            recv(sock, header, 1, 0);
+            continue;
+        }
+
+        if (!frame)
+        {
+            ESP_LOGI(TAG, "Stream started");
+            frame = ws2812_stream_begin(&frame_len);
+            stats = (stream_stats_t){.start_us = now};
+        }
+        if (!receiving)
+        {
+            receiving = true;
+            frame_seq = pkt.seq;
+            frame_start_us = now;
+        }
+        last_packet_us = now;
+
+        size_t offset = pkt.offset < frame_len ? pkt.offset : frame_len;
+        size_t len = pkt.len < frame_len - offset ? pkt.len : frame_len - offset;
+        struct iovec iov[2] = {
+            {.iov_base = header, .iov_len = pkt.header_len},
+            {.iov_base = frame + offset, .iov_len = len},
+        };
+        struct msghdr msg = {
+            .msg_iov = iov,
+            .msg_iovlen = 2,
+        };
+        n = recvmsg(sock, &msg, 0);
+        if (n > (int)pkt.header_len)
+        {
+            len = n - pkt.header_len;
+            if (offset < dirty_start)
+                dirty_start = offset;
+            if (offset + len > dirty_end)
+                dirty_end = offset + len;
+        }
+
+        if (pkt.flags & DDP_FLAGS_PUSH)
+        {
+            if (dirty_start < dirty_end)
+                ws2812_stream_show(dirty_start, dirty_end - dirty_start);
+            uint32_t latency_us = esp_timer_get_time() - frame_start_us;
+            stats.frames++;
+            stats.latency_us += latency_us;
+            if (latency_us > stats.latency_max_us)
+                stats.latency_max_us = latency_us;
+            receiving = false;
+            shown_seq = pkt.seq;
+            dirty_start = SIZE_MAX;
+            dirty_end = 0;
+        }
+    }
+}
+
+void stream_init(void)
+{
+    xTaskCreate(stream_task_fn, "LED Stream Task", STREAM_TASK_STACK, NULL, STREAM_TASK_PRIORITY, NULL);
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+// Starts listening for DDP pixel data on CONFIG_LED_STREAM_PORT. While packets
+// keep arriving they are shown instead of the HomeKit state.
+void stream_init(void);
@@ -0,0 +1,63 @@
+/*
+ * Sends a moving rainbow over DDP, for trying out the stream receiver on a
+ * lamp without xLights or WLED at hand.
+ *
+ * Usage: ./ddp_send <lamp ip> [pixels] [fps] [seconds] [port]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "color.h"
+#include "ddp_sender.h"
+#include "transition.h"
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <lamp ip> [pixels] [fps] [seconds] [port]\n", argv[0]);
+        return 1;
+    }
+    int pixels = argc > 2 ? atoi(argv[2]) : 144;
+    int fps = argc > 3 ? atoi(argv[3]) : 50;
+    int seconds = argc > 4 ? atoi(argv[4]) : 10;
+    int port = argc > 5 ? atoi(argv[5]) : 4048;
+    if (pixels <= 0 || fps <= 0)
+        return 1;
+
+    ddp_sender_t sender;
+    if (ddp_sender_open(&sender, argv[1], port) < 0)
+    {
+        printf("Cannot send to %s\n", argv[1]);
+        return 1;
+    }
+    uint8_t *frame = malloc(pixels * 3);
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (int n = 0; n < fps * seconds; n++)
+    {
+        for (int i = 0; i < pixels; i++)
+        {
+            uint16_t r, g, b;
+            uint16_t hue = (uint16_t)(i * 65536 / pixels + n * 655);
+            color_hsv_to_rgb(hue, 100 * LIGHT_FX_PERCENT, &r, &g, &b);
+            frame[i * 3] = r >> 8;
+            frame[i * 3 + 1] = g >> 8;
+            frame[i * 3 + 2] = b >> 8;
+        }
+        if (ddp_send_frame(&sender, frame, pixels * 3) < 0)
+            perror("sendto");
+        next.tv_nsec += 1000000000 / fps;
+        if (next.tv_nsec >= 1000000000)
+        {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    free(frame);
+    ddp_sender_close(&sender);
+    return 0;
+}
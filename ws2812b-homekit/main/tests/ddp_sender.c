@@ -0,0 +1,61 @@
+#include "ddp_sender.h"
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define DDP_HEADER_LEN 10
+#define DDP_FLAGS_VER1 0x40
+#define DDP_FLAGS_PUSH 0x01
+#define DDP_TYPE_RGB8 0x0b
+#define DDP_ID_DISPLAY 1
+
+int ddp_sender_open(ddp_sender_t *s, const char *host, int port)
+{
+    memset(s, 0, sizeof(*s));
+    s->addr.sin_family = AF_INET;
+    s->addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &s->addr.sin_addr) != 1)
+        return -1;
+    s->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    s->seq = 1;
+    return s->sock < 0 ? -1 : 0;
+}
+
+void ddp_sender_close(ddp_sender_t *s)
+{
+    close(s->sock);
+}
+
+int ddp_send_packet(ddp_sender_t *s, uint8_t seq, uint32_t offset, const uint8_t *data, size_t len, bool push)
+{
+    uint8_t packet[DDP_HEADER_LEN + DDP_SENDER_MAX_DATA];
+    if (len > DDP_SENDER_MAX_DATA)
+        return -1;
+    packet[0] = DDP_FLAGS_VER1 | (push ? DDP_FLAGS_PUSH : 0);
+    packet[1] = seq;
+    packet[2] = DDP_TYPE_RGB8;
+    packet[3] = DDP_ID_DISPLAY;
+    packet[4] = offset >> 24;
+    packet[5] = offset >> 16;
+    packet[6] = offset >> 8;
+    packet[7] = offset;
+    packet[8] = len >> 8;
+    packet[9] = len;
+    memcpy(packet + DDP_HEADER_LEN, data, len);
+    ssize_t n = sendto(s->sock, packet, DDP_HEADER_LEN + len, 0, (struct sockaddr *)&s->addr, sizeof(s->addr));
+    return n == (ssize_t)(DDP_HEADER_LEN + len) ? 0 : -1;
+}
+
+int ddp_send_frame(ddp_sender_t *s, const uint8_t *pixels, size_t len)
+{
+    for (size_t offset = 0; offset < len; offset += DDP_SENDER_MAX_DATA)
+    {
+        size_t chunk = len - offset < DDP_SENDER_MAX_DATA ? len - offset : DDP_SENDER_MAX_DATA;
+        if (ddp_send_packet(s, s->seq, offset, pixels + offset, chunk, offset + chunk == len) < 0)
+            return -1;
+    }
+    s->seq = s->seq % 15 + 1;
+    return 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * Host stand-in for a DDP sender such as xLights, WLED or LedFx: splits frames
+ * of RGB pixels into packets of at most DDP_SENDER_MAX_DATA bytes, numbers them
+ * and sets the push flag on the last one.
+ */
+#pragma once
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// As much RGB data as fits a 1500 byte MTU, in whole pixels
+#define DDP_SENDER_MAX_DATA 1440
+
+typedef struct
+{
+    int sock;
+    struct sockaddr_in addr;
+    // Sequence number of the next frame, 1 to 15
+    uint8_t seq;
+} ddp_sender_t;
+
+int ddp_sender_open(ddp_sender_t *s, const char *host, int port);
+void ddp_sender_close(ddp_sender_t *s);
+int ddp_send_packet(ddp_sender_t *s, uint8_t seq, uint32_t offset, const uint8_t *data, size_t len, bool push);
+int ddp_send_frame(ddp_sender_t *s, const uint8_t *pixels, size_t len);
@@ -0,0 +1,10 @@
+/* Host stand-in for the parts of FreeRTOS that stream.c uses. */
+#pragma once
+
+#include <stdint.h>
+
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define tskIDLE_PRIORITY 0
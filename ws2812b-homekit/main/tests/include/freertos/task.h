@@ -0,0 +1,23 @@
+/* Host stand-in: tasks are threads. */
+#pragma once
+
+#include <pthread.h>
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+
+static inline BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack,
+                                     void *arg, UBaseType_t prio, TaskHandle_t *handle)
+{
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, (void *(*)(void *))fn, arg))
+        return 0;
+    pthread_detach(thread);
+    return 1;
+}
+
+static inline void vTaskDelete(TaskHandle_t task)
+{
+    pthread_exit(NULL);
+}
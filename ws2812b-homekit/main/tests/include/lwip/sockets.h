@@ -0,0 +1,8 @@
+/* Host stand-in: lwIP's BSD socket API is the host's own. */
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
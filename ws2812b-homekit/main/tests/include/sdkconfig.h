@@ -0,0 +1,6 @@
+/* Host stand-in for the stream test: a port away from a real lamp's, and the
+ * shortest timeout the menu allows. */
+#pragma once
+
+#define CONFIG_LED_STREAM_PORT 14048
+#define CONFIG_LED_STREAM_TIMEOUT_MS 200
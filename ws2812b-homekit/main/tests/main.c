@@ -0,0 +1,191 @@
+/*
+ * Host test of the Adaptive Lighting curve: feeds a transition write in the
+ * format the Home app sends, and checks the targets the lamp steps through.
+ *
+ * Build and run with "make test" in this directory.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "adaptive.h"
+
+/* Value of a Characteristic Value Transition Control write, as base64 in the
+ * PUT body: colour temperature (iid 13) adjusted by brightness (iid 10,
+ * between 10 and 100), 25 hourly entries with a 30 minute hold at noon, and
+ * an update every minute. At 636 bytes, the update, the configuration and
+ * the curve all come in fragments.
+ */
+static const char transition_write[] =
+    "Av8B/wEBDQImARAQERITFBUWFxgZGhscHR4fAggA1m9OtgAAAAMIobLD1AECAwQDAQEF/wEP"
+    "AQQAAAC/AgQAAMhDAwEAAAABEgEEZmbmvgIEAAC+QwMEgO42AAAAARIBBM3MzL4CBAAAtEMD"
+    "BIDuNgAAAAESAQQzM7O+AgQAAKVDAwSA7jYAAAABEgEEmpmZvgIEAACWQwMEgO42AAAAARIB"
+    "BAAAgL4CBAAAh0MDBIDuNgAAAAESAQTNzEy+AgQAAHBDAwSA7jYAAAABEgEEzcxMvgIEAABS"
+    "QwMEgO42AAAAARIBBJqZGb4CBAAAPkMDBIDuNgAAAAESAQSamRm+AgQC/wAAAf8qQwMEgO42"
+    "AAAAARIBBM3MzL0CBAAAIEMDBIDuNgAAAAESAQTNzMy9AgQAABtDAwQF/4DuNgAAAAEYAQTN"
+    "zMy9AgQAABlDAwSA7jYABARAdxsAAAABEgEEzczMvQIEAAAbQwMEgO42AAAAARIBBM3MzL0C"
+    "BAAAIEMDBIDuNgAAAAESAQSamRm+AgQAAC9DAwSA7jYAAAABEgEEmpkZvgIEAABDQwMEgO42"
+    "AAAAARIBBM3MTL4CBAAAXEMDBIDuNgAAAAESAQQAAIC+AgQAAHpDAwSA7jYAAAABEgEEmpmZ"
+    "vgIEAACRQwMEgO42AAAAARIBBDMzs74CBAAApQJ4QwMEgAFy7jYAAAABEgEEzczMvgIEAAC5"
+    "QwMEgO42AAAAARIBBGZm5r4CBAAAyEMDBIDuNgAAAAEFNBIBBAAAAL8CBAAA0kMDBIDuNgAA"
+    "AAESAQQAAAC/AgQAANdDAwSA7jYAAgEKAwYBAQoCAWQGAmDqCARAdxsA";
+
+/* Targets for a brightness of 60, at the given minutes after the start. */
+static const struct {
+    int minute;
+    float mired;
+    bool running;
+} targets[] = {
+    {0, 370.0f, true},
+    {1, 369.717f, true},
+    {30, 361.5f, true},
+    {59, 353.283f, true},
+    {60, 353.0f, true},
+    {61, 352.717f, true},
+    {300, 255.0f, true},
+    {719, 147.033f, true},
+    {720, 147.0f, true},
+    {735, 147.0f, true},
+    {750, 147.0f, true},
+    {780, 148.0f, true},
+    {800, 148.667f, true},
+    {1440, 395.0f, true},
+    {1469, 399.833f, true},
+    {1470, 400.0f, false},
+    {1500, 400.0f, false},
+};
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static size_t base64_decode(const char *in, uint8_t *out)
+{
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint32_t acc = 0;
+    int bits = 0;
+    size_t len = 0;
+    for (; *in && *in != '='; in++) {
+        acc = (acc << 6) | (strchr(alphabet, *in) - alphabet);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out[len++] = acc >> bits;
+        }
+    }
+    return len;
+}
+
+static void test_curve(void)
+{
+    static adaptive_curve_t curve;
+    uint8_t buf[1024];
+    uint32_t iid = 0;
+    size_t len = base64_decode(transition_write, buf);
+
+    CHECK(len == 636);
+    CHECK(adaptive_parse_control(buf, len, &curve, &iid) == ADAPTIVE_REQ_START);
+    CHECK(iid == 13);
+    CHECK(curve.target_iid == 13);
+    CHECK(curve.adjust_iid == 10);
+    CHECK(curve.adjust_min == 10 && curve.adjust_max == 100);
+    CHECK(curve.interval_ms == 60000);
+    CHECK(curve.start_ms == 783000000000ULL);
+    CHECK(curve.entry_count == 25);
+    CHECK(curve.entries[12].duration_ms == 1800000);
+
+    for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+        float value;
+        bool running = adaptive_curve_value(&curve, targets[i].minute * 60000ULL, 60, &value);
+        if (fabsf(value - targets[i].mired) > 0.01f || running != targets[i].running) {
+            printf("FAIL minute %d: %.3f%s, expected %.3f%s\n", targets[i].minute,
+                   value, running ? "" : " (ended)",
+                   targets[i].mired, targets[i].running ? "" : " (ended)");
+            failures++;
+        }
+    }
+
+    /* The brightness is held to the range of the curve */
+    float low, clamped;
+    adaptive_curve_value(&curve, 0, 10, &low);
+    adaptive_curve_value(&curve, 0, 1, &clamped);
+    CHECK(low == clamped && fabsf(low - 395.0f) < 0.01f);
+
+    /* The steps of one hour every minute only ever go down */
+    float prev = 1000;
+    for (int minute = 0; minute <= 60; minute++) {
+        float value;
+        adaptive_curve_value(&curve, minute * 60000ULL, 60, &value);
+        CHECK(value < prev);
+        prev = value;
+    }
+
+    uint8_t status[64];
+    len = adaptive_build_status(&curve, 90000, status, sizeof(status));
+    const uint8_t expected_head[] = {0x01, 0x31, 0x01, 0x01, 0x0d, 0x02, 0x26, 0x01, 0x10, 0x10};
+    const uint8_t expected_tail[] = {0x03, 0x04, 0x90, 0x5f, 0x01, 0x00};
+    CHECK(len == 51);
+    CHECK(memcmp(status, expected_head, sizeof(expected_head)) == 0);
+    CHECK(memcmp(status + len - sizeof(expected_tail), expected_tail, sizeof(expected_tail)) == 0);
+    CHECK(adaptive_build_status(&curve, 90000, status, 40) == 0);
+}
+
+static void test_requests(void)
+{
+    static adaptive_curve_t curve;
+    uint32_t iid = 0;
+
+    uint8_t read[] = {0x01, 0x03, 0x01, 0x01, 0x0d};
+    CHECK(adaptive_parse_control(read, sizeof(read), &curve, &iid) == ADAPTIVE_REQ_READ);
+    CHECK(iid == 13);
+
+    uint8_t stop[] = {0x02, 0x05, 0x01, 0x03, 0x01, 0x01, 0x0a};
+    CHECK(adaptive_parse_control(stop, sizeof(stop), &curve, &iid) == ADAPTIVE_REQ_STOP);
+    CHECK(iid == 10);
+
+    uint8_t truncated[] = {0x02, 0x05, 0x01, 0x03, 0x01, 0x01};
+    CHECK(adaptive_parse_control(truncated, sizeof(truncated), &curve, &iid) == ADAPTIVE_REQ_INVALID);
+
+    uint32_t iids[] = {10, 13};
+    uint8_t types[] = {ADAPTIVE_TYPE_BRIGHTNESS, ADAPTIVE_TYPE_COLOR_TEMPERATURE};
+    uint8_t supported[32];
+    const uint8_t expected[] = {
+        0x01, 0x06, 0x01, 0x01, 0x0a, 0x02, 0x01, 0x01,
+        0x00, 0x00,
+        0x01, 0x06, 0x01, 0x01, 0x0d, 0x02, 0x01, 0x02,
+    };
+    CHECK(adaptive_build_supported(iids, types, 2, supported, sizeof(supported)) == sizeof(expected));
+    CHECK(memcmp(supported, expected, sizeof(expected)) == 0);
+}
+
+static void test_color(void)
+{
+    float hue, saturation;
+
+    /* 2700 K is a warm orange, 6500 K close to white */
+    adaptive_mired_to_hs(370, &hue, &saturation);
+    CHECK(hue > 25 && hue < 40 && saturation > 40 && saturation < 70);
+    adaptive_mired_to_hs(153, &hue, &saturation);
+    CHECK(saturation < 5);
+}
+
+int main(int argc, char **argv)
+{
+    test_curve();
+    test_requests();
+    test_color();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return -1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * Host test of the fixed-point colour code: compares it with the floating point
+ * hsv2rgb() and powf() gamma table it replaced, then times both per pixel and
+ * per frame.
+ *
+ * Build and run with "make test" in this directory.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "color.h"
+#include "transition.h"
+
+#define FRAME_PIXELS 144
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* The old colour path, as leds.c had it before the fixed-point code. */
+static uint8_t old_gamma_lut[256];
+
+static void old_build_gamma_table(void)
+{
+    const float gamma = 2.8f;
+    for (int i = 0; i < 256; ++i)
+    {
+        float norm = i / 255.0f;
+        old_gamma_lut[i] = (uint8_t)(powf(norm, gamma) * 255.0f + 0.5f);
+    }
+}
+
+/* hsv2rgb() up to the point where it cut the channels to 8 bits */
+static void old_hsv2rgb_float(double h, double s, double v, float out[3])
+{
+    double hh = (fmod(h, 360.0)) / 60.0;
+    int i = (int)hh;
+    float f = hh - i;
+    float vv = v / 100.0f;
+    float ss = s / 100.0f;
+    float p = vv * (1 - ss);
+    float q = vv * (1 - ss * f);
+    float t = vv * (1 - ss * (1 - f));
+
+    switch (i)
+    {
+    case 0:
+        out[0] = vv, out[1] = t, out[2] = p;
+        break;
+    case 1:
+        out[0] = q, out[1] = vv, out[2] = p;
+        break;
+    case 2:
+        out[0] = p, out[1] = vv, out[2] = t;
+        break;
+    case 3:
+        out[0] = p, out[1] = q, out[2] = vv;
+        break;
+    case 4:
+        out[0] = t, out[1] = p, out[2] = vv;
+        break;
+    default:
+        out[0] = vv, out[1] = p, out[2] = q;
+        break;
+    }
+}
+
+static void old_render(const light_fx_t *fx, uint8_t out[3])
+{
+    float rgb[3];
+    old_hsv2rgb_float(fx->hue * (360.0 / 65536), (double)fx->saturation / LIGHT_FX_PERCENT, 100, rgb);
+    uint8_t scale = (uint32_t)fx->level * 255 / (100 * LIGHT_FX_PERCENT);
+    for (int k = 0; k < 3; k++)
+        out[k] = old_gamma_lut[(uint16_t)(uint8_t)(rgb[k] * 255) * scale / 255];
+}
+
+/* The same curve with powf() applied to the exact colour, without the 8 bit
+ * steps of the table. */
+static void reference_render(const light_fx_t *fx, uint8_t out[3])
+{
+    float rgb[3];
+    old_hsv2rgb_float(fx->hue * (360.0 / 65536), (double)fx->saturation / LIGHT_FX_PERCENT, 100, rgb);
+    float level = (float)fx->level / (100 * LIGHT_FX_PERCENT);
+    for (int k = 0; k < 3; k++)
+        out[k] = (uint8_t)(powf(rgb[k] * level, 2.8f) * 255.0f + 0.5f);
+}
+
+static void new_render(const light_fx_t *fx, uint8_t out[3])
+{
+    uint16_t r, g, b;
+    color_hsv_to_rgb(fx->hue, fx->saturation, &r, &g, &b);
+    uint32_t scale = color_level_to_scale(fx->level);
+    out[0] = color_scale_gamma(r, scale);
+    out[1] = color_scale_gamma(g, scale);
+    out[2] = color_scale_gamma(b, scale);
+}
+
+/* Every channel is within one step of the powf() curve, over the colour wheel
+ * at all saturations and brightnesses. */
+static void test_accuracy(void)
+{
+    int max_err = 0, max_old_err = 0;
+    long exact = 0, total = 0;
+    light_fx_t fx;
+
+    for (uint32_t hue = 0; hue < 65536; hue += 61)
+    {
+        for (uint32_t sat = 0; sat <= 100 * LIGHT_FX_PERCENT; sat += 128)
+        {
+            for (uint32_t level = 0; level <= 100 * LIGHT_FX_PERCENT; level += 128)
+            {
+                uint8_t now[3], ref[3], old[3];
+                fx.hue = hue;
+                fx.saturation = sat;
+                fx.level = level;
+                new_render(&fx, now);
+                reference_render(&fx, ref);
+                old_render(&fx, old);
+                for (int k = 0; k < 3; k++)
+                {
+                    int err = abs(now[k] - ref[k]);
+                    int old_err = abs(old[k] - ref[k]);
+                    if (err > max_err)
+                        max_err = err;
+                    if (old_err > max_old_err)
+                        max_old_err = old_err;
+                    exact += err == 0;
+                    total++;
+                }
+            }
+        }
+    }
+    printf("colour error: %d LSB max, %.2f%% exact (old path: %d LSB max)\n",
+           max_err, 100.0 * exact / total, max_old_err);
+    CHECK(max_err <= 1);
+
+    /* Full brightness hits the corners of the wheel exactly */
+    fx.saturation = 100 * LIGHT_FX_PERCENT;
+    fx.level = 100 * LIGHT_FX_PERCENT;
+    for (int sector = 0; sector < 6; sector += 2)
+    {
+        uint8_t now[3];
+        fx.hue = (sector * 65536 + 5) / 6;
+        new_render(&fx, now);
+        CHECK(now[sector / 2] == 255 && now[(sector / 2 + 1) % 3] == 0 && now[(sector / 2 + 2) % 3] == 0);
+    }
+    fx.level = 0;
+    uint8_t off[3];
+    new_render(&fx, off);
+    CHECK(off[0] == 0 && off[1] == 0 && off[2] == 0);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static volatile uint8_t sink;
+
+/* Converts a stream of random colours, one pixel at a time. */
+static double bench_pixel(void (*render)(const light_fx_t *, uint8_t *), const light_fx_t *colors, int count)
+{
+    const int rounds = 200;
+    uint8_t acc = 0;
+    double start = now_ns();
+    for (int round = 0; round < rounds; round++)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            uint8_t out[3];
+            render(&colors[i], out);
+            acc += out[0] ^ out[1] ^ out[2];
+        }
+    }
+    sink = acc;
+    return (now_ns() - start) / ((double)rounds * count);
+}
+
+/* Renders a rainbow of FRAME_PIXELS pixels, moving it along a little each frame. */
+static double bench_frame(void (*render)(const light_fx_t *, uint8_t *))
+{
+    static uint8_t frame[FRAME_PIXELS * 3];
+    const int frames = 20000;
+    light_fx_t fx = {.saturation = 100 * LIGHT_FX_PERCENT, .level = 60 * LIGHT_FX_PERCENT};
+    double start = now_ns();
+    for (int n = 0; n < frames; n++)
+    {
+        for (int i = 0; i < FRAME_PIXELS; i++)
+        {
+            fx.hue = (uint16_t)(n * 97 + i * (65536 / FRAME_PIXELS));
+            render(&fx, &frame[i * 3]);
+        }
+        sink = frame[n % sizeof(frame)];
+    }
+    return (now_ns() - start) / frames / 1000;
+}
+
+static void bench(void)
+{
+    enum { COLORS = 4096 };
+    static light_fx_t colors[COLORS];
+    srand(1);
+    for (int i = 0; i < COLORS; i++)
+    {
+        colors[i].hue = rand() & 0xFFFF;
+        colors[i].saturation = rand() % (100 * LIGHT_FX_PERCENT + 1);
+        colors[i].level = rand() % (100 * LIGHT_FX_PERCENT + 1);
+    }
+    printf("per pixel: %6.1f ns float, %6.1f ns fixed point\n",
+           bench_pixel(old_render, colors, COLORS), bench_pixel(new_render, colors, COLORS));
+    printf("per %d pixel frame: %6.2f us float, %6.2f us fixed point\n", FRAME_PIXELS,
+           bench_frame(old_render), bench_frame(new_render));
+}
+
+int main(int argc, char **argv)
+{
+    old_build_gamma_table();
+    test_accuracy();
+    bench();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return -1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
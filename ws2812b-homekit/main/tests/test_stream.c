@@ -0,0 +1,273 @@
+/*
+ * Host test of the DDP stream receiver: runs stream.c on a loopback socket,
+ * feeds it frames from the sender stand-in and checks what reaches the strip.
+ * Measures the time from the first packet of a frame to its refresh, and that
+ * frames that lose a packet are dropped without tearing the ones around them.
+ *
+ * Build and run with "make test" in this directory.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ddp_sender.h"
+#include "esp_timer.h"
+#include "leds.h"
+#include "sdkconfig.h"
+#include "stream.h"
+
+#define STREAM_PIXELS 600
+#define FRAME_PERIOD_US 10000
+#define MAX_FRAMES 1024
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/* What leds.c would show: the frame buffer stream.c fills, and a copy of it
+ * taken on each refresh, as the strip driver's own buffers would. */
+static uint8_t frame[STREAM_PIXELS * 3];
+static uint8_t strip[STREAM_PIXELS * 3];
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static bool streaming;
+static int begins, ends;
+static int shown;
+static uint32_t shown_ids[MAX_FRAMES];
+static int64_t shown_us[MAX_FRAMES];
+static int torn;
+static int64_t end_us;
+static int64_t last_sent_us;
+
+/* Frame n carries n in its first four bytes and a pattern made from n in the
+ * rest, so that a refresh that mixes two frames shows. */
+static void make_frame(uint8_t *buf, uint32_t id)
+{
+    buf[0] = id >> 24;
+    buf[1] = id >> 16;
+    buf[2] = id >> 8;
+    buf[3] = id;
+    for (size_t i = 4; i < sizeof(frame); i++)
+        buf[i] = (uint8_t)(id * 31 + i);
+}
+
+static bool frame_matches(const uint8_t *buf, uint32_t *id)
+{
+    uint8_t expected[sizeof(frame)];
+    *id = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 | (uint32_t)buf[2] << 8 | buf[3];
+    make_frame(expected, *id);
+    return memcmp(buf, expected, sizeof(expected)) == 0;
+}
+
+uint8_t *ws2812_stream_begin(size_t *len)
+{
+    pthread_mutex_lock(&lock);
+    streaming = true;
+    begins++;
+    pthread_mutex_unlock(&lock);
+    *len = sizeof(frame);
+    return frame;
+}
+
+void ws2812_stream_show(size_t offset, size_t len)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t id;
+    memcpy(strip + offset, frame + offset, len);
+    pthread_mutex_lock(&lock);
+    if (!frame_matches(strip, &id))
+        torn++;
+    if (shown < MAX_FRAMES)
+    {
+        shown_ids[shown] = id;
+        shown_us[shown] = now;
+    }
+    shown++;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+void ws2812_stream_end(void)
+{
+    pthread_mutex_lock(&lock);
+    streaming = false;
+    ends++;
+    end_us = esp_timer_get_time();
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Waits up to a second for the receiver to get to the given count. */
+static bool wait_for(int *counter, int count)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec++;
+    pthread_mutex_lock(&lock);
+    while (*counter < count)
+    {
+        if (pthread_cond_timedwait(&cond, &lock, &deadline))
+            break;
+    }
+    bool reached = *counter >= count;
+    pthread_mutex_unlock(&lock);
+    return reached;
+}
+
+static void sleep_until(struct timespec *next, uint32_t period_us)
+{
+    next->tv_nsec += period_us * 1000;
+    if (next->tv_nsec >= 1000000000)
+    {
+        next->tv_nsec -= 1000000000;
+        next->tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL);
+}
+
+/* Streams at 100 fps, two packets a frame, and times each frame from its first
+ * packet being sent to the refresh. */
+static void test_latency(ddp_sender_t *sender)
+{
+    const int frames = 500;
+    static int64_t sent_us[MAX_FRAMES];
+    uint8_t buf[sizeof(frame)];
+    struct timespec next;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (int n = 0; n < frames; n++)
+    {
+        make_frame(buf, n);
+        sent_us[n] = esp_timer_get_time();
+        CHECK(ddp_send_frame(sender, buf, sizeof(buf)) == 0);
+        sleep_until(&next, FRAME_PERIOD_US);
+    }
+    CHECK(wait_for(&shown, frames));
+    CHECK(begins == 1);
+    CHECK(shown == frames);
+    CHECK(torn == 0);
+
+    int64_t total_us = 0, max_us = 0;
+    int in_order = 0;
+    for (int i = 0; i < shown && i < frames; i++)
+    {
+        int64_t latency = shown_us[i] - sent_us[shown_ids[i]];
+        in_order += shown_ids[i] == (uint32_t)i;
+        total_us += latency;
+        if (latency > max_us)
+            max_us = latency;
+    }
+    CHECK(in_order == frames);
+    printf("packet to refresh: %lld us avg, %lld us max over %d frames of %d pixels\n",
+           (long long)(total_us / frames), (long long)max_us, frames, STREAM_PIXELS);
+    CHECK(total_us / frames < FRAME_PERIOD_US);
+}
+
+/* Every tenth frame loses its last packet, the one with the push flag. The next
+ * frame replaces it as a whole, and after each frame a straggler of the one
+ * before turns up, which must not be shown again. */
+static void test_dropped(ddp_sender_t *sender)
+{
+    const int frames = 200;
+    uint8_t buf[sizeof(frame)];
+    struct timespec next;
+    uint8_t prev_seq = 0;
+    int base, expected = 0, dropped = 0;
+
+    pthread_mutex_lock(&lock);
+    base = shown;
+    torn = 0;
+    pthread_mutex_unlock(&lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (int n = 0; n < frames; n++)
+    {
+        uint32_t id = 1000 + n;
+        uint8_t seq = sender->seq;
+        make_frame(buf, id);
+        if (n % 10 == 5)
+        {
+            CHECK(ddp_send_packet(sender, seq, 0, buf, DDP_SENDER_MAX_DATA, false) == 0);
+            sender->seq = sender->seq % 15 + 1;
+            dropped++;
+        }
+        else
+        {
+            CHECK(ddp_send_frame(sender, buf, sizeof(buf)) == 0);
+            expected++;
+            if (prev_seq)
+            {
+                /* The tail of the frame before, with its push flag, arriving late */
+                uint8_t old[sizeof(frame)];
+                make_frame(old, id - 1);
+                CHECK(ddp_send_packet(sender, prev_seq, DDP_SENDER_MAX_DATA, old + DDP_SENDER_MAX_DATA,
+                                      sizeof(old) - DDP_SENDER_MAX_DATA, true) == 0);
+            }
+        }
+        prev_seq = seq;
+        last_sent_us = esp_timer_get_time();
+        sleep_until(&next, FRAME_PERIOD_US);
+    }
+    wait_for(&shown, base + expected);
+    usleep(50000);
+
+    pthread_mutex_lock(&lock);
+    int count = shown - base;
+    int wrong = 0;
+    for (int n = 0, i = base; n < frames && i < shown && i < MAX_FRAMES; n++)
+    {
+        if (n % 10 == 5)
+            continue;
+        wrong += shown_ids[i++] != 1000u + n;
+    }
+    pthread_mutex_unlock(&lock);
+
+    printf("%d frames sent, %d lost a packet, %d shown, %d torn\n", frames, dropped, count, torn);
+    CHECK(count == expected);
+    CHECK(wrong == 0);
+    CHECK(torn == 0);
+}
+
+/* Once packets stop, the lamp goes back to HomeKit after the timeout. */
+static void test_timeout(void)
+{
+    CHECK(wait_for(&ends, 1));
+    CHECK(!streaming);
+    int64_t after = end_us - last_sent_us;
+    printf("stream ended %lld ms after the last packet\n", (long long)(after / 1000));
+    CHECK(after >= CONFIG_LED_STREAM_TIMEOUT_MS * 1000 - FRAME_PERIOD_US);
+}
+
+int main(int argc, char **argv)
+{
+    ddp_sender_t sender;
+
+    stream_init();
+    /* Give the receiver time to bind */
+    usleep(100000);
+    if (ddp_sender_open(&sender, "127.0.0.1", CONFIG_LED_STREAM_PORT) < 0)
+    {
+        printf("Cannot open the sender\n");
+        return -1;
+    }
+    test_latency(&sender);
+    test_dropped(&sender);
+    test_timeout();
+    ddp_sender_close(&sender);
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return -1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Host test of the transition engine: checks the ends and the path of a fade,
+ * then times the work the render task does per frame of a transition.
+ *
+ * Build and run with "make test" in this directory.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "color.h"
+#include "transition.h"
+
+#define FRAME_PIXELS 144
+#define FRAME_PERIOD_US 10000
+
+static int failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("FAIL line %d: %s\n", __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static void test_fade(void)
+{
+    const light_fx_t red = {0, 100 * LIGHT_FX_PERCENT, 100 * LIGHT_FX_PERCENT};
+    const light_fx_t magenta = {(uint16_t)(65536 * 5 / 6), 100 * LIGHT_FX_PERCENT, 20 * LIGHT_FX_PERCENT};
+    transition_t t;
+    light_fx_t out;
+
+    transition_start(&t, &red, &magenta, 1000, 500000);
+    CHECK(transition_step(&t, 1000, &out));
+    CHECK(memcmp(&out, &red, sizeof(out)) == 0);
+
+    /* Red to magenta goes back across 0 rather than through green and blue, and
+     * the level only ever goes down */
+    uint16_t prev_level = out.level;
+    for (int64_t now = 1000; now < 501000; now += FRAME_PERIOD_US)
+    {
+        CHECK(transition_step(&t, now, &out));
+        CHECK(out.hue == 0 || out.hue >= magenta.hue);
+        CHECK(out.level <= prev_level);
+        prev_level = out.level;
+    }
+
+    /* Half way, smoothstep is at half as well */
+    transition_start(&t, &red, &magenta, 0, 500000);
+    transition_step(&t, 250000, &out);
+    uint16_t mid = (red.level + magenta.level) / 2;
+    CHECK(abs(out.level - mid) < 100);
+
+    /* The frame at the end shows the target and ends the transition */
+    CHECK(!transition_step(&t, 500000, &out));
+    CHECK(memcmp(&out, &magenta, sizeof(out)) == 0);
+    CHECK(!t.active);
+    CHECK(!transition_step(&t, 510000, &out));
+
+    /* A frame from before the start, as a late timer might give, shows the start */
+    transition_start(&t, &red, &magenta, 1000, 500000);
+    CHECK(transition_step(&t, 0, &out));
+    CHECK(memcmp(&out, &red, sizeof(out)) == 0);
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static volatile uint8_t sink;
+
+/* Renders a frame the way leds.c does: one colour, filled into every pixel. */
+static void render(const light_fx_t *fx)
+{
+    static uint8_t frame[FRAME_PIXELS * 3];
+    uint16_t r, g, b;
+    color_hsv_to_rgb(fx->hue, fx->saturation, &r, &g, &b);
+    uint32_t scale = color_level_to_scale(fx->level);
+    uint8_t rgb[3] = {color_scale_gamma(r, scale), color_scale_gamma(g, scale),
+                      color_scale_gamma(b, scale)};
+    for (int p = 0; p < FRAME_PIXELS; p++)
+        memcpy(&frame[p * 3], rgb, 3);
+    sink = frame[fx->level % sizeof(frame)];
+}
+
+/* Steps one second fades frame by frame, as the frame timer does, and returns
+ * the time per frame in us. */
+static double time_fades(bool with_render)
+{
+    const light_fx_t from = {0, 100 * LIGHT_FX_PERCENT, 0};
+    const light_fx_t to = {(uint16_t)(65536 / 3), 50 * LIGHT_FX_PERCENT, 100 * LIGHT_FX_PERCENT};
+    const int fades = 5000;
+    const uint32_t duration_us = 1000000;
+    const int frames = duration_us / FRAME_PERIOD_US;
+    transition_t t;
+    light_fx_t out;
+
+    double start = now_ns();
+    for (int n = 0; n < fades; n++)
+    {
+        transition_start(&t, &from, &to, 0, duration_us);
+        for (int i = 0; i < frames; i++)
+        {
+            transition_step(&t, (int64_t)i * FRAME_PERIOD_US + n, &out);
+            if (with_render)
+                render(&out);
+            else
+                sink = out.level;
+        }
+    }
+    return (now_ns() - start) / fades / frames / 1000;
+}
+
+static void bench(void)
+{
+    printf("per frame: %.3f us stepping, %.3f us stepping and rendering %d pixels (budget %d us)\n",
+           time_fades(false), time_fades(true), FRAME_PIXELS, FRAME_PERIOD_US);
+}
+
+int main(int argc, char **argv)
+{
+    transition_init();
+    test_fade();
+    bench();
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return -1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include "transition.h"
+
+#define EASE_STEPS 256
+#define EASE_ONE (1 << 15)
+
+// Smoothstep easing, in Q15, indexed by the linear progress in 1/255ths.
+static uint16_t ease_lut[EASE_STEPS];
+
+void transition_init(void)
+{
+    const uint64_t den = (uint64_t)(EASE_STEPS - 1) * (EASE_STEPS - 1) * (EASE_STEPS - 1);
+    for (uint32_t i = 0; i < EASE_STEPS; ++i)
+    {
+        // x^2 * (3 - 2x), with x = i / 255
+        uint64_t num = (uint64_t)i * i * (3 * (EASE_STEPS - 1) - 2 * i);
+        ease_lut[i] = (uint16_t)((num * EASE_ONE + den / 2) / den);
+    }
+}
+
+static uint16_t lerp(uint16_t from, uint16_t to, int32_t ease)
+{
+    return from + (((int32_t)to - from) * ease >> 15);
+}
+
+// The hue takes the shorter way around the colour wheel, which the wrap around
+// of the 16 bit difference gives for free.
+static uint16_t lerp_hue(uint16_t from, uint16_t to, int32_t ease)
+{
+    int16_t diff = (int16_t)(uint16_t)(to - from);
+    return (uint16_t)(from + (diff * ease >> 15));
+}
+
+void transition_start(transition_t *t, const light_fx_t *from, const light_fx_t *to,
+                      int64_t now_us, uint32_t duration_us)
+{
+    t->from = *from;
+    t->to = *to;
+    t->start_us = now_us;
+    t->duration_us = duration_us;
+    t->active = true;
+}
+
+// Writes the colour for the given time to out. Returns true while the transition
+// is in progress, and false from the frame which reaches the target onwards.
+bool transition_step(transition_t *t, int64_t now_us, light_fx_t *out)
+{
+    int64_t elapsed = now_us - t->start_us;
+    if (!t->active || elapsed >= t->duration_us)
+    {
+        t->active = false;
+        *out = t->to;
+        return false;
+    }
+    if (elapsed < 0)
+        elapsed = 0;
+    // Durations are limited to well below 2^32 / 255 us, so this does not overflow.
+    int32_t ease = ease_lut[(uint32_t)elapsed * (EASE_STEPS - 1) / t->duration_us];
+    out->hue = lerp_hue(t->from.hue, t->to.hue, ease);
+    out->saturation = lerp(t->from.saturation, t->to.saturation, ease);
+    out->level = lerp(t->from.level, t->to.level, ease);
+    return true;
+}
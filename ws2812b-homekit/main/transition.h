@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Colour of the lamp in fixed point. The hue is in 1/65536 of a turn, so that
+// it wraps around by itself, and saturation and level are in 1/256 percent.
+// The level is the brightness when on and 0 when off, so that switching the
+// lamp on and off fades as well.
+typedef struct
+{
+    uint16_t hue;
+    uint16_t saturation;
+    uint16_t level;
+} light_fx_t;
+
+#define LIGHT_FX_PERCENT 256
+
+typedef struct
+{
+    light_fx_t from;
+    light_fx_t to;
+    int64_t start_us;
+    uint32_t duration_us;
+    bool active;
+} transition_t;
+
+void transition_init(void);
+void transition_start(transition_t *t, const light_fx_t *from, const light_fx_t *to,
+                      int64_t now_us, uint32_t duration_us);
+bool transition_step(transition_t *t, int64_t now_us, light_fx_t *out);
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Streams test frames to the lamp over DDP.
+
+Sends a moving rainbow to the lamp's DDP port at a fixed frame rate. Packets
+can be dropped or reordered on purpose, to check how the lamp copes with a
+lossy network; the lamp logs the frames shown, the frames dropped and the
+packet-to-refresh latency every 10 seconds and when the stream times out.
+
+    tools/ddp_send.py lamp.local --pixels 144 --fps 60 --seconds 10
+"""
+import argparse
+import colorsys
+import random
+import socket
+import struct
+import time
+
+DDP_PORT = 4048
+DDP_FLAGS_VER1 = 0x40
+DDP_FLAGS_PUSH = 0x01
+DDP_TYPE_RGB8 = 0x0B
+DDP_ID_DISPLAY = 1
+# The largest run of whole pixels that fits a standard Ethernet frame.
+DDP_MAX_DATA = 480 * 3
+
+
+def rainbow(pixels, phase):
+    data = bytearray()
+    for i in range(pixels):
+        r, g, b = colorsys.hsv_to_rgb((i / pixels + phase) % 1.0, 1.0, 1.0)
+        data += bytes((int(r * 255), int(g * 255), int(b * 255)))
+    return data
+
+
+def packets(data, seq):
+    for offset in range(0, len(data), DDP_MAX_DATA):
+        chunk = data[offset:offset + DDP_MAX_DATA]
+        flags = DDP_FLAGS_VER1
+        if offset + len(chunk) == len(data):
+            flags |= DDP_FLAGS_PUSH
+        yield struct.pack(">BBBBIH", flags, seq, DDP_TYPE_RGB8, DDP_ID_DISPLAY, offset, len(chunk)) + chunk
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host")
+    parser.add_argument("--port", type=int, default=DDP_PORT)
+    parser.add_argument("--pixels", type=int, default=144)
+    parser.add_argument("--fps", type=float, default=60)
+    parser.add_argument("--seconds", type=float, default=10)
+    parser.add_argument("--loss", type=float, default=0, help="fraction of packets to drop")
+    parser.add_argument("--reorder", type=float, default=0,
+                        help="fraction of packets to hold back until after the next frame")
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    addr = (args.host, args.port)
+    period = 1 / args.fps
+    frames = int(args.seconds * args.fps)
+    sent = lost = held = 0
+    held_back = []
+    start = time.monotonic()
+    for n in range(frames):
+        # Sequence numbers run from 1 to 15, 0 would mean unnumbered.
+        seq = n % 15 + 1
+        late, held_back = held_back, []
+        for packet in packets(rainbow(args.pixels, n / 200), seq):
+            if random.random() < args.loss:
+                lost += 1
+            elif random.random() < args.reorder:
+                held_back.append(packet)
+                held += 1
+            else:
+                sock.sendto(packet, addr)
+                sent += 1
+        for packet in late:
+            sock.sendto(packet, addr)
+            sent += 1
+        delay = start + (n + 1) * period - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+    elapsed = time.monotonic() - start
+    print(f"{frames} frames in {elapsed:.2f} s ({frames / elapsed:.1f} fps), "
+          f"{sent} packets sent, {lost} dropped, {held} reordered")
+
+
+if __name__ == "__main__":
+    main()